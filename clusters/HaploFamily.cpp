@@ -359,7 +359,7 @@ void FamilyHaplos::RetrieveLikelihoods(Tree & tree)
 
 void FamilyHaplos::ListAllRecursively(Tree & tree, int node, int bit, double prob)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -383,7 +383,7 @@ void FamilyHaplos::ListAllRecursively(Tree & tree, int node, int bit, double pro
 
 void FamilyHaplos::RetrieveLikelihoods(Tree & tree, int node, int bit)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
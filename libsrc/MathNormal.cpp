@@ -19,9 +19,29 @@
 #include "MathSVD.h"
 #include "MathGenMin.h"
 #include "MathStats.h"
+#include "ThreadPool.h"
 
 #include <math.h>
 
+// Several blocks of families are queued for each thread, so that
+// threads that finish early can share the remaining work
+#define NORMAL_BLOCKS_PER_THREAD   4
+
+// Limits for Fisher scoring, before reverting to derivative free methods
+#define NORMAL_SCORING_ITERATIONS  50
+#define NORMAL_SCORING_HALVINGS    20
+
+// Convergence criterion for Fisher scoring, relative to the log-likelihood
+#define NORMAL_SCORING_TOLERANCE   1e-12
+
+// Largest reduction in a variance component in one iteration
+#define NORMAL_SCORING_SHRINK      0.1
+
+// Log-variances are clamped to this range when models are fitted
+#define NORMAL_LOG_VARIANCE_LIMIT  16.0
+
+bool NormalSet::derivativeFree = false;
+
 NormalEquations::NormalEquations() :
    means("linear"), variances("variances"),
    linearModel("linear"), scores("scores"),
@@ -32,6 +52,8 @@ NormalEquations::NormalEquations() :
    varComponents = NULL;
    includeLikelihoodConstant = false;
    multiple = 1;
+   nullProducts = NULL;
+   nullComponents = 0;
    }
 
 NormalEquations::~NormalEquations()
@@ -45,6 +67,11 @@ void NormalEquations::Free()
       delete [] varComponents;
    varComponents = NULL;
    variances.Dimension(0);
+
+   if (nullProducts != NULL)
+      delete [] nullProducts;
+   nullProducts = NULL;
+   nullComponents = 0;
    }
 
 void NormalEquations::CalculateResiduals()
@@ -150,6 +177,158 @@ void NormalEquations::Diagnostics()
       }
    }
 
+void NormalEquations::Derivatives()
+   {
+   int n = scores.dim;
+
+   // a = Inv(V) * (Xb - y)
+   CalculateResiduals();
+   cholesky.BackSubst(residuals);
+   Vector a = cholesky.x;
+
+   // Inv(V) is needed for traces and generalized least squares
+   cholesky.Invert();
+   Matrix & inv = cholesky.inv;
+
+   vcScore.Dimension(variances.dim);
+   vcScore.Zero();
+   vcInformation.Dimension(variances.dim, variances.dim);
+   vcInformation.Zero();
+
+   // w[j] = Vj * a and u[j] = Inv(V) * Vj * a
+   Matrix w(variances.dim, n), u(variances.dim, n);
+
+   for (int j = 0; j < variances.dim; j++)
+      {
+      Matrix & vj = varComponents[j];
+
+      if (vj.rows == 0 || vj.cols == 0)
+         {
+         w[j].Zero();
+         u[j].Zero();
+         continue;
+         }
+
+      // dL/dVj = -0.5 * [trace(Inv(V) * Vj) - a' * Vj * a]
+      double trace = 0.0;
+      for (int r = 0; r < n; r++)
+         for (int c = 0; c < n; c++)
+            trace += inv[r][c] * vj[c][r];
+
+      w[j].Product(vj, a);
+      u[j].Product(inv, w[j]);
+
+      vcScore[j] = -0.5 * (trace - a.InnerProduct(w[j]));
+      }
+
+   // The average information matrix is 0.5 * a' * Vj * Inv(V) * Vk * a
+   for (int j = 0; j < variances.dim; j++)
+      for (int k = j; k < variances.dim; k++)
+         vcInformation[j][k] = vcInformation[k][j] = 0.5 * w[j].InnerProduct(u[k]);
+
+   // Cross products for the generalized least squares estimate of means
+   int p = linearModel.cols;
+   Vector column(n), z(n);
+
+   glsProduct.Dimension(p, p);
+   glsScores.Dimension(p);
+
+   for (int j = 0; j < p; j++)
+      {
+      for (int r = 0; r < n; r++)
+         column[r] = linearModel[r][j];
+
+      z.Product(inv, column);
+
+      glsScores[j] = z.InnerProduct(scores);
+      for (int k = 0; k < p; k++)
+         {
+         double sum = 0.0;
+         for (int r = 0; r < n; r++)
+            sum += linearModel[r][k] * z[r];
+         glsProduct[j][k] = sum;
+         }
+      }
+   }
+
+void NormalEquations::PrepareTest()
+   {
+   int n = scores.dim;
+
+   CalculateResiduals();
+   cholesky.BackSubst(residuals);
+   nullResiduals = cholesky.x;
+
+   cholesky.Invert();
+   nullInverse = cholesky.inv;
+
+   if (nullProducts != NULL)
+      delete [] nullProducts;
+
+   nullComponents = variances.dim;
+   nullProducts = new Matrix[nullComponents];
+
+   for (int j = 0; j < nullComponents; j++)
+      if (varComponents[j].rows && varComponents[j].cols)
+         nullProducts[j].Product(nullInverse, varComponents[j]);
+
+   // Expected information for null variance components, 0.5 * trace(Bj * Bk)
+   vcInformation.Dimension(nullComponents, nullComponents);
+   vcInformation.Zero();
+
+   for (int j = 0; j < nullComponents; j++)
+      for (int k = j; k < nullComponents; k++)
+         if (nullProducts[j].rows && nullProducts[k].rows)
+            {
+            double trace = 0.0;
+            for (int r = 0; r < n; r++)
+               for (int c = 0; c < n; c++)
+                  trace += nullProducts[j][r][c] * nullProducts[k][c][r];
+            vcInformation[j][k] = vcInformation[k][j] = 0.5 * trace;
+            }
+   }
+
+void NormalEquations::ScoreTest(int component)
+   {
+   int n = scores.dim;
+
+   testScore = 0.0;
+   testInformation.Dimension(nullComponents + 1);
+   testInformation.Zero();
+
+   Matrix & vq = varComponents[component];
+
+   if (vq.rows == 0 || vq.cols == 0)
+      return;
+
+   // dL/dVq = -0.5 * [trace(Inv(V) * Vq) - a' * Vq * a]
+   Matrix product;
+   product.Product(nullInverse, vq);
+
+   Vector w;
+   w.Product(vq, nullResiduals);
+
+   double trace = 0.0;
+   for (int r = 0; r < n; r++)
+      trace += product[r][r];
+
+   testScore = -0.5 * (trace - nullResiduals.InnerProduct(w));
+
+   for (int j = 0; j <= nullComponents; j++)
+      {
+      Matrix & other = j < nullComponents ? nullProducts[j] : product;
+
+      if (other.rows == 0)
+         continue;
+
+      double sum = 0.0;
+      for (int r = 0; r < n; r++)
+         for (int c = 0; c < n; c++)
+            sum += product[r][c] * other[c][r];
+      testInformation[j] = 0.5 * sum;
+      }
+   }
+
 void NormalEquations::Prepare()
    {
    varMatrix.Dimension(scores.dim, scores.dim);
@@ -254,6 +433,19 @@ NormalSet::NormalSet(int threads)
    count = size = 0;
    numericMinimizer = 2;
    precision = 1e-8;
+   pool = NULL;
+   blocks = 0;
+   evaluations = iterations = 0;
+   warmStart = testReady = false;
+   testComponent = 0;
+   }
+
+NormalSet::~NormalSet()
+   {
+   Free();
+
+   if (pool != NULL)
+      delete pool;
    }
 
 void NormalSet::Free()
@@ -306,8 +498,9 @@ double NormalSet::Evaluate()
    {
    evaluations++;
 
-   for (int i = 0; i < count; i++)
-        sets[i]->Evaluate();
+   // Each family is evaluated independently, but partial likelihoods are
+   // always combined in the same order, so results don't depend on threads
+   ProcessSets(EvaluateBlock);
 
    logLikelihoods.Clear();
    logLikelihoods.Push(0.0);
@@ -366,13 +559,67 @@ double NormalSet::Evaluate()
    return likelihood;
    }
 
-void * NormalSet::EvaluateOneSet(void * which)
+void NormalSet::ProcessSets(void (* task)(void * set, int block, int thread))
+   {
+   int threads = maxThreads > 0 ? maxThreads : ThreadPool::defaultThreads;
+
+   if (threads > 1 && count >= threads * NORMAL_BLOCKS_PER_THREAD && !ThreadPool::InWorker())
+      {
+      if (pool == NULL)
+         pool = new ThreadPool(threads);
+
+      blocks = threads * NORMAL_BLOCKS_PER_THREAD;
+      pool->Run(task, this, blocks);
+      }
+   else
+      {
+      blocks = 1;
+      task(this, 0, 0);
+      }
+   }
+
+void NormalSet::EvaluateBlock(void * set, int block, int)
+   {
+   NormalSet * normal = (NormalSet *) set;
+
+   int first = (int) ((long long) normal->count * block / normal->blocks);
+   int last = (int) ((long long) normal->count * (block + 1) / normal->blocks);
+
+   for (int i = first; i < last; i++)
+      normal->sets[i]->Evaluate();
+   }
+
+void NormalSet::DerivativesBlock(void * set, int block, int)
+   {
+   NormalSet * normal = (NormalSet *) set;
+
+   int first = (int) ((long long) normal->count * block / normal->blocks);
+   int last = (int) ((long long) normal->count * (block + 1) / normal->blocks);
+
+   for (int i = first; i < last; i++)
+      normal->sets[i]->Derivatives();
+   }
+
+void NormalSet::PrepareTestBlock(void * set, int block, int)
+   {
+   NormalSet * normal = (NormalSet *) set;
+
+   int first = (int) ((long long) normal->count * block / normal->blocks);
+   int last = (int) ((long long) normal->count * (block + 1) / normal->blocks);
+
+   for (int i = first; i < last; i++)
+      normal->sets[i]->PrepareTest();
+   }
+
+void NormalSet::ScoreTestBlock(void * set, int block, int)
    {
-   NormalEquations * w = (NormalEquations *) which;
+   NormalSet * normal = (NormalSet *) set;
 
-   w->Evaluate();
+   int first = (int) ((long long) normal->count * block / normal->blocks);
+   int last = (int) ((long long) normal->count * (block + 1) / normal->blocks);
 
-   return NULL;
+   for (int i = first; i < last; i++)
+      normal->sets[i]->ScoreTest(normal->testComponent);
    }
 
 void NormalSet::SelectPoint(Vector & v)
@@ -394,8 +641,28 @@ void NormalSet::SelectPoint(Vector & v)
 
 void NormalSet::Solve()
    {
+   // Estimates from a previous fit can provide the starting point
+   Vector previousMeans = means, previousVariances = variances;
+
    EditLinearDegenerates();
 
+   if (warmStart && previousMeans.dim == means.dim &&
+       previousVariances.dim == variances.dim)
+      {
+      means = previousMeans;
+      variances = previousVariances;
+      }
+
+   // Reset the number of likelihood evaluations
+   evaluations = 0;
+
+   // Fisher scoring usually converges in a few iterations, but
+   // derivative free methods are more robust
+   if (!derivativeFree && FisherScoring())
+      return;
+
+   iterations = 0;
+
    GeneralMinimizer * solver = NULL;   // Initialization avoids compiler warnings
 
    switch (numericMinimizer)
@@ -411,9 +678,6 @@ void NormalSet::Solve()
    int parameters = CountParameters();
    solver->Reset(parameters);
 
-   // Reset the number of likelihood evaluations
-   evaluations = 0;
-
    // If we are not using the Nelder-Mead minimizer, use it
    // to conduct a rough pre-optimization.
    if (solver != NORMAL_AMOEBA_MIN)
@@ -462,6 +726,263 @@ void NormalSet::Solve()
    delete solver;
    }
 
+bool NormalSet::ScoringApplies()
+   {
+   if (vcConstrained || count == 0)
+      return false;
+
+   // Each term must be multiplied into the overall likelihood, possibly
+   // recording the likelihood for a subset of the sample along the way
+   for (int i = 0; i < count; i++)
+      {
+      int op = operators[i];
+
+      if ((op & NORMAL_OP_MASK) != NORMAL_MUL_LK)
+         return false;
+
+      while ((op >>= 3) != 0)
+         if ((op & NORMAL_OP_MASK) != NORMAL_NOP &&
+             (op & NORMAL_OP_MASK) != NORMAL_RECORD_LLK)
+            return false;
+      }
+
+   return true;
+   }
+
+// Maximizes the likelihood by Fisher scoring, using the average
+// information matrix for the variances and generalized least squares
+// for the means. See Gilmour, Thompson and Cullis, Biometrics (1995)
+// 51:1440-1450 for the average information algorithm.
+//
+
+bool NormalSet::FisherScoring()
+   {
+   iterations = 0;
+
+   if (!ScoringApplies())
+      return false;
+
+   int meanCount = means.dim;
+   int vcCount = vcEstimated;
+
+   // Variance components that are absent from all terms are not updated
+   IntArray active(vcCount);
+   active.Zero();
+
+   for (int i = 0; i < count; i++)
+      for (int j = 0; j < vcCount; j++)
+         if (sets[i]->varComponents[j].rows)
+            active[j] = 1;
+
+   // Smallest variance considered, as in SelectPoint()
+   double minVariance = exp(-NORMAL_LOG_VARIANCE_LIMIT);
+   double maxVariance = exp(NORMAL_LOG_VARIANCE_LIMIT);
+
+   Vector point(meanCount + vcCount), trial(meanCount + vcCount);
+   GetStartingPoint(point);
+
+   SelectPoint(point);
+   double fmin = Evaluate();
+
+   Vector   score(vcCount), step(vcCount), target(meanCount), current(vcCount);
+   Matrix   information(vcCount, vcCount), product(meanCount, meanCount);
+   Cholesky chol;
+
+   while (iterations++ < NORMAL_SCORING_ITERATIONS)
+      {
+      ProcessSets(DerivativesBlock);
+
+      score.Zero();
+      information.Zero();
+      target.Zero();
+      product.Zero();
+
+      // Partial derivatives are summed in the same order for any number of threads
+      for (int i = 0; i < count; i++)
+         {
+         score.Add(sets[i]->vcScore);
+         information.Add(sets[i]->vcInformation);
+         target.Add(sets[i]->glsScores);
+         product.Add(sets[i]->glsProduct);
+         }
+
+      // Generalized least squares estimates for the means
+      if (!chol.TryDecompose(product))
+         break;
+      chol.BackSubst(target);
+      target = chol.x;
+
+      for (int j = 0; j < vcCount; j++)
+         {
+         current[j] = variances[j];
+
+         // Variances that have reached zero stay there until the
+         // likelihood favours an increase
+         bool bounded = current[j] <= minVariance * 1.001 && score[j] <= 0.0;
+
+         if (!active[j] || bounded)
+            {
+            score[j] = 0.0;
+            for (int k = 0; k < vcCount; k++)
+               information[j][k] = information[k][j] = 0.0;
+            information[j][j] = 1.0;
+            }
+         }
+
+      if (!chol.TryDecompose(information))
+         break;
+      chol.BackSubst(score);
+      step = chol.x;
+
+      // Expected improvement in the log-likelihood, for checking convergence
+      double expected = score.InnerProduct(step);
+      for (int j = 0; j < meanCount; j++)
+         for (int k = 0; k < meanCount; k++)
+            expected += (target[j] - point[j]) * product[j][k] * (target[k] - point[k]);
+
+      // Scoring converges quickly, so estimates are refined well beyond the
+      // precision of derivative free fits and do not depend on the starting
+      // point at the precision at which results are reported
+      if (expected < NORMAL_SCORING_TOLERANCE * (fabs(fmin) + 1.0))
+         {
+         SelectPoint(point);
+         return true;
+         }
+
+      bool converged = expected < precision * (fabs(fmin) + precision);
+
+      // Take the largest step that improves the likelihood
+      double scale = 1.0, ftrial = fmin;
+
+      for (int halvings = 0; halvings < NORMAL_SCORING_HALVINGS; halvings++, scale *= 0.5)
+         {
+         for (int j = 0; j < meanCount; j++)
+            trial[j] = point[j] + scale * (target[j] - point[j]);
+
+         // Variances that would become negative are shrunk towards zero instead
+         for (int j = 0; j < vcCount; j++)
+            {
+            double update = current[j] + scale * step[j];
+
+            if (update < current[j] * NORMAL_SCORING_SHRINK)
+               update = current[j] * NORMAL_SCORING_SHRINK;
+            if (update < minVariance)
+               update = minVariance;
+            if (update > maxVariance)
+               update = maxVariance;
+
+            trial[meanCount + j] = log(update);
+            }
+
+         SelectPoint(trial);
+         ftrial = Evaluate();
+
+         if (ftrial <= fmin)
+            break;
+         }
+
+      // Beyond the precision of derivative free fits, rounding errors can
+      // prevent any further improvement
+      if (ftrial > fmin && converged)
+         {
+         SelectPoint(point);
+         return true;
+         }
+
+      if (ftrial > fmin)
+         break;
+
+      point = trial;
+      fmin = ftrial;
+      }
+
+   // Derivative free minimization continues from the best point found
+   SelectPoint(point);
+   return false;
+   }
+
+bool NormalSet::PrepareTest()
+   {
+   testReady = false;
+
+   if (!ScoringApplies())
+      return false;
+
+   // Cache the null model at the current estimates
+   Vector point(CountParameters());
+   GetStartingPoint(point);
+   SelectPoint(point);
+   Evaluate();
+
+   ProcessSets(PrepareTestBlock);
+
+   int vcCount = vcEstimated;
+   Matrix information(vcCount, vcCount);
+   information.Zero();
+
+   for (int i = 0; i < count; i++)
+      information.Add(sets[i]->vcInformation);
+
+   // Components that are absent, or estimated at zero, are held fixed
+   double minVariance = exp(-NORMAL_LOG_VARIANCE_LIMIT) * 1.001;
+
+   nullFixed.Dimension(vcCount);
+   for (int j = 0; j < vcCount; j++)
+      {
+      nullFixed[j] = information[j][j] <= 0.0 || variances[j] <= minVariance;
+
+      if (nullFixed[j])
+         {
+         for (int k = 0; k < vcCount; k++)
+            information[j][k] = information[k][j] = 0.0;
+         information[j][j] = 1.0;
+         }
+      }
+
+   if (!nullInformation.TryDecompose(information))
+      return false;
+
+   testReady = true;
+   return true;
+   }
+
+double NormalSet::ScoreTest(int component, double & estimate)
+   {
+   estimate = 0.0;
+
+   if (!testReady)
+      return 0.0;
+
+   testComponent = component;
+   ProcessSets(ScoreTestBlock);
+
+   int vcCount = nullFixed.Length();
+   double score = 0.0;
+   Vector information(vcCount + 1);
+   information.Zero();
+
+   for (int i = 0; i < count; i++)
+      {
+      score += sets[i]->testScore;
+      information.Add(sets[i]->testInformation);
+      }
+
+   // Efficient information, after adjusting for null variance components
+   Vector cross(vcCount);
+   for (int j = 0; j < vcCount; j++)
+      cross[j] = nullFixed[j] ? 0.0 : information[j];
+
+   nullInformation.BackSubst(cross);
+   double efficient = information[vcCount] - cross.InnerProduct(nullInformation.x);
+
+   // The new variance can't be negative
+   if (score <= 0.0 || efficient <= 0.0)
+      return 0.0;
+
+   estimate = score / efficient;
+   return score * estimate;
+   }
+
 int NormalSet::CountObservations()
    {
    int rows = 0;
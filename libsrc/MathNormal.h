@@ -27,6 +27,8 @@
 #define NORMAL_POWELL_MIN    1
 #define NORMAL_FLETCHER_MIN  2
 
+class ThreadPool;
+
 class NormalEquations
    {
    public:
@@ -66,6 +68,27 @@ class NormalEquations
       Vector Qi;        // Each Qi is approximately chi-square with 1 df
       void   Diagnostics();
 
+      // Analytic derivatives at the last evaluated point, for Fisher scoring
+      //    - vcScore is the derivative of the log-likelihood for each variance
+      //    - vcInformation is the average information matrix for variances
+      //    - glsProduct and glsScores are X'Inv(V)X and X'Inv(V)y, which
+      //      give generalized least squares estimates for the linear model
+      Vector vcScore;
+      Matrix vcInformation;
+      Matrix glsProduct;
+      Vector glsScores;
+      void   Derivatives();
+
+      // Score test for an additional variance component, using the null
+      // model at the last evaluated point, which is cached by PrepareTest()
+      //    - testScore is the derivative of the log-likelihood
+      //    - testInformation has the expected information for the new
+      //      component with each null component, and then with itself
+      double testScore;
+      Vector testInformation;
+      void   PrepareTest();
+      void   ScoreTest(int component);
+
    protected:
       void Free();
 
@@ -74,6 +97,13 @@ class NormalEquations
 
       bool      meanChange, varChange, init;
       IntArray  meanFlags;
+
+      // Null model for score tests, Inv(V), Inv(V) * (Xb - y) and
+      // Inv(V) * Vj for each null variance component
+      Matrix    nullInverse;
+      Vector    nullResiduals;
+      Matrix *  nullProducts;
+      int       nullComponents;
    };
 
 class NormalSet
@@ -94,9 +124,30 @@ class NormalSet
       // Number of function evaluations
       int    evaluations;
 
+      // Number of Fisher scoring iterations, zero when the last
+      // model was fitted by derivative free minimization
+      int    iterations;
+
+      // Disables Fisher scoring, so that all models are fitted
+      // by derivative free minimization
+      static bool derivativeFree;
+
+      // Start Solve() from the current means and variances, rather than
+      // from least squares estimates, when the model has the same shape
+      bool   warmStart;
+
+      // Score tests for an additional variance component, using the model
+      // fitted by the last call to Solve() as the null. ScoreTest returns
+      // the score statistic, which is approximately chi-squared, and a one
+      // step estimate for the new variance. PrepareTest() returns false
+      // when score tests are not available for the current model.
+      bool   PrepareTest();
+      double ScoreTest(int component, double & estimate);
+
+      // By default, use the thread count selected for the ThreadPool class
       NormalSet(int threads = 0);
 
-      virtual ~NormalSet() { Free(); }
+      virtual ~NormalSet();
 
       void        Dimension(int setCount, int vcCount, int vcDerived = 0);
       double      Evaluate();
@@ -119,8 +170,26 @@ class NormalSet
       virtual void CalculateConstrainedVariances();
 
    protected:
-      // for multi-threading
-      static void * EvaluateOneSet(void * which);
+      // for multi-threading, families are evaluated in blocks
+      ThreadPool * pool;
+      int          blocks;
+
+      void        ProcessSets(void (* task)(void * set, int block, int thread));
+      static void EvaluateBlock(void * set, int block, int thread);
+      static void DerivativesBlock(void * set, int block, int thread);
+      static void PrepareTestBlock(void * set, int block, int thread);
+      static void ScoreTestBlock(void * set, int block, int thread);
+
+      // Score test state
+      int          testComponent;
+      Cholesky     nullInformation;
+      IntArray     nullFixed;
+      bool         testReady;
+
+      // Fisher scoring for models where the likelihood is a product of
+      // independent terms, returns false if the fit doesn't converge
+      bool         ScoringApplies();
+      bool         FisherScoring();
 
       // house-keeping
       void  Free();
@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////// 
+// libsrc/MiniLZ.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "MiniLZ.h"
+
+#include <string.h>
+
+#define uchar        unsigned char
+
+static inline unsigned int Read32(const uchar * ptr)
+   {
+   unsigned int value;
+   memcpy(&value, ptr, sizeof(value));
+   return value;
+   }
+
+static inline int Hash(unsigned int sequence)
+   {
+   return (sequence * 2654435761U) >> (32 - MINILZ_HASH_BITS);
+   }
+
+MiniLZ::MiniLZ()
+   {
+   table = new int [1 << MINILZ_HASH_BITS];
+   }
+
+MiniLZ::~MiniLZ()
+   {
+   delete [] table;
+   }
+
+uchar * MiniLZ::WriteLength(uchar * out, int length)
+   {
+   for ( ; length >= 255; length -= 255)
+      *out++ = 255;
+
+   *out++ = (uchar) length;
+   return out;
+   }
+
+int MiniLZ::Compress(const void * input, int bytes, void * output)
+   {
+   const uchar * in = (const uchar *) input;
+   const uchar * end = in + bytes;
+   const uchar * anchor = in;
+   const uchar * ip = in;
+   uchar       * out = (uchar *) output;
+
+   for (int i = 0; i < (1 << MINILZ_HASH_BITS); i++)
+      table[i] = -1;
+
+   while (ip + MINILZ_MIN_MATCH <= end)
+      {
+      unsigned int sequence = Read32(ip);
+      int          hash = Hash(sequence);
+      int          candidate = table[hash];
+
+      table[hash] = ip - in;
+
+      if (candidate < 0 || ip - in - candidate > MINILZ_MAX_OFFSET ||
+          Read32(in + candidate) != sequence)
+         {
+         ip++;
+         continue;
+         }
+
+      // Extend the match as far as possible
+      const uchar * ref = in + candidate;
+      int length = MINILZ_MIN_MATCH;
+
+      while (ip + length < end && ref[length] == ip[length])
+         length++;
+
+      // Output token, literals and then the match
+      int literals = ip - anchor;
+      int extra = length - MINILZ_MIN_MATCH;
+      int offset = ip - ref;
+
+      *out++ = (uchar) (((literals < 15 ? literals : 15) << 4) | (extra < 15 ? extra : 15));
+      if (literals >= 15) out = WriteLength(out, literals - 15);
+
+      memcpy(out, anchor, literals);
+      out += literals;
+
+      *out++ = (uchar) (offset & 0xFF);
+      *out++ = (uchar) (offset >> 8);
+      if (extra >= 15) out = WriteLength(out, extra - 15);
+
+      ip += length;
+      anchor = ip;
+      }
+
+   // The final sequence holds the remaining literals
+   int literals = end - anchor;
+
+   *out++ = (uchar) ((literals < 15 ? literals : 15) << 4);
+   if (literals >= 15) out = WriteLength(out, literals - 15);
+
+   memcpy(out, anchor, literals);
+   out += literals;
+
+   return out - (uchar *) output;
+   }
+
+int MiniLZ::Decompress(const void * input, int bytes, void * output, int capacity)
+   {
+   const uchar * in = (const uchar *) input;
+   const uchar * end = in + bytes;
+   uchar       * out = (uchar *) output;
+   uchar       * limit = out + capacity;
+
+   while (in < end)
+      {
+      int token = *in++;
+      int literals = token >> 4;
+
+      if (literals == 15)
+         do { literals += *in; } while (*in++ == 255);
+
+      if (out + literals > limit || in + literals > end)
+         break;
+
+      memcpy(out, in, literals);
+      out += literals;
+      in += literals;
+
+      if (in >= end)
+         break;
+
+      int offset = in[0] | (in[1] << 8);
+      int length = (token & 15);
+
+      in += 2;
+
+      if (length == 15)
+         do { length += *in; } while (*in++ == 255);
+
+      length += MINILZ_MIN_MATCH;
+
+      if (out + length > limit || offset > out - (uchar *) output || offset == 0)
+         break;
+
+      // Matches may overlap the bytes being written
+      const uchar * ref = out - offset;
+
+      if (offset >= length)
+         memcpy(out, ref, length), out += length;
+      else
+         while (length--)
+            *out++ = *ref++;
+      }
+
+   return out - (uchar *) output;
+   }
+
+ 
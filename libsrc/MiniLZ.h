@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////// 
+// libsrc/MiniLZ.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __MINILZ_H__
+#define __MINILZ_H__
+
+// MiniLZ compresses memory buffers with a simple LZ77 scheme that favours
+// speed over compression ratio. Each sequence starts with a token byte,
+// holding the number of literals in the high nibble and the match length
+// minus MINILZ_MIN_MATCH in the low nibble. Nibbles of 15 are followed by
+// extension bytes, which are summed until a byte below 255 is found.
+// Literals follow, and then a two byte offset and any match length
+// extension. The final sequence holds only literals.
+//
+
+// Hash table size is 1 << MINILZ_HASH_BITS
+#define MINILZ_HASH_BITS   14
+// Shortest match that will be encoded
+#define MINILZ_MIN_MATCH   4
+// Furthest match that can be encoded
+#define MINILZ_MAX_OFFSET  65535
+
+class MiniLZ
+   {
+   public:
+      MiniLZ();
+      ~MiniLZ();
+
+      // Returns the size of the compressed output
+      int Compress(const void * input, int bytes, void * output);
+
+      // Returns the number of bytes decoded
+      int Decompress(const void * input, int bytes, void * output, int capacity);
+
+      // Largest possible output for an input of the given size
+      static int Bound(int bytes)
+         { return bytes + bytes / 255 + 16; }
+
+   private:
+      int * table;
+
+      static unsigned char * WriteLength(unsigned char * out, int length);
+   };
+
+#endif
+
+ 
@@ -0,0 +1,177 @@
+////////////////////////////////////////////////////////////////////// 
+// libsrc/ThreadPool.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "ThreadPool.h"
+#include "Error.h"
+
+int  ThreadPool::defaultThreads = 1;
+
+__thread bool ThreadPool::inWorker = false;
+
+ThreadPool::ThreadPool(int count)
+   {
+   threads = count > 0 ? count : defaultThreads;
+
+   // Avoid nested parallelism
+   if (threads < 1 || inWorker)
+      threads = 1;
+
+   task = NULL;
+   data = NULL;
+   this->count = next = pending = started = 0;
+   shutdown = false;
+   handles = NULL;
+
+   // A single thread pool processes items in the calling thread
+   if (threads == 1)
+      return;
+
+   pthread_mutex_init(&lock, NULL);
+   pthread_cond_init(&queued, NULL);
+   pthread_cond_init(&completed, NULL);
+
+   handles = new pthread_t [threads];
+
+   for (int i = 0; i < threads; i++)
+      if (pthread_create(&handles[i], NULL, Worker, this) != 0)
+         error("Failed to start thread %d of %d\n", i + 1, threads);
+   }
+
+ThreadPool::~ThreadPool()
+   {
+   if (handles == NULL)
+      return;
+
+   Finish();
+
+   pthread_mutex_lock(&lock);
+   shutdown = true;
+   pthread_cond_broadcast(&queued);
+   pthread_mutex_unlock(&lock);
+
+   for (int i = 0; i < threads; i++)
+      pthread_join(handles[i], NULL);
+
+   delete [] handles;
+
+   pthread_cond_destroy(&completed);
+   pthread_cond_destroy(&queued);
+   pthread_mutex_destroy(&lock);
+   }
+
+void ThreadPool::Start(ThreadTask t, void * d, int items, const int * order)
+   {
+   // Complete any outstanding work
+   Finish();
+
+   if (handles != NULL) pthread_mutex_lock(&lock);
+
+   task = t;
+   data = d;
+   count = pending = items;
+   next = 0;
+
+   sequence.Dimension(items);
+   finished.Dimension(items);
+   finished.Zero();
+
+   for (int i = 0; i < items; i++)
+      sequence[i] = order == NULL ? i : order[i];
+
+   if (handles != NULL)
+      {
+      pthread_cond_broadcast(&queued);
+      pthread_mutex_unlock(&lock);
+      }
+   }
+
+void ThreadPool::WaitFor(int item)
+   {
+   if (handles == NULL)
+      {
+      while (!finished[item])
+         ProcessNext();
+      return;
+      }
+
+   pthread_mutex_lock(&lock);
+   while (!finished[item])
+      pthread_cond_wait(&completed, &lock);
+   pthread_mutex_unlock(&lock);
+   }
+
+void ThreadPool::Finish()
+   {
+   if (handles == NULL)
+      {
+      while (next < count)
+         ProcessNext();
+      return;
+      }
+
+   pthread_mutex_lock(&lock);
+   while (pending)
+      pthread_cond_wait(&completed, &lock);
+   pthread_mutex_unlock(&lock);
+   }
+
+void ThreadPool::ProcessNext()
+   {
+   int item = sequence[next++];
+
+   task(data, item, 0);
+
+   finished[item] = true;
+   pending--;
+   }
+
+void * ThreadPool::Worker(void * arg)
+   {
+   ThreadPool * pool = (ThreadPool *) arg;
+
+   inWorker = true;
+
+   pthread_mutex_lock(&pool->lock);
+
+   int thread = pool->started++;
+
+   while (true)
+      {
+      while (!pool->shutdown && pool->next >= pool->count)
+         pthread_cond_wait(&pool->queued, &pool->lock);
+
+      if (pool->shutdown)
+         break;
+
+      int item = pool->sequence[pool->next++];
+
+      pthread_mutex_unlock(&pool->lock);
+      pool->task(pool->data, item, thread);
+      pthread_mutex_lock(&pool->lock);
+
+      pool->finished[item] = true;
+      pool->pending--;
+
+      pthread_cond_broadcast(&pool->completed);
+      }
+
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+   }
+
+ 
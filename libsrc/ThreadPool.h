@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////// 
+// libsrc/ThreadPool.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include "IntArray.h"
+
+#include <pthread.h>
+
+// A ThreadTask processes one work item, identified by a serial number
+// in the range [0, count). The thread number can be used to select
+// scratch space, and is always in the range [0, threads).
+//
+typedef void (* ThreadTask)(void * data, int item, int thread);
+
+class Mutex
+   {
+   public:
+      Mutex()  { pthread_mutex_init(&mutex, NULL); }
+      ~Mutex() { pthread_mutex_destroy(&mutex); }
+
+      void Lock()    { pthread_mutex_lock(&mutex); }
+      void Unlock()  { pthread_mutex_unlock(&mutex); }
+
+   private:
+      pthread_mutex_t mutex;
+   };
+
+// Holds a mutex until the end of the enclosing scope, so that it is
+// also released when an exception is thrown
+class MutexLock
+   {
+   public:
+      MutexLock(Mutex & m) : mutex(m) { mutex.Lock(); }
+      ~MutexLock() { mutex.Unlock(); }
+
+   private:
+      Mutex & mutex;
+   };
+
+class ThreadPool
+   {
+   public:
+      ThreadPool(int threads = 0);
+      ~ThreadPool();
+
+      // Queue a batch of work items. Items are claimed in the order
+      // listed in the optional order array, or in ascending order
+      void Start(ThreadTask task, void * data, int count, const int * order = NULL);
+
+      // Waits for a specific item in the current batch to be completed
+      void WaitFor(int item);
+
+      // Waits for all items in the current batch
+      void Finish();
+
+      // Queue a batch of work items and wait for them to complete
+      void Run(ThreadTask task, void * data, int count, const int * order = NULL)
+         { Start(task, data, count, order); Finish(); }
+
+      // Number of threads that process work items
+      int  Threads() { return threads; }
+
+      // Default number of threads for new pools
+      static int  defaultThreads;
+
+      // Returns true for code running in a worker thread. Nested pools
+      // created inside worker threads process their items serially.
+      static bool InWorker() { return inWorker; }
+
+   private:
+      int         threads;
+      pthread_t * handles;
+
+      pthread_mutex_t lock;
+      pthread_cond_t  queued, completed;
+
+      // Information on current batch
+      ThreadTask  task;
+      void *      data;
+      int         count;
+      int         next;
+      int         pending;
+      int         started;
+      bool        shutdown;
+      IntArray    sequence;
+      IntArray    finished;
+
+      // Processes the next queued item in the calling thread
+      void        ProcessNext();
+
+      static void * Worker(void * pool);
+
+      static __thread bool inWorker;
+   };
+
+#endif
+
+ 
@@ -66,6 +66,11 @@ const char * AnalysisTask::TaskDescription()
    return NULL;
    }
 
+const char * AnalysisTask::TaskName()
+   {
+   return "task";
+   }
+
 void * AnalysisTask::ProcessMessage(const char * message)
    {
    if (next == NULL)
@@ -73,6 +73,9 @@ class AnalysisTask
 
       virtual const char * TaskDescription();
 
+      // Short name used to label profiling results
+      virtual const char * TaskName();
+
       AnalysisTask * next;
 
       AnalysisTask(AnalysisTask * nextTask)
@@ -136,7 +136,7 @@ void AssociationAnalysis::AnalyseAssociation(FamilyAnalysis & engine)
 #endif
 
       // The normal set class is our workhorse
-      NormalSet mvn;
+      NormalSet mvn(MerlinCore::threads);
       mvn.Dimension(families, vc_count);
 
       // Per family likelihoods under the null and alternative hypothesis
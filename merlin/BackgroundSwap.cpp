@@ -0,0 +1,344 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/BackgroundSwap.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "BackgroundSwap.h"
+#include "Error.h"
+
+int BackgroundSwap::prefetch = 0;
+int BackgroundSwap::megabytes = 64;
+
+BackgroundSwap::BackgroundSwap()
+   {
+   started = shutdown = false;
+   nesting = 0;
+
+   jobs = NULL;
+   capacity = first = next = last = 0;
+   inFlight = 0.0;
+
+   for (int i = 0; i < SWAP_USAGE_FILES; i++)
+      usageFile[i] = NULL;
+   }
+
+BackgroundSwap::~BackgroundSwap()
+   {
+   if (started)
+      {
+      Finish();
+
+      pthread_mutex_lock(&lock);
+      shutdown = true;
+      pthread_cond_signal(&queued);
+      pthread_mutex_unlock(&lock);
+
+      pthread_join(thread, NULL);
+
+      pthread_mutex_destroy(&lock);
+      pthread_cond_destroy(&queued);
+      pthread_cond_destroy(&completed);
+      }
+
+   if (jobs != NULL)
+      delete [] jobs;
+   }
+
+void BackgroundSwap::Begin()
+   {
+   nesting++;
+
+   if (prefetch <= 0 || started)
+      return;
+
+   pthread_mutex_init(&lock, NULL);
+   pthread_cond_init(&queued, NULL);
+   pthread_cond_init(&completed, NULL);
+
+   if (pthread_create(&thread, NULL, Worker, this) != 0)
+      error("Failed to start background swap thread\n");
+
+   started = true;
+   }
+
+void BackgroundSwap::End()
+   {
+   if (--nesting == 0)
+      Finish();
+   }
+
+void BackgroundSwap::Pack(BasicTree & tree, TreeManager & file)
+   {
+   if (!Active() || !file.IsOpen())
+      {
+      tree.Pack(file);
+      return;
+      }
+
+   double bytes = tree.count * (double) TREE_NODE_SIZE;
+
+   pthread_mutex_lock(&lock);
+   Collect();
+
+   // Keep queued trees within the memory budget
+   while (next < last && inFlight + bytes > megabytes * 1048576.0)
+      {
+      pthread_cond_wait(&completed, &lock);
+      Collect();
+      }
+
+   // The tree will be counted by the background thread until it is freed
+   tree.ReleaseNodes();
+   Queue(tree, file, SWAP_JOB_PACK);
+
+   pthread_mutex_unlock(&lock);
+   }
+
+void BackgroundSwap::UnPack(BasicTree & tree, TreeManager & file)
+   {
+   if (!Active() || !file.IsOpen())
+      {
+      tree.UnPack(file);
+      return;
+      }
+
+   pthread_mutex_lock(&lock);
+   Collect();
+
+   if (!Queued(tree) && tree.IsInSwapFile())
+      Queue(tree, file, SWAP_JOB_UNPACK);
+
+   while (Queued(tree))
+      {
+      pthread_cond_wait(&completed, &lock);
+      Collect();
+      }
+
+   pthread_mutex_unlock(&lock);
+
+   // If the background thread ran out of memory, try again so that
+   // the problem is reported in the calling thread
+   if (tree.IsInSwapFile())
+      {
+      Finish();
+      tree.UnPack(file);
+      }
+   }
+
+void BackgroundSwap::Prefetch(BasicTree & tree, TreeManager & file)
+   {
+   if (!Active() || !file.IsOpen())
+      return;
+
+   pthread_mutex_lock(&lock);
+   Collect();
+
+   if (!Queued(tree) && tree.IsInSwapFile() &&
+       inFlight + tree.count * (double) TREE_NODE_SIZE <= megabytes * 1048576.0)
+      Queue(tree, file, SWAP_JOB_UNPACK);
+
+   pthread_mutex_unlock(&lock);
+   }
+
+void BackgroundSwap::Wait(BasicTree & tree)
+   {
+   if (!started)
+      return;
+
+   pthread_mutex_lock(&lock);
+   Collect();
+
+   while (Queued(tree))
+      {
+      pthread_cond_wait(&completed, &lock);
+      Collect();
+      }
+
+   pthread_mutex_unlock(&lock);
+   }
+
+void BackgroundSwap::Finish()
+   {
+   if (!started)
+      return;
+
+   pthread_mutex_lock(&lock);
+
+   while (next < last)
+      pthread_cond_wait(&completed, &lock);
+
+   Collect();
+
+   pthread_mutex_unlock(&lock);
+   }
+
+double BackgroundSwap::FileUsage(TreeManager & file)
+   {
+   if (!started)
+      return file.GetFileUsage();
+
+   pthread_mutex_lock(&lock);
+   Collect();
+
+   bool busy = false;
+
+   for (int i = first; i < last; i++)
+      if (jobs[i % capacity].file == &file)
+         busy = true;
+
+   double usage = 0.0;
+
+   // Use the usage recorded after the last job, while the file is in use
+   for (int i = 0; i < SWAP_USAGE_FILES; i++)
+      if (usageFile[i] == &file)
+         usage = usageBytes[i];
+
+   pthread_mutex_unlock(&lock);
+
+   return busy ? usage : file.GetFileUsage();
+   }
+
+void BackgroundSwap::Queue(BasicTree & tree, TreeManager & file, int type)
+   {
+   if (last - first == capacity)
+      {
+      int      newCapacity = capacity ? capacity * 2 : 64;
+      SwapJob * newJobs = new SwapJob [newCapacity];
+
+      for (int i = first; i < last; i++)
+         newJobs[i % newCapacity] = jobs[i % capacity];
+
+      if (jobs != NULL) delete [] jobs;
+
+      jobs = newJobs;
+      capacity = newCapacity;
+      }
+
+   SwapJob & job = jobs[last++ % capacity];
+
+   job.tree = &tree;
+   job.file = &file;
+   job.type = type;
+   job.bytes = tree.count * (double) TREE_NODE_SIZE;
+   job.usage = 0.0;
+
+   inFlight += job.bytes;
+
+   pthread_cond_signal(&queued);
+   }
+
+void BackgroundSwap::Collect()
+   {
+   while (first < next)
+      {
+      SwapJob & job = jobs[first++ % capacity];
+
+      // Trees in memory are counted by the calling thread again
+      if (job.tree->IsInMemory())
+         job.tree->AcquireNodes();
+
+      if (job.type == SWAP_JOB_PACK)
+         for (int i = 0; i < SWAP_USAGE_FILES; i++)
+            if (usageFile[i] == job.file || usageFile[i] == NULL)
+               {
+               usageFile[i] = job.file;
+               usageBytes[i] = job.usage;
+               break;
+               }
+
+      inFlight -= job.bytes;
+      }
+   }
+
+bool BackgroundSwap::Queued(BasicTree & tree)
+   {
+   for (int i = first; i < last; i++)
+      if (jobs[i % capacity].tree == &tree)
+         return true;
+
+   return false;
+   }
+
+void BackgroundSwap::Process(SwapJob & job)
+   {
+   BasicTree & tree = *job.tree;
+
+   if (job.type == SWAP_JOB_PACK)
+      {
+      tree.AcquireNodes();
+      tree.Pack(*job.file);
+
+      job.usage = job.file->GetFileUsage();
+      }
+   else
+      {
+      int count = tree.count;
+
+      try
+         {
+         tree.UnPack(*job.file);
+         }
+      catch (const TreesTooBig &)
+         {
+         // Leave the tree in the swap file for the calling thread
+         tree.count = count;
+         }
+      }
+
+   // Trees left in memory are handed back to the calling thread
+   if (tree.IsInMemory())
+      tree.ReleaseNodes();
+   }
+
+void * BackgroundSwap::Worker(void * data)
+   {
+   BackgroundSwap * swap = (BackgroundSwap *) data;
+
+   // Each thread that swaps trees needs its own buffers
+   TreeBuffers buffers;
+
+   BasicTree::SelectBuffers(&buffers);
+   BasicTree::AllocateBuffers();
+
+   pthread_mutex_lock(&swap->lock);
+
+   while (true)
+      {
+      while (swap->next == swap->last && !swap->shutdown)
+         pthread_cond_wait(&swap->queued, &swap->lock);
+
+      if (swap->next == swap->last)
+         break;
+
+      // The list may be reallocated while the job is processed
+      SwapJob job = swap->jobs[swap->next % swap->capacity];
+
+      pthread_mutex_unlock(&swap->lock);
+      Process(job);
+      pthread_mutex_lock(&swap->lock);
+
+      swap->jobs[swap->next++ % swap->capacity] = job;
+
+      pthread_cond_broadcast(&swap->completed);
+      }
+
+   pthread_mutex_unlock(&swap->lock);
+
+   BasicTree::SelectBuffers(NULL);
+
+   return NULL;
+   }
+
+ 
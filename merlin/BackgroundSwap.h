@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/BackgroundSwap.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __BACKGROUNDSWAP_H__
+#define __BACKGROUNDSWAP_H__
+
+#include "TreeBasics.h"
+
+#include <pthread.h>
+
+///////////////////////////////////////////////////////////////
+// This class moves trees in and out of swap files in a separate
+// thread, so that compression and decompression overlap with
+// likelihood calculations. Retired trees are written behind the
+// calling thread and trees that will be needed soon are read
+// ahead of time. Jobs are processed in the order they are queued,
+// so each swap file is only ever used by one thread at a time.
+//
+// While background swapping is active, a tree with a queued job
+// must not be examined before Wait() returns and swap files must
+// only be accessed through this class or after Finish().
+//
+
+#define SWAP_JOB_PACK     0
+#define SWAP_JOB_UNPACK   1
+
+// Swap files for which usage is tracked
+#define SWAP_USAGE_FILES  4
+
+class SwapJob
+   {
+   public:
+      BasicTree   * tree;
+      TreeManager * file;
+      int           type;
+      double        bytes;
+      double        usage;
+   };
+
+class BackgroundSwap
+   {
+   public:
+      BackgroundSwap();
+      ~BackgroundSwap();
+
+      // Background swapping is enabled between calls to Begin() and End(),
+      // which may be nested. End() waits for all queued jobs.
+      void Begin();
+      void End();
+
+      bool Active()
+         { return nesting > 0 && prefetch > 0; }
+
+      // Compresses a tree and releases its memory
+      void Pack(BasicTree & tree, TreeManager & file);
+
+      // Reads a tree into memory and waits for it
+      void UnPack(BasicTree & tree, TreeManager & file);
+
+      // Starts reading a tree into memory, if it is not already queued
+      // and the memory budget allows
+      void Prefetch(BasicTree & tree, TreeManager & file);
+
+      // Waits for any queued job involving a tree
+      void Wait(BasicTree & tree);
+
+      // Waits for all queued jobs
+      void Finish();
+
+      // Swap file usage in bytes, as of the last completed job
+      double FileUsage(TreeManager & file);
+
+      // Number of trees to read ahead, zero disables background swapping
+      static int prefetch;
+
+      // Memory for trees queued for writing or read but not yet used
+      static int megabytes;
+
+   private:
+      pthread_t       thread;
+      pthread_mutex_t lock;
+      pthread_cond_t  queued, completed;
+      bool            started, shutdown;
+
+      int             nesting;
+
+      // Circular list of jobs, [first, next) are completed and
+      // [next, last) are waiting or in progress
+      SwapJob       * jobs;
+      int             capacity;
+      int             first, next, last;
+
+      // Bytes of node storage held by queued jobs
+      double          inFlight;
+
+      // Most recent usage for each swap file
+      TreeManager   * usageFile[SWAP_USAGE_FILES];
+      double          usageBytes[SWAP_USAGE_FILES];
+
+      // These functions must be called while holding the lock
+      void Queue(BasicTree & tree, TreeManager & file, int type);
+      void Collect();
+      bool Queued(BasicTree & tree);
+
+      static void   Process(SwapJob & job);
+      static void * Worker(void * swap);
+   };
+
+// Enables background swapping until the end of the enclosing block,
+// including when the block is left because of an exception
+class BackgroundSwapScope
+   {
+   public:
+      BackgroundSwapScope(BackgroundSwap & swap) : background(swap)
+         { background.Begin(); }
+      ~BackgroundSwapScope()
+         { background.End(); }
+
+   private:
+      BackgroundSwap & background;
+   };
+
+#endif
+
+ 
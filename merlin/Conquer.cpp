@@ -17,11 +17,82 @@
  
 #include "Conquer.h"
 #include "MapFunction.h"
+#include "ThreadPool.h"
 
 #include <math.h>
+#include <string.h>
 
 int Multipoint::maximum_recombinants = 0;
 
+__thread int * Multipoint::moveAlongCounter = NULL;
+__thread DenseBuffer * Multipoint::denseBuffer = NULL;
+bool Multipoint::recursiveMoves = false;
+
+// Trees smaller than this are always transformed by a single thread
+#define CONQUER_MIN_NODES   16384
+#define CONQUER_MAX_TASKS   256
+
+// Dense trees in this range are transformed as flat arrays
+#define DENSE_MIN_BITS      4
+#define DENSE_MAX_BITS      24
+
+// Trees using at least this fraction of the nodes needed to store every
+// inheritance vector are treated as dense
+#define DENSE_MIN_FILL      0.5
+
+// Variants of the divide and conquer algorithm
+#define CONQUER_EXACT          0
+#define CONQUER_SEX_SPECIFIC   1
+#define CONQUER_QUICK          2
+
+// Subtrees that are transformed in parallel
+class ConquerTask
+   {
+   public:
+      int      node;
+      int      bit;
+      double   scale;
+      double * femaleScale;
+      double * maleScale;
+      int    * meiosis;
+   };
+
+class ConquerBatch
+   {
+   public:
+      ConquerBatch(Multipoint & tree, int variant)
+         : owner(tree) { kind = variant; count = failure = 0; subtrees = NULL; }
+
+      ConquerTask & NewTask(int node)
+         { tasks[count].node = node; return tasks[count++]; }
+
+      Multipoint & owner;
+      int          kind;
+      int          count;
+      int          failure;
+      ConquerTask  tasks[CONQUER_MAX_TASKS];
+      Multipoint * subtrees;
+   };
+
+static ThreadPool & ConquerPool()
+   {
+   static ThreadPool pool;
+
+   return pool;
+   }
+
+// Number of recursion levels handled before work is split across threads
+static int ConquerDepth()
+   {
+   int depth = 0;
+
+   while ((1 << depth) < ConquerPool().Threads() * 4 &&
+          (2 << depth) <= CONQUER_MAX_TASKS)
+      depth++;
+
+   return depth;
+   }
+
 ////////////////////////////////////////////////////////////////////////////
 // This unit implements the Elston and Idury divide-and-conquer algorithm
 // for general multipoint calculations
@@ -32,6 +103,8 @@ void Multipoint::MoveAlong(Mantra & m, double distance, double rescale)
    if (distance == 0.0)
       return;
 
+   CountMove();
+
    if (maximum_recombinants)
       {
       Approximation(m, distance, maximum_recombinants, rescale);
@@ -55,7 +128,17 @@ void Multipoint::MoveAlong(Mantra & m, double distance, double rescale)
       if (m.founder_bit_count[i])
          SpecialReUnite(0, 0, m.founder_bits[i]);
 
-   DivideAndConquer(bit_count);
+   if (UseDense(bit_count))
+      DenseDivideAndConquer(bit_count, NULL, pow_onex[0]);
+   else if (UseThreads())
+      {
+      ConquerBatch batch(*this, CONQUER_EXACT);
+
+      SplitDivideAndConquer(batch, ConquerDepth(), bit_count);
+      ConquerInParallel(batch);
+      }
+   else
+      DivideAndConquer(bit_count);
    for (int i = 0; i < m.couples; i++)
       if (m.couple_bits[i][m.two_n - 1])
          DoubleReUnite(0, 0, m.couple_bits[i]);
@@ -75,6 +158,8 @@ void Multipoint::MoveAlong(Mantra & m, double theta[2], double rescale)
       return;
       }
 
+   CountMove();
+
    if (maximum_recombinants)
       {
       Approximation(m, theta, maximum_recombinants, rescale);
@@ -126,9 +211,35 @@ void Multipoint::MoveAlong(Mantra & m, double theta[2], double rescale)
          SpecialReUnite(0, 0, m.founder_bits[i]);
          }
 
-   DivideAndConquer(&female_scale[m.bit_count - m.male_bit_count],
-                    &male_scale[m.male_bit_count],
-                    &m.bit_sex[m.bit_count]);
+   if (UseDense(m.bit_count))
+      {
+      // Find scaling constants for leaves at the bottom of the tree
+      double * femaleScale = &female_scale[m.bit_count - m.male_bit_count];
+      double * maleScale = &male_scale[m.male_bit_count];
+
+      for (int i = m.bit_count; i > 0; i--)
+         if (m.bit_sex[i])
+            maleScale--;
+         else
+            femaleScale--;
+
+      DenseDivideAndConquer(m.bit_count, &m.bit_sex[m.bit_count],
+                            (*femaleScale) * (*maleScale));
+      }
+   else if (UseThreads())
+      {
+      ConquerBatch batch(*this, CONQUER_SEX_SPECIFIC);
+
+      SplitDivideAndConquer(batch, ConquerDepth(),
+                            &female_scale[m.bit_count - m.male_bit_count],
+                            &male_scale[m.male_bit_count],
+                            &m.bit_sex[m.bit_count]);
+      ConquerInParallel(batch);
+      }
+   else
+      DivideAndConquer(&female_scale[m.bit_count - m.male_bit_count],
+                       &male_scale[m.male_bit_count],
+                       &m.bit_sex[m.bit_count]);
 
    SetMeiosisSex(0);
 
@@ -194,7 +305,18 @@ void Multipoint::QuickMoveAlong(Mantra & m, double rescale)
 
    // Handle regular bits, using increased recombination rates for
    // some hidden bits (as defined in the meiosis_type array).
-   QuickDivideAndConquer(scale, &meiosis_type[m.bit_count], m.bit_count);
+   if (UseDense(m.bit_count))
+      DenseDivideAndConquer(m.bit_count, &meiosis_type[m.bit_count], scale);
+   else if (UseThreads())
+      {
+      ConquerBatch batch(*this, CONQUER_QUICK);
+
+      SplitQuickDivideAndConquer(batch, ConquerDepth(), scale,
+                                 &meiosis_type[m.bit_count], m.bit_count);
+      ConquerInParallel(batch);
+      }
+   else
+      QuickDivideAndConquer(scale, &meiosis_type[m.bit_count], m.bit_count);
 
    SetMeiosisSex(0);
 
@@ -213,7 +335,7 @@ void Multipoint::QuickMoveAlong(Mantra & m, double rescale)
 
 void Multipoint::DivideAndConquer(int splits_to_go, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -234,7 +356,7 @@ void Multipoint::DivideAndConquer(int splits_to_go, int node)
 void Multipoint::DivideAndConquer(double * femaleScale, double * maleScale,
                                   int * isMale, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -264,7 +386,7 @@ void Multipoint::DivideAndConquer(double * femaleScale, double * maleScale,
 
 void Multipoint::QuickDivideAndConquer(double scale, int * meiosis_kind, int bit, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -291,10 +413,542 @@ void Multipoint::QuickDivideAndConquer(double scale, int * meiosis_kind, int bit
       }
    }
 
+///////////////////////////////////////////////////////////////////////
+// When most inheritance vectors have their own leaf, the tree is copied
+// into a flat array and each step of the algorithm is applied as a
+// butterfly over pairs of array elements. The array is then stored as
+// a new tree, where only subtrees without any inheritance vectors are
+// collapsed.
+//
+
+bool Multipoint::UseDense(int bits)
+   {
+   return denseBuffer != NULL && !recursiveMoves && IsDense(bits) &&
+          denseBuffer->Dimension(1 << bits);
+   }
+
+void Multipoint::DenseDivideAndConquer(int bits, int * meiosis, double scale)
+   {
+   int      size = 1 << bits;
+   double * values = denseBuffer->values;
+   char   * isLeaf = denseBuffer->isLeaf;
+
+   Expand(values, isLeaf, size, 0);
+
+   for (int bit = 0; bit < bits; bit++)
+      {
+      int    stride = size >> (bit + 1);
+      double ratio_x = meiosis == NULL ? x : ratio[meiosis[-bit]];
+
+      for (int block = 0; block < size; block += stride * 2)
+         {
+         double * left = values + block;
+         double * right = left + stride;
+         char   * leftLeaf = isLeaf + block;
+         char   * rightLeaf = leftLeaf + stride;
+
+         for (int i = 0; i < stride; i++)
+            {
+            double value_left = left[i];
+
+            left[i] += right[i] * ratio_x;
+            right[i] += value_left * ratio_x;
+
+            leftLeaf[i] = rightLeaf[i] = leftLeaf[i] | rightLeaf[i];
+            }
+         }
+      }
+
+   for (int i = 0; i < size; i++)
+      values[i] *= scale;
+
+   nextFree = 0;
+   Store(values, isLeaf, size);
+   }
+
+///////////////////////////////////////////////////////////////////////
+// Flat arrays used for dense trees are allocated outside the node
+// storage, so their size is tracked separately against the memory limit.
+//
+
+bool DenseBuffer::Dimension(int elements)
+   {
+   if (elements > capacity)
+      {
+      Free();
+
+      if (!BasicTree::ReserveScratch(Nodes(elements)))
+         return false;
+
+      values = new double [elements];
+      isLeaf = new char [elements];
+      capacity = elements;
+      }
+
+   size = elements;
+   return true;
+   }
+
+void DenseBuffer::Free()
+   {
+   if (capacity)
+      {
+      BasicTree::ReleaseScratch(Nodes(capacity));
+
+      delete [] values;
+      delete [] isLeaf;
+      }
+
+   values = NULL;
+   isLeaf = NULL;
+   size = capacity = 0;
+   }
+
+bool Multipoint::IsDense(int bits)
+   {
+   return bits >= DENSE_MIN_BITS && bits <= DENSE_MAX_BITS &&
+          nextFree >= DENSE_MIN_FILL * ((2 << bits) - 1);
+   }
+
+///////////////////////////////////////////////////////////////////////
+// Recombination between two locations is diagonal in the Walsh-Hadamard
+// basis: the coefficient for each subset of bits is scaled by the product
+// of (1 - 2 * theta) over those bits. Flanking trees can be transformed
+// once per interval, and each position then requires only a rescaling and
+// one inverse transform. The result is stored as a dense tree, so this
+// is only worthwhile when the flanking trees are themselves dense.
+//
+
+bool Multipoint::SpectralTransform(Mantra & m, DenseBuffer & spectrum)
+   {
+   if (maximum_recombinants)
+      return false;
+
+   // Couple symmetries are handled outside this framework
+   for (int i = 0; i < m.couples; i++)
+      if (m.couple_bits[i][m.two_n - 1])
+         return false;
+
+   // Sparse trees are cheaper to move with the regular algorithm
+   if (!IsDense(m.bit_count))
+      return false;
+
+   int size = 1 << m.bit_count;
+
+   if (!spectrum.Dimension(size))
+      return false;
+
+   Expand(spectrum.values, NULL, size, 0);
+   WalshHadamard(spectrum.values, size);
+
+   return true;
+   }
+
+void Multipoint::SpectralMoveAlong(Mantra & m, const DenseBuffer & spectrum,
+                                   double theta[2], double rescale, DenseBuffer & values)
+   {
+   int size = spectrum.size;
+
+   CountMove();
+
+   // Callers reserve room for the values along with the spectrum
+   values.Dimension(size);
+
+   // Hidden bits only contribute to the overall scaling constant, and
+   // the inverse transform requires an additional factor of 1 / size
+   double complement[2] = { 1.0 - theta[0], 1.0 - theta[1] };
+
+   values[0] = pow(complement[1], m.hidden_male_bit_count) *
+               pow(complement[0], m.hidden_bit_count - m.hidden_male_bit_count) *
+               rescale / size;
+
+   // Eigenvalues for each bit, with the lowest array bit corresponding
+   // to the bottom level of the tree
+   Vector eigenvalues(m.bit_count);
+
+   for (int bit = 0; bit < m.bit_count; bit++)
+      eigenvalues[bit] = 1.0 - 2.0 * theta[m.bit_sex[bit + 1]];
+
+   // Founders with two children fix one meiosis and double up the other,
+   // as in QuickMoveAlong(), while larger founder symmetries flip a set of
+   // bits and so have eigenvalue 1 + x or 1 - x depending on parity
+   IntArray masks;
+
+   for (int i = 0; i < m.two_f; i += 2)
+      if (m.founder_bit_count[i] == 1)
+         {
+         for (int j = 0; j < m.bit_count; j++)
+            if (m.founder_bits[i][j])
+               {
+               int bit = m.bit_count - 1 - j;
+               int sex = m.bit_sex[bit + 1];
+
+               eigenvalues[bit] *= eigenvalues[bit];
+               values[0] /= complement[sex];
+               break;
+               }
+         }
+      else if (m.founder_bit_count[i])
+         {
+         int mask = 0;
+
+         for (int j = 0; j < m.bit_count; j++)
+            if (m.founder_bits[i][j])
+               mask |= 1 << (m.bit_count - 1 - j);
+
+         masks.Push(mask);
+         masks.Push(m.founder_male[i]);
+         }
+
+   for (int bit = 0, half = 1; half < size; bit++, half *= 2)
+      for (int i = 0; i < half; i++)
+         values[i + half] = values[i] * eigenvalues[bit];
+
+   for (int f = 0; f < masks.Length(); f += 2)
+      {
+      double x = theta[masks[f + 1]] / complement[masks[f + 1]];
+
+      for (int i = 0; i < size; i++)
+         values[i] *= Parity(i & masks[f]) ? 1.0 - x : 1.0 + x;
+      }
+
+   for (int i = 0; i < size; i++)
+      values[i] *= spectrum[i];
+
+   WalshHadamard(values.values, size);
+
+   // Rounding error can leave tiny negative likelihoods
+   for (int i = 0; i < size; i++)
+      if (values[i] < 0.0)
+         values[i] = 0.0;
+   }
+
+void Multipoint::SpectralStore(const DenseBuffer & values)
+   {
+   Clear();
+   Store(values.values, NULL, values.size);
+
+   for (bit_count = 0; (1 << bit_count) < values.size; bit_count++)
+      ;
+   }
+
+int Multipoint::Store(const double * values, const char * isLeaf, int size)
+   {
+   int node = NewNode();
+
+   if (size == 1)
+      {
+      Type(node) = isLeaf == NULL || isLeaf[0] ? TREE_NODE_LEAF : TREE_NODE_ZERO;
+      nodes[node].value = values[0];
+      return node;
+      }
+
+   int half = size / 2;
+
+   Type(node) = TREE_NODE_TWO;
+   SAFE_SET(nodes[node].child[0], Store(values, isLeaf, half));
+   SAFE_SET(nodes[node].child[1], Store(values + half, isLeaf == NULL ? NULL : isLeaf + half, half));
+
+   // Both children were the last nodes allocated and can be released
+   if (Type(nodes[node].child[0]) == TREE_NODE_ZERO &&
+       Type(nodes[node].child[1]) == TREE_NODE_ZERO)
+      {
+      Type(node) = TREE_NODE_ZERO;
+      nextFree = node + 1;
+      }
+
+   return node;
+   }
+
+void Multipoint::Expand(double * values, char * isLeaf, int size, int node)
+   {
+   switch (Type(node))
+      {
+      case TREE_NODE_ZERO :
+         for (int i = 0; i < size; i++)
+            values[i] = 0.0;
+         if (isLeaf != NULL)
+            memset(isLeaf, 0, size);
+         return;
+      case TREE_NODE_LEAF :
+         for (int i = 0; i < size; i++)
+            values[i] = nodes[node].value;
+         if (isLeaf != NULL)
+            memset(isLeaf, 1, size);
+         return;
+      case TREE_NODE_ONE :
+         Expand(values, isLeaf, size / 2, nodes[node].child[0]);
+         memcpy(values + size / 2, values, sizeof(double) * (size / 2));
+         if (isLeaf != NULL)
+            memcpy(isLeaf + size / 2, isLeaf, size / 2);
+         return;
+      case TREE_NODE_TWO :
+         Expand(values, isLeaf, size / 2, nodes[node].child[0]);
+         Expand(values + size / 2, isLeaf == NULL ? NULL : isLeaf + size / 2,
+                size / 2, nodes[node].child[1]);
+         return;
+      }
+   }
+
+int Multipoint::Parity(int bits)
+   {
+   int parity = 0;
+
+   for ( ; bits; bits &= bits - 1)
+      parity ^= 1;
+
+   return parity;
+   }
+
+void Multipoint::WalshHadamard(double * values, int size)
+   {
+   for (int half = 1; half < size; half *= 2)
+      for (int block = 0; block < size; block += half * 2)
+         {
+         double * left = values + block;
+         double * right = left + half;
+
+         for (int i = 0; i < half; i++)
+            {
+            double value_left = left[i];
+
+            left[i] += right[i];
+            right[i] = value_left - right[i];
+            }
+         }
+   }
+
+///////////////////////////////////////////////////////////////////////
+// For large trees, the routines below carry out the first few levels of
+// the divide and conquer recursion and then transform each remaining
+// subtree in a separate thread. Each thread builds a copy of its subtree
+// in a private tree, and the results are spliced back together.
+//
+
+bool Multipoint::UseThreads()
+   {
+   return nextFree >= CONQUER_MIN_NODES && ThreadPool::defaultThreads > 1 &&
+          !ThreadPool::InWorker();
+   }
+
+void Multipoint::SplitDivideAndConquer(ConquerBatch & batch, int depth,
+                                       int splits_to_go, int node)
+   {
+   switch (Type(node))
+      {
+      case TREE_NODE_ZERO :
+         return;
+      case TREE_NODE_LEAF :
+         nodes[node].value *= pow_onex[splits_to_go];
+         return;
+      case TREE_NODE_ONE :
+         SplitDivideAndConquer(batch, depth, splits_to_go, nodes[node].child[0]);
+         return;
+      case TREE_NODE_TWO :
+         if (depth == 0)
+            {
+            batch.NewTask(node).bit = splits_to_go;
+            return;
+            }
+         ReUnite(nodes[node].child[0], nodes[node].child[1]);
+         SplitDivideAndConquer(batch, depth - 1, splits_to_go - 1, nodes[node].child[0]);
+         SplitDivideAndConquer(batch, depth - 1, splits_to_go - 1, nodes[node].child[1]);
+         return;
+      }
+   }
+
+void Multipoint::SplitDivideAndConquer(ConquerBatch & batch, int depth,
+                                       double * femaleScale, double * maleScale,
+                                       int * isMale, int node)
+   {
+   switch (Type(node))
+      {
+      case TREE_NODE_ZERO :
+         return;
+      case TREE_NODE_LEAF :
+         nodes[node].value *= (*femaleScale) * (*maleScale);
+         return;
+      case TREE_NODE_ONE :
+         SplitDivideAndConquer(batch, depth, femaleScale, maleScale, isMale - 1,
+                               nodes[node].child[0]);
+         return;
+      case TREE_NODE_TWO :
+         if (depth == 0)
+            {
+            ConquerTask & task = batch.NewTask(node);
+
+            task.femaleScale = femaleScale;
+            task.maleScale = maleScale;
+            task.meiosis = isMale;
+            return;
+            }
+         x = ratio[*isMale];
+         ReUnite(nodes[node].child[0], nodes[node].child[1]);
+         if (*isMale)
+            {
+            SplitDivideAndConquer(batch, depth - 1, femaleScale, maleScale - 1,
+                                  isMale - 1, nodes[node].child[0]);
+            SplitDivideAndConquer(batch, depth - 1, femaleScale, maleScale - 1,
+                                  isMale - 1, nodes[node].child[1]);
+            }
+         else
+            {
+            SplitDivideAndConquer(batch, depth - 1, femaleScale - 1, maleScale,
+                                  isMale - 1, nodes[node].child[0]);
+            SplitDivideAndConquer(batch, depth - 1, femaleScale - 1, maleScale,
+                                  isMale - 1, nodes[node].child[1]);
+            }
+         return;
+      }
+   }
+
+void Multipoint::SplitQuickDivideAndConquer(ConquerBatch & batch, int depth,
+                                            double scale, int * meiosis_kind,
+                                            int bit, int node)
+   {
+   switch (Type(node))
+      {
+      case TREE_NODE_ZERO :
+         return;
+      case TREE_NODE_LEAF :
+         QuickDivideAndConquer(scale, meiosis_kind, bit, node);
+         return;
+      case TREE_NODE_ONE :
+         scale *= factor[*meiosis_kind];
+         SplitQuickDivideAndConquer(batch, depth, scale, meiosis_kind - 1, bit - 1,
+                                    nodes[node].child[0]);
+         return;
+      case TREE_NODE_TWO :
+         if (depth == 0)
+            {
+            ConquerTask & task = batch.NewTask(node);
+
+            task.scale = scale;
+            task.meiosis = meiosis_kind;
+            task.bit = bit;
+            return;
+            }
+         x = ratio[*meiosis_kind];
+         ReUnite(nodes[node].child[0], nodes[node].child[1]);
+
+         SplitQuickDivideAndConquer(batch, depth - 1, scale, meiosis_kind - 1, bit - 1,
+                                    nodes[node].child[0]);
+         SplitQuickDivideAndConquer(batch, depth - 1, scale, meiosis_kind - 1, bit - 1,
+                                    nodes[node].child[1]);
+         return;
+      }
+   }
+
+void Multipoint::ConquerInParallel(ConquerBatch & batch)
+   {
+   if (batch.count == 0)
+      return;
+
+   batch.subtrees = new Multipoint [batch.count];
+
+   ConquerPool().Run(ConquerSubtree, &batch, batch.count);
+
+   if (!batch.failure)
+      {
+      // Mark the root of each subtree with the index of its replacement
+      for (int i = 0; i < batch.count; i++)
+         {
+         Type(batch.tasks[i].node) = TREE_NODE_INT_VALUE;
+         nodes[batch.tasks[i].node].integer = i;
+         }
+
+      Multipoint result;
+
+      result.logOffset = logOffset;
+      result.bit_count = bit_count;
+      result.Splice(*this, batch.subtrees, 0);
+
+      Exchange(result);
+      }
+
+   // Subtrees were built by other threads and not counted against our memory limit
+   for (int i = 0; i < batch.count; i++)
+      batch.subtrees[i].Free();
+
+   delete [] batch.subtrees;
+
+   if (batch.failure)
+      throw TreesTooBig(batch.failure);
+   }
+
+int Multipoint::Splice(const Multipoint & source, Multipoint * subtrees, int node)
+   {
+   if (source.Type(node) == TREE_NODE_INT_VALUE)
+      return Copy(subtrees[source.nodes[node].integer], 0);
+
+   int new_node = NewNode();
+
+   switch (Type(new_node) = source.Type(node))
+      {
+      case TREE_NODE_ZERO :
+         break;
+      case TREE_NODE_LEAF :
+         nodes[new_node].value = source.nodes[node].value;
+         break;
+      case TREE_NODE_TWO :
+         SAFE_SET(nodes[new_node].child[0], Splice(source, subtrees, source.nodes[node].child[0]));
+         SAFE_SET(nodes[new_node].child[1], Splice(source, subtrees, source.nodes[node].child[1]));
+         break;
+      case TREE_NODE_ONE :
+         SAFE_SET(nodes[new_node].child[0], Splice(source, subtrees, source.nodes[node].child[0]));
+         break;
+      }
+
+   return new_node;
+   }
+
+void Multipoint::ConquerSubtree(void * data, int item, int thread)
+   {
+   ConquerBatch & batch = *(ConquerBatch *) data;
+   ConquerTask & task = batch.tasks[item];
+   Multipoint & owner = batch.owner;
+   Multipoint & tree = batch.subtrees[item];
+
+   // Transition probabilities for the current step
+   tree.pow_onex = owner.pow_onex;
+   tree.x = owner.x;
+   tree.onex = owner.onex;
+
+   for (int i = 0; i < 4; i++)
+      {
+      tree.recombination[i] = owner.recombination[i];
+      tree.complement[i] = owner.complement[i];
+      tree.ratio[i] = owner.ratio[i];
+      tree.factor[i] = owner.factor[i];
+      }
+
+   try
+      {
+      tree.Copy(owner, task.node);
+
+      switch (batch.kind)
+         {
+         case CONQUER_EXACT :
+            tree.DivideAndConquer(task.bit);
+            break;
+         case CONQUER_SEX_SPECIFIC :
+            tree.DivideAndConquer(task.femaleScale, task.maleScale, task.meiosis);
+            break;
+         case CONQUER_QUICK :
+            tree.QuickDivideAndConquer(task.scale, task.meiosis, task.bit);
+            break;
+         }
+      }
+   catch (const TreesTooBig & problem)
+      {
+      batch.failure = problem.memory_request;
+      }
+   }
+
 void Multipoint::ReUnite(int left, int right)
    {
-   int type_left  = nodes[left].type;
-   int type_right = nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -309,11 +963,11 @@ void Multipoint::ReUnite(int left, int right)
          }
          return;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[left].type = TREE_NODE_LEAF;
+         Type(left) = TREE_NODE_LEAF;
          nodes[left].value = nodes[right].value * x;
          return;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
-         nodes[right].type = TREE_NODE_LEAF;
+         Type(right) = TREE_NODE_LEAF;
          nodes[right].value  = nodes[left].value * x;
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ONE) :
@@ -338,11 +992,11 @@ void Multipoint::ReUnite(int left, int right)
                nodes[left].value, nodes[left].value * x);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
-         nodes[right].type = TREE_NODE_TWO;
+         Type(right) = TREE_NODE_TWO;
          SAFE_SET(nodes[right].child[1], Copy(nodes[right].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
@@ -355,8 +1009,8 @@ void Multipoint::ReUnite(int left, int right)
 
 void Multipoint::SpecialReUnite(int left, int right, const int * flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -376,11 +1030,11 @@ void Multipoint::SpecialReUnite(int left, int right, const int * flips)
          }
          return;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[left].type = TREE_NODE_LEAF;
+         Type(left) = TREE_NODE_LEAF;
          nodes[left].value = nodes[right].value * x;
          return;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
-         nodes[right].type = TREE_NODE_LEAF;
+         Type(right) = TREE_NODE_LEAF;
          nodes[right].value = nodes[left].value * x;
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ONE) :
@@ -405,11 +1059,11 @@ void Multipoint::SpecialReUnite(int left, int right, const int * flips)
                nodes[left].value, nodes[left].value * x);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
-         nodes[right].type = TREE_NODE_TWO;
+         Type(right) = TREE_NODE_TWO;
          SAFE_SET(nodes[right].child[1], Copy(nodes[right].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
@@ -431,8 +1085,8 @@ void Multipoint::SpecialReUnite(int left, int right, const int * flips)
 
 void Multipoint::DoubleReUnite(int left, int right, const int * flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = Type(right);
 
    // If either side is a trivial node (eg. ZERO or LEAF) then ...
    switch (PAIR_NODES(type_left, type_right))
@@ -453,11 +1107,11 @@ void Multipoint::DoubleReUnite(int left, int right, const int * flips)
          }
          return;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[left].type = TREE_NODE_LEAF;
+         Type(left) = TREE_NODE_LEAF;
          nodes[left].value = nodes[right].value * x;
          return;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
-         nodes[right].type = TREE_NODE_LEAF;
+         Type(right) = TREE_NODE_LEAF;
          nodes[right].value = nodes[left].value * x;
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ZERO) :
@@ -493,11 +1147,11 @@ void Multipoint::DoubleReUnite(int left, int right, const int * flips)
             DoubleReUnite(nodes[left].child[0], nodes[right].child[0], flips + 1);
             return;
          case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-            nodes[left].type = TREE_NODE_TWO;
+            Type(left) = TREE_NODE_TWO;
             SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
             break;
          case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
-            nodes[right].type = TREE_NODE_TWO;
+            Type(right) = TREE_NODE_TWO;
             SAFE_SET(nodes[left].child[1], Copy(nodes[right].child[0]));
             break;
          case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
@@ -517,13 +1171,13 @@ void Multipoint::DoubleReUnite(int left, int right, const int * flips)
    int left_other  = type_left == TREE_NODE_TWO ? nodes[left].child[1] : 0;
 
    int left_level = type_left == TREE_NODE_TWO ||
-                    nodes[right_child].type == TREE_NODE_TWO ||
-                    right_other && nodes[right_other].type == TREE_NODE_TWO ?
+                    Type(right_child) == TREE_NODE_TWO ||
+                    right_other && Type(right_other) == TREE_NODE_TWO ?
                     TREE_NODE_TWO : TREE_NODE_ONE;
 
    int right_level = type_right == TREE_NODE_TWO ||
-                     nodes[left_child].type == TREE_NODE_TWO ||
-                     left_other && nodes[left_other].type == TREE_NODE_TWO ?
+                     Type(left_child) == TREE_NODE_TWO ||
+                     left_other && Type(left_other) == TREE_NODE_TWO ?
                      TREE_NODE_TWO : TREE_NODE_ONE;
 
    UpgradeNode(right_child, left_level);
@@ -677,7 +1331,7 @@ void Multipoint::Approximation
 
 void Multipoint::DivideAndConquer(Tree & original, int splits_to_go, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -699,7 +1353,7 @@ void Multipoint::DivideAndConquer(Tree & original, int splits_to_go, int node)
 void Multipoint::DivideAndConquer(Tree & tree,
     double * femaleScale, double * maleScale, int * isMale, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -729,8 +1383,8 @@ void Multipoint::DivideAndConquer(Tree & tree,
 
 void Multipoint::ReUnite(Tree & original, int left, int right)
    {
-   int type_left  = nodes[left].type;
-   int type_right = original.nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = original.Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -761,7 +1415,7 @@ void Multipoint::ReUnite(Tree & original, int left, int right)
          ReUnite(original, nodes[left].child[1], original.nodes[right].child[0]);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
          ReUnite(original, nodes[left].child[0], original.nodes[right].child[0]);
@@ -772,8 +1426,8 @@ void Multipoint::ReUnite(Tree & original, int left, int right)
 void Multipoint::SpecialReUnite
    (Tree & original, int left, int right, const int * flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = original.nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = original.Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -804,7 +1458,7 @@ void Multipoint::SpecialReUnite
          FlipGraftAndScaleAndAdd(flips, left, original, right, x, nodes[left].value);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
          ;
@@ -816,8 +1470,8 @@ void Multipoint::SpecialReUnite
 
 void Multipoint::DoubleReUnite(TreeFlips & original, int left, int right, const int *flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = original.nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = original.Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -858,7 +1512,7 @@ void Multipoint::DoubleReUnite(TreeFlips & original, int left, int right, const
                           original.nodes[right].child[0], flips + 1);
             return;
          case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-            nodes[left].type = TREE_NODE_TWO;
+            Type(left) = TREE_NODE_TWO;
             SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
          case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
             DoubleReUnite(original, nodes[left].child[0],
@@ -875,13 +1529,13 @@ void Multipoint::DoubleReUnite(TreeFlips & original, int left, int right, const
    int left_other  = type_left == TREE_NODE_TWO ? nodes[left].child[1] : 0;
 
    int left_level = type_left == TREE_NODE_TWO ||
-                    original.nodes[right_child].type == TREE_NODE_TWO ||
-                    right_other && original.nodes[right_other].type == TREE_NODE_TWO ?
+                    original.Type(right_child) == TREE_NODE_TWO ||
+                    right_other && original.Type(right_other) == TREE_NODE_TWO ?
                     TREE_NODE_TWO : TREE_NODE_ONE;
 
    int right_level = type_right == TREE_NODE_TWO ||
-                     nodes[left_child].type == TREE_NODE_TWO ||
-                     left_other && nodes[left_other].type == TREE_NODE_TWO ?
+                     Type(left_child) == TREE_NODE_TWO ||
+                     left_other && Type(left_other) == TREE_NODE_TWO ?
                      TREE_NODE_TWO : TREE_NODE_ONE;
 
    UpgradeNode(left_child, right_level);
@@ -979,7 +1633,7 @@ void Multipoint::Condition(Tree & flanker, double theta[2], double rescale)
 
 void Multipoint::Condition(Tree & tree, int bit, double scale, int node)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -988,12 +1642,12 @@ void Multipoint::Condition(Tree & tree, int bit, double scale, int node)
             {
             double value = tree.nodes[node].value;
 
-            tree.nodes[node].type = TREE_NODE_TWO;
+            tree.Type(node) = TREE_NODE_TWO;
             SAFE_SET(tree.nodes[node].child[0], tree.NewNode());
             SAFE_SET(tree.nodes[node].child[1], tree.NewNode());
 
-            tree.nodes[tree.nodes[node].child[0]].type = TREE_NODE_LEAF;
-            tree.nodes[tree.nodes[node].child[1]].type = TREE_NODE_LEAF;
+            tree.Type(tree.nodes[node].child[0]) = TREE_NODE_LEAF;
+            tree.Type(tree.nodes[node].child[1]) = TREE_NODE_LEAF;
             tree.nodes[tree.nodes[node].child[0]].value = value;
             tree.nodes[tree.nodes[node].child[1]].value = value;
             }
@@ -1004,7 +1658,7 @@ void Multipoint::Condition(Tree & tree, int bit, double scale, int node)
             }
          break;
       case TREE_NODE_ONE :
-         tree.nodes[node].type = TREE_NODE_TWO;
+         tree.Type(node) = TREE_NODE_TWO;
          SAFE_SET(tree.nodes[node].child[1], tree.Copy(tree.nodes[node].child[0]));
          break;
       case TREE_NODE_TWO :
@@ -1021,7 +1675,7 @@ void Multipoint::Condition(Tree & tree, int bit, double scale, int node)
 
 double Multipoint::ConditionalLikelihood(int bit, double lk, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return 0.0;
@@ -22,11 +22,51 @@
 #include "TreeFlips.h"
 #include "Mantra.h"
 
+class ConquerBatch;
+
+// Flat arrays with one element for each inheritance vector, used to
+// transform dense trees. Their size is counted, in tree nodes, against
+// the memory limit for the thread that allocates them.
+class DenseBuffer
+   {
+   public:
+      double * values;
+      char   * isLeaf;
+      int      size;
+
+      DenseBuffer()
+         { values = NULL; isLeaf = NULL; size = capacity = 0; }
+      ~DenseBuffer()
+         { Free(); }
+
+      // Makes room for size elements, returns false if this would
+      // exceed the memory limit
+      bool Dimension(int size);
+      void Free();
+
+      double & operator [] (int i) { return values[i]; }
+      double operator [] (int i) const { return values[i]; }
+
+   private:
+      int capacity;
+
+      static int Nodes(int elements)
+         { return (int) (elements * (sizeof(double) + 1.0) / TREE_NODE_SIZE) + 1; }
+   };
+
 class Multipoint : public TreeFlips
    {
    public:
       static int maximum_recombinants;
 
+      // Counts calls to MoveAlong, when profiling
+      static __thread int * moveAlongCounter;
+
+      // Scratch space for moving dense trees as flat arrays, selected for
+      // each thread. Without it, all trees use the recursive algorithm.
+      static __thread DenseBuffer * denseBuffer;
+      static bool recursiveMoves;
+
       double theta, oneminus;
       double x, onex;
       Vector pow_onex;
@@ -43,11 +83,43 @@ class Multipoint : public TreeFlips
       // Allocates variables required for likelihood conditioning
       void SetupConditioning(Mantra & m);
 
+      // Dense trees can also be moved in the Walsh-Hadamard domain,
+      // where recombination scales each coefficient independently
+      bool SpectralTransform(Mantra & m, DenseBuffer & spectrum);
+      void SpectralStore(const DenseBuffer & values);
+      static void SpectralMoveAlong(Mantra & m, const DenseBuffer & spectrum,
+                                    double theta[2], double rescale, DenseBuffer & values);
+
    private:
+      static void CountMove()
+         { if (moveAlongCounter != NULL) __sync_fetch_and_add(moveAlongCounter, 1); }
+
       // These apply the Elston and Idury algorithm
       void DivideAndConquer(int bit_count, int node = 0);
       void DivideAndConquer(double * femaleScale, double * maleScale, int * isMale, int node = 0);
       void QuickDivideAndConquer(double scale, int * isMale, int bit, int node = 0);
+
+      // These apply the algorithm to trees with a leaf for most inheritance vectors
+      bool UseDense(int bits);
+      bool IsDense(int bits);
+      void DenseDivideAndConquer(int bits, int * meiosis, double scale);
+      void Expand(double * values, char * isLeaf, int size, int node);
+      int  Store(const double * values, const char * isLeaf, int size);
+      static void WalshHadamard(double * values, int size);
+      static int  Parity(int bits);
+
+      // These split the top levels of the recursion across multiple threads,
+      // transforming each subtree separately before splicing results back
+      bool UseThreads();
+      void SplitDivideAndConquer(ConquerBatch & batch, int depth, int bit_count, int node = 0);
+      void SplitDivideAndConquer(ConquerBatch & batch, int depth, double * femaleScale,
+                                 double * maleScale, int * isMale, int node = 0);
+      void SplitQuickDivideAndConquer(ConquerBatch & batch, int depth, double scale,
+                                      int * isMale, int bit, int node = 0);
+      void ConquerInParallel(ConquerBatch & batch);
+      int  Splice(const Multipoint & source, Multipoint * subtrees, int node);
+
+      static void ConquerSubtree(void * data, int item, int thread);
       void ReUnite(int left, int right);
       void SpecialReUnite(int left, int right, const int * flips);
       void DoubleReUnite(int left, int right, const int * flips);
@@ -85,7 +85,7 @@ void MultipointHaplotyping::MoveAlong(Mantra & m, double theta[2], double rescal
 
 void MultipointHaplotyping::DivideAndConquer(int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -105,7 +105,7 @@ void MultipointHaplotyping::DivideAndConquer(int node)
 
 void MultipointHaplotyping::DivideAndConquer(int * isMale, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -126,8 +126,8 @@ void MultipointHaplotyping::DivideAndConquer(int * isMale, int node)
 
 void MultipointHaplotyping::ReUnite(int left, int right)
    {
-   int type_left  = nodes[left].type;
-   int type_right = nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -142,11 +142,11 @@ void MultipointHaplotyping::ReUnite(int left, int right)
          }
          return;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[left].type = TREE_NODE_LEAF;
+         Type(left) = TREE_NODE_LEAF;
          nodes[left].value = nodes[right].value * x;
          return;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
-         nodes[right].type = TREE_NODE_LEAF;
+         Type(right) = TREE_NODE_LEAF;
          nodes[right].value  = nodes[left].value * x;
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ONE) :
@@ -171,11 +171,11 @@ void MultipointHaplotyping::ReUnite(int left, int right)
                nodes[left].value, nodes[left].value * x);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
-         nodes[right].type = TREE_NODE_TWO;
+         Type(right) = TREE_NODE_TWO;
          SAFE_SET(nodes[right].child[1], Copy(nodes[right].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
@@ -188,8 +188,8 @@ void MultipointHaplotyping::ReUnite(int left, int right)
 
 void MultipointHaplotyping::SpecialReUnite(int left, int right, const int * flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -205,11 +205,11 @@ void MultipointHaplotyping::SpecialReUnite(int left, int right, const int * flip
             }
          return;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[left].type = TREE_NODE_LEAF;
+         Type(left) = TREE_NODE_LEAF;
          nodes[left].value = nodes[right].value * x;
          return;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
-         nodes[right].type = TREE_NODE_LEAF;
+         Type(right) = TREE_NODE_LEAF;
          nodes[right].value  = nodes[left].value * x;
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ONE) :
@@ -234,11 +234,11 @@ void MultipointHaplotyping::SpecialReUnite(int left, int right, const int * flip
                nodes[left].value, nodes[left].value * x);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
-         nodes[right].type = TREE_NODE_TWO;
+         Type(right) = TREE_NODE_TWO;
          SAFE_SET(nodes[right].child[1], Copy(nodes[right].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
@@ -260,8 +260,8 @@ void MultipointHaplotyping::SpecialReUnite(int left, int right, const int * flip
 
 void MultipointHaplotyping::DoubleReUnite(int left, int right, const int * flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = Type(right);
 
    // If either side is a trivial node (eg. ZERO or LEAF) then ...
    switch (PAIR_NODES(type_left, type_right))
@@ -278,11 +278,11 @@ void MultipointHaplotyping::DoubleReUnite(int left, int right, const int * flips
             }
          return;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[left].type = TREE_NODE_LEAF;
+         Type(left) = TREE_NODE_LEAF;
          nodes[left].value = nodes[right].value * x;
          return;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
-         nodes[right].type = TREE_NODE_LEAF;
+         Type(right) = TREE_NODE_LEAF;
          nodes[right].value  = nodes[left].value * x;
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ZERO) :
@@ -318,11 +318,11 @@ void MultipointHaplotyping::DoubleReUnite(int left, int right, const int * flips
             DoubleReUnite(nodes[left].child[0], nodes[right].child[0], flips + 1);
             return;
          case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-            nodes[left].type = TREE_NODE_TWO;
+            Type(left) = TREE_NODE_TWO;
             SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
             break;
          case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
-            nodes[right].type = TREE_NODE_TWO;
+            Type(right) = TREE_NODE_TWO;
             SAFE_SET(nodes[right].child[1], Copy(nodes[right].child[0]));
             break;
          case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
@@ -342,13 +342,13 @@ void MultipointHaplotyping::DoubleReUnite(int left, int right, const int * flips
    int left_other  = type_left == TREE_NODE_TWO ? nodes[left].child[1] : 0;
 
    int left_level = type_left == TREE_NODE_TWO ||
-                    nodes[right_child].type == TREE_NODE_TWO ||
-                    right_other && nodes[right_other].type == TREE_NODE_TWO ?
+                    Type(right_child) == TREE_NODE_TWO ||
+                    right_other && Type(right_other) == TREE_NODE_TWO ?
                     TREE_NODE_TWO : TREE_NODE_ONE;
 
    int right_level = type_right == TREE_NODE_TWO ||
-                     nodes[left_child].type == TREE_NODE_TWO ||
-                     left_other && nodes[left_other].type == TREE_NODE_TWO ?
+                     Type(left_child) == TREE_NODE_TWO ||
+                     left_other && Type(left_other) == TREE_NODE_TWO ?
                      TREE_NODE_TWO : TREE_NODE_ONE;
 
    UpgradeNode(right_child, left_level);
@@ -470,7 +470,7 @@ void MultipointHaplotyping::Approximation
 
 void MultipointHaplotyping::DivideAndConquer(Tree & original, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
       case TREE_NODE_LEAF :
@@ -489,7 +489,7 @@ void MultipointHaplotyping::DivideAndConquer(Tree & original, int node)
 
 void MultipointHaplotyping::DivideAndConquer(Tree & original, int * isMale, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
       case TREE_NODE_LEAF :
@@ -509,8 +509,8 @@ void MultipointHaplotyping::DivideAndConquer(Tree & original, int * isMale, int
 
 void MultipointHaplotyping::ReUnite(Tree & original, int left, int right)
    {
-   int type_left  = nodes[left].type;
-   int type_right = original.nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = original.Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -541,7 +541,7 @@ void MultipointHaplotyping::ReUnite(Tree & original, int left, int right)
          ReUnite(original, nodes[left].child[1], original.nodes[right].child[0]);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
          ReUnite(original, nodes[left].child[0], original.nodes[right].child[0]);
@@ -552,8 +552,8 @@ void MultipointHaplotyping::ReUnite(Tree & original, int left, int right)
 void MultipointHaplotyping::SpecialReUnite
    (Tree & original, int left, int right, const int * flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = original.nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = original.Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -584,7 +584,7 @@ void MultipointHaplotyping::SpecialReUnite
          FlipGraftAndScaleAndChoose(flips, left, original, right, x, nodes[left].value);
          return;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[left].type = TREE_NODE_TWO;
+         Type(left) = TREE_NODE_TWO;
          SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
          ;
@@ -596,8 +596,8 @@ void MultipointHaplotyping::SpecialReUnite
 
 void MultipointHaplotyping::DoubleReUnite(TreeFlips & original, int left, int right, const int *flips)
    {
-   int type_left  = nodes[left].type;
-   int type_right = original.nodes[right].type;
+   int type_left  = Type(left);
+   int type_right = original.Type(right);
 
    switch (PAIR_NODES(type_left, type_right))
       {
@@ -638,7 +638,7 @@ void MultipointHaplotyping::DoubleReUnite(TreeFlips & original, int left, int ri
                           original.nodes[right].child[0], flips + 1);
             return;
          case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-            nodes[left].type = TREE_NODE_TWO;
+            Type(left) = TREE_NODE_TWO;
             SAFE_SET(nodes[left].child[1], Copy(nodes[left].child[0]));
          case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
             DoubleReUnite(original, nodes[left].child[0],
@@ -655,13 +655,13 @@ void MultipointHaplotyping::DoubleReUnite(TreeFlips & original, int left, int ri
    int left_other  = type_left == TREE_NODE_TWO ? nodes[left].child[1] : 0;
 
    int left_level = type_left == TREE_NODE_TWO ||
-                    original.nodes[right_child].type == TREE_NODE_TWO ||
-                    right_other && original.nodes[right_other].type == TREE_NODE_TWO ?
+                    original.Type(right_child) == TREE_NODE_TWO ||
+                    right_other && original.Type(right_other) == TREE_NODE_TWO ?
                     TREE_NODE_TWO : TREE_NODE_ONE;
 
    int right_level = type_right == TREE_NODE_TWO ||
-                     nodes[left_child].type == TREE_NODE_TWO ||
-                     left_other && nodes[left_other].type == TREE_NODE_TWO ?
+                     Type(left_child) == TREE_NODE_TWO ||
+                     left_other && Type(left_other) == TREE_NODE_TWO ?
                      TREE_NODE_TWO : TREE_NODE_ONE;
 
    UpgradeNode(left_child, right_level);
@@ -760,7 +760,7 @@ void MultipointHaplotyping::Condition(Tree & flanker, double theta[2], double re
 
 void MultipointHaplotyping::Condition(Tree & tree, int bit, double scaling, int node)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          return;
@@ -769,12 +769,12 @@ void MultipointHaplotyping::Condition(Tree & tree, int bit, double scaling, int
             {
             double value = tree.nodes[node].value;
 
-            tree.nodes[node].type = TREE_NODE_TWO;
+            tree.Type(node) = TREE_NODE_TWO;
             SAFE_SET(tree.nodes[node].child[0], tree.NewNode());
             SAFE_SET(tree.nodes[node].child[1], tree.NewNode());
 
-            tree.nodes[tree.nodes[node].child[0]].type = TREE_NODE_LEAF;
-            tree.nodes[tree.nodes[node].child[1]].type = TREE_NODE_LEAF;
+            tree.Type(tree.nodes[node].child[0]) = TREE_NODE_LEAF;
+            tree.Type(tree.nodes[node].child[1]) = TREE_NODE_LEAF;
             tree.nodes[tree.nodes[node].child[0]].value = value;
             tree.nodes[tree.nodes[node].child[1]].value = value;
             }
@@ -785,7 +785,7 @@ void MultipointHaplotyping::Condition(Tree & tree, int bit, double scaling, int
             }
          break;
       case TREE_NODE_ONE :
-         tree.nodes[node].type = TREE_NODE_TWO;
+         tree.Type(node) = TREE_NODE_TWO;
          SAFE_SET(tree.nodes[node].child[1], tree.Copy(tree.nodes[node].child[0]));
          break;
       case TREE_NODE_TWO :
@@ -802,7 +802,7 @@ void MultipointHaplotyping::Condition(Tree & tree, int bit, double scaling, int
 
 double MultipointHaplotyping::ConditionalLikelihood(int bit, double lk, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return 0.0;
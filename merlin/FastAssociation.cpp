@@ -18,11 +18,200 @@
 #include "FastAssociation.h"
 #include "MerlinFamily.h"
 #include "MathStats.h"
+#include "ThreadPool.h"
+
+// Score statistics are calculated for blocks of markers, so that each
+// covariance factor is applied to many genotype vectors at once
+#define FAST_ASSOC_BLOCK      64
 
 double FastAssociationAnalysis::fastFilter = _NAN_;
 
 RefinedQtlModel FastAssociationAnalysis::refinedFastModels;
 
+// Solves L * X = B in place, where L is lower triangular and B holds
+// count rows with columns entries each, stored contiguously by row
+static void ForwardSubst(Matrix & L, double * b, int count, int columns)
+   {
+   for (int i = 0; i < count; i++)
+      {
+      double * row = b + i * columns;
+
+      for (int k = 0; k < i; k++)
+         {
+         double   factor = L[i][k];
+         double * prior = b + k * columns;
+
+         for (int j = 0; j < columns; j++)
+            row[j] -= factor * prior[j];
+         }
+
+      double scale = 1.0 / L[i][i];
+
+      for (int j = 0; j < columns; j++)
+         row[j] *= scale;
+      }
+   }
+
+// Shared information for scoring blocks of markers
+class FastScoreBatch
+   {
+   public:
+      FamilyAnalysis * engine;
+      IntArray       * pheno;
+      NormalSet      * mvn;
+
+      // Families with phenotypes, and their residuals premultiplied by Inv(L)
+      IntArray  families;
+      Vector  * residuals;
+
+      // Markers to test and the resulting score statistics
+      IntArray  tested;
+      Vector    numerators, denominators;
+
+      // Scratch space for each thread
+      Vector  * genotypes;
+      int       threads;
+
+      FastScoreBatch(FamilyAnalysis & e, IntArray * p, NormalSet & m);
+      ~FastScoreBatch();
+
+      void Score();
+
+      static void ScoreBlock(void * batch, int block, int thread);
+   };
+
+FastScoreBatch::FastScoreBatch(FamilyAnalysis & e, IntArray * p, NormalSet & m)
+   {
+   engine = &e;
+   pheno = p;
+   mvn = &m;
+
+   int markers = engine->markers.Length();
+
+   numerators.Dimension(markers);
+   denominators.Dimension(markers);
+   numerators.Zero();
+   denominators.Zero();
+
+   residuals = NULL;
+   genotypes = NULL;
+   threads = 0;
+   }
+
+FastScoreBatch::~FastScoreBatch()
+   {
+   if (residuals != NULL) delete [] residuals;
+   if (genotypes != NULL) delete [] genotypes;
+   }
+
+void FastScoreBatch::Score()
+   {
+   Pedigree & ped = engine->ped;
+
+   // Residuals are premultiplied by the inverse Cholesky factor once per family,
+   // so that Genotype * SIGMA^-1 * Phenotype = (Inv(L) * Genotype) * (Inv(L) * Phenotype)
+   for (int f = 0; f < ped.familyCount; f++)
+      if (pheno[f].Length())
+         families.Push(f);
+
+   residuals = new Vector[families.Length()];
+
+   int largest = 0;
+   for (int i = 0; i < families.Length(); i++)
+      {
+      int count = pheno[families[i]].Length();
+
+      residuals[i] = (*mvn)[i].residuals;
+      ForwardSubst((*mvn)[i].cholesky.L, residuals[i].data, count, 1);
+
+      if (count > largest) largest = count;
+      }
+
+   int blocks = (tested.Length() + FAST_ASSOC_BLOCK - 1) / FAST_ASSOC_BLOCK;
+
+   threads = MerlinCore::threads > 0 ? MerlinCore::threads : ThreadPool::defaultThreads;
+   if (threads > blocks) threads = blocks;
+   if (threads < 1 || ThreadPool::InWorker()) threads = 1;
+
+   genotypes = new Vector[threads];
+   for (int i = 0; i < threads; i++)
+      genotypes[i].Dimension(largest * FAST_ASSOC_BLOCK);
+
+   if (threads > 1)
+      {
+      ThreadPool pool(threads);
+      pool.Run(ScoreBlock, this, blocks);
+      }
+   else
+      for (int block = 0; block < blocks; block++)
+         ScoreBlock(this, block, 0);
+   }
+
+void FastScoreBatch::ScoreBlock(void * data, int block, int thread)
+   {
+   FastScoreBatch * batch = (FastScoreBatch *) data;
+   FamilyAnalysis & engine = *batch->engine;
+   Pedigree & ped = engine.ped;
+
+   int first = block * FAST_ASSOC_BLOCK;
+   int last = first + FAST_ASSOC_BLOCK;
+   if (last > batch->tested.Length()) last = batch->tested.Length();
+
+   int columns = last - first;
+
+   // Expected genotype for each marker and the resulting score statistics
+   double expected[FAST_ASSOC_BLOCK];
+   double numerator[FAST_ASSOC_BLOCK], denominator[FAST_ASSOC_BLOCK];
+
+   for (int j = 0; j < columns; j++)
+      {
+      expected[j] = 2.0 * ped.GetMarkerInfo(engine.markers[batch->tested[first + j]])->freq[1];
+      numerator[j] = 0.0;
+      denominator[j] = 1e-10;
+      }
+
+   double * genotypes = batch->genotypes[thread].data;
+
+   for (int index = 0; index < batch->families.Length(); index++)
+      {
+      IntArray & pheno = batch->pheno[batch->families[index]];
+      int count = pheno.Length();
+
+      // First calculate a matrix of expected genotypes, with one row per
+      // individual and one column per marker. Genotypes are retrieved one
+      // marker at a time, since quantized dosages are stored by marker.
+      for (int j = 0; j < columns; j++)
+         for (int i = 0; i < count; i++)
+            genotypes[i * columns + j] =
+               engine.imputationEngine.GetExpectedGenotype(ped, pheno[i],
+                  engine.markers[batch->tested[first + j]]) - expected[j];
+
+      // Next, calculate Inv(L) * Genotypes
+      ForwardSubst((*batch->mvn)[index].cholesky.L, genotypes, count, columns);
+
+      // Numerator of test statistic is Genotype * SIGMA^-1 * Phenotype and
+      // denominator of test statistic is Genotype * SIGMA^-1 * Genotype
+      double * residuals = batch->residuals[index].data;
+
+      for (int i = 0; i < count; i++)
+         {
+         double * row = genotypes + i * columns;
+
+         for (int j = 0; j < columns; j++)
+            {
+            numerator[j] += row[j] * residuals[i];
+            denominator[j] += row[j] * row[j];
+            }
+         }
+      }
+
+   for (int j = 0; j < columns; j++)
+      {
+      batch->numerators[batch->tested[first + j]] = numerator[j];
+      batch->denominators[batch->tested[first + j]] = denominator[j];
+      }
+   }
+
 void FastAssociationAnalysis::AnalyseAssociation(FamilyAnalysis & engine)
    {
    Pedigree & ped = engine.ped;
@@ -114,7 +303,7 @@ void FastAssociationAnalysis::AnalyseAssociation(FamilyAnalysis & engine)
 #endif
 
       // The normal set class is our workhorse
-      NormalSet mvn;
+      NormalSet mvn(MerlinCore::threads);
       mvn.Dimension(families, vc_count);
 
       // Per family likelihoods under the null and alternative hypothesis
@@ -160,6 +349,24 @@ void FastAssociationAnalysis::AnalyseAssociation(FamilyAnalysis & engine)
       printf("%10s %13s %7s %7s %7s %7s %7s %7s\n",
              "Position", "Marker", "Allele", "Effect", "StdErr", "H2", "LOD", "pvalue");
 
+      // List markers to be tested and calculate all score statistics up front
+      FastScoreBatch batch(engine, pheno, mvn);
+
+      for (int pos = 0, marker = 0; pos < positions; pos++)
+         {
+         while (marker < markers &&
+                engine.markerPositions[marker] < engine.analysisPositions[pos])
+            marker++;
+
+         for ( ; marker < markers &&
+                 engine.markerPositions[marker] == engine.analysisPositions[pos]; marker++)
+            if (engine.imputationEngine.resultsAvailable(engine.markers[marker]) &&
+                !(customModels.HaveModels() && customModels.SkipMarker(m, engine.markers[marker])))
+               batch.tested.Push(marker);
+         }
+
+      batch.Score();
+
       // These are use to track the position of the most interesting result
       int    peak_marker = -1, peak_digits = -1, peak_sdigits = -1, peak_pos = -1, tests = 0;
       double peak_lod = -1., peak_effect = 0., peak_stderr = 0., peak_h2 = 0., peak_pvalue = 1.;
@@ -201,51 +408,15 @@ void FastAssociationAnalysis::AnalyseAssociation(FamilyAnalysis & engine)
                continue;
                }
 
-            // Vector of genotypes for each family
-            Vector genotypes;
-
             // Allele frequency
             double freq = ped.GetMarkerInfo(markerId)->freq[1];
 
-            // Expected genotype for each individual
-            double expectedGenotype = 2.0 * freq;
-
             // Variance genotype scores
             double genotypeVariance = 2.0 * freq * (1.0 - freq);
 
             // Z statistic evaluating evidence for association
-            double numerator = 0.0, denominator = 1e-10; // SSxy = 0.0, SSxx = 0.0;
-
-            // Loop through families and calculate score statistic to evaluate
-            // evidence for association
-            for (int f = 0, index = 0, count; f < ped.familyCount; f++)
-               if ((count = pheno[f].Length()) > 0)
-                  {
-                  // First calculate a vector of expected genotypes
-                  genotypes.Dimension(count);
-                  for (int i = 0; i < count; i++)
-                     genotypes[i] =
-                        engine.imputationEngine.GetExpectedGenotype(ped, pheno[f][i], markerId) -
-                        expectedGenotype;
-
-                  // Next, calculate Genotype * SIGMA^-1
-                  mvn[index].cholesky.BackSubst(genotypes);
-
-                  // Numerator of test statistic is Genotype * SIGMA^-1 * Phenotype
-                  numerator += mvn[index].cholesky.x.InnerProduct(mvn[index].residuals);
-
-                  // Denominator of test statistic is Genotype * SIGMA^-1 * Genotype
-                  denominator += mvn[index].cholesky.x.InnerProduct(genotypes);
-
-                  // printf("n = %.5f, d = %.5f\n", numerator * mvn.variances.Sum(), denominator * mvn.variances.Sum());
-
-                  // Update residual sum of squares for estimating effect size
-                  // SSxx += genotypes.SumSquares();
-                  // SSxy += mvn[index].residuals.InnerProduct(genotypes);
-
-                  // Update family index
-                  index++;
-                  }
+            double numerator = batch.numerators[marker];
+            double denominator = batch.denominators[marker];
 
             // Get key values
             double assoc_chisq  = numerator * numerator / denominator;
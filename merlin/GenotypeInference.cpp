@@ -22,6 +22,14 @@
 #include "Error.h"
 
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Largest fixed point value for stored probabilities, after the offset
+// reserved for genotypes that were not inferred
+#define DOSAGE_SCALE_8     254.0
+#define DOSAGE_SCALE_16    65534.0
 
 bool GenotypeInference::inferBest = false;
 bool GenotypeInference::inferExpected = false;
@@ -29,14 +37,74 @@ bool GenotypeInference::inferProbabilities = false;
 
 bool GenotypeInference::offline = false;
 
+int  GenotypeInference::dosageBits = 0;
+
+GenotypeInference::GenotypeInference()
+   {
+   store = NULL;
+   storeFile = NULL;
+   storeBytes = 0;
+   individuals = 0;
+   markers = 0;
+   }
+
+GenotypeInference::~GenotypeInference()
+   {
+   FreeMemory();
+   }
+
+void GenotypeInference::FreeMemory()
+   {
+   if (store != NULL)
+      munmap(store, storeBytes);
+
+   if (storeFile != NULL)
+      fclose(storeFile);
+
+   store = NULL;
+   storeFile = NULL;
+   storeBytes = 0;
+
+   probability[0].Dimension(0);
+   probability[1].Dimension(0);
+   }
+
 void GenotypeInference::AllocateMemory(Pedigree & ped)
    {
-   probability[0].Dimension(ped.count * markers);
-   probability[1].Dimension(ped.count * markers);
+   FreeMemory();
+
+   individuals = ped.count;
 
-   // Setting probabilities to -1.0 let us check for individuals whose
-   // genotypes were not adequately infered, for whatever reason
-   probability[0].Set(-1.0);
+   if (dosageBits && markers)
+      {
+      // The temporary file is reserved up front, so that running out of
+      // disk is reported here. It starts out filled with zeros, which flag
+      // genotypes that have not been inferred.
+      storeBytes = (long long) ped.count * markers * 2 * (dosageBits / 8);
+      storeFile = tmpfile();
+
+      if (storeFile == NULL || posix_fallocate(fileno(storeFile), 0, storeBytes) != 0)
+         error("Unable to reserve %.1f MB for inferred genotype probabilities\n",
+               storeBytes / 1048576.0);
+
+      void * mapping = mmap(NULL, storeBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fileno(storeFile), 0);
+
+      if (mapping == MAP_FAILED)
+         error("Unable to map %.1f MB of inferred genotype probabilities into memory\n",
+               storeBytes / 1048576.0);
+
+      store = (unsigned char *) mapping;
+      }
+   else
+      {
+      probability[0].Dimension(ped.count * markers);
+      probability[1].Dimension(ped.count * markers);
+
+      // Setting probabilities to -1.0 let us check for individuals whose
+      // genotypes were not adequately infered, for whatever reason
+      probability[0].Set(-1.0);
+      }
 
 #ifdef __CHROMOSOME_X__
    isFemale.Dimension(ped.count);
@@ -58,19 +126,19 @@ double GenotypeInference::GetExpectedGenotype(Pedigree & ped, int individual, in
 
 double GenotypeInference::GetExpectedGenotype(int individual, int marker)
    {
-   int slot = GetSlot(individual, marker);
+   double p11, p22;
 
-   if (probability[0][slot] == -1.0)
+   if (!GetProbabilities(individual, marker, p11, p22))
       return 2.0 * frequencies[markerKey[marker]];
 
-   return probability[0][slot] * 2 + (1.0 - probability[0][slot] - probability[1][slot]);
+   return p11 * 2 + (1.0 - p11 - p22);
    }
 
 double GenotypeInference::GetProbability(int individual, int marker, int genotype)
    {
-   int slot = GetSlot(individual, marker);
+   double p11, p22;
 
-   if (probability[0][slot] == -1.0)
+   if (!GetProbabilities(individual, marker, p11, p22))
       {
       double freq = frequencies[markerKey[marker]];
 
@@ -103,11 +171,11 @@ double GenotypeInference::GetProbability(int individual, int marker, int genotyp
    switch (genotype)
       {
       case 0:
-         return probability[0][slot];
+         return p11;
       case 1:
-         return 1.0 - probability[0][slot] - probability[1][slot];
+         return 1.0 - p11 - p22;
       default: /* case 2 */
-         return probability[1][slot];
+         return p22;
       }
    }
 
@@ -120,6 +188,80 @@ int GenotypeInference::GetSlot(int individual, int marker)
    return individual * markers + marker;
    }
 
+void GenotypeInference::SetProbabilities(int individual, int marker, double p11, double p22)
+   {
+   if (store == NULL)
+      {
+      int slot = GetSlot(individual, marker);
+
+      probability[0][slot] = p11;
+      probability[1][slot] = p22;
+      return;
+      }
+
+   // Ratios of likelihoods can stray slightly outside the unit interval
+   if (p11 < 0.0) p11 = 0.0;
+   if (p11 > 1.0) p11 = 1.0;
+   if (p22 < 0.0) p22 = 0.0;
+   if (p22 > 1.0) p22 = 1.0;
+
+   long long slot = ((long long) markerKey[marker] * individuals + individual) * 2;
+
+   if (dosageBits == 16)
+      {
+      unsigned short * values = (unsigned short *) store + slot;
+
+      values[0] = (unsigned short) (p11 * DOSAGE_SCALE_16 + 1.5);
+      values[1] = (unsigned short) (p22 * DOSAGE_SCALE_16 + 1.5);
+      }
+   else
+      {
+      unsigned char * values = store + slot;
+
+      values[0] = (unsigned char) (p11 * DOSAGE_SCALE_8 + 1.5);
+      values[1] = (unsigned char) (p22 * DOSAGE_SCALE_8 + 1.5);
+      }
+   }
+
+bool GenotypeInference::GetProbabilities(int individual, int marker, double & p11, double & p22)
+   {
+   if (markerKey[marker] < 0)
+      return false;
+
+   if (store == NULL)
+      {
+      int slot = GetSlot(individual, marker);
+
+      p11 = probability[0][slot];
+      p22 = probability[1][slot];
+
+      return p11 != -1.0;
+      }
+
+   long long slot = ((long long) markerKey[marker] * individuals + individual) * 2;
+
+   if (dosageBits == 16)
+      {
+      unsigned short * values = (unsigned short *) store + slot;
+
+      if (values[0] == 0) return false;
+
+      p11 = (values[0] - 1) * (1.0 / DOSAGE_SCALE_16);
+      p22 = (values[1] - 1) * (1.0 / DOSAGE_SCALE_16);
+      }
+   else
+      {
+      unsigned char * values = store + slot;
+
+      if (values[0] == 0) return false;
+
+      p11 = (values[0] - 1) * (1.0 / DOSAGE_SCALE_8);
+      p22 = (values[1] - 1) * (1.0 / DOSAGE_SCALE_8);
+      }
+
+   return true;
+   }
+
 void GenotypeInference::InferGenotypes(
     Mantra & mantra, TreeInfo & stats,
     Tree & withMarker, Tree & without, Tree & single,
@@ -153,8 +295,10 @@ void GenotypeInference::InferGenotypes(
 
       for (int id = family->first; id <= family->last; id++)
          {
-         int slot = GetSlot(id, marker);
-         if (slot < 0) continue;
+         if (!resultsAvailable(marker)) continue;
+
+         // Probability that the individual is homozygous for allele 1 or 2
+         double homozygous[2];
 
          // If the genotype is known, there is nothing to calculate
          int genotype = ped[id].markers[marker].BinaryCoded();
@@ -162,9 +306,9 @@ void GenotypeInference::InferGenotypes(
          if (genotype >= 0 /* and the error rate is zero */ )
             switch (genotype)
                {
-               case 1: probability[0][slot] = 1.0; probability[1][slot] = 0.0; continue;
-               case 2: probability[0][slot] = 0.0; probability[1][slot] = 1.0; continue;
-               case 3: probability[0][slot] = 0.0; probability[1][slot] = 0.0; continue;
+               case 1: SetProbabilities(id, marker, 1.0, 0.0); continue;
+               case 2: SetProbabilities(id, marker, 0.0, 1.0); continue;
+               case 3: SetProbabilities(id, marker, 0.0, 0.0); continue;
                }
 
          // Otherwise, we first try to set the genotype as if it were homozygous
@@ -179,8 +323,7 @@ void GenotypeInference::InferGenotypes(
          // If the other family members fix the genotype, then we are done ...
          if (alternative_likelihood == singlepoint_likelihood)
             {
-            probability[0][slot] = 1.0;
-            probability[1][slot] = 0.0;
+            SetProbabilities(id, marker, 1.0, 0.0);
 
             // We need to restore the old missing genotype so as
             // not to disrupt missing data patterns for other analyses
@@ -192,7 +335,7 @@ void GenotypeInference::InferGenotypes(
          // Otherwise, check if we need to update multipoint likelihood
          if (alternative_likelihood == 0.0)
             // Genotype is impossible
-            probability[0][slot] = 0.0;
+            homozygous[0] = 0.0;
          else
             {
             // If we get here we must recalculate the full multipoint likelihood
@@ -202,7 +345,7 @@ void GenotypeInference::InferGenotypes(
             double alternative_multipoint = alternative.MeanProduct(without);
 
             // This is the conditional probability of the current genotype
-            probability[0][slot] = alternative_multipoint / multipoint_likelihood *
+            homozygous[0] = alternative_multipoint / multipoint_likelihood *
                                    exp(alternative.logOffset - single.logOffset);
             }
 
@@ -217,8 +360,7 @@ void GenotypeInference::InferGenotypes(
          // If the other family members fix the genotype, then we are done ...
          if (alternative_likelihood == singlepoint_likelihood)
             {
-            probability[0][slot] = 0.0;
-            probability[1][slot] = 1.0;
+            SetProbabilities(id, marker, 0.0, 1.0);
 
             // We need to restore the old missing genotype so as
             // not to disrupt missing data patterns for other analyses
@@ -230,7 +372,7 @@ void GenotypeInference::InferGenotypes(
          // Otherwise, check if we need to update multipoint likelihood
          if (alternative_likelihood == 0.0)
             // Genotype is impossible
-            probability[1][slot] = 0.0;
+            homozygous[1] = 0.0;
          else
             {
             // If we get here we must recalculate the full multipoint likelihood
@@ -240,11 +382,13 @@ void GenotypeInference::InferGenotypes(
             double alternative_multipoint = alternative.MeanProduct(without);
 
             // This is the conditional probability of the current genotype
-            probability[1][slot] = alternative_multipoint / multipoint_likelihood *
+            homozygous[1] = alternative_multipoint / multipoint_likelihood *
                                    exp(alternative.logOffset - single.logOffset);
             }
 
          ped[id].markers[marker][0] = ped[id].markers[marker][1] = 0;
+
+         SetProbabilities(id, marker, homozygous[0], homozygous[1]);
          }
       }
    }
@@ -338,15 +482,14 @@ void GenotypeInference::OutputGenotypes(Pedigree & ped, IntArray & markerList)
       for (int j = 0, index = 0; j < markerList.Length(); j++)
          if (resultsAvailable(markerList[j]))
             {
-            int slot  = GetSlot(i, markerList[j]);
-            double z0 = probability[0][slot];
-            double z2 = probability[1][slot];
+            double z0 = 0.0, z2 = 0.0;
+            bool inferred = GetProbabilities(i, markerList[j], z0, z2);
             double z1 = 1.0 - z0 - z2;
 
-            if (flips[index] && z0 >= 0.0)
+            if (flips[index] && inferred)
                { double swap = z0; z0 = z2; z2 = swap; }
 
-            if (z0 < 0.0)
+            if (!inferred)
                // These genotypes were not inferred, perhaps because no
                // genotyped relatives were available ... we use their
                // population frequencies instead
@@ -23,9 +23,14 @@
 #include "Tree.h"
 #include "MathFloatVector.h"
 
+#include <stdio.h>
+
 class GenotypeInference
    {
    public:
+      GenotypeInference();
+      ~GenotypeInference();
+
       // These variables control exactly what should be infered
       static bool inferBest;          // infer the most likely genotype
       static bool inferExpected;      // infer the expected genotype
@@ -35,6 +40,10 @@ class GenotypeInference
       // into the pedigree
       static bool offline;
 
+      // When set to 8 or 16, inferred probabilities are stored as fixed
+      // point values of this size in a memory mapped temporary file
+      static int  dosageBits;
+
       // Initializes temporary memory allocation
       void     AllocateMemory(Pedigree & ped);
       int      SelectMarkers(IntArray & markers, Vector & markerPositions, Vector & analysisPositions);
@@ -79,6 +88,22 @@ class GenotypeInference
       // This function maps an individual to a slot within the probability array
       int      GetSlot(int individual, int marker);
 
+      // Alternatively, probabilities are stored in pairs, with all individuals
+      // for each marker together. Each value is offset by one, so that zero
+      // flags genotypes that were not inferred.
+      unsigned char * store;
+      FILE *          storeFile;
+      long long       storeBytes;
+      int             individuals;
+
+      void     FreeMemory();
+
+      // Probabilities for either storage format, markers are identified by
+      // their pedigree index. Retrieval returns false if the genotype was not
+      // inferred or the marker was not selected.
+      void     SetProbabilities(int individual, int marker, double p11, double p22);
+      bool     GetProbabilities(int individual, int marker, double & p11, double & p22);
+
       // List of selected markers
       IntArray markerKey;
 
@@ -343,19 +343,19 @@ int FuzzyInheritanceTree::ScoreRecursive(Mantra & m, int bit, int last_pivot)
    // Is this configuration impossible?
    if (impossible)
       {
-      nodes[node].type = TREE_NODE_ZERO;
+      Type(node) = TREE_NODE_ZERO;
       nodes[node].value = 0.0;
       }
    // Is this a leaf node?
    else if (bit < 0)
       // If so, evaluate likelihood
       {
-      nodes[node].type = TREE_NODE_LEAF;
+      Type(node) = TREE_NODE_LEAF;
       nodes[node].value = CalculateLikelihood(m);
       }
    else
       // Find out if we can save time by using symmetries in the data
-      switch (nodes[node].type = FindRedundancy(m, pivot))
+      switch (Type(node) = FindRedundancy(m, pivot))
          {
          case TREE_NODE_ZERO :
             nodes[node].value = 0.0;
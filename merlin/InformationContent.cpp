@@ -150,4 +150,9 @@ void InformationContent::CloseFiles()
    fclose(infoFile);
    infoFile = NULL;
    }
+
+const char * InformationContent::TaskName()
+   {
+   return "information";
+   }
  
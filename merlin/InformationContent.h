@@ -36,6 +36,8 @@ class InformationContent : public AnalysisTask
       virtual void OpenFiles(AnalysisInfo & info, String & prefix);
       virtual void CloseFiles();
 
+      virtual const char * TaskName();
+
    private:
       Vector   infoBits, totalBits;
       TreeInfo stats;
@@ -431,6 +431,10 @@ KongAndCox::KongAndCox(Pedigree & ped)
    // Initialize pointer variables
    index = NULL;
    npl = NULL;
+   informative = NULL;
+
+   // Initialize scoring tree cache
+   useCounter = residentNodes = 0;
 
    // How many NPL statistics to calculate
    statistics = (nplAll + nplPairs + nplExtras * 2) * ped.affectionCount +
@@ -448,6 +452,10 @@ void KongAndCox::AllocateMemory()
       scales.Dimension(statistics);
 
       npl = new Tree[statistics];
+      informative = new Tree * [statistics];
+
+      lastUsed.Dimension(statistics);
+      lastUsed.Zero();
       if (nplExponential) index = new IndexTree[statistics];
       }
    }
@@ -492,6 +500,7 @@ KongAndCox::~KongAndCox()
    {
    if (npl != NULL) delete [] npl;
    if (index != NULL) delete [] index;
+   if (informative != NULL) delete [] informative;
    }
 
 void KongAndCox::Setup(AnalysisInfo & info)
@@ -511,6 +520,9 @@ void KongAndCox::SetupFamily(AnalysisInfo & info)
    int quantitative = Pedigree::traitCount;
    int s = 0;
 
+   // Trees for the previous family are replaced
+   residentNodes = 0;
+
    if (nplAll)
       {
       NPL_ALL engine;
@@ -579,6 +591,8 @@ void KongAndCox::SetupFamily(AnalysisInfo & info)
          ScoreNPLBounds(s++, info.famno);
          }
       }
+
+   CombineTrees();
    }
 
 bool KongAndCox::CalculateNPL(Pedigree & ped)
@@ -613,7 +627,94 @@ void KongAndCox::ScoreNPLBounds(int s, int f)
       em.NullDistribution(s, f, index[s].uniqValues, index[s].freqs);
       }
 
-   npl[s].Pack();
+   // Store a compressed copy, so the tree can be released if needed
+   npl[s].PackOnly();
+   lastUsed[s] = ++useCounter;
+
+   if (Releasable(s))
+      residentNodes += npl[s].count;
+
+   ReleaseTrees();
+   }
+
+bool KongAndCox::Releasable(int s)
+   {
+   return BasicTree::SwapEnabled() && npl[s].IsSwappable();
+   }
+
+void KongAndCox::FetchTree(int s)
+   {
+   if (!npl[s].IsInMemory())
+      {
+      npl[s].UnPack();
+      residentNodes += npl[s].count;
+      }
+
+   lastUsed[s] = ++useCounter;
+   }
+
+int KongAndCox::ResidentLimit()
+   {
+   return BasicTree::maxNodes ? BasicTree::maxNodes / 8 : NPL_RESIDENT_NODES;
+   }
+
+void KongAndCox::ReleaseTrees()
+   {
+   int limit = ResidentLimit();
+
+   while (residentNodes > limit)
+      {
+      // Find the least recently used tree still in memory
+      int lru = -1;
+
+      for (int s = 0; s < statistics; s++)
+         if (npl[s].IsInMemory() && Releasable(s) &&
+             (lru == -1 || lastUsed[s] < lastUsed[lru]))
+            lru = s;
+
+      if (lru == -1) break;
+
+      npl[lru].RePack();
+      residentNodes -= npl[lru].count;
+      }
+   }
+
+void KongAndCox::CombineTrees()
+   {
+   combined.Free();
+
+   int count = 0, sourceNodes = 0;
+   for (int s = 0; s < statistics; s++)
+      if (scales[s] != 0.0)
+         {
+         FetchTree(s);
+         informative[count++] = &npl[s];
+         sourceNodes += npl[s].nextFree;
+         }
+
+   if (count > 1)
+      {
+      combined.Combine(informative, count);
+
+      // Size of combined tree and score table, in tree nodes
+      int size = combined.nextFree +
+                 combined.scores.Length() * sizeof(double) / TREE_NODE_SIZE;
+
+      // Only use combined tree if it does not increase memory use
+      if (size <= sourceNodes &&
+          (!BasicTree::SwapEnabled() || size <= ResidentLimit()))
+         {
+         for (int s = 0; s < statistics; s++)
+            npl[s].Discard();
+
+         residentNodes = 0;
+         return;
+         }
+
+      combined.Free();
+      }
+
+   ReleaseTrees();
    }
 
 void KongAndCox::SkipFamily(AnalysisInfo & info)
@@ -639,15 +740,30 @@ void KongAndCox::Analyse(AnalysisInfo & info, Tree & tree, int position)
    if (info.lk == -1.0)
       info.lk = tree.WeightedSum();
 
-   for (int s = 0; s < statistics; s++)
+   // Score all informative statistics in a single pass through the tree
+   if (combined.statistics)
+      combined.MeanProducts(tree, products);
+   else
+      {
+      int count = 0;
+      for (int s = 0; s < statistics; s++)
+         if (scales[s] != 0.0)
+            {
+            FetchTree(s);
+            informative[count++] = &npl[s];
+            }
+
+      tree.MeanProducts(informative, count, products);
+      ReleaseTrees();
+      }
+
+   for (int s = 0, i = 0; s < statistics; s++)
       // Only analyse informative families (eg. multiple related affecteds)
       if (scales[s] != 0.0)
          {
          // Calculate Z-score for linear model
-         npl[s].UnPack();
          lm.scores[s][info.famno][position] =
-            (tree.MeanProduct(npl[s])/info.lk - means[s]) * scales[s];
-         npl[s].RePack();
+            (products[i++]/info.lk - means[s]) * scales[s];
 
          if (!nplExponential) continue;
 
@@ -895,6 +1011,11 @@ const char * KongAndCox::TaskDescription()
    return "Scoring Nonparametric Statistics";
    }
 
+const char * KongAndCox::TaskName()
+   {
+   return "npl";
+   }
+
 void KongAndCox::OutputPerFamily(Pedigree & ped, const char * label, double delta)
    {
    int stat = lm.stat;
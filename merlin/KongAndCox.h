@@ -23,6 +23,10 @@
 #include "TreeInfo.h"
 #include "MathGold.h"
 
+// Default limit on the number of scoring tree nodes kept in memory when
+// a swap file is available and no memory limit has been set
+#define NPL_RESIDENT_NODES   (4 * 1024 * 1024)
+
 class LinearModel : public ScalarMinimizer
    {
    public:
@@ -98,6 +102,13 @@ class KongAndCox : public AnalysisTask
       Tree *             npl;
       TreeInfo           stats;
 
+      // Trees for informative statistics, scored in a single pass
+      Tree **            informative;
+      Vector             products;
+
+      // Combined scoring tree, used instead of npl when it is smaller
+      MultiScoreTree     combined;
+
       StringArray pheno, phenoTag;
 
       int    statistics, families, positions;
@@ -126,12 +137,24 @@ class KongAndCox : public AnalysisTask
       virtual void CloseFiles();
 
       virtual const char * TaskDescription();
+      virtual const char * TaskName();
 
    private:
       void AllocateMemory();
       void LabelAnalyses(Pedigree & ped);
       void ScoreNPLBounds(int statistics, int family);
 
+      // Scoring trees stay in memory between positions, and the least
+      // recently used trees are released when the budget is exceeded
+      IntArray lastUsed;
+      int      useCounter, residentNodes;
+
+      bool Releasable(int statistic);
+      int  ResidentLimit();
+      void FetchTree(int statistic);
+      void ReleaseTrees();
+      void CombineTrees();
+
       void OutputLabel(int chromosome, double position,
                        const char * what, const char * poslabel, double Z);
       void OutputLOD(double delta, double chisq);
@@ -142,7 +142,7 @@ int InheritanceTree::ScoreRecursive
       {
       m.state[pivot] = m.state[m.vector[pivot] &= ~1];
 
-      nodes[node].type = TREE_NODE_ONE;
+      Type(node) = TREE_NODE_ONE;
       SAFE_SET(nodes[node].child[0],
                ScoreRecursive(m, bit - 1, last_pivot, graph,
                               alleles, fixed, alleles2, dirty));
@@ -192,7 +192,7 @@ int InheritanceTree::ScoreRecursive
    // Is this an impossible state?
    if (last_pivot < pivot)
       {
-      nodes[node].type  = TREE_NODE_ZERO;
+      Type(node)  = TREE_NODE_ZERO;
       nodes[node].value = 0.0;
 
       return node;
@@ -201,7 +201,7 @@ int InheritanceTree::ScoreRecursive
    // Is this a leaf node?
    if (bit < 0)
       {
-      nodes[node].type = TREE_NODE_LEAF;
+      Type(node) = TREE_NODE_LEAF;
       nodes[node].value =
          CalculateLikelihood(m, graph, alleles, fixed, alleles2, dirty);
 
@@ -217,7 +217,7 @@ int InheritanceTree::ScoreRecursive
       }
 
    // Find out if we can save time by using symmetries in the data
-   switch (nodes[node].type =
+   switch (Type(node) =
            FindRedundancy(m, pivot, graph, alleles, fixed, alleles2, dirty))
       {
       case TREE_NODE_ZERO :
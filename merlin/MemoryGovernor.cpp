@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MemoryGovernor.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "MemoryGovernor.h"
+#include "TreeBasics.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+
+double MemoryGovernor::target = 512.0 * 1024 * 1024;
+double MemoryGovernor::swapBudget = 1024.0 * 1024 * 1024;
+
+static const char * strategyNames[] =
+   { "in-memory trees", "swapping trees to disk", "recomputing trees from checkpoints" };
+
+MemoryGovernor::MemoryGovernor()
+   {
+   strategy = MEMORY_RESIDENT;
+   retrying = committed = false;
+
+   for (int i = 0; i < MEMORY_CATEGORIES; i++)
+      peak[i] = 0.0;
+
+   tally[MEMORY_SINGLEPOINT] = tally[MEMORY_CONDITIONAL] = 0.0;
+
+   escalations = retries = 0;
+   }
+
+void MemoryGovernor::SetupGlobals(int megabytes, int threads)
+   {
+   // An explicit limit applies to each thread, otherwise physical memory
+   // is shared among threads
+   if (megabytes)
+      target = megabytes * 1024.0 * 1024.0;
+   else
+      {
+      long pages = sysconf(_SC_PHYS_PAGES);
+      long pageSize = sysconf(_SC_PAGE_SIZE);
+
+      if (pages > 0 && pageSize > 0)
+         target = pages * (double) pageSize / (threads > 1 ? threads : 1);
+      }
+
+   // Leave at least half of the free space in the temporary directory
+   // untouched, shared between singlepoint and multipoint swap files
+   struct statvfs disk;
+
+   if (statvfs(P_tmpdir, &disk) == 0)
+      swapBudget = disk.f_bavail * (double) disk.f_frsize * 0.25;
+   }
+
+void MemoryGovernor::Plan(int requested, int positions)
+   {
+   // A family that is being retried keeps its more economical strategy
+   if (!retrying || requested > strategy)
+      strategy = requested;
+
+   retrying = committed = false;
+
+   for (int i = 0; i < MEMORY_SCRATCH; i++)
+      nodes[i].Dimension(positions);
+
+   Reset();
+   }
+
+void MemoryGovernor::Reset()
+   {
+   for (int i = 0; i < MEMORY_SCRATCH; i++)
+      {
+      nodes[i].Zero();
+      tally[i] = 0.0;
+      }
+   }
+
+const char * MemoryGovernor::StrategyName()
+   {
+   return strategyNames[strategy];
+   }
+
+bool MemoryGovernor::Escalate()
+   {
+   if (strategy == MEMORY_RECOMPUTE)
+      return false;
+
+   strategy++;
+   escalations++;
+
+   return true;
+   }
+
+bool MemoryGovernor::Retry()
+   {
+   if (committed || !Escalate())
+      return false;
+
+   Reset();
+   retries++;
+
+   return true;
+   }
+
+void MemoryGovernor::Track(int category, int position, int count)
+   {
+   if (position >= nodes[category].Length())
+      return;
+
+   tally[category] += count - nodes[category][position];
+   nodes[category][position] = count;
+
+   UpdatePeaks();
+   }
+
+double MemoryGovernor::Usage(int category)
+   {
+   if (category != MEMORY_SCRATCH)
+      return tally[category] * TREE_NODE_SIZE;
+
+   double scratch = BasicTree::totalNodes - tally[MEMORY_SINGLEPOINT] - tally[MEMORY_CONDITIONAL];
+
+   return scratch > 0.0 ? scratch * TREE_NODE_SIZE : 0.0;
+   }
+
+bool MemoryGovernor::OverTarget()
+   {
+   // Stored trees can use up to half the target, the remainder is left
+   // for the trees used as scratch space by each analysis
+   return Usage(MEMORY_SINGLEPOINT) + Usage(MEMORY_CONDITIONAL) > target * 0.5;
+   }
+
+void MemoryGovernor::UpdatePeaks()
+   {
+   for (int i = 0; i < MEMORY_CATEGORIES; i++)
+      {
+      double usage = Usage(i);
+
+      if (usage > peak[i]) peak[i] = usage;
+      }
+   }
+
+void MemoryGovernor::Merge(const MemoryGovernor & other)
+   {
+   for (int i = 0; i < MEMORY_CATEGORIES; i++)
+      if (other.peak[i] > peak[i])
+         peak[i] = other.peak[i];
+
+   escalations += other.escalations;
+   retries += other.retries;
+   }
+
+void MemoryGovernor::Report()
+   {
+   printf("Memory governor: peak tree usage %.1f Mb singlepoint, "
+          "%.1f Mb conditional, %.1f Mb scratch\n",
+          peak[MEMORY_SINGLEPOINT] / 1048576.0,
+          peak[MEMORY_CONDITIONAL] / 1048576.0,
+          peak[MEMORY_SCRATCH] / 1048576.0);
+
+   if (escalations)
+      printf("                 %d strategy changes, %d families retried\n",
+             escalations, retries);
+
+   printf("\n");
+   }
+
+ 
@@ -0,0 +1,117 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MemoryGovernor.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __MEMORYGOVERNOR_H__
+#define __MEMORYGOVERNOR_H__
+
+#include "IntArray.h"
+
+///////////////////////////////////////////////////////////////
+// This class chooses how intermediate inheritance trees are
+// stored for each family. It tracks the memory held by trees
+// in each category and moves to progressively more economical
+// strategies when the memory target is exceeded, or when a
+// family runs out of memory, so that large families are
+// analysed more slowly rather than skipped.
+//
+
+// Categories of trees whose memory use is tracked
+#define MEMORY_SINGLEPOINT   0
+#define MEMORY_CONDITIONAL   1
+#define MEMORY_SCRATCH       2
+#define MEMORY_CATEGORIES    3
+
+// Strategies, from fastest to most economical
+#define MEMORY_RESIDENT      0   // All trees are kept in memory
+#define MEMORY_SWAP          1   // Trees are swapped to disk
+#define MEMORY_RECOMPUTE     2   // Only checkpoints are kept, other trees
+                                 // are recomputed as needed
+
+class MemoryGovernor
+   {
+   public:
+      MemoryGovernor();
+
+      // Selects the strategy for a new family, unless a family is being
+      // retried, in which case the more economical strategy is kept
+      void Plan(int strategy, int positions);
+
+      int  Strategy() { return strategy; }
+      const char * StrategyName();
+
+      // Moves to the next strategy, returning false if there is none
+      bool Escalate();
+
+      // Called when a family runs out of memory, returns true if it can
+      // be analysed again with a more economical strategy
+      bool Retry();
+
+      // Checks whether Retry() would succeed
+      bool CanRetry()
+         { return !committed && strategy != MEMORY_RECOMPUTE; }
+
+      // Keeps the current strategy when the family is selected again
+      void KeepStrategy()
+         { retrying = true; }
+      bool Retrying()
+         { return retrying; }
+
+      // Once results are reported, the family can no longer be retried
+      void Commit()
+         { committed = true; }
+
+      // Records the number of nodes kept in memory at one position
+      void Track(int category, int position, int nodes);
+
+      // Bytes currently used for each category of trees
+      double Usage(int category);
+
+      // Checks whether stored trees exceed their share of the target
+      bool OverTarget();
+
+      // Checks whether a swap file exceeds its share of free disk space
+      bool SwapFull(double bytes)
+         { return bytes > swapBudget; }
+
+      // Summary of memory usage and strategy changes
+      double peak[MEMORY_CATEGORIES];
+      int    escalations, retries;
+
+      void Merge(const MemoryGovernor & other);
+      void Report();
+
+      // Memory target per thread and disk space available for each swap
+      // file, both in bytes
+      static double target;
+      static double swapBudget;
+
+      static void SetupGlobals(int megabytes, int threads);
+
+   private:
+      int      strategy;
+      bool     retrying, committed;
+
+      IntArray nodes[MEMORY_SCRATCH];
+      double   tally[MEMORY_SCRATCH];
+
+      void Reset();
+      void UpdatePeaks();
+   };
+
+#endif
+
+ 
@@ -123,9 +123,14 @@ int main(int argc, char * argv[])
          if (pl.simulateNull)
             Simulator::Simulate(ped, engine.markers);
 
-         for (int i = 0; i < ped.familyCount; i++)
-            if (engine.SelectFamily(ped.families[i]))
-               engine.Analyse();
+         // Families are analysed in parallel, unless there is only one
+         if (MerlinCore::threads > 1 && FamilyAnalysis::parallelFamilies &&
+             ped.familyCount > 1)
+            engine.AnalyseInParallel();
+         else
+            for (int i = 0; i < ped.familyCount; i++)
+               if (engine.SelectFamily(ped.families[i]))
+                  engine.Analyse();
 
          printf("\n");
          engine.ShowLikelihood();
@@ -16,7 +16,11 @@
 // 
  
 #include "MerlinCache.h"
+#include "MerlinCluster.h"
 #include "Houdini.h"
+#include "Error.h"
+
+#include <string.h>
 
 #ifndef VERSION
 #define VERSION "Unofficial Release"
@@ -24,172 +28,413 @@
 
 #define  DIRCHAR "/"
 
+// Initial number of slots in the on-disk index (must be a power of two)
+#define  CACHE_INITIAL_SLOTS  4096
+
+// Index files start with a fixed length signature
+#define  CACHE_SIGNATURE      "MERLIN-CACHE-01\n"
+#define  CACHE_HEADER_SIZE    (16 + 2 * sizeof(int))
+#define  CACHE_SLOT_SIZE      (3 * sizeof(long long))
+
+// Hashing functions for cache keys
+//
+
+CacheKey::CacheKey()
+   {
+   lo = 14695981039346656037ULL;
+   hi = 0x9E3779B97F4A7C15ULL;
+   }
+
+void CacheKey::Add(const void * data, int bytes)
+   {
+   const unsigned char * ptr = (const unsigned char *) data;
+
+   for (int i = 0; i < bytes; i++)
+      {
+      lo = (lo ^ ptr[i]) * 1099511628211ULL;
+      hi = (hi ^ ptr[i]) * 0xFF51AFD7ED558CCDULL;
+      hi ^= hi >> 29;
+      }
+   }
+
+void CacheKey::Add(const char * string)
+   {
+   Add(string, strlen(string) + 1);
+   }
+
+// Cache objects are opened for each family, but all share a single store
+//
+
 String MerlinCache::directory;
 
+FILE * MerlinCache::indexFile = NULL;
+FILE * MerlinCache::dataFile = NULL;
+int    MerlinCache::slots = 0;
+int    MerlinCache::entries = 0;
+bool   MerlinCache::storeOpen = false;
+bool   MerlinCache::storeFailed = false;
+Mutex  MerlinCache::lock;
+
 MerlinCache::MerlinCache()
    {
-   isActive = directory.Length() > 0;
-   tag.printf(":%g:%g",
-              FuzzyInheritanceTree::perAlleleError,
-              FuzzyInheritanceTree::perGenotypeError);
-
-   indexFile = NULL;
-   dataFile = NULL;
+   isActive = false;
+   hits = misses = 0;
    }
 
 MerlinCache::~MerlinCache()
    {
    }
 
-bool MerlinCache::IndexMatches(Mantra & m)
+void MerlinCache::OpenCache(Mantra & m)
    {
-   String buffer;
-   StringArray tokens;
+   isActive = false;
 
-   // If input files are not available, we have a cache miss
-   if (indexFile == NULL || dataFile == NULL)
-      return false;
+   if (directory.IsEmpty() || m.bit_count < 4)
+      return;
 
-   // A cached version of the family may exist ...
+   lock.Lock();
+   bool available = OpenStore();
+   lock.Unlock();
 
-   // First check the Merlin version that generated the index
-   buffer.ReadLine(indexFile);
-   if (buffer != "Cache generated by MERLIN " VERSION )
-      return false;
+   if (!available)
+      return;
 
-   // Then check whether the pedigree graph vector matches our current one
-   buffer.ReadLine(indexFile);
-   tokens.AddTokens(buffer);
+   // The family key captures the program version, the pedigree structure
+   // and global settings that affect all singlepoint calculations
+   family = CacheKey();
 
-   if (tokens.Length() != m.vector.Length() + 1 || tokens[0] != "Vector:")
-      return false;
+   family.Add("MERLIN " VERSION);
+#ifdef __CHROMOSOME_X__
+   family.Add("X");
+#endif
+   family.Add(Mantra::ignoreCoupleSymmetries ? 1 : 0);
+   family.Add(InheritanceTree::mergingStrategy);
+   family.Add(FuzzyInheritanceTree::perAlleleError);
+   family.Add(FuzzyInheritanceTree::perGenotypeError);
+
+   family.Add(m.family->count);
+   for (int i = 0; i < m.family->count; i++)
+      {
+      Person & p = (*m.pedigree)[m.family->path[i]];
 
-   for (int i = 0; i < m.vector.Length(); i++)
-      if (tokens[i + 1].AsInteger() != m.vector[i])
-         return false;
+      family.Add(p.sex);
+      family.Add(p.father == NULL ? -1 : p.father->traverse);
+      family.Add(p.mother == NULL ? -1 : p.mother->traverse);
+      }
 
-   // And finally check that the inheritance graph bits match our current one
-   buffer.ReadLine(indexFile);
-   tokens.Clear();
-   tokens.AddTokens(buffer);
+   family.Add(m.bits);
+   family.Add(m.bit_count);
+   family.Add(m.couples);
 
-   if (tokens.Length() != m.bits.Length() + 1 || tokens[0] != "Bits:")
-      return false;
+   isActive = true;
+   }
 
-   for (int i = 0; i < m.bits.Length(); i++)
-      if (tokens[i + 1].AsInteger() != m.bits[i])
-         return false;
+void MerlinCache::CloseCache()
+   {
+   if (!isActive) return;
 
-   return true;
+   lock.Lock();
+   if (dataFile != NULL) fflush(dataFile);
+   if (indexFile != NULL) fflush(indexFile);
+   lock.Unlock();
+
+   isActive = false;
    }
 
-void MerlinCache::OpenCache(Mantra & m)
+CacheKey MerlinCache::MarkerKey(Mantra & m)
    {
-   if (!isActive || m.bit_count < 4) return;
+   CacheKey key = family;
 
-   String      buffer;
-   StringArray tokens;
-   String      filename = directory + DIRCHAR + m.family->famid;
+   key.Add("Marker");
+   key.Add(&m.genotype[0], sizeof(m.genotype[0]) * m.two_n);
+   key.Add(m.frequencies);
 
-   indexFile = fopen(filename + ".txt", "r+t");
-   dataFile = fopen(filename + ".bin", "r+b");
+   return key;
+   }
 
-   if (IndexMatches(m))
-      {
-      while (!feof(indexFile))
-         {
-         buffer.ReadLine(indexFile);
-         tokens.Clear();
-         tokens.AddTokens(buffer);
+CacheKey MerlinCache::ClusterKey(Mantra & m, MarkerCluster & cluster)
+   {
+   CacheKey key = family;
 
-         if (tokens.Length() != 2)
-            continue;
+   key.Add("Cluster");
+   key.Add(cluster.markerIds.Length());
 
-         markers.SetInteger(tokens[0], tokens[1].AsInteger());
+   for (int i = 0; i < m.family->count; i++)
+      {
+      Person & p = (*m.pedigree)[m.family->path[i]];
+
+      for (int j = 0; j < cluster.markerIds.Length(); j++)
+         {
+         key.Add(p.markers[cluster.markerIds[j]][0]);
+         key.Add(p.markers[cluster.markerIds[j]][1]);
          }
       }
+
+   key.Add(cluster.alleles);
+   key.Add(cluster.freqs);
+
+   return key;
+   }
+
+bool MerlinCache::RetrieveFromCache(Mantra & m, BasicTree & tree)
+   {
+   if (!isActive || m.bit_count < 4)
+      return false;
+
+   bool found = Retrieve(MarkerKey(m), tree, NULL);
+
+   if (found)
+      hits++;
    else
-      {
-      CloseCache();
-
-      indexFile = fopen(filename + ".txt", "w+t");
-      dataFile = fopen(filename + ".bin", "w+b");
-
-      if (indexFile == NULL || dataFile == NULL)
-         return;
-
-      fprintf(indexFile, "Cache generated by MERLIN " VERSION "\n");
-      fprintf(indexFile, "Vector:");
-      for (int i = 0; i < m.vector.Length(); i++)
-         fprintf(indexFile, " %d", m.vector[i]);
-      fprintf(indexFile, "\nBits:");
-      for (int i = 0; i < m.bits.Length(); i++)
-         fprintf(indexFile, " %d", m.bits[i]);
-      fprintf(indexFile, "\n\n");
-      }
+      misses++;
+
+   return found;
    }
 
-void MerlinCache::CloseCache()
+void MerlinCache::SaveToCache(Mantra & m, BasicTree & tree)
+   {
+   if (!isActive || m.bit_count < 4)
+      return;
+
+   Save(MarkerKey(m), tree, NULL);
+   }
+
+bool MerlinCache::RetrieveFromCache(Mantra & m, MarkerCluster & cluster, BasicTree & tree)
    {
-   if (indexFile != NULL)
-      fclose(indexFile);
+   if (!isActive || m.bit_count < 4)
+      return false;
+
+   bool found = Retrieve(ClusterKey(m, cluster), tree, &cluster.errormsg);
 
-   if (dataFile != NULL)
-      fclose(dataFile);
+   if (found)
+      hits++;
+   else
+      misses++;
 
-   dataFile = NULL;
-   indexFile = NULL;
+   return found;
    }
 
-void MerlinCache::SaveToCache(Mantra & m, BasicTree & tree, String & marker)
+void MerlinCache::SaveToCache(Mantra & m, MarkerCluster & cluster, BasicTree & tree)
    {
-   if (!isActive || dataFile == NULL || indexFile == NULL || m.bit_count < 4)
+   if (!isActive || m.bit_count < 4)
       return;
 
-   fseek(dataFile, 0, SEEK_END);
+   Save(ClusterKey(m, cluster), tree, &cluster.errormsg);
+   }
+
+// Each record in the data file repeats its key, followed by the
+// likelihood offset, an optional message and the tree itself
+//
+
+bool MerlinCache::Retrieve(const CacheKey & key, BasicTree & tree, String * message)
+   {
+   // Reading the tree can throw TreesTooBig, which must release the lock
+   MutexLock hold(lock);
+
+   long long offset;
+   CacheKey  stored;
+   double    logOffset;
+   int       length;
+
+   bool found = FindSlot(key, offset) >= 0 && offset != 0 &&
+                fseek(dataFile, (long) offset, SEEK_SET) == 0 &&
+                fread(&stored.hi, sizeof(stored.hi), 1, dataFile) == 1 &&
+                fread(&stored.lo, sizeof(stored.lo), 1, dataFile) == 1 &&
+                stored == key &&
+                fread(&logOffset, sizeof(logOffset), 1, dataFile) == 1 &&
+                fread(&length, sizeof(length), 1, dataFile) == 1;
+
+   if (found && message != NULL)
+      {
+      message->Clear();
+      for (int i = 0; i < length; i++)
+         *message += (char) fgetc(dataFile);
+      }
+   else if (found)
+      fseek(dataFile, length, SEEK_CUR);
+
+   if (found)
+      {
+      tree.ReadFromFile(dataFile);
+      tree.logOffset = logOffset;
+      }
 
-   // Log location of the write to index
-   fprintf(indexFile, "%s%s %ld\n",
-           (const char *) marker, (const char *) tag, (long int) ftell(dataFile));
+   return found;
+   }
 
-   // First write out genotypes array
-   fwrite(&m.genotype[0], sizeof(m.genotype[0]), m.two_n, dataFile);
+void MerlinCache::Save(const CacheKey & key, BasicTree & tree, const String * message)
+   {
+   MutexLock hold(lock);
 
-   // Then write out allele frequencies
-   fwrite(&m.frequencies[0], sizeof(m.frequencies[0]), m.frequencies.Length(), dataFile);
+   long long offset;
+   int       slot = FindSlot(key, offset);
 
-   // Finally, write out inheritance tree
-   tree.WriteToFile(dataFile);
+   if (slot >= 0 && offset == 0)
+      {
+      fseek(dataFile, 0, SEEK_END);
+      offset = ftell(dataFile);
+
+      int length = message == NULL ? 0 : message->Length();
+
+      fwrite(&key.hi, sizeof(key.hi), 1, dataFile);
+      fwrite(&key.lo, sizeof(key.lo), 1, dataFile);
+      fwrite(&tree.logOffset, sizeof(tree.logOffset), 1, dataFile);
+      fwrite(&length, sizeof(length), 1, dataFile);
+      if (length) fwrite((const char *) *message, 1, length, dataFile);
+      tree.WriteToFile(dataFile);
+
+      WriteSlot(slot, key, offset);
+      entries++;
+
+      // Keep the index at most half full, so probe sequences stay short
+      if (entries * 2 > slots)
+         GrowIndex();
+      else
+         WriteHeader();
+      }
    }
 
-bool MerlinCache::RetrieveFromCache(Mantra & m, BasicTree & tree, String & marker)
+// Functions for managing the on-disk index
+//
+
+bool MerlinCache::OpenStore()
    {
-   if (!isActive || dataFile == NULL || indexFile == NULL || m.bit_count < 4)
-      return false;
+   if (storeOpen || storeFailed)
+      return storeOpen;
+
+   String indexName = directory + DIRCHAR "merlin-cache.idx";
+   String dataName = directory + DIRCHAR "merlin-cache.dat";
+
+   indexFile = fopen(indexName, "r+b");
+   dataFile = fopen(dataName, "r+b");
 
-   int where = markers.Integer(marker + tag);
+   char signature[17] = "";
 
-   if (where == -1)
+   if (indexFile != NULL && dataFile != NULL &&
+       fread(signature, 1, 16, indexFile) == 16 &&
+       memcmp(signature, CACHE_SIGNATURE, 16) == 0 &&
+       fread(&slots, sizeof(slots), 1, indexFile) == 1 &&
+       fread(&entries, sizeof(entries), 1, indexFile) == 1 &&
+       slots > 0 && (slots & (slots - 1)) == 0)
+      return storeOpen = true;
+
+   // Start a new, empty store
+   if (indexFile != NULL) fclose(indexFile);
+   if (dataFile != NULL) fclose(dataFile);
+
+   indexFile = fopen(indexName, "w+b");
+   dataFile = fopen(dataName, "w+b");
+
+   if (indexFile == NULL || dataFile == NULL)
+      {
+      warning("Singlepoint cache could not be created in directory '%s'\n",
+              (const char *) directory);
+      CloseStore();
+      storeFailed = true;
       return false;
+      }
+
+   // Data file offsets of zero mark empty index slots
+   fwrite(CACHE_SIGNATURE, 1, 16, dataFile);
+
+   slots = CACHE_INITIAL_SLOTS;
+   entries = 0;
+
+   WriteHeader();
+
+   CacheKey  empty;
+   for (int i = 0; i < slots; i++)
+      WriteSlot(i, empty, 0);
+
+   return storeOpen = true;
+   }
+
+void MerlinCache::CloseStore()
+   {
+   if (indexFile != NULL) fclose(indexFile);
+   if (dataFile != NULL) fclose(dataFile);
+
+   indexFile = dataFile = NULL;
+   storeOpen = false;
+   }
+
+int MerlinCache::FindSlot(const CacheKey & key, long long & offset)
+   {
+   CacheKey stored;
+
+   for (int i = 0, slot = (int) (key.lo & (slots - 1)); i < slots;
+        i++, slot = (slot + 1) & (slots - 1))
+      {
+      ReadSlot(slot, stored, offset);
+
+      if (offset == 0 || stored == key)
+         return slot;
+      }
+
+   return -1;
+   }
+
+void MerlinCache::ReadSlot(int slot, CacheKey & key, long long & offset)
+   {
+   fseek(indexFile, CACHE_HEADER_SIZE + slot * (long) CACHE_SLOT_SIZE, SEEK_SET);
+
+   if (fread(&key.hi, sizeof(key.hi), 1, indexFile) != 1 ||
+       fread(&key.lo, sizeof(key.lo), 1, indexFile) != 1 ||
+       fread(&offset, sizeof(offset), 1, indexFile) != 1)
+      offset = 0;
+   }
+
+void MerlinCache::WriteSlot(int slot, const CacheKey & key, long long offset)
+   {
+   fseek(indexFile, CACHE_HEADER_SIZE + slot * (long) CACHE_SLOT_SIZE, SEEK_SET);
+
+   fwrite(&key.hi, sizeof(key.hi), 1, indexFile);
+   fwrite(&key.lo, sizeof(key.lo), 1, indexFile);
+   fwrite(&offset, sizeof(offset), 1, indexFile);
+   }
+
+void MerlinCache::WriteHeader()
+   {
+   fseek(indexFile, 0, SEEK_SET);
+   fwrite(CACHE_SIGNATURE, 1, 16, indexFile);
+   fwrite(&slots, sizeof(slots), 1, indexFile);
+   fwrite(&entries, sizeof(entries), 1, indexFile);
+   }
+
+void MerlinCache::GrowIndex()
+   {
+   // Read all occupied slots ...
+   CacheKey * keys = new CacheKey [entries];
+   long long * offsets = new long long [entries];
+
+   int used = 0;
+   for (int i = 0; i < slots && used < entries; i++)
+      {
+      ReadSlot(i, keys[used], offsets[used]);
+      if (offsets[used] != 0) used++;
+      }
+
+   // ... and rewrite them into a table twice as large
+   slots *= 2;
+   entries = 0;
+
+   WriteHeader();
+
+   CacheKey empty;
+   for (int i = 0; i < slots; i++)
+      WriteSlot(i, empty, 0);
+
+   for (int i = 0; i < used; i++)
+      {
+      long long offset;
+
+      WriteSlot(FindSlot(keys[i], offset), keys[i], offsets[i]);
+      entries++;
+      }
+
+   WriteHeader();
 
-   fseek(dataFile, where, SEEK_SET);
-
-   // First check whether genotypes array matches
-   longint genotype;
-   for (int i = 0; i < m.two_n; i++)
-      if (fread(&genotype, sizeof(genotype), 1, dataFile) != 1 ||
-          genotype != m.genotype[i])
-          return false;
-
-   // Next check whether allele frequency array matches
-   double frequency;
-   for (int i = 0; i < m.frequencies.Length(); i++)
-      if (fread(&frequency, sizeof(frequency), 1, dataFile) != 1 ||
-          frequency != m.frequencies[i])
-          return false;
-
-   // Read inheritance tree
-   tree.ReadFromFile(dataFile);
-   return true;
+   delete [] keys;
+   delete [] offsets;
    }
  
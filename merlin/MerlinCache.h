@@ -20,6 +20,29 @@
 
 #include "Mantra.h"
 #include "TreeBasics.h"
+#include "ThreadPool.h"
+
+class MarkerCluster;
+
+// Cache entries are identified by a 128-bit hash of everything that
+// determines the singlepoint inheritance tree
+class CacheKey
+   {
+   public:
+      unsigned long long hi, lo;
+
+      CacheKey();
+
+      void Add(const void * data, int bytes);
+      void Add(int value)               { Add(&value, sizeof(value)); }
+      void Add(double value)            { Add(&value, sizeof(value)); }
+      void Add(const char * string);
+      void Add(IntArray & array)        { Add(array.Length()); Add((int *) array, sizeof(int) * array.Length()); }
+      void Add(const Vector & vector)   { Add(vector.Length()); Add(vector.data, sizeof(double) * vector.Length()); }
+
+      bool operator == (const CacheKey & rhs) const
+         { return hi == rhs.hi && lo == rhs.lo; }
+   };
 
 class MerlinCache
    {
@@ -30,25 +53,51 @@ class MerlinCache
       void OpenCache(Mantra & m);
       void CloseCache();
 
-      bool RetrieveFromCache(Mantra & m, BasicTree & tree, String & marker);
-      void SaveToCache(Mantra & m, BasicTree & tree, String & marker);
+      // Regular markers are keyed on the selected marker genotypes
+      bool RetrieveFromCache(Mantra & m, BasicTree & tree);
+      void SaveToCache(Mantra & m, BasicTree & tree);
+
+      // Clusters are keyed on raw genotypes and haplotype frequencies,
+      // and also record any error message generated during scoring
+      bool RetrieveFromCache(Mantra & m, MarkerCluster & cluster, BasicTree & tree);
+      void SaveToCache(Mantra & m, MarkerCluster & cluster, BasicTree & tree);
+
+      // Lookups that found or missed a stored tree
+      int hits, misses;
 
       static String directory;
 
       static void FreeBuffers() { BasicTree::FreeBuffers(); }
 
-   private:
-      FILE * indexFile;
-      FILE * dataFile;
+      // Closes the index and data files shared by all families
+      static void CloseStore();
 
-      StringIntHash markers;
-      String tag;
+   private:
+      CacheKey family;
 
       bool isActive;
 
-      bool IndexMatches(Mantra & m);
-   };
+      CacheKey MarkerKey(Mantra & m);
+      CacheKey ClusterKey(Mantra & m, MarkerCluster & cluster);
+
+      bool Retrieve(const CacheKey & key, BasicTree & tree, String * message);
+      void Save(const CacheKey & key, BasicTree & tree, const String * message);
 
+      // The store is an open addressing hash table on disk, pointing
+      // to records appended to a separate data file
+      static FILE * indexFile;
+      static FILE * dataFile;
+      static int    slots, entries;
+      static bool   storeOpen, storeFailed;
+      static Mutex  lock;
+
+      static bool OpenStore();
+      static int  FindSlot(const CacheKey & key, long long & offset);
+      static void ReadSlot(int slot, CacheKey & key, long long & offset);
+      static void WriteSlot(int slot, const CacheKey & key, long long offset);
+      static void WriteHeader();
+      static void GrowIndex();
+   };
 
 #endif
  
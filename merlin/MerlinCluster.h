@@ -21,6 +21,7 @@
 #include "Pedigree.h"
 #include "Mantra.h"
 #include "Tree.h"
+#include "ThreadPool.h"
 
 #define  CLUSTER_SEARCH_MAX   20
 
@@ -127,6 +128,9 @@ class MarkerClusters
       // Prints a blank line after all other messages
       void FinishOutput();
 
+      // Serializes likelihood calculations when families are analysed in parallel
+      Mutex lock;
+
    protected:
       void CreateCluster(IntArray & markers, int clusterStart, int clusterEnd);
       void AdjustPositions(IntArray & markers);
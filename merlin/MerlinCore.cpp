@@ -20,6 +20,8 @@
 #include "MerlinCache.h"
 #include "MerlinCluster.h"
 #include "MathStats.h"
+#include "MerlinSinglepoint.h"
+#include "MerlinScan.h"
 #include "Houdini.h"
 #include "Error.h"
 
@@ -52,12 +54,17 @@ String MerlinCore::filePrefix = "merlin";
 // Swap options
 bool MerlinCore::useSwap = false;
 bool MerlinCore::smallSwap = false;
+int  MerlinCore::threads = 1;
+bool MerlinCore::reportCosts = false;
+bool MerlinCore::shareTrees = false;
+bool MerlinCore::spectralGrid = false;
 
 // Internal flags to minimize useless calculations
 bool MerlinCore::multipoint = false;
 bool MerlinCore::scanChromosome = false;
 bool MerlinCore::betweenMarkers = false;
 bool MerlinCore::lazyRightConditional = false;
+bool MerlinCore::likelihoodOnly = false;
 
 // Flags for controlling recombination
 bool MerlinCore::zeroRecombination = false;
@@ -76,6 +83,14 @@ MerlinCore::MerlinCore(Pedigree & pedigree) : mantra(), ped(pedigree)
    {
    memoryManagement = false;
    printHeader = false;
+   outputBuffer = NULL;
+   parallelScoring = NULL;
+   parallelScan = NULL;
+   spectralAnchor = -1;
+   spectralValid = false;
+   singlepointCursor = multipointCursor = -1;
+   singlepointStep = multipointStep = 0;
+   swapReadMark = swapWrittenMark = 0.0;
    lowBound = pow(2.0, -129);
    rescale  = pow(2.0, 258);
    lnScale  = 258 * log(0.5);
@@ -83,6 +98,19 @@ MerlinCore::MerlinCore(Pedigree & pedigree) : mantra(), ped(pedigree)
 
 MerlinCore::~MerlinCore()
    {
+   if (parallelScoring != NULL)
+      delete parallelScoring;
+
+   if (parallelScan != NULL)
+      delete parallelScan;
+
+   // Trees that outlive this engine return their nodes to the system
+   if (BasicTree::SelectedPool() == &nodePool)
+      BasicTree::SelectPool(NULL);
+
+   if (Multipoint::denseBuffer == &denseBuffer)
+      Multipoint::denseBuffer = NULL;
+
    MerlinCache::FreeBuffers();
    }
 
@@ -95,6 +123,9 @@ void MerlinCore::SetupGlobals()
    Multipoint::maximum_recombinants =
       threeRecombinations * 3 + twoRecombinations * 2 + oneRecombination;
 
+   // Swap files may also be opened later, when memory runs short
+   TreeManager::SelectCodec();
+
    if (useSwap || smallSwap)
       {
       BasicTree::SetupSwap();
@@ -106,28 +137,35 @@ void MerlinCore::SetupGlobals()
 
 void MerlinCore::CleanupGlobals()
    {
-   if (useSwap || smallSwap)
+   if (reportCosts)
+      governor.Report();
+
+   // Swap files are reported when requested or when opened for large families
+   double swapUsage = singlepointSwap.GetFileSize() +
+                      multipointSwap.GetFileSize() +
+                      scaffoldSwap.GetFileSize();
+
+   if (useSwap || smallSwap || swapUsage > 0.0)
       {
-      bool   validSize = BasicTree::SwapFileSize() >= 0 &&
-                         singlepointSwap.GetFileSize() >= 0 &&
-                         multipointSwap.GetFileSize() >= 0 &&
-                         scaffoldSwap.GetFileSize() >= 0;
+      double fileSize = BasicTree::SwapFileSize() + swapUsage;
 
-      double fileSize = BasicTree::SwapFileSize() +
-                        singlepointSwap.GetFileSize() +
-                        multipointSwap.GetFileSize() +
-                        scaffoldSwap.GetFileSize();
+      if (reportCosts)
+         {
+         printf("Swap file throughput (%s codec):\n", (const char *) TreeManager::codecName);
+         singlepointSwap.ReportThroughput("singlepoint");
+         multipointSwap.ReportThroughput("multipoint");
+         scaffoldSwap.ReportThroughput("scaffold");
+         }
 
       BasicTree::CloseSwap(true);
       singlepointSwap.CloseFiles();
       multipointSwap.CloseFiles();
       scaffoldSwap.CloseFiles();
 
-      if (validSize)
-         printf("Swap file usage peaked at < %.0fM\n", fileSize * 1e-6 + 1);
-      else
-         printf("Swap file usage peaked at > 2048M\n");
+      printf("Swap file usage peaked at < %.0fM\n", fileSize * 1e-6 + 1);
       }
+
+   MerlinCache::CloseStore();
    }
 
 // Setup map for analysing the next chromosome at currently selected locations
@@ -148,7 +186,7 @@ int MerlinCore::SetupMap(int chromosome)
       warning("Requested position for starting analyses is greater than final position\n");
 
    // Update swap file information
-   BasicTree::UpdateSwapThreshold(markerCount * 2 + 10);
+   BasicTree::UpdateSwapThreshold(markerCount * 2 + 10, MemoryGovernor::target);
    multipointGrid = introot(markerCount);
 
    // Clear previous information
@@ -343,6 +381,32 @@ int MerlinCore::SetupMap(int chromosome)
    return next;
    }
 
+// Copy the map currently selected by another engine, so that families
+// can be analysed in parallel without repeating map setup
+//
+
+void MerlinCore::CopyMap(MerlinCore & engine)
+   {
+   markers = engine.markers;
+   markerCount = engine.markerCount;
+   multipointGrid = engine.multipointGrid;
+
+   labels = engine.labels;
+   analysisPositions = engine.analysisPositions;
+
+   markerPositions = engine.markerPositions;
+   markerMalePositions = engine.markerMalePositions;
+   markerFemalePositions = engine.markerFemalePositions;
+
+   femaleMarkerTheta = engine.femaleMarkerTheta;
+   maleMarkerTheta = engine.maleMarkerTheta;
+   keyFemaleTheta = engine.keyFemaleTheta;
+   keyMaleTheta = engine.keyMaleTheta;
+
+   femalePositions = engine.femalePositions;
+   malePositions = engine.malePositions;
+   }
+
 // Construct sex specific map using current sex averaged map as a template
 //
 
@@ -431,18 +495,44 @@ bool MerlinCore::SelectFamily(Family * f, bool warnOnSkip)
    family = f;
    serial = f->serial;
 
-   memoryManagement = useSwap || smallSwap;
+   // Transforms left over if the previous family ran out of memory
+   FreeSpectral();
+
+   denseBuffer.Free();
+   Multipoint::denseBuffer = &denseBuffer;
 
-   if (!memoryManagement && BasicTree::maxNodes)
+   // Trees are kept in memory unless swapping was requested or the
+   // pedigree is clearly too large for the memory limit
+   int  strategy = smallSwap ? MEMORY_RECOMPUTE : useSwap ? MEMORY_SWAP : MEMORY_RESIDENT;
+   bool largePedigree = false;
+
+   if (strategy == MEMORY_RESIDENT && BasicTree::maxNodes)
       {
-      memoryManagement = mantra.bit_count > (int) (CHAR_BIT * sizeof(mantra.bit_count) - 2) ||
-                         (2 << mantra.bit_count) > BasicTree::LargeTreeSize() ||
-                         BasicTree::LargeTreeSize() <= 256;
+      largePedigree = mantra.bit_count > (int) (CHAR_BIT * sizeof(mantra.bit_count) - 2) ||
+                      (2 << mantra.bit_count) > BasicTree::LargeTreeSize() ||
+                      BasicTree::LargeTreeSize() <= 256;
 
-      if (memoryManagement)
-         PrintMessage("  Advanced Memory Management enabled for large pedigree");
+      if (largePedigree)
+         strategy = MEMORY_SWAP;
       }
 
+   if (governor.Retrying())
+      PrintMessage("  Memory limit reached, retrying with %s", governor.StrategyName());
+
+   // Statistics for a family that is retried include all attempts
+   if (!governor.Retrying())
+      BeginProfile();
+
+   governor.Plan(strategy, markerCount);
+
+   memoryManagement = false;
+
+   if (governor.Strategy() != MEMORY_RESIDENT)
+      EnableMemoryManagement();
+
+   if (largePedigree)
+      PrintMessage("  Advanced Memory Management enabled for large pedigree");
+
    // if (mantra.couples)
    //   PrintMessage("  %d symmetric founder couple%s detected",
    //               mantra.couples, mantra.couples == 1 ? "" : "s");
@@ -470,7 +560,7 @@ double MerlinCore::CalculateLikelihood()
       ScoreSinglepoint();
 
       if (informativeCount > 0)
-         ScoreConditionals();
+         ScoreLikelihood();
 
       CleanMessages();
 
@@ -480,11 +570,15 @@ double MerlinCore::CalculateLikelihood()
    }
    catch (const TreesTooBig & problem)
       {
-      PrintMessage("  SKIPPED: At least %d megabytes needed", problem.memory_request);
-      CleanMessages();
-
       if (singlepoint != NULL) delete [] singlepoint;
       if (right != NULL) delete [] right;
+
+      // Try again with a more economical strategy, if one is left
+      if (RetryFamily())
+         return CalculateLikelihood();
+
+      PrintMessage("  SKIPPED: At least %d megabytes needed", problem.memory_request);
+      CleanMessages();
       }
    catch (const OutOfTime & problem)
       {
@@ -498,11 +592,52 @@ double MerlinCore::CalculateLikelihood()
    return likelihood;
    }
 
+// Analysis of a single family, shared by serial and parallel analyses
+//
+
+void MerlinCore::AnalyseFamily()
+   {
+   FreeSwap();
+
+   ScoreSinglepoint();
+
+   if (informativeCount == 0)
+      {
+      profile.status = "uninformative";
+      FamilyUninformativeHook();
+      return;
+      }
+
+   FamilySetupHook();
+
+   if (multipoint)
+      {
+      if (likelihoodOnly ? ScoreLikelihood() : ScoreConditionals())
+         {
+         if (scanChromosome) ScanChromosome();
+         FamilyLikelihoodHook();
+         }
+      else
+         {
+         PrintMessage("  SKIPPED: Requires impossible recombination pattern");
+         profile.status = "impossible";
+         FamilyImpossibleHook();
+         }
+      if (!twopoint)
+         {
+         delete [] right;
+         right = NULL;
+         }
+      }
+   }
+
 // Calculation of single marker likelihoods
 //
 
 void MerlinCore::ScoreSinglepoint()
    {
+   ProfileTimer timer(profile, PROFILE_SINGLEPOINT);
+   BackgroundSwapScope swapScope(background);
    MerlinCache cache;
 
    keyThetas = false;
@@ -511,6 +646,7 @@ void MerlinCore::ScoreSinglepoint()
    FuzzyInheritanceTree tempVectors;
 
    informativeCount = 0;
+   singlepointNodes = 0.0;
    informativeMarkers.Clear();
    informativePositions.Clear();
    informationScores.Clear();
@@ -523,6 +659,18 @@ void MerlinCore::ScoreSinglepoint()
    // Initialize a file cache for this family
    cache.OpenCache(mantra);
 
+   // Unless results are cached on disk, markers can be scored in parallel
+   bool parallel = threads > 1 && markerCount > 1 &&
+                   MerlinCache::directory.IsEmpty() && !ThreadPool::InWorker();
+
+   if (parallel)
+      {
+      if (parallelScoring == NULL)
+         parallelScoring = new ParallelSinglepoint(*this, threads);
+
+      parallelScoring->Start();
+      }
+
    // Reset the likelihood
    likelihood = 0;
 
@@ -537,16 +685,21 @@ void MerlinCore::ScoreSinglepoint()
          {
          MarkerCluster * cluster = clusters.markerToCluster[markerid];
 
-         // Score using clustering algorithms
-         cluster->ScoreLikelihood(mantra, tempVectors);
+         // Score using clustering algorithms, which are not thread safe
+         MutexLock hold(clusters.lock);
+
+         if (!cache.RetrieveFromCache(mantra, *cluster, tempVectors))
+            {
+            cluster->ScoreLikelihood(mantra, tempVectors);
+            cache.SaveToCache(mantra, *cluster, tempVectors);
+            }
+         String errormsg = cluster->errormsg;
 
          // Clear error messages
-         if (!cluster->errormsg.IsEmpty())
-            PrintMessage("  %s", (const char *) cluster->errormsg,
+         if (!errormsg.IsEmpty())
+            PrintMessage("  %s", (const char *) errormsg,
                                   error_message_printed = true);
 
-         // TO DO -- Code for implementing cache when there are clustered markers
-
          // Skip subsequent markers that are in the same cluster
          m += cluster->markerIds.Length() - 1;
          }
@@ -554,10 +707,12 @@ void MerlinCore::ScoreSinglepoint()
          {
          mantra.SelectMarker(markerid);
 
-         if (!cache.RetrieveFromCache(mantra, tempVectors, Pedigree::markerNames[markerid]))
+         if (parallel)
+            parallelScoring->Retrieve(m, tempVectors);
+         else if (!cache.RetrieveFromCache(mantra, tempVectors))
             {
             tempVectors.FuzzyScoreVectors(mantra);
-            cache.SaveToCache(mantra, tempVectors, Pedigree::markerNames[markerid]);
+            cache.SaveToCache(mantra, tempVectors);
             }
          }
 
@@ -592,8 +747,8 @@ void MerlinCore::ScoreSinglepoint()
 
       if (stats.information > 1e-5 || twopoint ||
            InheritanceTree::mergingStrategy != MERGE_ALL &&
-           tempVectors.nodes[0].type != TREE_NODE_ZERO &&
-           tempVectors.nodes[0].type != TREE_NODE_LEAF ||
+           tempVectors.Type(0) != TREE_NODE_ZERO &&
+           tempVectors.Type(0) != TREE_NODE_LEAF ||
            GenotypeAnalysisEnabled(m, true))
          {
          // The next few lines implement the complex recombination
@@ -608,6 +763,8 @@ void MerlinCore::ScoreSinglepoint()
             }
 
          singlepoint[informativeCount].Copy(tempVectors);
+         singlepointNodes += tempVectors.nextFree;
+         CompactTree(singlepoint[informativeCount]);
          StoreSinglepoint(informativeCount++);
 
          informativeMarkers.Push(m);
@@ -669,6 +826,9 @@ void MerlinCore::ScoreSinglepoint()
       }
 #endif
 
+   profile.cacheHits += cache.hits;
+   profile.cacheMisses += cache.misses;
+
    cache.CloseCache();
    }
 
@@ -711,6 +871,9 @@ void MerlinCore::CalculateThetas()
 
 bool MerlinCore::ScoreConditionals()
    {
+   ProfileTimer timer(profile, PROFILE_CONDITIONALS);
+   BackgroundSwapScope swapScope(background);
+
    if (zeroRecombination)
       return ZeroRecombination();
 
@@ -734,6 +897,8 @@ bool MerlinCore::ScoreConditionals()
    right[last].Copy(singlepoint[last]);
    ReStoreSinglepoint(last);
 
+   CompactTree(right[last]);
+
    bool   check_time = (mantra.bit_count >= 16) && (maxMinutes > 0);
    double seconds = 0;  // Initialization avoids compiler warning
    time_t start_time;
@@ -789,6 +954,8 @@ bool MerlinCore::ScoreConditionals()
          right[m].Copy(engine);
          }
 
+      CompactTree(right[m]);
+
       // Check that the likelihood hasn't hit zero
       if (stats.GetMean(right[m]) == 0.0) return false;
 
@@ -814,6 +981,91 @@ bool MerlinCore::ScoreConditionals()
    return true;
    }
 
+// When only the likelihood is required, right conditionals are not stored
+// and only the trees for the current and previous markers are kept
+//
+
+bool MerlinCore::ScoreLikelihood()
+   {
+   ProfileTimer timer(profile, PROFILE_CONDITIONALS);
+   BackgroundSwapScope swapScope(background);
+
+   if (zeroRecombination)
+      return ZeroRecombination();
+
+   if (twopoint) return true;
+
+   CalculateThetas();
+
+   Multipoint engine;
+   Tree       conditional;
+
+   if (useSparse) engine.SetupConditioning(mantra);
+
+   int last = informativeCount - 1;
+
+   RetrieveSinglepoint(last);
+   conditional.Copy(singlepoint[last]);
+   ReStoreSinglepoint(last);
+
+   bool   check_time = (mantra.bit_count >= 16) && (maxMinutes > 0);
+   double seconds = 0;  // Initialization avoids compiler warning
+   time_t start_time;
+
+   if (check_time)
+      {
+      seconds = maxMinutes * 60.;
+      time(&start_time);
+      }
+
+   int    rescalings = 0;
+   double scale = 1.0;
+
+   for (int m = last - 1; m >= 0; m--)
+      {
+      ProgressReport("Likelihood", last - m, informativeCount);
+
+      double theta[2];
+
+      theta[0] = keyFemaleTheta[m];
+      theta[1] = keyMaleTheta[m];
+
+      // Retrieve inheritance at m+1 given m + 1, m + 2, ... (copying
+      // rather than exchanging trees discards unreachable nodes)
+      engine.Clear();
+      engine.Copy(conditional);
+
+      RetrieveSinglepoint(m);
+      if (useSparse && (informationBounds[m+1] + informationBounds[m] > 1.0))
+         {
+         conditional.Copy(singlepoint[m]);
+         engine.Condition(conditional, theta, scale);
+         }
+      else
+         {
+         engine.MoveAlong(mantra, theta, scale);
+         engine.Multiply(singlepoint[m]);
+         conditional.Exchange(engine);
+         }
+      ReStoreSinglepoint(m);
+
+      // Check that the likelihood hasn't hit zero
+      if (stats.GetMean(conditional) == 0.0) return false;
+
+      // If the tree is very unlikely, multiply by a constant to avoid underflow
+      scale = stats.mean < lowBound ? (rescalings+=m!=0, rescale) : 1.0;
+
+      if (check_time)
+         if (difftime(time(NULL), start_time) > seconds)
+            throw OutOfTime();
+      }
+
+   if (informativeCount == 1) stats.GetMean(conditional);
+   likelihood += log(stats.mean) + rescalings * lnScale;
+
+   return true;
+   }
+
 // Likelihood calculation assuming no recombination
 //
 
@@ -891,6 +1143,15 @@ bool MerlinCore::ZeroRecombination()
    return true;
    }
 
+// Applies storage options to trees that are kept for later use
+//
+
+void MerlinCore::CompactTree(BasicTree & tree)
+   {
+   if (BasicTree::floatLeaves) tree.RoundToFloat();
+   if (shareTrees) tree.Share();
+   }
+
 // Calculation of left conditional likelihoods
 //
 
@@ -1009,6 +1270,9 @@ void MerlinCore::WalkLeft
 
 void MerlinCore::ScanChromosome()
    {
+   ProfileTimer timer(profile, PROFILE_SCAN);
+   BackgroundSwapScope swapScope(background);
+
    // Total number of analysis locations
    int positionCount = analysisPositions.Length();
 
@@ -1034,6 +1298,9 @@ void MerlinCore::ScanChromosome()
       for (int pos = 0; pos < positionCount; pos++)
          {
          RetrieveSinglepoint(pos);
+
+         // Analyses may modify the tree, so it needs its own nodes
+         singlepoint[pos].Expand();
          AnalyseLocation(pos, singlepoint[pos]);
 
          if (GenotypeAnalysisEnabled(pos, false))
@@ -1047,6 +1314,9 @@ void MerlinCore::ScanChromosome()
    // Left-conditioned probabilities up to left-marker
    Multipoint leftMarker;
 
+   // No interval has been transformed for this family
+   spectralAnchor = -1;
+
    // Left and right conditionals up to current position
    Multipoint leftInheritance, inheritance;
 
@@ -1125,6 +1395,56 @@ void MerlinCore::ScanChromosome()
          pos++;
          continue;
          }
+      // Optionally, move flanking trees in the Walsh-Hadamard domain
+      else if (spectralGrid && SpectralInterval(leftMarker, leftAnchor, rightAnchor))
+         {
+         int marker = informativeMarkers[leftAnchor];
+
+         theta[0] = DistanceToRecombination(femalePositions[pos] - markerFemalePositions[marker]);
+         theta[1] = DistanceToRecombination(malePositions[pos] - markerMalePositions[marker]);
+
+         Multipoint::SpectralMoveAlong(mantra, leftSpectrum, theta,
+                                       leftScale[leftAnchor], leftValues);
+
+         marker = informativeMarkers[rightAnchor];
+
+         theta[0] = DistanceToRecombination(markerFemalePositions[marker] - femalePositions[pos]);
+         theta[1] = DistanceToRecombination(markerMalePositions[marker] - malePositions[pos]);
+
+         Multipoint::SpectralMoveAlong(mantra, rightSpectrum, theta,
+                                       rightScale[rightAnchor], rightValues);
+
+         for (int i = 0; i < leftValues.size; i++)
+            leftValues[i] *= rightValues[i];
+
+         inheritance.SpectralStore(leftValues);
+         inheritance.logOffset = right[rightAnchor].logOffset;
+         }
+      // With multiple threads, evaluate all positions in this interval at once
+      else if (threads > 1 && !ThreadPool::InWorker())
+         {
+         int count = 1;
+
+         while (pos + count < positionCount &&
+                analysisPositions[pos + count] < informativePositions[rightAnchor])
+            count++;
+
+         if (parallelScan == NULL)
+            parallelScan = new ParallelScan(*this, threads);
+
+         RetrieveMultipoint(rightAnchor);
+         parallelScan->Start(leftMarker, right[rightAnchor], leftAnchor, rightAnchor, pos, count);
+         ReStoreMultipoint(rightAnchor);
+
+         for (int i = 0; i < count; i++)
+            {
+            if (i) ProgressReport("Scanning Chromosome", pos, positionCount);
+
+            AnalyseLocation(pos++, parallelScan->Retrieve(i));
+            }
+
+         continue;
+         }
       // Otherwise we are really between markers
       else
          {
@@ -1171,16 +1491,83 @@ void MerlinCore::ScanChromosome()
 
          AnalyseLocation(pos++, inheritance);
          }
+
+   FreeSpectral();
+   }
+
+// Prepares Walsh-Hadamard transforms of the trees flanking an interval,
+// returning false when these include symmetries that are not supported
+//
+
+bool MerlinCore::SpectralInterval(Multipoint & leftMarker, int leftAnchor, int rightAnchor)
+   {
+   if (spectralAnchor == leftAnchor)
+      return spectralValid;
+
+   spectralAnchor = leftAnchor;
+   spectralValid = false;
+
+   if (!leftMarker.SpectralTransform(mantra, leftSpectrum))
+      {
+      FreeSpectral();
+      return false;
+      }
+
+   Multipoint rightMarker;
+
+   RetrieveMultipoint(rightAnchor);
+   rightMarker.Copy(right[rightAnchor]);
+   ReStoreMultipoint(rightAnchor);
+
+   // Each position also needs room for both moved vectors
+   spectralValid = rightMarker.SpectralTransform(mantra, rightSpectrum) &&
+                   leftValues.Dimension(leftSpectrum.size) &&
+                   rightValues.Dimension(leftSpectrum.size);
+
+   if (!spectralValid)
+      FreeSpectral();
+
+   return spectralValid;
+   }
+
+// Releases the memory used for spectral transforms, so that it is
+// available to the trees for the next interval or family
+//
+
+void MerlinCore::FreeSpectral()
+   {
+   leftSpectrum.Free();
+   rightSpectrum.Free();
+   leftValues.Free();
+   rightValues.Free();
    }
 
 // Output buffering functions
 //
 
+void MerlinCore::Output(const char * format, ...)
+   {
+   va_list ap;
+
+   va_start(ap, format);
+   if (outputBuffer == NULL)
+      vprintf(format, ap);
+   else
+      outputBuffer->vcatprintf(format, ap);
+   va_end(ap);
+   }
+
+void MerlinCore::FlushOutput()
+   {
+   if (outputBuffer == NULL)
+      fflush(stdout);
+   }
+
 void MerlinCore::PrintHeader()
    {
    printHeader = false;
 
-   printf("Family: %5s - Founders: %-2d - Descendants: %-2d - Bits: %-2d\n",
+   Output("Family: %5s - Founders: %-2d - Descendants: %-2d - Bits: %-2d\n",
           (const char *) family->famid, mantra.f, mantra.n - mantra.f,
           mantra.bit_count);
    }
@@ -1192,9 +1579,13 @@ void MerlinCore::PrintMessage(const char * msg, ...)
    va_list ap;
 
    va_start (ap, msg);
-   vprintf(msg, ap);
-   printf("\n");
+   if (outputBuffer == NULL)
+      vprintf(msg, ap);
+   else
+      outputBuffer->vcatprintf(msg, ap);
    va_end(ap);
+
+   Output("\n");
    }
 
 void MerlinCore::ProgressReport(const char * msg, int done, int total)
@@ -1205,10 +1596,10 @@ void MerlinCore::ProgressReport(const char * msg, int done, int total)
    if (mantra.bit_count > 16 || ((done & check ) == check))
       {
       if (printHeader)
-         printf("Family %s (%d bits) -",
+         Output("Family %s (%d bits) -",
                (const char *) family->famid, mantra.bit_count);
-      printf("  %s: %3d%%%20s\r", msg, done * 100 / total, "");
-      fflush(stdout);
+      Output("  %s: %3d%%%20s\r", msg, done * 100 / total, "");
+      FlushOutput();
       cleanOutput = true;
       }
    }
@@ -1217,12 +1608,12 @@ void MerlinCore::CleanMessages()
    {
    if (cleanOutput)
       {
-      printf("%70s\r", "");
-      fflush(stdout);
+      Output("%70s\r", "");
+      FlushOutput();
       }
 
    if (!printHeader)
-      printf("\n");
+      Output("\n");
    }
 
 // Enforce maximum number of alleles on markers
@@ -1249,6 +1640,10 @@ void MerlinCore::ValidateMarker(MarkerInfo * info)
 // Stub functions that should be replaced by derived classes
 
 void MerlinCore::AnalyseLocation(int, Tree &) { }
+void MerlinCore::FamilySetupHook() { }
+void MerlinCore::FamilyUninformativeHook() { }
+void MerlinCore::FamilyLikelihoodHook() { }
+void MerlinCore::FamilyImpossibleHook() { }
 void MerlinCore::GenotypeAnalysisHook(Tree &, Tree &, int ) { }
 
 // This function prepares structures to be handled by the genotype inference
@@ -1295,22 +1690,35 @@ bool MerlinCore::GenotypeAnalysisEnabled(int, bool )
    }
 
 // Routines for swapping singlepoint results in and out of memory
-// (when the swap file exceeds 1 GB, these routines discard
-// and recalculate singlepoint results as needed).
+// (when the swap file exceeds its share of free disk space, these
+// routines discard and recalculate singlepoint results as needed).
 
 void MerlinCore::StoreSinglepoint(int position)
    {
    // Check if swap file is open
    if (!memoryManagement)
+      {
+      governor.Track(MEMORY_SINGLEPOINT, position, singlepoint[position].count);
+
+      // Start swapping once trees outgrow their share of memory
+      if (governor.OverTarget())
+         EscalateSinglepoint(position);
+
       return;
+      }
 
    // Update list of positions stored in file
    if (position == 0)
-      lastSinglepointSwap = (useSwap && !smallSwap) ? markerCount : -1;
+      lastSinglepointSwap = governor.Strategy() == MEMORY_SWAP ? markerCount : -1;
 
    // Check if tree is complex enough to merit swapping
    if (!singlepoint[position].IsSwappable())
+      {
+      governor.Track(MEMORY_SINGLEPOINT, position, singlepoint[position].count);
       return;
+      }
+
+   governor.Track(MEMORY_SINGLEPOINT, position, 0);
 
    // Check if swapping is enabled for the present location
    if (position > lastSinglepointSwap)
@@ -1320,13 +1728,19 @@ void MerlinCore::StoreSinglepoint(int position)
       }
 
    // If everything checks out, then swap the current location
-   singlepoint[position].Pack(singlepointSwap);
+   background.Pack(singlepoint[position], singlepointSwap);
 
-   // Check if swap file is filled up (i.e. exceeds 1 GB)
-   double usage = singlepointSwap.GetFileUsage();
+   // Check if swap file is filled up, in which case later
+   // trees are recalculated as needed
+   double usage = background.FileUsage(singlepointSwap);
 
-   if (usage < 0.0 || usage > 1024 * 1024 * 1024)
+   if (governor.SwapFull(usage))
+      {
       lastSinglepointSwap = position;
+
+      if (governor.Strategy() == MEMORY_SWAP)
+         governor.Escalate();
+      }
    }
 
 void MerlinCore::RetrieveSinglepoint(int position)
@@ -1335,9 +1749,15 @@ void MerlinCore::RetrieveSinglepoint(int position)
    if (!memoryManagement)
       return;
 
+   // Trees may still be on their way from the swap file
+   background.Wait(singlepoint[position]);
+
    // Check if tree is complex enough to merit swapping
    if (singlepoint[position].IsInMemory())
+      {
+      PrefetchSinglepoint(position);
       return;
+      }
 
    // Check if swapping is enabled for the present location
    if (position > lastSinglepointSwap)
@@ -1358,13 +1778,16 @@ void MerlinCore::RetrieveSinglepoint(int position)
          MarkerCluster * cluster = clusters.markerToCluster[markerid];
 
          // Score using clustering algorithms
-         cluster->ScoreLikelihood(mantra, engine);
+         MutexLock hold(clusters.lock);
+
+         if (!cache.RetrieveFromCache(mantra, *cluster, engine))
+            cluster->ScoreLikelihood(mantra, engine);
          }
       else
          {
          mantra.SelectMarker(markerid);
 
-         if (!cache.RetrieveFromCache(mantra, engine, Pedigree::markerNames[markerid]))
+         if (!cache.RetrieveFromCache(mantra, engine))
             engine.FuzzyScoreVectors(mantra);
          }
 
@@ -1379,9 +1802,18 @@ void MerlinCore::RetrieveSinglepoint(int position)
          }
       else
          singlepoint[position].Copy(engine);
+
+      CompactTree(singlepoint[position]);
+
+      profile.cacheHits += cache.hits;
+      profile.cacheMisses += cache.misses;
       }
    else
-      singlepoint[position].UnPack(singlepointSwap);
+      background.UnPack(singlepoint[position], singlepointSwap);
+
+   governor.Track(MEMORY_SINGLEPOINT, position, singlepoint[position].count);
+
+   PrefetchSinglepoint(position);
    }
 
 void MerlinCore::ReStoreSinglepoint(int position)
@@ -1399,30 +1831,45 @@ void MerlinCore::ReStoreSinglepoint(int position)
       singlepoint[position].Discard();
    else
       singlepoint[position].RePack();
+
+   governor.Track(MEMORY_SINGLEPOINT, position, 0);
    }
 
 void MerlinCore::StoreMultipoint(int position)
    {
    // Check if swap file is open
    if (!memoryManagement)
+      {
+      governor.Track(MEMORY_CONDITIONAL, position, right[position].count);
+
+      // Start swapping once trees outgrow their share of memory
+      if (governor.OverTarget())
+         EscalateMultipoint(position);
+
       return;
+      }
 
    // Update list of positions stored in file
    if (position == informativeCount - 1)
       {
       multipointSwapStart = 1;
-      multipointSwapEnd = (useSwap && !smallSwap) ? informativeCount - 1 : multipointGrid - 1;
+      multipointSwapEnd = governor.Strategy() == MEMORY_SWAP ? informativeCount - 1 : multipointGrid - 1;
       }
 
    // Check if tree is complex enough to merit swapping
    if (!right[position].IsSwappable())
+      {
+      governor.Track(MEMORY_CONDITIONAL, position, right[position].count);
       return;
+      }
+
+   governor.Track(MEMORY_CONDITIONAL, position, 0);
 
    // We always swap grid points, so as to keep recalculation
    // times manageable
    if (position % multipointGrid == 0 || position == informativeCount - 1 || zeroRecombination)
       {
-      right[position].Pack(scaffoldSwap);
+      background.Pack(right[position], scaffoldSwap);
       return;
       }
 
@@ -1434,19 +1881,22 @@ void MerlinCore::StoreMultipoint(int position)
       }
 
    // If everything checks out, then swap the current location
-   right[position].Pack(multipointSwap);
+   background.Pack(right[position], multipointSwap);
 
    // If we are already in economy mode, nothing else we can do
    if (multipointSwapEnd == multipointGrid - 1)
       return;
 
-   // Check if swap file is filled up (i.e. exceeds 1 GB)
-   double usage = multipointSwap.GetFileUsage();
+   // Check if swap file is filled up
+   double usage = background.FileUsage(multipointSwap);
 
    // If so, we discard contents unless we are "nearly done" ...
-   if ((usage < 0.0 || usage > 1024 * 1024 * 1024) && position > multipointGrid * 2)
+   if (governor.SwapFull(usage) && position > multipointGrid * 2)
       {
+      governor.Escalate();
+
       // Discard previously swapped results
+      background.Finish();
       multipointSwap.Free();
       for (int i = position; i < informativeCount - 1; i++)
          if (right[i].IsInSwapFile() && !(i % multipointGrid == 0))
@@ -1464,25 +1914,30 @@ void MerlinCore::RetrieveMultipoint(int position)
    if (!memoryManagement)
       return;
 
+   // Trees may still be on their way from the swap file
+   background.Wait(right[position]);
+
    // Check if tree is complex enough to merit swapping
    if (right[position].IsInMemory())
-      return;
-
-   // Grid points are always available from a separate swap file
-   if (position % multipointGrid == 0 || position == informativeCount - 1 || zeroRecombination)
       {
-      right[position].UnPack(scaffoldSwap);
+      PrefetchMultipoint(position);
       return;
       }
 
-   // Check if swapping is enabled for the present location
-   if (position >= multipointSwapStart && position <= multipointSwapEnd)
+   // Grid points are always available from a separate swap file, and
+   // other positions while swapping is enabled for them
+   TreeManager * file = MultipointSwapFile(position);
+
+   if (file != NULL)
       {
-      right[position].UnPack(multipointSwap);
+      background.UnPack(right[position], *file);
+      governor.Track(MEMORY_CONDITIONAL, position, right[position].count);
+      PrefetchMultipoint(position);
       return;
       }
 
    // Otherwise, we first reset the swap file state
+   background.Finish();
    multipointSwap.Free();
 
    for (int i = multipointSwapStart; i <= multipointSwapEnd; i++)
@@ -1547,6 +2002,8 @@ void MerlinCore::RetrieveMultipoint(int position)
          // Store it for future use
          right[m].Copy(engine);
          }
+
+      CompactTree(right[m]);
       }
 
    // Free memory, if appropriate
@@ -1555,12 +2012,13 @@ void MerlinCore::RetrieveMultipoint(int position)
 
    // The PackOnly function keeps the tree in memory after writing swap file
    right[position].PackOnly(multipointSwap);
+   governor.Track(MEMORY_CONDITIONAL, position, right[position].count);
    }
 
 void MerlinCore::ReStoreMultipoint(int position)
    {
    // Check if swap file is open
-   if (multipointSwap.skeleton == NULL || scaffoldSwap.skeleton == NULL)
+   if (!memoryManagement)
       return;
 
    // Check if tree is complex enough to merit swapping
@@ -1569,14 +2027,206 @@ void MerlinCore::ReStoreMultipoint(int position)
 
    // Discard information at the current position
    right[position].RePack();
+   governor.Track(MEMORY_CONDITIONAL, position, 0);
+   }
+
+void MerlinCore::MergeSwapUsage(MerlinCore & engine)
+   {
+   singlepointSwap.MergeFileSize(engine.singlepointSwap);
+   multipointSwap.MergeFileSize(engine.multipointSwap);
+   scaffoldSwap.MergeFileSize(engine.scaffoldSwap);
+
+   governor.Merge(engine.governor);
+   }
+
+// The memory governor moves to more economical strategies as trees
+// accumulate, and when a family runs out of memory
+//
+
+void MerlinCore::EnableMemoryManagement()
+   {
+   memoryManagement = true;
+
+   // Analyses can also swap their own trees from now on
+   BasicTree::SetupSwap();
+
+   if (singlepointSwap.IsOpen())
+      return;
+
+   singlepointSwap.OpenFiles();
+   multipointSwap.OpenFiles();
+   scaffoldSwap.OpenFiles();
+   }
+
+void MerlinCore::EscalateSinglepoint(int position)
+   {
+   if (!governor.Escalate())
+      return;
+
+   PrintMessage("  Memory target reached, switching to %s", governor.StrategyName());
+   EnableMemoryManagement();
+
+   // Store earlier trees as if swapping had been enabled all along
+   for (int i = 0; i <= position; i++)
+      StoreSinglepoint(i);
+   }
+
+void MerlinCore::EscalateMultipoint(int position)
+   {
+   if (!governor.Escalate())
+      return;
+
+   PrintMessage("  Memory target reached, switching to %s", governor.StrategyName());
+   EnableMemoryManagement();
+
+   // All singlepoint trees are in memory and can now be swapped
+   for (int i = 0; i < informativeCount; i++)
+      StoreSinglepoint(i);
+
+   // Right conditionals calculated so far are stored as if swapping
+   // had been enabled all along
+   for (int i = zeroRecombination ? 0 : informativeCount - 1; i >= position; i--)
+      StoreMultipoint(i);
+   }
+
+// Per family statistics for the --profile option
+//
+
+void MerlinCore::BeginProfile()
+   {
+   if (!MerlinProfile::Enabled())
+      {
+      Multipoint::moveAlongCounter = NULL;
+      return;
+      }
+
+   profile.Clear();
+   Multipoint::moveAlongCounter = &profile.moveAlong;
+   BasicTree::ResetPeakNodes();
+
+   swapReadMark = SwapBytesRead();
+   swapWrittenMark = SwapBytesWritten();
+   }
+
+void MerlinCore::FinishProfile()
+   {
+   if (!MerlinProfile::Enabled())
+      return;
+
+   // Swap counters are updated by the background thread
+   background.Finish();
+
+   if (BasicTree::peakNodes > profile.peakNodes)
+      profile.peakNodes = BasicTree::peakNodes;
+
+   profile.singlepointNodes = singlepointNodes;
+   profile.singlepointTrees = informativeCount;
+   profile.swapRead = SwapBytesRead() - swapReadMark;
+   profile.swapWritten = SwapBytesWritten() - swapWrittenMark;
+   profile.strategy = governor.StrategyName();
+   }
+
+double MerlinCore::SwapBytesRead()
+   {
+   return singlepointSwap.bytesUnPacked + multipointSwap.bytesUnPacked + scaffoldSwap.bytesUnPacked;
+   }
+
+double MerlinCore::SwapBytesWritten()
+   {
+   return singlepointSwap.bytesStored + multipointSwap.bytesStored + scaffoldSwap.bytesStored;
+   }
+
+bool MerlinCore::RetryFamily()
+   {
+   if (!governor.Retry())
+      return false;
+
+   PrintMessage("  Memory limit reached, retrying with %s", governor.StrategyName());
+   EnableMemoryManagement();
+
+   return true;
    }
 
 void MerlinCore::FreeSwap()
    {
+   background.Finish();
+
+   singlepointCursor = multipointCursor = -1;
+   singlepointStep = multipointStep = 0;
+
    BasicTree::FreeSwap();
 
    singlepointSwap.Free();
    multipointSwap.Free();
    scaffoldSwap.Free();
    }
+
+// Returns the swap file holding right conditional likelihoods for a
+// position, or NULL if they must be recalculated
+//
+
+TreeManager * MerlinCore::MultipointSwapFile(int position)
+   {
+   if (position % multipointGrid == 0 || position == informativeCount - 1 || zeroRecombination)
+      return &scaffoldSwap;
+
+   if (position >= multipointSwapStart && position <= multipointSwapEnd)
+      return &multipointSwap;
+
+   return NULL;
+   }
+
+// While trees are retrieved one position after another, the next few
+// trees in the same direction are read ahead in the background
+//
+
+void MerlinCore::PrefetchSinglepoint(int position)
+   {
+   if (!background.Active())
+      return;
+
+   if (position != singlepointCursor)
+      {
+      singlepointStep = abs(position - singlepointCursor) == 1 ? position - singlepointCursor : 0;
+      singlepointCursor = position;
+      }
+
+   if (singlepointStep == 0)
+      return;
+
+   for (int i = 0, next = position + singlepointStep; i < BackgroundSwap::prefetch; i++, next += singlepointStep)
+      {
+      if (next < 0 || next >= informativeCount || next > lastSinglepointSwap)
+         break;
+
+      background.Prefetch(singlepoint[next], singlepointSwap);
+      }
+   }
+
+void MerlinCore::PrefetchMultipoint(int position)
+   {
+   if (!background.Active())
+      return;
+
+   if (position != multipointCursor)
+      {
+      multipointStep = abs(position - multipointCursor) == 1 ? position - multipointCursor : 0;
+      multipointCursor = position;
+      }
+
+   if (multipointStep == 0)
+      return;
+
+   for (int i = 0, next = position + multipointStep; i < BackgroundSwap::prefetch; i++, next += multipointStep)
+      {
+      if (next < 0 || next >= informativeCount)
+         break;
+
+      TreeManager * file = MultipointSwapFile(next);
+
+      if (file != NULL)
+         background.Prefetch(right[next], *file);
+      }
+   }
+
  
@@ -27,6 +27,12 @@
 
 #include "Conquer.h"
 #include "TreeInfo.h"
+#include "BackgroundSwap.h"
+#include "MemoryGovernor.h"
+#include "MerlinProfile.h"
+
+class ParallelSinglepoint;
+class ParallelScan;
 
 class MerlinCore
    {
@@ -40,12 +46,19 @@ class MerlinCore
       virtual int  SetupMap(int chromosome = -1);
       virtual void SexSpecificMap();
 
+      // Copies map and analysis positions from another engine
+      void CopyMap(MerlinCore & engine);
+
+      // Updates peak swap file and memory usage with information from another engine
+      void MergeSwapUsage(MerlinCore & engine);
+
       virtual bool SelectFamily(Family * f, bool warnOnSkip = true);
 
       // Iterators for likelihood calculations
       void ScoreSinglepoint();
       void CalculateThetas();
       bool ScoreConditionals();
+      bool ScoreLikelihood();
       void ScanChromosome();
 
       // Routines for managing intermediate singlepoint results
@@ -97,12 +110,23 @@ class MerlinCore
       // Flags for controlling performance
       static bool useSwap;
       static bool smallSwap;
+      // With --threads, families are analysed in parallel. Singlepoint trees
+      // for the largest families are measured first, and families with the
+      // largest predicted costs are started first, but only among the next
+      // few families per thread to be reported, so a costly family near the
+      // end of the pedigree may still finish last. --costs reports how well
+      // the predicted costs matched the time taken by each family.
+      static int  threads;
+      static bool reportCosts;
+      static bool shareTrees;
+      static bool spectralGrid;
 
       // Internal flags to minimize useless calculations
       static bool multipoint;
       static bool scanChromosome;
       static bool betweenMarkers;
       static bool lazyRightConditional;
+      static bool likelihoodOnly;
 
       // Bounds for rescaling inheritance vectors
       double lowBound, rescale, lnScale;
@@ -133,6 +157,15 @@ class MerlinCore
       IntArray informationIndex;
       int      informativeCount;
 
+      // Total size of informative singlepoint trees, a guide to analysis cost
+      double   singlepointNodes;
+
+      // Recycles node storage between the trees used for each family
+      NodePool nodePool;
+
+      // Timings and tree statistics for the current family
+      FamilyProfile profile;
+
       // Between marker recombination fractions along sex-specific map
       Vector   femaleMarkerTheta;
       Vector   maleMarkerTheta;
@@ -172,12 +205,24 @@ class MerlinCore
       // Used for managing output buffering
       int  printHeader, cleanOutput;
 
+      // When set, messages are appended here rather than printed
+      String * outputBuffer;
+
       // Likelihood for the current family
       double likelihood;
 
       // Allows derived classes to perform custom analyses at each location
       virtual void AnalyseLocation(int pos, Tree & inheritance);
 
+      // Analyses the selected family, from singlepoint trees through to the
+      // multipoint scan, calling the hooks below as each outcome is known
+      void AnalyseFamily();
+
+      virtual void FamilySetupHook();
+      virtual void FamilyUninformativeHook();
+      virtual void FamilyLikelihoodHook();
+      virtual void FamilyImpossibleHook();
+
       // Allows derived classes to perform genotype inference
       virtual bool GenotypeAnalysisEnabled(int marker, bool globalMapping);
       virtual void GenotypeAnalysisHook(Tree & withMarker, Tree & without, int marker);
@@ -193,12 +238,62 @@ class MerlinCore
       int          multipointGrid;
       int          multipointSwapStart, multipointSwapEnd;
 
+      // Compresses and reads ahead swapped trees in a separate thread
+      BackgroundSwap background;
+
+      // Last position retrieved and direction of travel, used for reading ahead
+      int          singlepointCursor, singlepointStep;
+      int          multipointCursor, multipointStep;
+
       // Swap file helper functions
       void         FreeSwap();
+      void         PrefetchSinglepoint(int position);
+      void         PrefetchMultipoint(int position);
+      TreeManager * MultipointSwapFile(int position);
+
+      // Chooses between keeping trees in memory, swapping and recomputing
+      MemoryGovernor governor;
+
+      void         EnableMemoryManagement();
+      void         EscalateSinglepoint(int position);
+      void         EscalateMultipoint(int position);
+      bool         RetryFamily();
+
+      // Start and finish collecting statistics for the current family
+      void         BeginProfile();
+      void         FinishProfile();
+      double       SwapBytesRead();
+      double       SwapBytesWritten();
+      double       swapReadMark, swapWrittenMark;
+
+      // Rounds and shares trees that are kept for later use
+      void         CompactTree(BasicTree & tree);
 
       bool         memoryManagement;
 
+      // Scratch space for moving dense trees within each family
+      DenseBuffer  denseBuffer;
+
    private:
+      // Scores singlepoint likelihoods for multiple markers at once
+      ParallelSinglepoint * parallelScoring;
+
+      // Calculates likelihoods for multiple positions between markers
+      ParallelScan * parallelScan;
+
+      // Walsh-Hadamard transforms of the flanking trees for one interval
+      int         spectralAnchor;
+      bool        spectralValid;
+      DenseBuffer leftSpectrum, rightSpectrum;
+      DenseBuffer leftValues, rightValues;
+
+      bool SpectralInterval(Multipoint & leftMarker, int leftAnchor, int rightAnchor);
+      void FreeSpectral();
+
+      // Prints or buffers output
+      void Output(const char * format, ...);
+      void FlushOutput();
+
       // Update left conditional probabilities at the edge of map
       // (used when skipping through positions where we don't want to evaluate
       //  lod scores, etc.)
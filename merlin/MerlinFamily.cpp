@@ -25,6 +25,7 @@
 #include "MapFunction.h"
 #include "MathConstant.h"
 #include "KongAndCox.h"
+#include "MerlinWorker.h"
 #include "Houdini.h"
 
 // General analyses
@@ -48,6 +49,7 @@ bool FamilyAnalysis::allHaplotypes = false;
 bool FamilyAnalysis::simwalk2 = false;
 bool FamilyAnalysis::perFamily = false;
 bool FamilyAnalysis::writePDF = false;
+bool FamilyAnalysis::parallelFamilies = true;
 
 // Error detection and genotype inference
 bool FamilyAnalysis::inferGenotypes = false;
@@ -62,6 +64,7 @@ FamilyAnalysis::FamilyAnalysis(Pedigree & pedigree) :
    {
    errorfile = NULL;
    taskList = NULL;
+   recording = NULL;
    }
 
 FamilyAnalysis::~FamilyAnalysis()
@@ -136,6 +139,10 @@ void FamilyAnalysis::SetupGlobals()
    multipoint     = scanChromosome || bestHaplotype && zeroRecombination ||
                     (sampledHaplotypes != 0) || allHaplotypes || calcLikelihood;
 
+   // Is the likelihood the only multipoint result required?
+   likelihoodOnly = calcLikelihood && !scanChromosome && !simwalk2 &&
+                    !bestHaplotype && !sampledHaplotypes && !allHaplotypes;
+
    // Stop right conditional calculations early?
    lazyRightConditional = !(bestHaplotype && zeroRecombination || allHaplotypes ||
                             sampledHaplotypes || calcLikelihood);
@@ -200,52 +207,33 @@ void FamilyAnalysis::Analyse()
    singlepoint = NULL;
    right = NULL;
 
+   // Recycle tree storage across positions and families
+   BasicTree::SelectPool(&nodePool);
+
    // Update task information
    taskInfo.famno = mantra.family->serial;
    taskInfo.famid = &(mantra.family->famid);
 
-   try
+   // Results are recorded and only replayed once the family is done, so
+   // that the analysis can start over with a more economical strategy.
+   // With the most economical strategy, results are reported directly.
+   FamilyResults buffered;
+
+   if (governor.CanRetry())
       {
-      FreeSwap();
+      recording = &buffered;
+      outputBuffer = &buffered.output;
+      }
 
-      ScoreSinglepoint();
+   try
+      {
+      AnalyseFamily();
+      StopRecording();
 
-      if (informativeCount == 0)
-         SkipFamily();
-      else
+      if (informativeCount && bestHaplotype && !zeroRecombination)
          {
-         // Setup for generic tasks
-         for (AnalysisTask * task = taskList; task != NULL; task = task->next)
-            {
-            ProgressReport(task->TaskDescription());
-            task->SetupFamily(taskInfo);
-            }
-
-         if (multipoint)
-            {
-            if (ScoreConditionals())
-               {
-               if (scanChromosome) ScanChromosome();
-               if (calcLikelihood && perFamily) PrintMessage("  lnLikelihood = %.3f    ", likelihood);
-               if (simwalk2) hybrid.Output();
-               if (allHaplotypes) haplo.All(*this);
-               for (int i = 0; i < sampledHaplotypes; i++) haplo.Sample(*this);
-               if (bestHaplotype && zeroRecombination) haplo.MostLikely(*this);
-               lkSum += likelihood;
-               lkCount ++;
-               }
-            else
-               {
-               PrintMessage("  SKIPPED: Requires impossible recombination pattern");
-               AbortAnalysis();
-               }
-            if (!twopoint)
-               {
-               delete [] right;
-               right = NULL;
-               }
-            }
-         if (bestHaplotype && !zeroRecombination) haplo.MostLikely(*this);
+         ProfileTimer timer(profile, PROFILE_HAPLOTYPING);
+         haplo.MostLikely(*this);
          }
 
       CleanMessages();
@@ -253,22 +241,241 @@ void FamilyAnalysis::Analyse()
       }
    catch (const TreesTooBig & problem)
       {
+      FreeMemory();
+      DiscardRecording();
+
+      // Families that run out of memory before any results are reported
+      // are analysed again with a more economical strategy
+      if (RetryFamily())
+         {
+         Analyse();
+         return;
+         }
+
       PrintMessage("  SKIPPED: At least %d megabytes needed", problem.memory_request);
       CleanMessages();
 
-      FreeMemory();
+      profile.status = "skipped";
       AbortAnalysis();
       }
    catch (const OutOfTime & problem)
       {
+      DiscardRecording();
+
       PrintMessage("  SKIPPED: Analysis would require more than %d minutes\n", maxMinutes);
       CleanMessages();
 
+      profile.status = "skipped";
       FreeMemory();
       AbortAnalysis();
       };
+
+   denseBuffer.Free();
+
+   FinishProfile();
+   MerlinProfile::WriteFamily(profile, taskInfo.chromosome, mantra.family->famid,
+                              mantra.bit_count, taskList);
    };
 
+void FamilyAnalysis::FamilySetupHook()
+   {
+   // Setup for generic tasks
+   int index = 0;
+   for (AnalysisTask * task = taskList; task != NULL; task = task->next)
+      {
+      ProgressReport(task->TaskDescription());
+      Event(WORKER_SETUP_TASK, index++);
+      }
+   }
+
+void FamilyAnalysis::FamilyUninformativeHook()
+   {
+   SkipFamily();
+   }
+
+void FamilyAnalysis::FamilyLikelihoodHook()
+   {
+   if (calcLikelihood && perFamily) PrintMessage("  lnLikelihood = %.3f    ", likelihood);
+
+   Event(WORKER_LIKELIHOOD);
+
+   // SimWalk2 output and haplotypes follow the replayed results
+   StopRecording();
+
+   if (simwalk2) hybrid.Output();
+   if (allHaplotypes || sampledHaplotypes || bestHaplotype && zeroRecombination)
+      {
+      ProfileTimer timer(profile, PROFILE_HAPLOTYPING);
+      if (allHaplotypes) haplo.All(*this);
+      for (int i = 0; i < sampledHaplotypes; i++) haplo.Sample(*this);
+      if (bestHaplotype && zeroRecombination) haplo.MostLikely(*this);
+      }
+   }
+
+void FamilyAnalysis::FamilyImpossibleHook()
+   {
+   Event(WORKER_ABORT);
+   }
+
+// Families are analysed in worker threads, but results are replayed in
+// the original order, so that output is the same as for a serial run
+//
+
+void FamilyAnalysis::AnalyseInParallel()
+   {
+   if (analysisPositions.Length() == 0)
+      error("List of positions to analyze is empty\n");
+
+   ParallelAnalysis parallel(*this, taskList, threads);
+   String           discard;
+
+   parallel.Start();
+
+   for (int i = 0; i < ped.familyCount; i++)
+      {
+      FamilyResults & results = parallel.WaitFor(i);
+
+      if (results.deferred)
+         {
+         // Results for this family didn't fit in memory, so it is analysed
+         // here and replayed as it goes, using the main thread's buffers
+         BasicTree::SelectBuffers(NULL);
+
+         if (SelectFamily(ped.families[i]))
+            Analyse();
+
+         fflush(stdout);
+
+         parallel.Release(i);
+         continue;
+         }
+
+      // Messages about this family were already recorded by the worker
+      outputBuffer = &discard;
+      bool selected = SelectFamily(ped.families[i], false);
+      outputBuffer = NULL;
+      discard.Clear();
+
+      if (selected)
+         {
+         Replay(results);
+
+         profile.Merge(results.profile);
+         MerlinProfile::WriteFamily(profile, taskInfo.chromosome, mantra.family->famid,
+                                    mantra.bit_count, taskList);
+         }
+      else
+         printf("%s", (const char *) results.output);
+
+      fflush(stdout);
+
+      parallel.Release(i);
+      }
+
+   if (reportCosts)
+      parallel.ReportCosts();
+   }
+
+void FamilyAnalysis::Replay(FamilyResults & results)
+   {
+   // Update task information
+   taskInfo.famno = mantra.family->serial;
+   taskInfo.famid = &(mantra.family->famid);
+
+   likelihood = results.likelihood;
+
+   FreeSwap();
+
+   ReplayEvents(results);
+   }
+
+void FamilyAnalysis::ReplayEvents(FamilyResults & results)
+   {
+   int printed = 0;
+
+   for (int i = 0; i < results.events.Length(); i++)
+      {
+      // Print output that precedes the current event
+      fwrite((const char *) results.output + printed, 1,
+             results.offsets[i] - printed, stdout);
+      printed = results.offsets[i];
+
+      if (results.events[i] == WORKER_LOCATION)
+         AnalyseLocation(results.arguments[i], results.trees[results.arguments[i]]);
+      else
+         PerformEvent(results.events[i], results.arguments[i]);
+      }
+
+   fwrite((const char *) results.output + printed, 1,
+          results.output.Length() - printed, stdout);
+   }
+
+void FamilyAnalysis::PerformEvent(int event, int argument)
+   {
+   AnalysisTask * task = taskList;
+
+   switch (event)
+      {
+      case WORKER_SETUP_TASK :
+         {
+         for (int j = 0; j < argument; j++)
+            task = task->next;
+
+         profile.AddTask(argument, 0.0, 0.0);
+         ProfileTimer timer(profile, profile.taskWall[argument], profile.taskCpu[argument]);
+         task->SetupFamily(taskInfo);
+         }
+         break;
+      case WORKER_UNINFORMATIVE :
+         UninformativeFamily();
+         break;
+      case WORKER_ABORT :
+         AbortAnalysis();
+         break;
+      case WORKER_LIKELIHOOD :
+         lkSum += likelihood;
+         lkCount ++;
+         break;
+      }
+   }
+
+// Serial analyses record results in the same way as worker threads,
+// until the family is done or its stored trees no longer fit
+//
+
+void FamilyAnalysis::Event(int event, int argument)
+   {
+   if (recording != NULL)
+      recording->Record(event, argument);
+   else
+      PerformEvent(event, argument);
+   }
+
+void FamilyAnalysis::StopRecording()
+   {
+   if (recording == NULL)
+      return;
+
+   FamilyResults * results = recording;
+
+   recording = NULL;
+   outputBuffer = NULL;
+
+   ReplayEvents(*results);
+   results->Free();
+   }
+
+void FamilyAnalysis::DiscardRecording()
+   {
+   if (recording == NULL)
+      return;
+
+   recording->Free();
+
+   recording = NULL;
+   outputBuffer = NULL;
+   }
+
 void FamilyAnalysis::FreeMemory()
    {
    if (singlepoint != NULL) delete [] singlepoint;
@@ -291,8 +498,13 @@ void FamilyAnalysis::SkipFamily()
    // Print out overall gene-flow likelihood
    if (calcLikelihood && perFamily)
       PrintMessage("  lnLikelihood = %.3f", likelihood);
-      
-   // And update overall likelihood for the sample
+
+   Event(WORKER_UNINFORMATIVE);
+   }
+
+void FamilyAnalysis::UninformativeFamily()
+   {
+   // Update overall likelihood for the sample
    lkSum += likelihood;
    lkCount++;
 
@@ -335,21 +547,55 @@ void FamilyAnalysis::SkipFamily()
 
 void FamilyAnalysis::AnalyseLocation(int pos, Tree & inheritance)
    {
+   // Trees are stored while the thread uses less than half its memory
+   // target, leaving the remainder for the analysis itself. Beyond that,
+   // or once the family can't be retried, results are reported directly.
+   if (recording != NULL && governor.CanRetry() &&
+       (BasicTree::totalNodes + inheritance.nextFree) * (double) TREE_NODE_SIZE <= MemoryGovernor::target * 0.5 &&
+       recording->Store(pos, analysisPositions.Length(), inheritance))
+      return;
+
+   StopRecording();
+
    // The probability of the data summed all possible inheritance vectors
    double & lk = taskInfo.lk = -1.0;
 
+   // Results are reported from here on, so the family can't be retried
+   governor.Commit();
+
+   ProfileTimer timer(profile, profile.locationWall, profile.locationCpu);
+   profile.locationNodes += inheritance.count;
+   profile.locations++;
+
    if (estimateKinship15) kinship15.Calculate(inheritance, labels[pos]);
    if (estimateMatrices) lk = matrix.Calculate(inheritance, labels[pos]);
-   if (estimateIBD) lk = ibd.Calculate(inheritance, labels[pos]);
+   if (estimateIBD)
+      {
+      // IBD and kinship coefficients can be scored in a single pass
+      if (kinship.write || kinship.store || kinship.selectCases)
+         {
+         SharingScorer * scorers[2] = { &ibd, &kinship };
+         SharingScorer::Score(inheritance, scorers, 2);
+         }
+
+      lk = ibd.Calculate(inheritance, labels[pos]);
+      }
 
    // Execute generic analysis hooks
-   for (AnalysisTask * task = taskList; task != NULL; task = task->next)
+   int index = 0;
+   for (AnalysisTask * task = taskList; task != NULL; task = task->next, index++)
+      {
+      profile.AddTask(index, 0.0, 0.0);
+      ProfileTimer timer(profile, profile.taskWall[index], profile.taskCpu[index]);
       task->Analyse(taskInfo, inheritance, pos);
+      }
    }
 
 void FamilyAnalysis::GenotypeAnalysisHook
    (Tree & withMarker, Tree & withoutMarker, int informativeMarker)
    {
+   governor.Commit();
+
    if (findErrors)
       ErrorCheck(withMarker, withoutMarker, informativeMarker);
 
@@ -431,11 +677,20 @@ void FamilyAnalysis::ErrorCheck
 
 void FamilyAnalysis::ShowLODs()
    {
+   // Analyses that combine all families are profiled once per chromosome
+   FamilyProfile summary;
+   double wall[PROFILE_SUMMARIES] = { 0.0, 0.0, 0.0 };
+   double cpu[PROFILE_SUMMARIES] = { 0.0, 0.0, 0.0 };
+
    if (storeKinshipForVc)
+      {
+      ProfileTimer timer(summary, wall[PROFILE_VC], cpu[PROFILE_VC]);
       vc.Analyse(*this);
+      }
 
    if (storeKinshipForAssoc)
       {
+      ProfileTimer timer(summary, wall[PROFILE_ASSOCIATION], cpu[PROFILE_ASSOCIATION]);
       AssociationAnalysis engine;
 
       if (perFamily) engine.OpenPerFamilyFile(taskInfo.chromosome);
@@ -445,18 +700,25 @@ void FamilyAnalysis::ShowLODs()
 
    if (fastAssociationAnalysis)
       {
+      ProfileTimer timer(summary, wall[PROFILE_ASSOCIATION], cpu[PROFILE_ASSOCIATION]);
       FastAssociationAnalysis engine;
 
       engine.AnalyseAssociation(*this);
       }
 
-   // Generic analysis hooks
-   for (AnalysisTask * task = taskList; task != NULL; task = task->next)
-      task->Report(taskInfo);
+      {
+      ProfileTimer timer(summary, wall[PROFILE_REPORTS], cpu[PROFILE_REPORTS]);
+
+      // Generic analysis hooks
+      for (AnalysisTask * task = taskList; task != NULL; task = task->next)
+         task->Report(taskInfo);
+
+      // Genotype inference
+      if (outputInferredGenotypes)
+         imputationEngine.OutputGenotypes(ped, markers);
+      }
 
-   // Genotype inference
-   if (outputInferredGenotypes)
-      imputationEngine.OutputGenotypes(ped, markers);
+   MerlinProfile::WriteChromosome(taskInfo.chromosome, ped.familyCount, wall, cpu);
    }
 
 void FamilyAnalysis::OpenErrorFile()
@@ -478,6 +740,7 @@ void FamilyAnalysis::SetupFiles()
    if (bestHaplotype || (sampledHaplotypes != 0) || allHaplotypes) haplo.OpenFile();
    if (simwalk2) hybrid.OpenFiles();
    if (writePDF) pdf.OpenFile((const char *) (MerlinCore::filePrefix + ".pdf"));
+   MerlinProfile::OpenFile();
 
    for (AnalysisTask * task = taskList; task != NULL; task = task->next)
       task->OpenFiles(taskInfo, MerlinCore::filePrefix);
@@ -497,6 +760,7 @@ void FamilyAnalysis::CloseFiles()
    if (bestHaplotype || (sampledHaplotypes != 0) || allHaplotypes) haplo.CloseFile();
    if (simwalk2) hybrid.CloseFiles();
    if (writePDF) pdf.CloseFile();
+   MerlinProfile::CloseFile();
    if (storeKinshipForAssoc) AssociationAnalysis::OutputRefinedModels(MerlinCore::filePrefix, ped);
    if (fastAssociationAnalysis) FastAssociationAnalysis::OutputFastModels(MerlinCore::filePrefix, ped);
 
@@ -34,6 +34,8 @@
 // The MerlinCore class manages basic likelihood calculations
 #include "MerlinCore.h"
 
+class FamilyResults;
+
 class FamilyAnalysis : public MerlinCore
    {
    public:
@@ -49,6 +51,9 @@ class FamilyAnalysis : public MerlinCore
       virtual bool SelectFamily(Family * f, bool warnOnSkip = true);
       void Analyse();
 
+      // Analyses all families, using multiple threads
+      void AnalyseInParallel();
+
       void ShowLODs();
       void ShowLikelihood();
 
@@ -97,6 +102,9 @@ class FamilyAnalysis : public MerlinCore
       static bool perFamily;
       static bool writePDF;
 
+      // Cleared for analyses that must process one family at a time
+      static bool parallelFamilies;
+
       // Specialized engines
       MerlinMatrix       matrix;
       MerlinKinship      kinship;
@@ -125,6 +133,12 @@ class FamilyAnalysis : public MerlinCore
       virtual void GenotypeAnalysisHook(Tree & withMarker, Tree & without, int marker);
       virtual bool GenotypeAnalysisEnabled(int informativeMarker, bool global);
 
+      // Interface between family analysis steps and MerlinCore
+      virtual void FamilySetupHook();
+      virtual void FamilyUninformativeHook();
+      virtual void FamilyLikelihoodHook();
+      virtual void FamilyImpossibleHook();
+
    private:
       // Generic task list ... new functionality should go here
       AnalysisTask * taskList;
@@ -143,6 +157,19 @@ class FamilyAnalysis : public MerlinCore
 
       // Functions for managing task list
       void NewTask(AnalysisTask * task);
+
+      // Functions for replaying results from parallel analyses
+      void Replay(FamilyResults & results);
+      void ReplayEvents(FamilyResults & results);
+      void PerformEvent(int event, int argument);
+      void UninformativeFamily();
+
+      // Results for the current family, while these are being recorded
+      FamilyResults * recording;
+
+      void Event(int event, int argument = 0);
+      void StopRecording();
+      void DiscardRecording();
    };
 
 #endif
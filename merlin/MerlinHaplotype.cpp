@@ -812,7 +812,7 @@ void MerlinHaplotype::FindBest(Tree & tree, IntArray & best_vector)
 void MerlinHaplotype::FindBestRecursively(Tree & tree, int node, int bit,
                                           IntArray & best)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -884,7 +884,7 @@ void MerlinHaplotype::FindBest(Tree & tree, IntArray & best, IntArray & flanker)
 void MerlinHaplotype::FindBestRecursively(Tree & tree, int node, int bit, double lk,
                                           IntArray & best, IntArray & flanker)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -946,7 +946,7 @@ void MerlinHaplotype::Sample(Tree & tree, IntArray & best_vector)
 void MerlinHaplotype::SampleRecursively(Tree & tree, int node, int bit,
                                         IntArray & best, double weight)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -984,7 +984,7 @@ void MerlinHaplotype::SampleRecursively(Tree & tree, int node, int bit,
 void MerlinHaplotype::SampleRecursively(Tree & tree, int node, int bit, double lk,
                                           IntArray & best, IntArray & flanker)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -1076,7 +1076,7 @@ void MerlinHaplotype::Sample(Tree & tree,
 void MerlinHaplotype::ListAllRecursively(Tree & tree, int node, int bit,
                                          double n, HaplotypeChain & head)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -23,7 +23,8 @@
 // The routines in this section perform IBD calculations
 //    Calculate(...) calculates and outputs IBD state probabilities
 //                   returning the overall likelihood of all vectors in the tree
-//    Score(...)  traverses an inheritance tree and fills IBD1 and IBD2
+//    Accumulate(...) is called by SharingScorer while traversing an
+//                   inheritance tree and fills IBD1 and IBD2
 //                   with relative sharing probabities
 //    Output(...) rescales sharing probabilities to the 0.0 .. 1.0 range
 //                   and stores them in a file
@@ -32,80 +33,25 @@
 
 double MerlinIBD::Calculate(Tree & tree, const char * label)
    {
-   // Dimension IBD matrices
-   IBD1.Dimension(mantra.n, mantra.n);
-   IBD2.Dimension(mantra.n, mantra.n);
-   IBD1.Zero();
-   IBD2.Zero();
-
    // Calculate IBDs as well as the overall likelihood
-   double likelihood  = Score(tree, 0, tree.bit_count - 1);
+   double likelihood  = SharingScorer::Calculate(tree);
 
    Output(label, likelihood);
 
    return likelihood * pow(2.0, -mantra.bit_count);
    }
 
-double MerlinIBD::Score(Tree & tree, int node, int bit, int start)
+void MerlinIBD::Prepare()
    {
-   double sum = 0.0; // Initialization avoids compiler warning
-   int pivot, end;
-
-   if (bit != mantra.bit_count - 1)
-      {
-      int pivot = bit == -1 ? mantra.two_n : mantra.bits[bit];
-      int last_pivot = mantra.bits[bit+1] + 1;
-
-      for (int i = last_pivot; i < pivot; i++)
-         mantra.state[i] = mantra.state[mantra.vector[i]];
-      }
-
-   if (bit >= 0)
-      {
-      pivot = mantra.bits[bit];
-      end = pivot & ~1;
-
-      switch (tree.nodes[node].type)
-         {
-         case TREE_NODE_ZERO :
-            return 0.0;
-         case TREE_NODE_LEAF :
-            uninformative.Dimension(mantra.two_n);
-            uninformative.Zero();
-            uninformative[pivot] = true;
-
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, node, bit - 1, end);
-            break;
-         case TREE_NODE_ONE :
-            uninformative.Dimension(mantra.two_n);
-            uninformative.Zero();
-            uninformative[pivot] = true;
-
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, tree.nodes[node].child[0], bit - 1, end);
-            break;
-         case TREE_NODE_TWO :
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = Score(tree, tree.nodes[node].child[0], bit - 1, end);
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] |= 1];
-            sum += Score(tree, tree.nodes[node].child[1],bit - 1, end);
-            break;
-         }
-      }
-   else
-      {
-      // At the base of the tree there are only zero nodes
-      // and leaf nodes ...
-
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
-         return 0.0;
-
-      end = mantra.two_n;
-      sum = tree.nodes[node].value;
-      }
-
+   // Dimension IBD matrices
+   IBD1.Dimension(mantra.n, mantra.n);
+   IBD2.Dimension(mantra.n, mantra.n);
+   IBD1.Zero();
+   IBD2.Zero();
+   }
 
+void MerlinIBD::Accumulate(int start, int end, double sum)
+   {
    for ( int i = start, ii = start >> 1 ; i < end; i++, i++, ii++)
       for ( int j = 0, jj = 0; j <= i; j++, j++, jj++)
          if (mantra.ibd[ii][jj] == MANTRA_IBD_UNKNOWN)
@@ -122,8 +68,6 @@ double MerlinIBD::Score(Tree & tree, int node, int bit, int start)
                 mantra.state[i+1] == mantra.state[j])
                IBD1[ii][jj] += sum;
             }
-
-   return sum;
    }
 
 void MerlinIBD::Output(const char * label, double scale)
@@ -252,64 +196,8 @@ double MerlinIBD::PairWiseIBD2(int a, int b, int c, int d)
              c == a ? parent : c, d == a ? parent : d);
    }
 
-double MerlinIBD::WeightedScore(Tree & tree, int node, int bit, int start,
-                        double weight)
+void MerlinIBD::WeightedAccumulate(int start, int end, double sum)
    {
-   double sum = 0.0; // Initialization avoids compiler warning
-   int pivot, end;
-
-   if (bit != mantra.bit_count - 1)
-      {
-      int pivot = bit == -1 ? mantra.two_n : mantra.bits[bit];
-      int last_pivot = mantra.bits[bit+1] + 1;
-
-      for (int i = last_pivot; i < pivot; i++)
-         mantra.state[i] = mantra.state[mantra.vector[i]];
-      }
-
-   if (bit >= 0)
-      {
-      pivot = mantra.bits[bit];
-      end = pivot & ~1;
-
-      switch (tree.nodes[node].type)
-         {
-         case TREE_NODE_ZERO :
-            return 0.0;
-         case TREE_NODE_LEAF :
-            uninformative[pivot] = true;
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, node, bit - 1, end, weight * 2.0);
-            break;
-         case TREE_NODE_ONE :
-            uninformative[pivot] = true;
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, tree.nodes[node].child[0], bit - 1, end,
-                  weight * 2.0);
-            break;
-         case TREE_NODE_TWO :
-            uninformative[pivot] = false;
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, tree.nodes[node].child[0], bit - 1, end,
-                  weight);
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] |= 1];
-            sum += WeightedScore(tree, tree.nodes[node].child[1],bit - 1, end,
-                   weight);
-            break;
-         }
-      }
-   else
-      {
-      // At the base of the tree there are only zero nodes
-      // and leaf nodes ...
-
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
-         return 0.0;
-
-      end = mantra.two_n;
-      sum = tree.nodes[node].value * weight;
-      }
-
    for ( int i = start, ii = start >> 1 ; i < end; i++, i++, ii++)
       for ( int j = 0, jj = 0; j <= i; j++, j++, jj++)
          if (mantra.ibd[ii][jj] == MANTRA_IBD_UNKNOWN)
@@ -324,8 +212,6 @@ double MerlinIBD::WeightedScore(Tree & tree, int node, int bit, int start,
             IBD1[ii][jj] += PairWiseIBD1(i, i + 1, j, j + (isMale ? 0 : 1)) * sum;
 #endif
             }
-
-   return sum;
    }
 
 
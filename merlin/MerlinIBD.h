@@ -23,16 +23,16 @@
 #include "Mantra.h"
 #include "Tree.h"
 #include "MerlinCore.h"
+#include "SharingScorer.h"
 
 #include <stdio.h>
 
-class MerlinIBD
+class MerlinIBD : public SharingScorer
    {
    public:
-      MerlinIBD(Mantra & m) : mantra(m) {}
+      MerlinIBD(Mantra & m) : SharingScorer(m) {}
 
       double Calculate(Tree & tree, const char * label);
-      double Score(Tree & tree, int node, int bit, int start = 0);
       void   Output(const char * label, double scale);
 
       void   OpenFile();
@@ -40,14 +40,17 @@ class MerlinIBD
 
       void   SelectFamily(Pedigree * p, Family * f);
 
+   protected:
+      // Accumulate IBD sharing probabilities during tree traversal
+      virtual void Prepare();
+      virtual void Accumulate(int start, int end, double sum);
+      virtual void WeightedAccumulate(int start, int end, double sum);
+
    private:
       Pedigree * ped;
       Family   * family;
-      Mantra   & mantra;
 
       // Specialized routines for trees with symmetries
-      double WeightedScore(Tree & tree, int node, int bit, int start,
-                           double weight = 2.0);
       double PairWiseIBD1(int a, int b, int c, int d);
       double PairWiseIBD2(int a, int b, int c, int d);
 
@@ -56,9 +59,6 @@ class MerlinIBD
 
       // Temporary storage
       Matrix   IBD1, IBD2;
-
-      // Uninformative meiosis in trees with symmetries
-      IntArray uninformative;
    };
 
 #endif
@@ -25,7 +25,8 @@
 // The routines in this section perform Kinship calculations
 //    Calculate(...) calculates and outputs kinship coefficients
 //                   returning the overall likelihood of all vectors in the tree
-//    Score(...)  traverses an inheritance tree and fills kinship matrix
+//    Accumulate(...) is called by SharingScorer while traversing an
+//                   inheritance tree and fills kinship matrix
 //                   with unscaled kinship coefficients
 //    Output(...) rescales coefficients to the 0.0 .. 1.0 range
 //                   and stores them in a file
@@ -33,7 +34,7 @@
 //
 
 MerlinKinship::MerlinKinship(Mantra & m)
-   : mantra(m)
+   : SharingScorer(m)
    {
    ped = NULL;
    family = NULL;
@@ -51,12 +52,8 @@ MerlinKinship::~MerlinKinship()
 
 void MerlinKinship::Analyse(AnalysisInfo & info, Tree & tree, int position)
    {
-   // Dimension Kinship matrices
-   kinship.Dimension(mantra.n, mantra.n);
-   kinship.Zero();
-
-   // Calculate IBDs as well as the overall likelihood
-   double likelihood  = Score(tree, 0, tree.bit_count - 1);
+   // Calculate kinships as well as the overall likelihood
+   double likelihood  = Calculate(tree);
    double scale = 1.0 / likelihood * 0.25;
 
    if (write) Output((*info.labels)[position], scale);
@@ -71,12 +68,8 @@ void MerlinKinship::AnalyseUninformative(AnalysisInfo & info, Tree & tree)
    // Allocates memory, etc...
    SetupFamily(info);
 
-   // Dimension Kinship matrices
-   kinship.Dimension(mantra.n, mantra.n);
-   kinship.Zero();
-
-   // Calculate IBDs as well as the overall likelihood
-   double likelihood  = Score(tree, 0, tree.bit_count - 1);
+   // Calculate kinships as well as the overall likelihood
+   double likelihood  = Calculate(tree);
    double scale = 1.0 / likelihood * 0.25;
 
    for (int position = 0; position < info.positions; position++)
@@ -89,65 +82,15 @@ void MerlinKinship::AnalyseUninformative(AnalysisInfo & info, Tree & tree)
    info.lk = likelihood * pow(2.0, -mantra.bit_count);
    }
 
-double MerlinKinship::Score(Tree & tree, int node, int bit, int start)
+void MerlinKinship::Prepare()
    {
-   double sum = 0.0; // Initialization avoids compiler warning
-   int pivot, end;
-
-   if (bit != mantra.bit_count - 1)
-      {
-      int pivot = bit == -1 ? mantra.two_n : mantra.bits[bit];
-      int last_pivot = mantra.bits[bit+1] + 1;
-
-      for (int i = last_pivot; i < pivot; i++)
-         mantra.state[i] = mantra.state[mantra.vector[i]];
-      }
-
-   if (bit >= 0)
-      {
-      pivot = mantra.bits[bit];
-      end = pivot & ~1;
-
-      switch (tree.nodes[node].type)
-         {
-         case TREE_NODE_ZERO :
-            return 0.0;
-         case TREE_NODE_LEAF :
-            uninformative.Dimension(mantra.two_n);
-            uninformative.Zero();
-            uninformative[pivot] = true;
-
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, node, bit - 1, end);
-            break;
-         case TREE_NODE_ONE :
-            uninformative.Dimension(mantra.two_n);
-            uninformative.Zero();
-            uninformative[pivot] = true;
-
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, tree.nodes[node].child[0], bit - 1, end);
-            break;
-         case TREE_NODE_TWO :
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = Score(tree, tree.nodes[node].child[0], bit - 1, end);
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] |= 1];
-            sum += Score(tree, tree.nodes[node].child[1],bit - 1, end);
-            break;
-         }
-      }
-   else
-      {
-      // At the base of the tree there are only zero nodes
-      // and leaf nodes ...
-
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
-         return 0.0;
-
-      end = mantra.two_n;
-      sum = tree.nodes[node].value;
-      }
+   // Dimension Kinship matrices
+   kinship.Dimension(mantra.n, mantra.n);
+   kinship.Zero();
+   }
 
+void MerlinKinship::Accumulate(int start, int end, double sum)
+   {
    for ( int i = start, ii = start >> 1 ; i < end; i++, i++, ii++)
       for ( int j = 0, jj = 0; j <= i; j++, j++, jj++)
          if (mantra.ibd[ii][jj] == MANTRA_IBD_UNKNOWN)
@@ -156,8 +99,6 @@ double MerlinKinship::Score(Tree & tree, int node, int bit, int start)
                 (mantra.state[i+1] == mantra.state[j+1] ) +
                 (mantra.state[i]   == mantra.state[j+1] ) +
                 (mantra.state[i+1] == mantra.state[j]   ));
-
-   return sum;
    }
 
 // Routines for scoring kinships in trees with symmetries
@@ -220,71 +161,14 @@ double MerlinKinship::AlleleKinship(int a, int b)
       }
    }
 
-double MerlinKinship::WeightedScore(Tree & tree, int node, int bit, int start,
-                                    double weight)
+void MerlinKinship::WeightedAccumulate(int start, int end, double sum)
    {
-   double sum = 0.0; // Initialization avoids compiler warning
-   int pivot, end;
-
-   if (bit != mantra.bit_count - 1)
-      {
-      int pivot = bit == -1 ? mantra.two_n : mantra.bits[bit];
-      int last_pivot = mantra.bits[bit+1] + 1;
-
-      for (int i = last_pivot; i < pivot; i++)
-         mantra.state[i] = mantra.state[mantra.vector[i]];
-      }
-
-   if (bit >= 0)
-      {
-      pivot = mantra.bits[bit];
-      end = pivot & ~1;
-
-      switch (tree.nodes[node].type)
-         {
-         case TREE_NODE_ZERO :
-            return 0.0;
-         case TREE_NODE_LEAF :
-            uninformative[pivot] = true;
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, node, bit - 1, end, weight * 2.0);
-            break;
-         case TREE_NODE_ONE :
-            uninformative[pivot] = true;
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, tree.nodes[node].child[0], bit - 1, end,
-                                weight * 2.0);
-            break;
-         case TREE_NODE_TWO :
-            uninformative[pivot] = false;
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
-            sum = WeightedScore(tree, tree.nodes[node].child[0], bit - 1, end,
-                                weight);
-            mantra.state[pivot] = mantra.state[mantra.vector[pivot] |= 1];
-            sum += WeightedScore(tree, tree.nodes[node].child[1],bit - 1, end,
-                                 weight);
-            break;
-         }
-      }
-   else
-      {
-      // At the base of the tree there are only zero nodes
-      // and leaf nodes ...
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
-         return 0.0;
-
-      end = mantra.two_n;
-      sum = tree.nodes[node].value * weight;
-      }
-
    for ( int i = start, ii = start >> 1 ; i < end; i++, i++, ii++)
       for ( int j = 0, jj = 0; j <= i; j++, j++, jj++)
          if (mantra.ibd[ii][jj] == MANTRA_IBD_UNKNOWN)
             kinship[ii][jj] += sum *
                (AlleleKinship(i, j) + AlleleKinship(i + 1, j + 1) +
                 AlleleKinship(i + 1, j) + AlleleKinship(i, j + 1));
-
-   return sum;
    }
 
 // File I/O routines
@@ -397,12 +281,8 @@ void MerlinKinship::SetupFamily(AnalysisInfo & info)
       NPL_Pairs npl;
       TreeInfo  stats;
 
-      // Dimension Kinship matrices
-      kinship.Dimension(mantra.n, mantra.n);
-      kinship.Zero();
-
-      // Calculate IBDs as well as the overall likelihood
-      double likelihood = Score(dummy, 0, dummy.bit_count - 1);
+      // Calculate kinships as well as the overall likelihood
+      double likelihood = Calculate(dummy);
       double scale = 1.0 / likelihood * 0.25;
 
       prior.Dimension(ped->affectionCount);
@@ -460,6 +340,11 @@ void MerlinKinship::SkipFamily(AnalysisInfo &)
    if (store) matrices[family->serial].Dimension(0);
    }
 
+const char * MerlinKinship::TaskName()
+   {
+   return "kinship";
+   }
+
 void MerlinKinship::Store(int position, double scale)
    {
    int index = position * (family->count - family->founders) *
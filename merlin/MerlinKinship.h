@@ -24,10 +24,11 @@
 #include "Tree.h"
 #include "MerlinCore.h"
 #include "AnalysisTask.h"
+#include "SharingScorer.h"
 
 #include <stdio.h>
 
-class MerlinKinship : public AnalysisTask
+class MerlinKinship : public AnalysisTask, public SharingScorer
    {
    public:
       MerlinKinship(Mantra & m);
@@ -35,7 +36,6 @@ class MerlinKinship : public AnalysisTask
 
       virtual void Analyse(AnalysisInfo & info, Tree & tree, int position);
       virtual void AnalyseUninformative(AnalysisInfo & info, Tree & dummy);
-      double Score(Tree & tree, int node, int bit, int start = 0);
 
       virtual void OpenFiles(AnalysisInfo & info, String & prefix);
       virtual void CloseFiles();
@@ -55,17 +55,22 @@ class MerlinKinship : public AnalysisTask
       // were analysis could not be completed
       virtual void SkipFamily(AnalysisInfo & info);
 
+      virtual const char * TaskName();
+
       bool   write, store, selectCases;
 
+   protected:
+      // Accumulate kinship coefficients during tree traversal
+      virtual void Prepare();
+      virtual void Accumulate(int start, int end, double sum);
+      virtual void WeightedAccumulate(int start, int end, double sum);
+
    private:
       Pedigree * ped;
       Family   * family;
-      Mantra   & mantra;
 
       // Routines for scoring kinship in trees with symmetries
       double   AlleleKinship(int allele1, int allele2);
-      double   WeightedScore(Tree & tree, int node, int bit, int start,
-                             double weight = 2.0);
 
       // Output files
       FILE     * kinfile;
@@ -78,9 +83,6 @@ class MerlinKinship : public AnalysisTask
       // Temporary storage
       Matrix   kinship;
 
-      // Track uninformative meiosis in the pedigree
-      IntArray uninformative;
-
       // Store kinship matrices for all families
       // prior to variance components analysis
       Vector * matrices;
@@ -80,7 +80,7 @@ double MerlinKinship15::WScore(Tree & tree, int node, int bit, int start, double
       pivot = mantra.bits[bit];
       end = pivot & ~1;
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             return 0.0;
@@ -105,7 +105,7 @@ double MerlinKinship15::WScore(Tree & tree, int node, int bit, int start, double
       // At the base of the tree there are only zero nodes
       // and leaf nodes ...
 
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
+      if (tree.Type(node) == TREE_NODE_ZERO)
          return 0.0;
 
       end = mantra.two_n;
@@ -162,7 +162,7 @@ double MerlinKinship15::Score(Tree & tree, int node, int bit, int start)
       pivot = mantra.bits[bit];
       end = pivot & ~1;
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             return 0.0;
@@ -187,7 +187,7 @@ double MerlinKinship15::Score(Tree & tree, int node, int bit, int start)
       // At the base of the tree there are only zero nodes
       // and leaf nodes ...
 
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
+      if (tree.Type(node) == TREE_NODE_ZERO)
          return 0.0;
 
       end = mantra.two_n;
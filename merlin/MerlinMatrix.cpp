@@ -84,7 +84,7 @@ double MerlinMatrix::Score(Tree & tree, int node, int bit, int start, int pos)
 
    if (bit >= 0)
       {
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             return 0.0;
@@ -110,7 +110,7 @@ double MerlinMatrix::Score(Tree & tree, int node, int bit, int start, int pos)
       // and leaf nodes ...
 
       // Zero nodes we ignore
-      if (tree.nodes[node].type == TREE_NODE_ZERO)
+      if (tree.Type(node) == TREE_NODE_ZERO)
          return 0.0;
 
       // So this is a leaf node
@@ -96,9 +96,13 @@ ParametricAnalysis::ParametricAnalysis(DisModel * m, StringArray & l)
    impossible = new IntArray [modelCount];
    models = new DisModel [modelCount];
    likelihoods = new Tree [modelCount];
+   modelTrees = new Tree * [modelCount];
 
    for (int i = 0; i < modelCount; i++)
+      {
       models[i] = m[i];
+      modelTrees[i] = &likelihoods[i];
+      }
 
    baseline.Dimension(modelCount);
 
@@ -110,6 +114,7 @@ ParametricAnalysis::~ParametricAnalysis()
    {
    delete [] impossible;
    delete [] likelihoods;
+   delete [] modelTrees;
    delete [] models;
    delete [] scores;
    delete [] rawScores;
@@ -170,9 +175,12 @@ void ParametricAnalysis::Analyse(AnalysisInfo & info, Tree & tree, int position)
 
    double offset = -log(info.lk);
 
+   // Evaluate likelihoods for all models in a single pass
+   tree.MeanProducts(modelTrees, modelCount, products);
+
    for (int i = 0; i < modelCount; i++)
       {
-      double lkPos = tree.MeanProduct(likelihoods[i]);
+      double lkPos = products[i];
       double lkRatio = 0.0; // Initialization avoids compiler warning
 
       if (lkPos <= 0.0)
@@ -363,4 +371,9 @@ const char * ParametricAnalysis::TaskDescription()
    {
    return ("Scoring Parametric Models");
    }
+
+const char * ParametricAnalysis::TaskName()
+   {
+   return "parametric";
+   }
  
@@ -67,6 +67,7 @@ class ParametricAnalysis : public AnalysisTask, private ScalarMinimizer
       virtual void CloseFiles();
 
       virtual const char * TaskDescription();
+      virtual const char * TaskName();
 
       // Estimates proportion of admixed families to maximize LOD score
       void   EstimateAlpha();
@@ -86,6 +87,10 @@ class ParametricAnalysis : public AnalysisTask, private ScalarMinimizer
       // Tree with model information
       Tree * likelihoods;
 
+      // Pointers to each model tree, for scoring all models in one pass
+      Tree ** modelTrees;
+      Vector  products;
+
       // File for storing results for individual families
       FILE * scoreFile, * scoreTable;
       String filename, tablename;
@@ -26,6 +26,7 @@
 #include "Pedigree.h"
 #include "Houdini.h"
 #include "Random.h"
+#include "ThreadPool.h"
 
 int  MerlinParameters::maxMegabytes = 0;
 bool MerlinParameters::trimPedigree = false;
@@ -84,6 +85,8 @@ BEGIN_LONG_PARAMETERS(longParameters)
       LONG_PARAMETER("useCovariates", &VarianceComponents::useCovariates)
       LONG_PARAMETER("ascertainment", &VarianceComponents::useProbands)
       LONG_DOUBLEPARAMETER("unlinked", &VarianceComponents::unlinkedFraction)
+      LONG_DOUBLEPARAMETER("screen", &VarianceComponents::screenLod)
+      LONG_PARAMETER("coldStart", &VarianceComponents::coldStart)
    LONG_PARAMETER_GROUP("Association")
       LONG_PARAMETER("infer", &FamilyAnalysis::inferGenotypes)
       LONG_PARAMETER("assoc", &MerlinParameters::associationAnalysis)
@@ -126,7 +129,19 @@ BEGIN_LONG_PARAMETERS(longParameters)
 #endif
       LONG_PARAMETER("swap", &FamilyAnalysis::useSwap)
       LONG_PARAMETER("smallSwap", &MerlinCore::smallSwap)
-//      LONG_STRINGPARAMETER("cache", &MerlinCache::directory)
+      LONG_STRINGPARAMETER("codec", &TreeManager::codecName)
+      LONG_INTPARAMETER("prefetch", &BackgroundSwap::prefetch)
+      LONG_INTPARAMETER("ioBudget", &BackgroundSwap::megabytes)
+      LONG_INTPARAMETER("threads", &MerlinCore::threads)
+      LONG_PARAMETER("costs", &MerlinCore::reportCosts)
+      LONG_PARAMETER("derivativeFree", &NormalSet::derivativeFree)
+      LONG_STRINGPARAMETER("profile", &MerlinProfile::filename)
+      LONG_PARAMETER("shareTrees", &MerlinCore::shareTrees)
+      LONG_PARAMETER("float", &BasicTree::floatLeaves)
+      LONG_INTPARAMETER("dosageBits", &GenotypeInference::dosageBits)
+      LONG_PARAMETER("spectral", &MerlinCore::spectralGrid)
+      LONG_PARAMETER("recursiveMoves", &Multipoint::recursiveMoves)
+      LONG_STRINGPARAMETER("cache", &MerlinCache::directory)
    LONG_PARAMETER_GROUP("Output")
       LONG_PARAMETER("quiet", &MerlinCore::quietOutput)
       LONG_PARAMETER("markerNames", &MerlinCore::useMarkerNames)
@@ -307,6 +322,12 @@ void MerlinParameters::Read(int argc, char ** argv, int start)
        VarianceComponents::unlinkedFraction >= 1.0)
       VarianceComponents::unlinkedFraction = 0.0;
 
+   // Inferred genotype probabilities are stored in 8 or 16 bits
+   if (GenotypeInference::dosageBits != 0 &&
+       GenotypeInference::dosageBits != 8 && GenotypeInference::dosageBits != 16)
+      Enforce(GenotypeInference::dosageBits, 0,
+              "The --%s option must be set to 8 or 16 and will be disabled\n", "dosageBits");
+
    // Limited range of options zero recombination is assumed
    if (MerlinCore::zeroRecombination)
       {
@@ -342,9 +363,34 @@ void MerlinParameters::Read(int argc, char ** argv, int start)
    if (associationAnalysis || FamilyAnalysis::fastAssociationAnalysis)
       FamilyAnalysis::inferGenotypes = true;
 
+   // At least one thread is needed for analysis
+   if (MerlinCore::threads < 1)
+      MerlinCore::threads = 1;
+
+   ThreadPool::defaultThreads = MerlinCore::threads;
+
+   // Analyses that update genotypes or use random numbers while
+   // processing each family are carried out one family at a time,
+   // with multiple threads used only for singlepoint calculations
+   if (MerlinCore::threads > 1)
+      {
+      const char * reason = "Families are analysed one at a time for %s\n";
+
+      if (FamilyAnalysis::findErrors || FamilyAnalysis::inferGenotypes)
+         Enforce(FamilyAnalysis::parallelFamilies, false, reason, "error checking and genotype inference");
+
+      if (FamilyAnalysis::bestHaplotype || FamilyAnalysis::sampledHaplotypes ||
+          FamilyAnalysis::allHaplotypes)
+         Enforce(FamilyAnalysis::parallelFamilies, false, reason, "haplotyping");
+
+      if (FamilyAnalysis::simwalk2)
+         Enforce(FamilyAnalysis::parallelFamilies, false, reason, "SimWalk2 output");
+      }
+
    // Some basic calculations to convert megabyte memory usage
    // limit into maximum TreeNode count
-   BasicTree::maxNodes = (1024 * 1024) / sizeof(TreeNode) * maxMegabytes;
+   BasicTree::maxNodes = (1024 * 1024) / TREE_NODE_SIZE * maxMegabytes;
+   MemoryGovernor::SetupGlobals(maxMegabytes, MerlinCore::threads);
 
    // If we are saving replicated data, then we should also
    // be simulating it!
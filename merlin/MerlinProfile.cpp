@@ -0,0 +1,298 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinProfile.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "MerlinProfile.h"
+#include "AnalysisTask.h"
+#include "Error.h"
+
+#include <time.h>
+#include <sys/time.h>
+
+static const char * phaseNames[PROFILE_PHASES] =
+   { "singlepoint", "conditionals", "scan", "haplotyping" };
+
+static const char * summaryNames[PROFILE_SUMMARIES] =
+   { "vc", "association", "reports" };
+
+String MerlinProfile::filename;
+FILE * MerlinProfile::output = NULL;
+bool   MerlinProfile::started = false;
+
+// Timings and tree statistics for one family
+//
+
+FamilyProfile::FamilyProfile()
+   {
+   threadClock = false;
+
+   Clear();
+   }
+
+void FamilyProfile::Clear()
+   {
+   for (int i = 0; i < PROFILE_PHASES; i++)
+      wall[i] = cpu[i] = 0.0;
+
+   taskWall.Dimension(0);
+   taskCpu.Dimension(0);
+   locationWall = locationCpu = 0.0;
+
+   peakNodes = singlepointTrees = locations = moveAlong = 0;
+   singlepointNodes = locationNodes = 0.0;
+
+   swapRead = swapWritten = 0.0;
+   cacheHits = cacheMisses = 0;
+
+   status = "analysed";
+   strategy = NULL;
+
+   nestedWall = nestedCpu = 0.0;
+   }
+
+void FamilyProfile::Merge(const FamilyProfile & other)
+   {
+   for (int i = 0; i < PROFILE_PHASES; i++)
+      {
+      wall[i] += other.wall[i];
+      cpu[i] += other.cpu[i];
+      }
+
+   for (int i = 0; i < other.taskWall.Length(); i++)
+      AddTask(i, other.taskWall[i], other.taskCpu[i]);
+
+   locationWall += other.locationWall;
+   locationCpu += other.locationCpu;
+
+   if (other.peakNodes > peakNodes)
+      peakNodes = other.peakNodes;
+
+   singlepointNodes += other.singlepointNodes;
+   singlepointTrees += other.singlepointTrees;
+   locationNodes += other.locationNodes;
+   locations += other.locations;
+   moveAlong += other.moveAlong;
+
+   swapRead += other.swapRead;
+   swapWritten += other.swapWritten;
+   cacheHits += other.cacheHits;
+   cacheMisses += other.cacheMisses;
+
+   status = other.status;
+
+   if (other.strategy != NULL)
+      strategy = other.strategy;
+   }
+
+void FamilyProfile::AddTask(int task, double seconds, double cpuSeconds)
+   {
+   while (taskWall.Length() <= task)
+      {
+      taskWall.Push(0.0);
+      taskCpu.Push(0.0);
+      }
+
+   taskWall[task] += seconds;
+   taskCpu[task] += cpuSeconds;
+   }
+
+double FamilyProfile::WallTime()
+   {
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+
+   return now.tv_sec + now.tv_usec * 1e-6;
+   }
+
+double FamilyProfile::CpuTime()
+   {
+   struct timespec now;
+
+   if (clock_gettime(threadClock ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID, &now) != 0)
+      return 0.0;
+
+   return now.tv_sec + now.tv_nsec * 1e-9;
+   }
+
+// Timers record time exclusive of any nested timers, so that the
+// phases and tasks for each family add up to the total run time
+//
+
+ProfileTimer::ProfileTimer(FamilyProfile & p, double & w, double & c)
+   : profile(p), wall(w), cpu(c)
+   {
+   Start();
+   }
+
+ProfileTimer::ProfileTimer(FamilyProfile & p, int phase)
+   : profile(p), wall(p.wall[phase]), cpu(p.cpu[phase])
+   {
+   Start();
+   }
+
+void ProfileTimer::Start()
+   {
+   active = MerlinProfile::Enabled();
+
+   if (!active) return;
+
+   startWall = FamilyProfile::WallTime();
+   startCpu = profile.CpuTime();
+   nestedWall = profile.nestedWall;
+   nestedCpu = profile.nestedCpu;
+   }
+
+ProfileTimer::~ProfileTimer()
+   {
+   if (!active) return;
+
+   double elapsedWall = FamilyProfile::WallTime() - startWall;
+   double elapsedCpu = profile.CpuTime() - startCpu;
+
+   wall += elapsedWall - (profile.nestedWall - nestedWall);
+   cpu += elapsedCpu - (profile.nestedCpu - nestedCpu);
+
+   profile.nestedWall = nestedWall + elapsedWall;
+   profile.nestedCpu = nestedCpu + elapsedCpu;
+   }
+
+// Output file
+//
+
+void MerlinProfile::OpenFile()
+   {
+   if (filename.IsEmpty() || output != NULL)
+      return;
+
+   // Replicate runs are appended to the same file
+   output = fopen(filename, started ? "at" : "wt");
+
+   if (output == NULL)
+      error("Can't open profile file [%s]\n", (const char *) filename);
+
+   started = true;
+   }
+
+void MerlinProfile::CloseFile()
+   {
+   if (output == NULL)
+      return;
+
+   fclose(output);
+   output = NULL;
+
+   printf("Profile for each family written to file [%s]\n", (const char *) filename);
+   }
+
+void MerlinProfile::WriteFamily(FamilyProfile & profile, int chromosome,
+                                const char * famid, int bits, AnalysisTask * tasks)
+   {
+   if (output == NULL)
+      return;
+
+   double totalWall = profile.locationWall, totalCpu = profile.locationCpu;
+
+   for (int i = 0; i < PROFILE_PHASES; i++)
+      {
+      totalWall += profile.wall[i];
+      totalCpu += profile.cpu[i];
+      }
+
+   for (int i = 0; i < profile.taskWall.Length(); i++)
+      {
+      totalWall += profile.taskWall[i];
+      totalCpu += profile.taskCpu[i];
+      }
+
+   fprintf(output, "{\"chromosome\": %d, \"family\": ", chromosome);
+   WriteString(famid);
+   fprintf(output, ", \"bits\": %d, \"status\": \"%s\"", bits, profile.status);
+
+   if (profile.strategy != NULL)
+      fprintf(output, ", \"memory\": \"%s\"", profile.strategy);
+
+   fprintf(output, ", ");
+   WriteTime("total", totalWall, totalCpu);
+
+   fprintf(output, ", \"phases\": {");
+   for (int i = 0; i < PROFILE_PHASES; i++)
+      {
+      if (i) fprintf(output, ", ");
+      WriteTime(phaseNames[i], profile.wall[i], profile.cpu[i]);
+      }
+
+   fprintf(output, "}, \"tasks\": {");
+   WriteTime("locations", profile.locationWall, profile.locationCpu);
+
+   AnalysisTask * task = tasks;
+   for (int i = 0; i < profile.taskWall.Length() && task != NULL; i++, task = task->next)
+      {
+      fprintf(output, ", ");
+      WriteTime(task->TaskName(), profile.taskWall[i], profile.taskCpu[i]);
+      }
+
+   fprintf(output, "}, \"nodes\": {\"peak\": %d, \"singlepoint\": %.0f, "
+                   "\"singlepoint_mean\": %.1f, \"location_mean\": %.1f}",
+           profile.peakNodes, profile.singlepointNodes,
+           profile.singlepointTrees ? profile.singlepointNodes / profile.singlepointTrees : 0.0,
+           profile.locations ? profile.locationNodes / profile.locations : 0.0);
+
+   fprintf(output, ", \"move_along\": %d, \"swap_read\": %.0f, \"swap_written\": %.0f"
+                   ", \"cache_hits\": %d, \"cache_misses\": %d}\n",
+           profile.moveAlong, profile.swapRead, profile.swapWritten,
+           profile.cacheHits, profile.cacheMisses);
+   }
+
+void MerlinProfile::WriteChromosome(int chromosome, int families,
+                                    double wall[PROFILE_SUMMARIES], double cpu[PROFILE_SUMMARIES])
+   {
+   if (output == NULL)
+      return;
+
+   fprintf(output, "{\"chromosome\": %d, \"families\": %d", chromosome, families);
+
+   for (int i = 0; i < PROFILE_SUMMARIES; i++)
+      {
+      fprintf(output, ", ");
+      WriteTime(summaryNames[i], wall[i], cpu[i]);
+      }
+
+   fprintf(output, "}\n");
+   fflush(output);
+   }
+
+void MerlinProfile::WriteTime(const char * label, double wall, double cpu)
+   {
+   fprintf(output, "\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", label, wall, cpu);
+   }
+
+void MerlinProfile::WriteString(const char * string)
+   {
+   fputc('"', output);
+
+   for (const char * ch = string; *ch; ch++)
+      if (*ch == '"' || *ch == '\\')
+         fprintf(output, "\\%c", *ch);
+      else if ((unsigned char) *ch < 32)
+         fprintf(output, "\\u%04x", *ch);
+      else
+         fputc(*ch, output);
+
+   fputc('"', output);
+   }
+
+ 
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinProfile.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __MERLINPROFILE_H__
+#define __MERLINPROFILE_H__
+
+#include "MathVector.h"
+#include "StringBasics.h"
+
+#include <stdio.h>
+
+class AnalysisTask;
+
+// Phases timed for each family
+#define PROFILE_SINGLEPOINT    0
+#define PROFILE_CONDITIONALS   1
+#define PROFILE_SCAN           2
+#define PROFILE_HAPLOTYPING    3
+#define PROFILE_PHASES         4
+
+// Analyses timed once per chromosome
+#define PROFILE_VC             0
+#define PROFILE_ASSOCIATION    1
+#define PROFILE_REPORTS        2
+#define PROFILE_SUMMARIES      3
+
+// Timings and tree statistics for the current family
+class FamilyProfile
+   {
+   public:
+      FamilyProfile();
+
+      void Clear();
+
+      // Adds timings and counters recorded by another thread
+      void Merge(const FamilyProfile & other);
+
+      // Wall clock and CPU seconds for each phase
+      double wall[PROFILE_PHASES], cpu[PROFILE_PHASES];
+
+      // Seconds for each analysis task, and for IBD, kinship and
+      // matrix estimates at each location
+      Vector taskWall, taskCpu;
+      double locationWall, locationCpu;
+
+      // Tree statistics
+      int    peakNodes;
+      double singlepointNodes;
+      int    singlepointTrees;
+      double locationNodes;
+      int    locations;
+      int    moveAlong;
+
+      // Swap and cache activity
+      double swapRead, swapWritten;
+      int    cacheHits, cacheMisses;
+
+      const char * status;
+      const char * strategy;
+
+      // CPU time is measured for the calling thread when families are
+      // analysed in parallel, and for the whole process otherwise
+      bool   threadClock;
+
+      // Time spent in nested timers, excluded from enclosing timers
+      double nestedWall, nestedCpu;
+
+      void   AddTask(int task, double wall, double cpu);
+
+      double CpuTime();
+      static double WallTime();
+   };
+
+// Adds the wall clock and CPU time until the end of the current scope
+// to a pair of counters, when profiling is enabled
+class ProfileTimer
+   {
+   public:
+      ProfileTimer(FamilyProfile & profile, double & wall, double & cpu);
+      ProfileTimer(FamilyProfile & profile, int phase);
+      ~ProfileTimer();
+
+   private:
+      FamilyProfile & profile;
+      double & wall;
+      double & cpu;
+
+      void   Start();
+
+      bool   active;
+      double startWall, startCpu;
+      double nestedWall, nestedCpu;
+   };
+
+// Writes one JSON object per line for each family and chromosome
+class MerlinProfile
+   {
+   public:
+      static String filename;
+
+      static bool Enabled()
+         { return output != NULL; }
+
+      static void OpenFile();
+      static void CloseFile();
+
+      static void WriteFamily(FamilyProfile & profile, int chromosome,
+                              const char * famid, int bits, AnalysisTask * tasks);
+      static void WriteChromosome(int chromosome, int families,
+                                  double wall[PROFILE_SUMMARIES], double cpu[PROFILE_SUMMARIES]);
+
+   private:
+      static FILE * output;
+      static bool   started;
+
+      static void WriteTime(const char * label, double wall, double cpu);
+      static void WriteString(const char * string);
+   };
+
+#endif
+
+ 
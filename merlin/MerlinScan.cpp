@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinScan.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "MerlinScan.h"
+#include "MapFunction.h"
+
+ParallelScan::ParallelScan(MerlinCore & core, int threads)
+   : engine(core), pool(threads)
+   {
+   left = new Multipoint [pool.Threads()];
+   inheritance = new Multipoint [pool.Threads()];
+
+   trees = NULL;
+   first = count = capacity = 0;
+   }
+
+ParallelScan::~ParallelScan()
+   {
+   pool.Finish();
+
+   FreeTrees();
+
+   // Scratch trees were not counted against our memory limit
+   for (int i = 0; i < pool.Threads(); i++)
+      {
+      left[i].Free();
+      inheritance[i].Free();
+      }
+
+   delete [] left;
+   delete [] inheritance;
+
+   if (trees != NULL) delete [] trees;
+   }
+
+void ParallelScan::FreeTrees()
+   {
+   for (int i = 0; i < count; i++)
+      trees[i].Free();
+   }
+
+void ParallelScan::Start(Multipoint & leftTree, Tree & rightTree,
+                         int leftMarkerIndex, int rightMarkerIndex,
+                         int firstPosition, int positions)
+   {
+   // Complete calculations for any abandoned interval
+   pool.Finish();
+
+   FreeTrees();
+
+   if (capacity < positions)
+      {
+      if (trees != NULL) delete [] trees;
+
+      capacity = positions;
+      trees = new Multipoint [capacity];
+      }
+
+   leftMarker.Copy(leftTree);
+   rightMarker.Copy(rightTree);
+
+   leftAnchor = leftMarkerIndex;
+   rightAnchor = rightMarkerIndex;
+   first = firstPosition;
+   count = positions;
+
+   failures.Dimension(count);
+   failures.Zero();
+
+   pool.Start(ScorePosition, this, count);
+   }
+
+Tree & ParallelScan::Retrieve(int position)
+   {
+   pool.WaitFor(position);
+
+   if (failures[position])
+      throw TreesTooBig(failures[position]);
+
+   return trees[position];
+   }
+
+void ParallelScan::ScorePosition(void * data, int position, int thread)
+   {
+   ParallelScan * scan = (ParallelScan *) data;
+   MerlinCore & engine = scan->engine;
+
+   // Moves calculated by helper threads are counted for the family
+   if (MerlinProfile::Enabled())
+      Multipoint::moveAlongCounter = &engine.profile.moveAlong;
+
+   int    pos = scan->first + position;
+   int    marker = engine.informativeMarkers[scan->leftAnchor];
+   double theta[2];
+
+   // Scratch space for moving dense trees at this position
+   DenseBuffer dense;
+   Multipoint::denseBuffer = &dense;
+
+   try
+      {
+      Multipoint & leftInheritance = scan->left[thread];
+
+      theta[0] = DistanceToRecombination(engine.femalePositions[pos] - engine.markerFemalePositions[marker]);
+      theta[1] = DistanceToRecombination(engine.malePositions[pos] - engine.markerMalePositions[marker]);
+
+      leftInheritance.Copy(scan->leftMarker);
+      leftInheritance.MoveAlong(engine.mantra, theta, engine.leftScale[scan->leftAnchor]);
+
+      Multipoint & inheritance = scan->inheritance[thread];
+
+      marker = engine.informativeMarkers[scan->rightAnchor];
+
+      theta[0] = DistanceToRecombination(engine.markerFemalePositions[marker] - engine.femalePositions[pos]);
+      theta[1] = DistanceToRecombination(engine.markerMalePositions[marker] - engine.malePositions[pos]);
+
+      inheritance.Copy(scan->rightMarker);
+      inheritance.MoveAlong(engine.mantra, theta, engine.rightScale[scan->rightAnchor]);
+      inheritance.Multiply(leftInheritance);
+
+      scan->trees[position].CopyForThread(inheritance);
+      }
+   catch (const TreesTooBig & problem)
+      {
+      scan->failures[position] = problem.memory_request;
+      }
+
+   Multipoint::denseBuffer = NULL;
+   }
+
+ 
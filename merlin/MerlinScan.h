@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinScan.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __MERLINSCAN_H__
+#define __MERLINSCAN_H__
+
+#include "MerlinCore.h"
+#include "ThreadPool.h"
+
+///////////////////////////////////////////////////////////////
+// This class calculates multipoint likelihoods at all analysis
+// positions between a pair of informative markers, using
+// multiple threads. Flanking conditional likelihoods are copied
+// when each interval is started, so that calculations in progress
+// are not affected if the main thread abandons the family.
+//
+
+class ParallelScan
+   {
+   public:
+      ParallelScan(MerlinCore & engine, int threads);
+      ~ParallelScan();
+
+      // Starts calculating likelihoods for count positions, beginning at
+      // first, using conditional likelihoods at the flanking markers
+      void Start(Multipoint & leftMarker, Tree & rightMarker,
+                 int leftAnchor, int rightAnchor, int first, int count);
+
+      // Waits for the likelihood at one of the positions in the interval
+      Tree & Retrieve(int position);
+
+   private:
+      MerlinCore & engine;
+      ThreadPool   pool;
+
+      // Conditional likelihoods at flanking markers
+      Multipoint   leftMarker, rightMarker;
+      int          leftAnchor, rightAnchor;
+
+      // Scratch space for each thread
+      Multipoint * left, * inheritance;
+
+      // Results for each position, and memory required when calculations fail
+      Multipoint * trees;
+      IntArray     failures;
+      int          first, count, capacity;
+
+      void FreeTrees();
+
+      static void ScorePosition(void * data, int position, int thread);
+   };
+
+#endif
+
+ 
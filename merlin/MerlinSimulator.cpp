@@ -410,7 +410,7 @@ void Simulator::SampleInheritanceVector(Tree & tree, int node, int bit,
                                         IntArray & current, IntArray & best,
                                         double & sum, double weight)
    {
-   switch (tree.nodes[node].type)
+   switch (tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinSinglepoint.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "MerlinSinglepoint.h"
+#include "MerlinCluster.h"
+
+ParallelSinglepoint::ParallelSinglepoint(MerlinCore & core, int threads)
+   : engine(core), pool(threads)
+   {
+   mantras = new Mantra [pool.Threads()];
+   scratch = new FuzzyInheritanceTree [pool.Threads()];
+   trees = NULL;
+   markers = 0;
+   }
+
+ParallelSinglepoint::~ParallelSinglepoint()
+   {
+   pool.Finish();
+
+   // Trees built by other threads were not counted against our memory limit
+   for (int i = 0; i < pool.Threads(); i++)
+      scratch[i].Free();
+
+   for (int i = 0; i < markers; i++)
+      trees[i].Free();
+
+   delete [] mantras;
+   delete [] scratch;
+
+   if (trees != NULL) delete [] trees;
+   }
+
+void ParallelSinglepoint::Start()
+   {
+   pool.Finish();
+
+   // Discard results left over if the previous family was aborted
+   for (int i = 0; i < markers; i++)
+      trees[i].Free();
+
+   if (markers != engine.markerCount)
+      {
+      if (trees != NULL) delete [] trees;
+
+      markers = engine.markerCount;
+      trees = new BasicTree [markers];
+      }
+
+   failures.Dimension(markers);
+   failures.Zero();
+
+   for (int i = 0; i < pool.Threads(); i++)
+      {
+      mantras[i].Prepare(engine.ped, *engine.family);
+      mantras[i].PrepareIBD();
+      }
+
+   pool.Start(ScoreMarker, this, markers);
+   }
+
+void ParallelSinglepoint::Retrieve(int marker, BasicTree & tree)
+   {
+   pool.WaitFor(marker);
+
+   if (failures[marker])
+      throw TreesTooBig(failures[marker]);
+
+   tree.Copy(trees[marker]);
+   trees[marker].Free();
+   }
+
+void ParallelSinglepoint::ScoreMarker(void * data, int marker, int thread)
+   {
+   ParallelSinglepoint * parallel = (ParallelSinglepoint *) data;
+
+   int markerid = parallel->engine.markers[marker];
+
+   // Clustered markers are scored by the main thread
+   if (clusters.Enabled() && clusters.markerToCluster[markerid] != NULL)
+      return;
+
+   Mantra & mantra = parallel->mantras[thread];
+   FuzzyInheritanceTree & tree = parallel->scratch[thread];
+
+   try
+      {
+      mantra.SelectMarker(markerid);
+      tree.FuzzyScoreVectors(mantra);
+
+      parallel->trees[marker].CopyForThread(tree);
+      }
+   catch (const TreesTooBig & problem)
+      {
+      parallel->failures[marker] = problem.memory_request;
+      }
+   }
+
+ 
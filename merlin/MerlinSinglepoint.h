@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinSinglepoint.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __MERLINSINGLEPOINT_H__
+#define __MERLINSINGLEPOINT_H__
+
+#include "MerlinCore.h"
+#include "ThreadPool.h"
+#include "Houdini.h"
+
+///////////////////////////////////////////////////////////////
+// This class scores singlepoint likelihoods for all markers in
+// the currently selected family, using multiple threads. Each
+// thread keeps its own copy of the family description and its
+// own scratch inheritance tree. Clustered markers are left for
+// the main thread.
+//
+
+class ParallelSinglepoint
+   {
+   public:
+      ParallelSinglepoint(MerlinCore & engine, int threads);
+      ~ParallelSinglepoint();
+
+      // Starts scoring all markers for the currently selected family
+      void Start();
+
+      // Waits for the likelihoods for a specific marker and copies them
+      void Retrieve(int marker, BasicTree & tree);
+
+   private:
+      MerlinCore           & engine;
+      ThreadPool             pool;
+      Mantra               * mantras;
+      FuzzyInheritanceTree * scratch;
+
+      // Results for each marker, and memory required when scoring fails
+      BasicTree            * trees;
+      IntArray               failures;
+      int                    markers;
+
+      static void ScoreMarker(void * data, int marker, int thread);
+   };
+
+#endif
+
+ 
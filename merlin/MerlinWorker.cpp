@@ -0,0 +1,663 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinWorker.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "MerlinWorker.h"
+#include "MerlinFamily.h"
+#include "QuickIndex.h"
+
+#include <math.h>
+#include <sys/time.h>
+
+static double WallTime()
+   {
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+
+   return now.tv_sec + now.tv_usec * 1e-6;
+   }
+
+// Results for a single family
+//
+
+FamilyResults::FamilyResults()
+   {
+   selected = false;
+   likelihood = 0.0;
+   positions = bits = 0;
+   trees = NULL;
+   predictedCost = seconds = singlepointNodes = 0.0;
+   peakNodes = 0;
+   measured = false;
+   bufferedNodes = 0;
+   deferred = false;
+   }
+
+FamilyResults::~FamilyResults()
+   {
+   Free();
+   }
+
+void FamilyResults::Record(int event, int argument)
+   {
+   events.Push(event);
+   arguments.Push(argument);
+   offsets.Push(output.Length());
+   }
+
+bool FamilyResults::Store(int pos, int count, Tree & inheritance)
+   {
+   if (trees == NULL)
+      trees = new Tree[positions = count];
+
+   // Copies must fit within the memory target as well as any hard limit
+   if ((BasicTree::totalNodes + inheritance.nextFree) * (double) TREE_NODE_SIZE > MemoryGovernor::target ||
+       !BasicTree::ReserveScratch(inheritance.nextFree))
+      return false;
+
+   trees[pos].CopyForThread(inheritance);
+   Record(WORKER_LOCATION, pos);
+
+   return true;
+   }
+
+int FamilyResults::HandOver()
+   {
+   if (trees != NULL)
+      for (int i = 0; i < positions; i++)
+         {
+         trees[i].ReleaseNodes();
+         bufferedNodes += trees[i].count;
+         }
+
+   return bufferedNodes;
+   }
+
+void FamilyResults::Free()
+   {
+   if (trees != NULL)
+      {
+      // Trees that were handed over are counted by the thread freeing them
+      if (bufferedNodes)
+         for (int i = 0; i < positions; i++)
+            trees[i].AcquireNodes();
+
+      delete [] trees;
+      }
+
+   trees = NULL;
+   bufferedNodes = 0;
+
+   output.Clear();
+   events.Clear();
+   arguments.Clear();
+   offsets.Clear();
+   }
+
+// Worker engines, one per thread
+//
+
+MerlinWorker::MerlinWorker(MerlinCore & engine, AnalysisTask * tasks, TreeBuffers * buffers)
+   : MerlinCore(engine.ped)
+   {
+   CopyMap(engine);
+
+   taskList = tasks;
+   treeBuffers = buffers;
+   results = NULL;
+   swapReady = false;
+
+   // Other families are analysed concurrently in the same process
+   profile.threadClock = true;
+   }
+
+MerlinWorker::~MerlinWorker()
+   {
+   singlepointSwap.CloseFiles();
+   multipointSwap.CloseFiles();
+   scaffoldSwap.CloseFiles();
+   }
+
+void MerlinWorker::Analyse(Family * f, FamilyResults & output)
+   {
+   results = &output;
+   outputBuffer = &output.output;
+
+   double start = WallTime();
+
+   PrepareThread();
+
+   results->selected = SelectFamily(f);
+
+   if (!results->selected)
+      {
+      results->seconds = WallTime() - start;
+      return;
+      }
+
+   singlepoint = NULL;
+   right = NULL;
+
+   try
+      {
+      AnalyseFamily();
+
+      CleanMessages();
+      delete [] singlepoint;
+      singlepoint = NULL;
+      }
+   catch (const TreesTooBig & problem)
+      {
+      FreeMemory();
+
+      // Results are only replayed once the family is done, so the
+      // analysis can always start over with a more economical strategy
+      if (governor.Retry())
+         {
+         governor.KeepStrategy();
+         results->Free();
+         Analyse(f, output);
+         return;
+         }
+
+      // Families whose stored trees don't fit are analysed again by the
+      // main thread once they are next in line, without storing results
+      if (results->trees != NULL)
+         {
+         results->Free();
+         results->deferred = true;
+         }
+      else
+         {
+         PrintMessage("  SKIPPED: At least %d megabytes needed", problem.memory_request);
+         CleanMessages();
+
+         profile.status = "skipped";
+         results->Record(WORKER_ABORT);
+         }
+      }
+   catch (const OutOfTime & problem)
+      {
+      PrintMessage("  SKIPPED: Analysis would require more than %d minutes\n", maxMinutes);
+      CleanMessages();
+
+      profile.status = "skipped";
+      FreeMemory();
+      results->Record(WORKER_ABORT);
+      };
+
+   results->singlepointNodes = singlepointNodes;
+   results->likelihood = likelihood;
+   results->seconds = WallTime() - start;
+   results->peakNodes = BasicTree::peakNodes;
+
+   denseBuffer.Free();
+
+   FinishProfile();
+   results->profile.Clear();
+   results->profile.Merge(profile);
+   }
+
+void MerlinWorker::FamilySetupHook()
+   {
+   int index = 0;
+
+   for (AnalysisTask * task = taskList; task != NULL; task = task->next)
+      {
+      ProgressReport(task->TaskDescription());
+      results->Record(WORKER_SETUP_TASK, index++);
+      }
+   }
+
+void MerlinWorker::FamilyUninformativeHook()
+   {
+   if (FamilyAnalysis::calcLikelihood && FamilyAnalysis::perFamily)
+      PrintMessage("  lnLikelihood = %.3f", likelihood);
+
+   results->Record(WORKER_UNINFORMATIVE);
+   }
+
+void MerlinWorker::FamilyLikelihoodHook()
+   {
+   if (FamilyAnalysis::calcLikelihood && FamilyAnalysis::perFamily)
+      PrintMessage("  lnLikelihood = %.3f    ", likelihood);
+
+   results->Record(WORKER_LIKELIHOOD);
+   }
+
+void MerlinWorker::FamilyImpossibleHook()
+   {
+   results->Record(WORKER_ABORT);
+   }
+
+void MerlinWorker::AnalyseLocation(int pos, Tree & inheritance)
+   {
+   // Stored trees count against the worker's memory limit until the
+   // family is finished and its results are handed over for replay
+   if (!results->Store(pos, analysisPositions.Length(), inheritance))
+      throw TreesTooBig(BasicTree::MegabytesNeeded(inheritance.nextFree));
+   }
+
+void MerlinWorker::PrepareThread()
+   {
+   BasicTree::SelectBuffers(treeBuffers);
+   BasicTree::SelectPool(&nodePool);
+   BasicTree::ResetPeakNodes();
+
+   if ((useSwap || smallSwap) && !swapReady)
+      {
+      BasicTree::SetupSwap();
+      singlepointSwap.OpenFiles();
+      multipointSwap.OpenFiles();
+      scaffoldSwap.OpenFiles();
+      swapReady = true;
+      }
+   }
+
+bool MerlinWorker::MeasureSinglepoint(Family * f, double & nodes, int & trees)
+   {
+   // Messages are discarded and the family is planned again when analysed
+   String          scratch;
+   MemoryGovernor  plan = governor;
+   bool            measured = false;
+
+   outputBuffer = &scratch;
+
+   PrepareThread();
+
+   singlepoint = NULL;
+   right = NULL;
+
+   if (SelectFamily(f, false))
+      try
+         {
+         FreeSwap();
+
+         ScoreSinglepoint();
+
+         nodes = singlepointNodes;
+         trees = informativeCount;
+         measured = true;
+         }
+      catch (const TreesTooBig & problem)
+         { }
+
+   FreeMemory();
+
+   governor = plan;
+   outputBuffer = NULL;
+
+   return measured;
+   }
+
+void MerlinWorker::FreeMemory()
+   {
+   if (singlepoint != NULL) delete [] singlepoint;
+   if (right != NULL) delete [] right;
+
+   right = NULL;
+   singlepoint = NULL;
+   }
+
+// Parallel analysis of all families in the pedigree
+//
+
+ParallelAnalysis::ParallelAnalysis(MerlinCore & core, AnalysisTask * tasks, int threads)
+   : engine(core), pool(threads)
+   {
+   workers = new MerlinWorker * [pool.Threads()];
+   buffers = new TreeBuffers [pool.Threads()];
+   results = new FamilyResults [engine.ped.familyCount];
+
+   for (int i = 0; i < pool.Threads(); i++)
+      workers[i] = new MerlinWorker(engine, tasks, &buffers[i]);
+
+   pthread_mutex_init(&lock, NULL);
+   pthread_cond_init(&progress, NULL);
+
+   started.Dimension(engine.ped.familyCount);
+   finished.Dimension(engine.ped.familyCount);
+   started.Zero();
+   finished.Zero();
+
+   window = pool.Threads() * WORKER_WINDOW_PER_THREAD;
+   replayed = tickets = 0;
+   bufferedNodes = 0;
+   abandoned = false;
+   }
+
+ParallelAnalysis::~ParallelAnalysis()
+   {
+   // If replay stopped early, families that haven't started are skipped
+   pthread_mutex_lock(&lock);
+   abandoned = true;
+   pthread_cond_broadcast(&progress);
+   pthread_mutex_unlock(&lock);
+
+   pool.Finish();
+
+   for (int i = 0; i < pool.Threads(); i++)
+      {
+      engine.MergeSwapUsage(*workers[i]);
+
+      // Worker buffers are released when workers are deleted
+      BasicTree::SelectBuffers(&buffers[i]);
+      delete workers[i];
+      }
+   BasicTree::SelectBuffers(NULL);
+
+   delete [] workers;
+   delete [] buffers;
+   delete [] results;
+
+   pthread_cond_destroy(&progress);
+   pthread_mutex_destroy(&lock);
+   }
+
+void ParallelAnalysis::Start()
+   {
+   EstimateCosts();
+
+   elapsed = WallTime();
+
+   // Each work item analyses whichever family NextFamily() selects
+   pool.Start(AnalyseFamily, this, engine.ped.familyCount);
+   }
+
+int ParallelAnalysis::NextFamily()
+   {
+   int families = engine.ped.familyCount;
+
+   pthread_mutex_lock(&lock);
+
+   int best = -1;
+
+   while (!abandoned)
+      {
+      // Once results waiting for replay fill the memory target for one
+      // thread, only the next family to be replayed can be started
+      bool full = bufferedNodes * (double) TREE_NODE_SIZE >= MemoryGovernor::target;
+
+      for (int i = replayed; i < families && i < replayed + window; i++)
+         if (!started[i] && (!full || i == replayed) &&
+             (best < 0 || results[i].predictedCost > results[best].predictedCost))
+            best = i;
+
+      if (best >= 0)
+         {
+         started[best] = true;
+         break;
+         }
+
+      pthread_cond_wait(&progress, &lock);
+      }
+
+   pthread_mutex_unlock(&lock);
+
+   return best;
+   }
+
+void ParallelAnalysis::EstimateCosts()
+   {
+   Pedigree & ped = engine.ped;
+   Mantra & mantra = engine.mantra;
+
+   Vector   complexity;
+   IntArray genotyped(ped.familyCount);
+
+   measure.Clear();
+   treeNodes.Dimension(ped.familyCount);
+   treeNodes.Zero();
+
+   for (int i = 0; i < ped.familyCount; i++)
+      {
+      Family * family = ped.families[i];
+
+      mantra.Prepare(ped, *family);
+
+      results[i].bits = mantra.bit_count;
+      genotyped[i] = 0;
+
+      // Families above the complexity limit will be skipped
+      if (mantra.bit_count > MerlinCore::maxBits)
+         continue;
+
+      for (int m = 0; m < engine.markerCount; m++)
+         for (int j = family->first; j <= family->last; j++)
+            if (ped[j].isGenotyped(engine.markers[m]))
+               {
+               genotyped[i]++;
+               break;
+               }
+
+      // Each symmetric founder couple halves the number of inheritance
+      // vectors, and a tree with a leaf for each vector has twice as
+      // many nodes
+      int bits = mantra.bit_count - mantra.couples;
+
+      treeNodes[i] = pow(2.0, bits > 0 ? bits + 1 : 1);
+
+      if (mantra.bit_count >= WORKER_MEASURE_MIN_BITS && genotyped[i])
+         {
+         measure.Push(i);
+         complexity.Push(-mantra.bit_count);
+         }
+      }
+
+   // Singlepoint trees for the largest families are calculated first
+   if (measure.Length())
+      {
+      QuickIndex index(complexity);
+      IntArray   unsorted(measure);
+
+      for (int i = 0; i < measure.Length(); i++)
+         measure[i] = unsorted[index[i]];
+
+      pool.Run(MeasureFamily, this, measure.Length());
+      }
+
+   // Trees for smaller families are assumed to be no more than
+   // as full as those measured for larger families
+   double measured = 0.0, expanded = 0.0;
+
+   for (int i = 0; i < measure.Length(); i++)
+      if (results[measure[i]].measured)
+         {
+         measured += treeNodes[measure[i]];
+         expanded += pow(2.0, results[measure[i]].bits + 1);
+         }
+
+   if (measured > 0.0 && measured < expanded)
+      for (int i = 0; i < ped.familyCount; i++)
+         if (!results[i].measured)
+            treeNodes[i] *= measured / expanded;
+
+   // Every marker and analysis position requires operations on a tree at
+   // least as large as the average singlepoint tree
+   for (int i = 0; i < ped.familyCount; i++)
+      results[i].predictedCost = genotyped[i] == 0 ? 0.0 :
+         (genotyped[i] + engine.analysisPositions.Length()) * treeNodes[i];
+   }
+
+void ParallelAnalysis::MeasureFamily(void * data, int item, int thread)
+   {
+   ParallelAnalysis * parallel = (ParallelAnalysis *) data;
+
+   int    family = parallel->measure[item];
+   double nodes = 0.0;
+   int    trees = 0;
+
+   try
+      {
+      if (!parallel->workers[thread]->MeasureSinglepoint(
+               parallel->engine.ped.families[family], nodes, trees))
+         return;
+      }
+   catch (...)
+      {
+      // Errors are reported when the family is analysed
+      return;
+      }
+
+   // Families without informative markers are quickly skipped
+   parallel->treeNodes[family] = trees ? nodes / trees : 0.0;
+   parallel->results[family].measured = true;
+   }
+
+void ParallelAnalysis::ReportCosts()
+   {
+   pool.Finish();
+
+   int    families = engine.ped.familyCount, measured = 0;
+   double predicted = 0.0, actual = 0.0, crossproducts = 0.0;
+   double squares = 0.0, actualSquares = 0.0;
+
+   for (int i = 0; i < families; i++)
+      {
+      predicted += results[i].predictedCost;
+      actual += results[i].seconds;
+      crossproducts += results[i].predictedCost * results[i].seconds;
+      squares += results[i].predictedCost * results[i].predictedCost;
+      actualSquares += results[i].seconds * results[i].seconds;
+      measured += results[i].measured;
+      }
+
+   // Costs are predicted before the analysis starts; the time per unit
+   // of cost is only fitted afterwards, to compare predictions with the
+   // time each family actually took
+   double rate = squares > 0.0 ? crossproducts / squares : 0.0;
+
+   double covariance = crossproducts - predicted * actual / families;
+   double variance[2] = { squares - predicted * predicted / families,
+                          actualSquares - actual * actual / families };
+
+   printf("\nFamily Scheduling Summary\n"
+          "=========================\n"
+          "   %d families analysed with %d threads in %.1f seconds (%.1f seconds of work)\n"
+          "   Largest predicted costs first, among the next %d families to be reported\n"
+          "   Costs predicted from singlepoint trees for %d families, from bit counts for %d\n"
+          "   Seconds per unit of predicted cost, fitted after the run: %.3g\n",
+          families, pool.Threads(), WallTime() - elapsed, actual, window,
+          measured, families - measured, rate);
+
+   if (variance[0] > 0.0 && variance[1] > 0.0)
+      printf("   Correlation between predicted costs and analysis times: %.2f\n",
+             covariance / sqrt(variance[0] * variance[1]));
+
+   // Summarize recycling of tree storage across threads
+   double requests = 0.0, recycled = 0.0, stored = 0.0;
+
+   for (int i = 0; i < pool.Threads(); i++)
+      {
+      requests += workers[i]->nodePool.requests;
+      recycled += workers[i]->nodePool.recycled;
+      stored += workers[i]->nodePool.peakStoredNodes;
+      }
+
+   printf("   Tree storage recycled for %.1f%% of %.0f allocations (%.1f MB held in reserve)\n\n",
+          requests > 0.0 ? recycled * 100.0 / requests : 0.0, requests,
+          stored * TREE_NODE_SIZE / (1024.0 * 1024.0));
+
+   printf("%15s %6s %12s %12s %12s %12s %12s\n",
+          "FAMILY", "BITS", "COST", "FITTED", "ACTUAL", "NODES", "PEAK MB");
+
+   // List the most expensive families, sorting on negative costs
+   Vector order(families);
+
+   for (int i = 0; i < families; i++)
+      order[i] = -results[i].predictedCost;
+
+   QuickIndex index(order);
+
+   for (int i = 0; i < families && i < 10; i++)
+      {
+      FamilyResults & family = results[index[i]];
+
+      if (family.predictedCost == 0.0) break;
+
+      printf("%15s %6d %12.4g %11.2fs %11.2fs %12.0f %12.1f\n",
+             (const char *) engine.ped.families[index[i]]->famid,
+             family.bits, family.predictedCost, family.predictedCost * rate, family.seconds,
+             family.singlepointNodes, family.peakNodes * (double) TREE_NODE_SIZE / (1024.0 * 1024.0));
+      }
+   }
+
+FamilyResults & ParallelAnalysis::WaitFor(int family)
+   {
+   // Without worker threads, items are processed here until the family is done
+   if (pool.Threads() == 1)
+      while (!finished[family])
+         pool.WaitFor(tickets++);
+
+   pthread_mutex_lock(&lock);
+   while (!finished[family])
+      pthread_cond_wait(&progress, &lock);
+   pthread_mutex_unlock(&lock);
+
+   // Unexpected errors in worker threads are reported by the main thread
+   if (results[family].failure)
+      std::rethrow_exception(results[family].failure);
+
+   return results[family];
+   }
+
+void ParallelAnalysis::Release(int family)
+   {
+   int nodes = results[family].bufferedNodes;
+
+   results[family].Free();
+
+   // Allow workers to start families further down the pedigree
+   pthread_mutex_lock(&lock);
+   bufferedNodes -= nodes;
+   replayed = family + 1;
+   pthread_cond_broadcast(&progress);
+   pthread_mutex_unlock(&lock);
+   }
+
+void ParallelAnalysis::AnalyseFamily(void * data, int, int thread)
+   {
+   ParallelAnalysis * parallel = (ParallelAnalysis *) data;
+
+   int family = parallel->NextFamily();
+
+   if (family < 0)
+      return;
+
+   // Exceptions can't propagate out of a pool thread, so any that the
+   // worker doesn't handle are stored and rethrown by WaitFor()
+   try
+      {
+      parallel->workers[thread]->Analyse(parallel->engine.ped.families[family],
+                                         parallel->results[family]);
+      }
+   catch (...)
+      {
+      parallel->results[family].failure = std::current_exception();
+      }
+
+   // Stored trees are no longer counted against the worker's memory limit
+   int nodes = parallel->results[family].HandOver();
+
+   pthread_mutex_lock(&parallel->lock);
+   parallel->bufferedNodes += nodes;
+   parallel->finished[family] = true;
+   pthread_cond_broadcast(&parallel->progress);
+   pthread_mutex_unlock(&parallel->lock);
+   }
+
+ 
@@ -0,0 +1,201 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/MerlinWorker.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __MERLINWORKER_H__
+#define __MERLINWORKER_H__
+
+#include "MerlinCore.h"
+#include "AnalysisTask.h"
+#include "ThreadPool.h"
+
+#include <exception>
+
+///////////////////////////////////////////////////////////////
+// These classes allow families to be analysed in parallel.
+// Each worker thread records screen output and the inheritance
+// trees at each analysis location; the main thread then replays
+// these in the original family order, so that analysis tasks
+// accumulate results exactly as in a single-threaded run.
+// Stored trees count against the memory limit; families whose
+// trees don't fit are analysed by the main thread in their turn.
+//
+
+// Events recorded for replay by the main thread
+#define WORKER_SETUP_TASK     0
+#define WORKER_LOCATION       1
+#define WORKER_UNINFORMATIVE  2
+#define WORKER_ABORT          3
+#define WORKER_LIKELIHOOD     4
+
+// Families are only started when they are within this many families per
+// thread of the next family to be replayed, which limits the number of
+// finished families whose results are held in memory
+#define WORKER_WINDOW_PER_THREAD  8
+
+// Singlepoint trees are measured before scheduling families with at least
+// this many bits, smaller families are costed from their inheritance vectors
+#define WORKER_MEASURE_MIN_BITS   8
+
+class FamilyResults
+   {
+   public:
+      FamilyResults();
+      ~FamilyResults();
+
+      // Buffered screen output
+      String   output;
+
+      // Whether the family was selected for analysis, and whether it must
+      // be analysed again by the main thread
+      bool     selected;
+      bool     deferred;
+
+      // Overall likelihood for the family
+      double   likelihood;
+
+      // Events and corresponding offsets into output buffer
+      IntArray events, arguments, offsets;
+
+      // Inheritance trees at each analysis location
+      Tree *   trees;
+      int      positions;
+
+      // Predicted and observed analysis costs, in tree nodes and seconds
+      int      bits;
+      bool     measured;
+      double   predictedCost;
+      double   seconds;
+      double   singlepointNodes;
+      int      peakNodes;
+
+      // Timings and tree statistics for the optional profile
+      FamilyProfile profile;
+
+      // Unexpected exception thrown while analysing the family
+      std::exception_ptr failure;
+
+      // Nodes in stored trees, once these are no longer counted against
+      // the memory limit for the worker that analysed the family
+      int      bufferedNodes;
+
+      void Record(int event, int argument = 0);
+      void Free();
+
+      // Stores a copy of the tree at one of count locations, counted against
+      // the memory limit for the current thread. Returns false, storing
+      // nothing, if the copy doesn't fit within the limit or the target.
+      bool Store(int pos, int count, Tree & inheritance);
+
+      // Stops counting stored trees against the current thread, returning
+      // their total size in nodes
+      int  HandOver();
+   };
+
+class MerlinWorker : public MerlinCore
+   {
+   public:
+      MerlinWorker(MerlinCore & engine, AnalysisTask * tasks, TreeBuffers * buffers);
+      virtual ~MerlinWorker();
+
+      // Analyses one family, recording results for later replay
+      void Analyse(Family * f, FamilyResults & output);
+
+      // Calculates singlepoint trees for one family, returning the total
+      // number of nodes and the number of informative trees
+      bool MeasureSinglepoint(Family * f, double & nodes, int & trees);
+
+   protected:
+      virtual void AnalyseLocation(int pos, Tree & inheritance);
+
+      // Outcomes are recorded for replay by the main thread
+      virtual void FamilySetupHook();
+      virtual void FamilyUninformativeHook();
+      virtual void FamilyLikelihoodHook();
+      virtual void FamilyImpossibleHook();
+
+   private:
+      AnalysisTask  * taskList;
+      TreeBuffers   * treeBuffers;
+      FamilyResults * results;
+      bool            swapReady;
+
+      void FreeMemory();
+
+      // Selects tree buffers and swap files for the current thread
+      void PrepareThread();
+   };
+
+class ParallelAnalysis
+   {
+   public:
+      ParallelAnalysis(MerlinCore & engine, AnalysisTask * tasks, int threads);
+      ~ParallelAnalysis();
+
+      // Starts analysing all families in the pedigree. Among the families
+      // in the window that starts at the next one to be replayed, those
+      // with the largest predicted cost go first.
+      void Start();
+
+      // Compares predicted and actual analysis costs for each family
+      void ReportCosts();
+
+      // Waits for results for a specific family, and releases them when done
+      FamilyResults & WaitFor(int family);
+      void            Release(int family);
+
+   private:
+      MerlinCore    & engine;
+      ThreadPool      pool;
+      MerlinWorker ** workers;
+      TreeBuffers   * buffers;
+      FamilyResults * results;
+
+      double          elapsed;
+
+      // Families are claimed from a window that starts at the next family
+      // to be replayed. Workers wait when every family in the window has
+      // been started, and the main thread waits for each family to finish.
+      pthread_mutex_t lock;
+      pthread_cond_t  progress;
+      IntArray        started, finished;
+      int             window, replayed, tickets;
+      bool            abandoned;
+
+      // Nodes in trees stored for finished families that are waiting to
+      // be replayed, which count against the memory target for one thread
+      int             bufferedNodes;
+
+      // Estimates the cost of each family from the size of its singlepoint
+      // trees and the number of markers and positions to be analysed
+      void EstimateCosts();
+
+      // Families whose singlepoint trees are measured, and the average
+      // number of nodes in the singlepoint trees for each family
+      IntArray        measure;
+      Vector          treeNodes;
+
+      static void MeasureFamily(void * data, int item, int thread);
+
+      // Selects the next family to analyse, or returns -1 if abandoned
+      int  NextFamily();
+
+      static void AnalyseFamily(void * data, int ticket, int thread);
+   };
+
+#endif
+
+ 
@@ -46,7 +46,7 @@ void NPL_ASP_Tree::ScoreNPL(Mantra & m, int affection)
    if (m.aff_count < 1)
       {
       int node = NewNode();
-      nodes[node].type = TREE_NODE_LEAF;
+      Type(node) = TREE_NODE_LEAF;
       nodes[node].value = 1.0;
       return;
       }
@@ -77,7 +77,7 @@ int NPL_ASP_Tree::RecursivelyScoreNPL(Mantra & m, int bit)
    // Bottom of the pedigree
    if (bit < 0)
       {
-      nodes[node].type = TREE_NODE_LEAF;
+      Type(node) = TREE_NODE_LEAF;
       nodes[node].value = CalculateNPL(m);
       return node;
       }
@@ -88,12 +88,12 @@ int NPL_ASP_Tree::RecursivelyScoreNPL(Mantra & m, int bit)
    if (isRedundantNPL(m, pivot))
       {
       m.state[pivot] = m.state[m.vector[pivot] &= ~1];
-      nodes[node].type = TREE_NODE_ONE;
+      Type(node) = TREE_NODE_ONE;
       SAFE_SET(nodes[node].child[0], RecursivelyScoreNPL(m, bit - 1));
       }
    else
       {
-      nodes[node].type = TREE_NODE_TWO;
+      Type(node) = TREE_NODE_TWO;
 
       m.state[pivot] = m.state[m.vector[pivot] &= ~1];
       SAFE_SET(nodes[node].child[0], RecursivelyScoreNPL(m, bit - 1));
@@ -118,14 +118,14 @@ int LikelihoodTree::ScoreRecursive
    // Is this a leaf node?
    if (bit < 0)
       {
-      nodes[node].type = TREE_NODE_LEAF;
+      Type(node) = TREE_NODE_LEAF;
       nodes[node].value = CalculateLikelihood(m, *graph);
 
       return node;
       }
 
    // Find out if we can save time by using symmetries in the data
-   switch (nodes[node].type = FindRedundancy(m, pivot))
+   switch (Type(node) = FindRedundancy(m, pivot))
       {
       case TREE_NODE_ZERO :
          nodes[node].value = 0.0;
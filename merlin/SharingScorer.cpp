@@ -0,0 +1,198 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/SharingScorer.cpp 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#include "SharingScorer.h"
+
+// The routines in this section traverse an inheritance tree, tracking
+// the founder allele carried by each non-founder allele in mantra.state.
+//    Score(...) handles fully specified branches of the tree, and
+//               switches to WeightedScore(...) when symmetries are found
+//    WeightedScore(...) flags uninformative meioses so that each scorer
+//               can average over the alternatives
+//
+// All scorers in the list must share the same mantra, and each branch
+// is visited once regardless of how many scorers are updated.
+//
+
+double SharingScorer::Score(Tree & tree, SharingScorer ** scorers, int count)
+   {
+   for (int i = 0; i < count; i++)
+      scorers[i]->Prepare();
+
+   double sum = Score(tree, scorers, count, 0, tree.bit_count - 1, 0);
+
+   // Results for joint traversals are held for later Calculate() calls
+   if (count > 1)
+      for (int i = 0; i < count; i++)
+         {
+         scorers[i]->scored = &tree;
+         scorers[i]->likelihood = sum;
+         }
+
+   return sum;
+   }
+
+double SharingScorer::Calculate(Tree & tree)
+   {
+   if (scored == &tree)
+      {
+      scored = NULL;
+      return likelihood;
+      }
+
+   SharingScorer * self = this;
+
+   return Score(tree, &self, 1);
+   }
+
+double SharingScorer::Score(Tree & tree, SharingScorer ** scorers, int count,
+                            int node, int bit, int start)
+   {
+   Mantra & mantra = scorers[0]->mantra;
+
+   double sum = 0.0; // Initialization avoids compiler warning
+   int pivot, end;
+
+   if (bit != mantra.bit_count - 1)
+      {
+      int pivot = bit == -1 ? mantra.two_n : mantra.bits[bit];
+      int last_pivot = mantra.bits[bit+1] + 1;
+
+      for (int i = last_pivot; i < pivot; i++)
+         mantra.state[i] = mantra.state[mantra.vector[i]];
+      }
+
+   if (bit >= 0)
+      {
+      pivot = mantra.bits[bit];
+      end = pivot & ~1;
+
+      switch (tree.Type(node))
+         {
+         case TREE_NODE_ZERO :
+            return 0.0;
+         case TREE_NODE_LEAF :
+         case TREE_NODE_ONE :
+            for (int s = 0; s < count; s++)
+               {
+               scorers[s]->uninformative.Dimension(mantra.two_n);
+               scorers[s]->uninformative.Zero();
+               scorers[s]->uninformative[pivot] = true;
+               }
+
+            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
+            sum = WeightedScore(tree, scorers, count,
+                  tree.Type(node) == TREE_NODE_LEAF ?
+                  node : tree.nodes[node].child[0], bit - 1, end);
+            break;
+         case TREE_NODE_TWO :
+            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
+            sum = Score(tree, scorers, count, tree.nodes[node].child[0],
+                        bit - 1, end);
+            mantra.state[pivot] = mantra.state[mantra.vector[pivot] |= 1];
+            sum += Score(tree, scorers, count, tree.nodes[node].child[1],
+                        bit - 1, end);
+            break;
+         }
+      }
+   else
+      {
+      // At the base of the tree there are only zero nodes
+      // and leaf nodes ...
+
+      if (tree.Type(node) == TREE_NODE_ZERO)
+         return 0.0;
+
+      end = mantra.two_n;
+      sum = tree.nodes[node].value;
+      }
+
+   for (int s = 0; s < count; s++)
+      scorers[s]->Accumulate(start, end, sum);
+
+   return sum;
+   }
+
+double SharingScorer::WeightedScore(Tree & tree, SharingScorer ** scorers,
+                            int count, int node, int bit, int start,
+                            double weight)
+   {
+   Mantra & mantra = scorers[0]->mantra;
+
+   double sum = 0.0; // Initialization avoids compiler warning
+   int pivot, end;
+
+   if (bit != mantra.bit_count - 1)
+      {
+      int pivot = bit == -1 ? mantra.two_n : mantra.bits[bit];
+      int last_pivot = mantra.bits[bit+1] + 1;
+
+      for (int i = last_pivot; i < pivot; i++)
+         mantra.state[i] = mantra.state[mantra.vector[i]];
+      }
+
+   if (bit >= 0)
+      {
+      pivot = mantra.bits[bit];
+      end = pivot & ~1;
+
+      switch (tree.Type(node))
+         {
+         case TREE_NODE_ZERO :
+            return 0.0;
+         case TREE_NODE_LEAF :
+         case TREE_NODE_ONE :
+            for (int s = 0; s < count; s++)
+               scorers[s]->uninformative[pivot] = true;
+
+            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
+            sum = WeightedScore(tree, scorers, count,
+                  tree.Type(node) == TREE_NODE_LEAF ?
+                  node : tree.nodes[node].child[0], bit - 1, end, weight * 2.0);
+            break;
+         case TREE_NODE_TWO :
+            for (int s = 0; s < count; s++)
+               scorers[s]->uninformative[pivot] = false;
+
+            mantra.state[pivot] = mantra.state[mantra.vector[pivot] &= ~1];
+            sum = WeightedScore(tree, scorers, count, tree.nodes[node].child[0],
+                                bit - 1, end, weight);
+            mantra.state[pivot] = mantra.state[mantra.vector[pivot] |= 1];
+            sum += WeightedScore(tree, scorers, count, tree.nodes[node].child[1],
+                                 bit - 1, end, weight);
+            break;
+         }
+      }
+   else
+      {
+      // At the base of the tree there are only zero nodes
+      // and leaf nodes ...
+
+      if (tree.Type(node) == TREE_NODE_ZERO)
+         return 0.0;
+
+      end = mantra.two_n;
+      sum = tree.nodes[node].value * weight;
+      }
+
+   for (int s = 0; s < count; s++)
+      scorers[s]->WeightedAccumulate(start, end, sum);
+
+   return sum;
+   }
+
+ 
@@ -0,0 +1,73 @@
+////////////////////////////////////////////////////////////////////// 
+// merlin/SharingScorer.h 
+// (c) 2000-2007 Goncalo Abecasis
+// 
+// This file is distributed as part of the MERLIN source code package   
+// and may not be redistributed in any form, without prior written    
+// permission from the author. Permission is granted for you to       
+// modify this file for your own personal use, but modified versions  
+// must retain this copyright notice and must not be distributed.     
+// 
+// Permission is granted for you to use this file to compile MERLIN.    
+// 
+// All computer programs have bugs. Use this file at your own risk.   
+// 
+// Tuesday December 18, 2007
+// 
+ 
+#ifndef __SHARING_SCORER_H__
+#define __SHARING_SCORER_H__
+
+#include "Mantra.h"
+#include "Tree.h"
+#include "IntArray.h"
+
+// Base class for statistics that are accumulated by walking an
+// inheritance tree and examining the allele sharing implied by each
+// branch. Several scorers can be updated in a single traversal.
+//
+
+class SharingScorer
+   {
+   public:
+      SharingScorer(Mantra & m) : mantra(m), scored(NULL) {}
+      virtual ~SharingScorer() {}
+
+      // Traverses tree once, updating all listed scorers, and returns
+      // the unscaled likelihood for the tree
+      static double Score(Tree & tree, SharingScorer ** scorers, int count);
+
+      // Scores a single tree, reusing the result of an earlier joint
+      // traversal when one is available
+      double Calculate(Tree & tree);
+
+   protected:
+      Mantra & mantra;
+
+      // Uninformative meiosis in trees with symmetries
+      IntArray uninformative;
+
+      // Called before traversal to clear accumulated statistics
+      virtual void Prepare() = 0;
+
+      // Update statistics for alleles in the range [start, end) given
+      // fully specified inheritance (Accumulate) or inheritance with
+      // symmetries flagged as uninformative (WeightedAccumulate)
+      virtual void Accumulate(int start, int end, double sum) = 0;
+      virtual void WeightedAccumulate(int start, int end, double sum) = 0;
+
+   private:
+      // Result of the last joint traversal, pending use by Calculate()
+      Tree *   scored;
+      double   likelihood;
+
+      static double Score(Tree & tree, SharingScorer ** scorers, int count,
+                          int node, int bit, int start);
+      static double WeightedScore(Tree & tree, SharingScorer ** scorers,
+                          int count, int node, int bit, int start,
+                          double weight = 2.0);
+   };
+
+#endif
+
+ 
@@ -29,7 +29,7 @@ void Tree::Multiply(int node, double scale)
       {
       node = stack[--ptr];
 
-      switch (nodes[node].type)
+      switch (Type(node))
          {
          case TREE_NODE_ZERO :
             break;
@@ -56,10 +56,10 @@ void Tree::Add(int node, double constant)
       {
       node = stack[--ptr];
 
-      switch (nodes[node].type)
+      switch (Type(node))
          {
          case TREE_NODE_ZERO :
-            nodes[node].type = TREE_NODE_LEAF;
+            Type(node) = TREE_NODE_LEAF;
             nodes[node].value = constant;
             break;
          case TREE_NODE_LEAF :
@@ -87,10 +87,10 @@ void Tree::Floor(int node, double floor)
       {
       node = stack[--ptr];
 
-      switch (nodes[node].type)
+      switch (Type(node))
          {
          case TREE_NODE_ZERO :
-            nodes[node].type = TREE_NODE_LEAF;
+            Type(node) = TREE_NODE_LEAF;
             nodes[node].value = floor;
             break;
          case TREE_NODE_LEAF :
@@ -118,10 +118,10 @@ void Tree::ScaleSum(int node, double scale, double sum)
       {
       node = stack[--ptr];
 
-      switch (nodes[node].type)
+      switch (Type(node))
          {
          case TREE_NODE_ZERO :
-            nodes[node].type = TREE_NODE_LEAF;
+            Type(node) = TREE_NODE_LEAF;
             nodes[node].value = sum;
             break;
          case TREE_NODE_LEAF :
@@ -138,7 +138,7 @@ void Tree::ScaleSum(int node, double scale, double sum)
 
 void Tree::Graft(int target, int source)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
          break;
@@ -157,7 +157,7 @@ void Tree::Graft(int target, int source)
 
 void Tree::GraftAndScale(int target, int source, double scale)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
          break;
@@ -176,7 +176,7 @@ void Tree::GraftAndScale(int target, int source, double scale)
 
 void Tree::GraftAndScale(int target, Tree & tree, int source, double scale)
    {
-   switch (nodes[target].type = tree.nodes[source].type)
+   switch (Type(target) = tree.Type(source))
       {
       case TREE_NODE_ZERO :
          break;
@@ -199,10 +199,10 @@ void Tree::GraftAndScale(int target, Tree & tree, int source, double scale)
 void Tree::GraftAndScaleAndAdd
    (int target, Tree & tree, int source, double scale, double add)
    {
-   switch (nodes[target].type = tree.nodes[source].type)
+   switch (Type(target) = tree.Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = add;
          break;
       case TREE_NODE_LEAF :
@@ -224,10 +224,10 @@ void Tree::GraftAndScaleAndAdd
 void Tree::GraftAndScaleAndChoose
    (int target, Tree & tree, int source, double scale, double floor)
    {
-   switch (nodes[target].type = tree.nodes[source].type)
+   switch (Type(target) = tree.Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = floor;
          break;
       case TREE_NODE_LEAF :
@@ -249,12 +249,12 @@ void Tree::GraftAndScaleAndChoose
 void Tree::GraftAndScaleAndAdd(int target, int source, double scale,
                                double sum_target, double sum_source)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = sum_target;
-         nodes[source].type = TREE_NODE_LEAF;
+         Type(source) = TREE_NODE_LEAF;
          nodes[source].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -278,7 +278,7 @@ int Tree::CopyAndScale(int node, double scale)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -301,7 +301,7 @@ int Tree::CopyAndScale(Tree & tree, int node, double scale)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -327,10 +327,10 @@ int Tree::CopyAndScaleAndAdd(Tree & tree, int node, double scale, double add)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = add;
          break;
       case TREE_NODE_LEAF :
@@ -355,10 +355,10 @@ int Tree::CopyAndScaleAndChoose(Tree & tree, int node, double scale, double floo
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = floor;
          break;
       case TREE_NODE_LEAF :
@@ -384,12 +384,12 @@ int Tree::CopyAndScaleAndAdd(int node, double scale, double sum_target,
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = sum_target;
-         nodes[node].type = TREE_NODE_LEAF;
+         Type(node) = TREE_NODE_LEAF;
          nodes[node].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -413,7 +413,7 @@ int Tree::CopyAndScaleAndAdd(int node, double scale, double sum_target,
 
 void Tree::Multiply(Tree & tree, int node1, int node2)
    {
-   switch (PAIR_NODES(nodes[node1].type, tree.nodes[node2].type))
+   switch (PAIR_NODES(Type(node1), tree.Type(node2)))
       {
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_ZERO) :
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
@@ -423,7 +423,7 @@ void Tree::Multiply(Tree & tree, int node1, int node2)
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ZERO) :
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ZERO)  :
       case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ZERO)  :
-         nodes[node1].type = TREE_NODE_ZERO;
+         Type(node1) = TREE_NODE_ZERO;
          break;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_LEAF) :
          Multiply(nodes[node1].child[0], tree.nodes[node2].value );
@@ -436,14 +436,14 @@ void Tree::Multiply(Tree & tree, int node1, int node2)
          nodes[node1].value *= tree.nodes[node2].value;
          break;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ONE) :
-         nodes[node1].type = TREE_NODE_ONE;
+         Type(node1) = TREE_NODE_ONE;
          SAFE_SET(nodes[node1].child[0],
             CopyAndScale(tree, tree.nodes[node2].child[0], nodes[node1].value));
          break;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_TWO) :
          {
          double old_value = nodes[node1].value;
-         nodes[node1].type = TREE_NODE_TWO;
+         Type(node1) = TREE_NODE_TWO;
          SAFE_SET(nodes[node1].child[0],
             CopyAndScale(tree, tree.nodes[node2].child[0], old_value));
          SAFE_SET(nodes[node1].child[1],
@@ -454,7 +454,7 @@ void Tree::Multiply(Tree & tree, int node1, int node2)
          Multiply(tree, nodes[node1].child[0], tree.nodes[node2].child[0]);
          break;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[node1].type = TREE_NODE_TWO;
+         Type(node1) = TREE_NODE_TWO;
          SAFE_SET(nodes[node1].child[1], Copy(nodes[node1].child[0]));
          Multiply(tree, nodes[node1].child[0], tree.nodes[node2].child[0]);
          Multiply(tree, nodes[node1].child[1], tree.nodes[node2].child[1]);
@@ -472,7 +472,7 @@ void Tree::Multiply(Tree & tree, int node1, int node2)
 
 double Tree::Mean(int node, double weight) const
    {
-   switch (nodes[node].type)
+   switch (Type(node))
      {
      case TREE_NODE_ZERO :
         return 0.0;
@@ -489,7 +489,7 @@ double Tree::Mean(int node, double weight) const
 
 double Tree::MeanProduct(Tree & tree, int node1, int node2, double weight)
    {
-   switch (PAIR_NODES(nodes[node1].type, tree.nodes[node2].type))
+   switch (PAIR_NODES(Type(node1), tree.Type(node2)))
       {
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_ZERO) :
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
@@ -529,6 +529,100 @@ double Tree::MeanProduct(Tree & tree, int node1, int node2, double weight)
    return 0.0;
    }
 
+// Evaluates the mean product of this tree with each of several others
+//    Each branch of this tree is visited once, carrying the matching
+//    node in every partner tree. Partners that reach a zero or leaf node
+//    are resolved immediately and drop out of the traversal. Sums are
+//    accumulated in the same order as MeanProduct() so results match.
+//
+
+void Tree::MeanProducts(Tree ** trees, int count, Vector & means)
+   {
+   means.Dimension(count);
+
+   if (count == 0) return;
+
+   // Scratch space for each level of the traversal
+   IntArray partners(count * 2 * (bit_count + 2));
+   Vector   scratch(count * 2 * (bit_count + 2));
+
+   partners.Zero();
+
+   MeanProducts(trees, count, 0, partners, 1.0, means.data,
+                (int *) partners + count, scratch.data);
+   }
+
+void Tree::MeanProducts(Tree ** trees, int count, int node, const int * partners,
+                        double weight, double * sums, int * next, double * scratch)
+   {
+   int  active = 0;
+   bool split = false;
+
+   double mean = 0.0;
+   bool   meanCalculated = false;
+
+   for (int i = 0; i < count; i++)
+      {
+      sums[i] = 0.0;
+      next[i] = -1;
+
+      if (partners[i] == -1) continue;
+
+      Tree & tree = *trees[i];
+      int node2 = partners[i];
+
+      if (Type(node) == TREE_NODE_ZERO || tree.Type(node2) == TREE_NODE_ZERO)
+         continue;
+
+      if (Type(node) == TREE_NODE_LEAF)
+         sums[i] = tree.Type(node2) == TREE_NODE_LEAF ?
+                   nodes[node].value * tree.nodes[node2].value * weight :
+                   tree.Mean(node2, weight) * nodes[node].value;
+      else if (tree.Type(node2) == TREE_NODE_LEAF)
+         {
+         if (!meanCalculated)
+            {
+            mean = Mean(node, weight);
+            meanCalculated = true;
+            }
+
+         sums[i] = mean * tree.nodes[node2].value;
+         }
+      else
+         {
+         next[i] = node2;
+         split |= tree.Type(node2) == TREE_NODE_TWO;
+         active++;
+         }
+      }
+
+   if (active == 0) return;
+
+   // Branch on this tree, or on any partner with two distinct children
+   split |= Type(node) == TREE_NODE_TWO;
+
+   int    * child = next + count;
+   double * left = scratch;
+   double * right = scratch + count;
+
+   for (int b = 0; b < (split ? 2 : 1); b++)
+      {
+      for (int i = 0; i < count; i++)
+         child[i] = next[i] == -1 ? -1 :
+                    trees[i]->nodes[next[i]].child[
+                       trees[i]->Type(next[i]) == TREE_NODE_TWO ? b : 0];
+
+      MeanProducts(trees, count,
+                   nodes[node].child[Type(node) == TREE_NODE_TWO ? b : 0],
+                   child, split ? weight * 0.5 : weight, b ? right : left,
+                   child + count, scratch + count * 2);
+      }
+
+   for (int i = 0; i < count; i++)
+      if (next[i] != -1)
+         sums[i] = split ? left[i] + right[i] : left[i];
+   }
+
 // Branch grafting and copying routines used by the haplotyping engine
 //
 //    When haplotyping the objective is to find the single most likely path
@@ -542,12 +636,12 @@ int Tree::CopyAndScaleAndChoose(int node, double scale, double sum_target,
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = sum_target;
-         nodes[node].type = TREE_NODE_LEAF;
+         Type(node) = TREE_NODE_LEAF;
          nodes[node].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -572,12 +666,12 @@ int Tree::CopyAndScaleAndChoose(int node, double scale, double sum_target,
 void Tree::GraftAndScaleAndChoose(int target, int source,
            double scale, double sum_target, double sum_source)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = sum_target;
-         nodes[source].type = TREE_NODE_LEAF;
+         Type(source) = TREE_NODE_LEAF;
          nodes[source].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -606,32 +700,32 @@ void Tree::MakeTree(const int * bits, int depth, double value)
    for (int i = depth - 1; i >= 0; i--)
       {
       int node = NewNode();
-      nodes[node].type = TREE_NODE_TWO;
+      Type(node) = TREE_NODE_TWO;
       nodes[node].child[bits[i] != 0] = (depth - i) * 2;
       nodes[node].child[bits[i] == 0] = (depth - i) * 2 - 1;
       node = NewNode();
-      nodes[node].type = TREE_NODE_ZERO;
+      Type(node) = TREE_NODE_ZERO;
       }
 
    int node = NewNode();
-   nodes[node].type = TREE_NODE_LEAF;
+   Type(node) = TREE_NODE_LEAF;
    nodes[node].value = value;
    }
 
 void Tree::Add(Tree & tree, int node1, int node2)
    {
-   switch (PAIR_NODES(nodes[node1].type, tree.nodes[node2].type))
+   switch (PAIR_NODES(Type(node1), tree.Type(node2)))
       {
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_LEAF) :
-         nodes[node1].type = TREE_NODE_LEAF;
+         Type(node1) = TREE_NODE_LEAF;
          nodes[node1].value = tree.nodes[node2].value;
          break;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_ONE)  :
-         nodes[node1].type = TREE_NODE_ONE;
+         Type(node1) = TREE_NODE_ONE;
          SAFE_SET(nodes[node1].child[0], Copy(tree, tree.nodes[node2].child[0]));
          break;
       case PAIR_NODES(TREE_NODE_ZERO, TREE_NODE_TWO)  :
-         nodes[node1].type = TREE_NODE_ONE;
+         Type(node1) = TREE_NODE_ONE;
          SAFE_SET(nodes[node1].child[0], Copy(tree, tree.nodes[node2].child[0]));
          SAFE_SET(nodes[node1].child[1], Copy(tree, tree.nodes[node2].child[1]));
          break;
@@ -648,14 +742,14 @@ void Tree::Add(Tree & tree, int node1, int node2)
          nodes[node1].value += tree.nodes[node2].value;
          break;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_ONE) :
-         nodes[node1].type = TREE_NODE_ONE;
+         Type(node1) = TREE_NODE_ONE;
          SAFE_SET(nodes[node1].child[0],
             CopyAndAdd(tree, tree.nodes[node2].child[0], nodes[node1].value));
          break;
       case PAIR_NODES(TREE_NODE_LEAF, TREE_NODE_TWO) :
          {
          double old_value = nodes[node1].value;
-         nodes[node1].type = TREE_NODE_TWO;
+         Type(node1) = TREE_NODE_TWO;
          SAFE_SET(nodes[node1].child[0],
             CopyAndAdd(tree, tree.nodes[node2].child[0], old_value));
          SAFE_SET(nodes[node1].child[1],
@@ -666,7 +760,7 @@ void Tree::Add(Tree & tree, int node1, int node2)
          Add(tree, nodes[node1].child[0], tree.nodes[node2].child[0]);
          break;
       case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
-         nodes[node1].type = TREE_NODE_TWO;
+         Type(node1) = TREE_NODE_TWO;
          SAFE_SET(nodes[node1].child[1], Copy(nodes[node1].child[0]));
          Add(tree, nodes[node1].child[0], tree.nodes[node2].child[0]);
          Add(tree, nodes[node1].child[1], tree.nodes[node2].child[1]);
@@ -686,10 +780,10 @@ int Tree::CopyAndAdd(Tree & tree, int node, double summand)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type  = TREE_NODE_LEAF;
+         Type(new_node)  = TREE_NODE_LEAF;
          nodes[new_node].value = summand;
          break;
       case TREE_NODE_LEAF :
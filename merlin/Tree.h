@@ -20,6 +20,7 @@
 
 #include "TreeBasics.h"
 #include "IntArray.h"
+#include "MathVector.h"
 
 class Tree : public BasicTree
    {
@@ -36,6 +37,9 @@ class Tree : public BasicTree
       double Mean(int node1, double weight=1.0) const;
       double WeightedSum() const { return Mean(0, 1.0); }
 
+      // Evaluates MeanProduct() for several trees in a single traversal
+      void   MeanProducts(Tree ** trees, int count, Vector & means);
+
       void ScaleSum(int node, double scale, double sum);
 
       int  CopyAndScale(int node, double scale);
@@ -66,6 +70,10 @@ class Tree : public BasicTree
          { Multiply(rhs, 0, 0); return *this; }
 
       void MakeTree(const int * bits, int depth, double value);
+
+   private:
+      void MeanProducts(Tree ** trees, int count, int node, const int * partners,
+                        double weight, double * sums, int * next, double * scratch);
    };
 
 #endif
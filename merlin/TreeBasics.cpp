@@ -20,19 +20,61 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <float.h>
 
 int BasicTree::maxNodes = 0;
-int BasicTree::totalNodes = 0;
+bool BasicTree::floatLeaves = false;
+__thread int BasicTree::totalNodes = 0;
+__thread int BasicTree::peakNodes = 0;
 
 void BasicTree::Grow()
    {
-   totalNodes -= count;
+   int previous = count;
    count = count ? count * 2 : 256;
-   totalNodes += count;
 
-   if (maxNodes && totalNodes > maxNodes) MemoryCeiling();
-   TreeNode * _nodes = (TreeNode *) realloc(nodes, count * sizeof(TreeNode));
+   if (CountNodes(count - previous) > maxNodes && maxNodes) MemoryCeiling();
+   Reallocate(previous);
+   }
+
+void BasicTree::Reallocate(int previous)
+   {
+   // Reuse a block released by another tree, if one is available
+   TreeNode * _nodes = pool == NULL ? NULL : pool->Allocate(count);
+
+   if (_nodes != NULL)
+      {
+      if (nodes != NULL)
+         {
+         int keep = min(count, previous);
+
+         memcpy(_nodes, nodes, sizeof(TreeNode) * keep);
+#ifndef __WIDE_TREE_NODES__
+         memcpy(_nodes + count, nodes + previous, keep);
+#endif
+
+         if (!pool->Recycle(nodes, previous))
+            free(nodes);
+         }
+
+      nodes = _nodes;
+      return;
+      }
+
+#ifndef __WIDE_TREE_NODES__
+   // Node types follow the last node and must be moved down before shrinking
+   if (nodes != NULL && count < previous)
+      memmove(nodes + count, nodes + previous, count);
+#endif
+
+   _nodes = (TreeNode *) realloc(nodes, count * TREE_NODE_SIZE);
    if (_nodes == NULL) OutOfMemory();
+
+#ifndef __WIDE_TREE_NODES__
+   // ... or moved up after growing
+   if (nodes != NULL && count > previous)
+      memmove(_nodes + count, _nodes + previous, previous);
+#endif
+
    nodes = _nodes;
    }
 
@@ -40,28 +82,28 @@ void BasicTree::TrimNoMerge(int node)
    {
    int child, child2;
 
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
       case TREE_NODE_TWO :
          TrimNoMerge(child = nodes[node].child[0]);
          TrimNoMerge(child2 = nodes[node].child[1]);
-         if (nodes[child].type == nodes[child2].type &&
-             nodes[child].type == TREE_NODE_ZERO)
-             nodes[node].type = TREE_NODE_ZERO;
+         if (Type(child) == Type(child2) &&
+             Type(child) == TREE_NODE_ZERO)
+             Type(node) = TREE_NODE_ZERO;
          return;
       case TREE_NODE_ONE :
          TrimNoMerge(child = nodes[node].child[0]);
-         if (nodes[child].type == TREE_NODE_ZERO)
-            nodes[node].type = TREE_NODE_ZERO;
-         else if (nodes[child].type == TREE_NODE_LEAF)
-            nodes[node].type = TREE_NODE_LEAF,
+         if (Type(child) == TREE_NODE_ZERO)
+            Type(node) = TREE_NODE_ZERO;
+         else if (Type(child) == TREE_NODE_LEAF)
+            Type(node) = TREE_NODE_LEAF,
             nodes[node].value = nodes[child].value;
          return;
       case TREE_NODE_LEAF :
          if (nodes[node].value == 0.0)
-            nodes[node].type = TREE_NODE_ZERO;
+            Type(node) = TREE_NODE_ZERO;
          return;
       }
    }
@@ -70,36 +112,36 @@ void BasicTree::Trim(int node)
    {
    int child, child2;
 
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
       case TREE_NODE_TWO :
          Trim(child = nodes[node].child[0]);
          Trim(child2 = nodes[node].child[1]);
-         if (nodes[child].type == nodes[child2].type)
-            if (nodes[child].type == TREE_NODE_ZERO)
-               nodes[node].type = TREE_NODE_ZERO;
-            else if (nodes[child].type == TREE_NODE_LEAF &&
+         if (Type(child) == Type(child2))
+            if (Type(child) == TREE_NODE_ZERO)
+               Type(node) = TREE_NODE_ZERO;
+            else if (Type(child) == TREE_NODE_LEAF &&
                      nodes[child].value == nodes[child2].value)
                {
-               nodes[node].type = TREE_NODE_LEAF;
+               Type(node) = TREE_NODE_LEAF;
                nodes[node].value = nodes[child].value;
                }
          return;
       case TREE_NODE_ONE :
          Trim(child = nodes[node].child[0]);
-         if (nodes[child].type == TREE_NODE_ZERO)
-            nodes[node].type = TREE_NODE_ZERO;
-         else if (nodes[child].type == TREE_NODE_LEAF)
+         if (Type(child) == TREE_NODE_ZERO)
+            Type(node) = TREE_NODE_ZERO;
+         else if (Type(child) == TREE_NODE_LEAF)
             {
-            nodes[node].type = TREE_NODE_LEAF;
+            Type(node) = TREE_NODE_LEAF;
             nodes[node].value = nodes[child].value;
             }
          return;
       case TREE_NODE_LEAF :
          if (nodes[node].value == 0.0)
-            nodes[node].type = TREE_NODE_ZERO;
+            Type(node) = TREE_NODE_ZERO;
          return;
       }
    }
@@ -108,25 +150,25 @@ void BasicTree::MakeBooleanTree(int node)
    {
    int child, child2;
 
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return;
       case TREE_NODE_TWO :
          MakeBooleanTree(child = nodes[node].child[0]);
          MakeBooleanTree(child2 = nodes[node].child[1]);
-         if (nodes[child].type == nodes[child2].type)
-            if (nodes[child].type == TREE_NODE_ZERO)
-               nodes[node].type = TREE_NODE_ZERO;
+         if (Type(child) == Type(child2))
+            if (Type(child) == TREE_NODE_ZERO)
+               Type(node) = TREE_NODE_ZERO;
          return;
       case TREE_NODE_ONE :
          MakeBooleanTree(child = nodes[node].child[0]);
-         if (nodes[child].type == TREE_NODE_ZERO)
-            nodes[node].type = TREE_NODE_ZERO;
+         if (Type(child) == TREE_NODE_ZERO)
+            Type(node) = TREE_NODE_ZERO;
          return;
       case TREE_NODE_LEAF :
          if (nodes[node].value == 0.0)
-            nodes[node].type = TREE_NODE_ZERO;
+            Type(node) = TREE_NODE_ZERO;
          else
             nodes[node].value = 1.0;
          return;
@@ -137,7 +179,7 @@ int BasicTree::Copy(int node)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -160,7 +202,7 @@ int BasicTree::Copy(const BasicTree & source, int node)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = source.nodes[node].type)
+   switch (Type(new_node) = source.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -189,7 +231,7 @@ void BasicTree::Copy(const BasicTree & rhs)
 
 void BasicTree::Print(int node, int pad)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          printf("%*s ZERO\n", pad, "");
@@ -216,7 +258,7 @@ void BasicTree::MakeMinimalTree(double value, int bits)
 
    int node = NewNode();
 
-   nodes[node].type = TREE_NODE_LEAF;
+   Type(node) = TREE_NODE_LEAF;
    nodes[node].value = value;
 
    bit_count = bits;
@@ -229,7 +271,7 @@ void BasicTree::MakeEmptyTree(int bits)
 
    int node = NewNode();
 
-   nodes[node].type = TREE_NODE_ZERO;
+   Type(node) = TREE_NODE_ZERO;
 
    bit_count = bits;
    logOffset = 0;
@@ -239,20 +281,256 @@ void BasicTree::CarbonCopy(const BasicTree & rhs)
    {
    if (count < rhs.count)
       {
-      totalNodes -= count;
+      int previous = count;
       count = rhs.count;
-      totalNodes += count;
 
-      if (maxNodes && totalNodes > maxNodes) MemoryCeiling();
-      TreeNode * _nodes = (TreeNode *) realloc(nodes, count * sizeof(TreeNode));
-      if (_nodes == NULL) OutOfMemory();
-      nodes = _nodes;
+      if (CountNodes(count - previous) > maxNodes && maxNodes) MemoryCeiling();
+      Reallocate(previous);
       }
 
    nextFree = rhs.nextFree;
    bit_count = rhs.bit_count;
+   shared = rhs.shared;
+
+   memcpy(nodes, rhs.nodes, sizeof(TreeNode) * nextFree);
+#ifndef __WIDE_TREE_NODES__
+   memcpy(&Type(0), &rhs.Type(0), nextFree);
+#endif
+   }
+
+void BasicTree::CopyForThread(const BasicTree & rhs)
+   {
+   Free();
+
+   nodes = (TreeNode *) malloc(rhs.nextFree * TREE_NODE_SIZE);
+   if (nodes == NULL) OutOfMemory();
+
+   count = nextFree = rhs.nextFree;
+   bit_count = rhs.bit_count;
+   logOffset = rhs.logOffset;
+   shared = rhs.shared;
 
    memcpy(nodes, rhs.nodes, sizeof(TreeNode) * nextFree);
+#ifndef __WIDE_TREE_NODES__
+   memcpy(&Type(0), &rhs.Type(0), nextFree);
+#endif
+   }
+
+// This section handles recycling of node storage
+//
+
+__thread NodePool * BasicTree::pool = NULL;
+
+NodePool::NodePool()
+   {
+   for (int i = 0; i < NODE_POOL_CLASSES; i++)
+      blocks[i] = NULL;
+
+   requests = recycled = storedNodes = peakStoredNodes = 0;
+   }
+
+int NodePool::SizeClass(int count)
+   {
+   // Only blocks with a power of two number of nodes are recycled
+   if (count < NODE_POOL_MIN_NODES || (count & (count - 1)))
+      return -1;
+
+   int size = 0;
+   while ((NODE_POOL_MIN_NODES << size) < count)
+      size++;
+
+   return size < NODE_POOL_CLASSES ? size : -1;
+   }
+
+TreeNode * NodePool::Allocate(int count)
+   {
+   requests++;
+
+   int size = SizeClass(count);
+   if (size < 0 || blocks[size] == NULL) return NULL;
+
+   // Unused blocks are linked through their first node
+   TreeNode * block = blocks[size];
+   blocks[size] = (TreeNode *) block->info;
+
+   storedNodes -= count;
+   recycled++;
+
+   return block;
+   }
+
+bool NodePool::Recycle(TreeNode * block, int count)
+   {
+   int size = SizeClass(count);
+   if (size < 0) return false;
+
+   // Limit the amount of memory held in reserve
+   int limit = BasicTree::maxNodes ? BasicTree::maxNodes / 4 : NODE_POOL_MAX_NODES;
+   if (storedNodes + count > limit) return false;
+
+   block->info = blocks[size];
+   blocks[size] = block;
+
+   storedNodes += count;
+   if (storedNodes > peakStoredNodes) peakStoredNodes = storedNodes;
+
+   return true;
+   }
+
+void NodePool::Release()
+   {
+   for (int i = 0; i < NODE_POOL_CLASSES; i++)
+      while (blocks[i] != NULL)
+         {
+         TreeNode * block = blocks[i];
+         blocks[i] = (TreeNode *) block->info;
+         free(block);
+         }
+
+   storedNodes = 0;
+   }
+
+// This section handles sharing of identical subtrees
+//
+
+void BasicTree::Share()
+   {
+   if (shared || nextFree < 2) return;
+
+   // Table of unique subtrees, kept less than half full
+   int size = 256;
+   while (size < nextFree * 2)
+      size *= 2;
+
+   IntArray table(size);
+   table.Set(-1);
+
+   // Unique subtrees are listed with children before their parents
+   BasicTree unique;
+   ShareNode(unique, table, 0);
+
+   // Reverse the list, so that the root is stored in the first node
+   int last = unique.nextFree - 1;
+
+   for (int i = 0, j = last; i < j; i++, j--)
+      {
+      TreeNode swap = unique.nodes[i];
+      unique.nodes[i] = unique.nodes[j];
+      unique.nodes[j] = swap;
+
+      int swap_type = unique.Type(i);
+      unique.Type(i) = unique.Type(j);
+      unique.Type(j) = swap_type;
+      }
+
+   for (int i = 0; i <= last; i++)
+      switch (unique.Type(i))
+         {
+         case TREE_NODE_TWO :
+            unique.nodes[i].child[1] = last - unique.nodes[i].child[1];
+         case TREE_NODE_ONE :
+            unique.nodes[i].child[0] = last - unique.nodes[i].child[0];
+            break;
+         }
+
+   unique.bit_count = bit_count;
+   unique.logOffset = logOffset;
+
+   Exchange(unique);
+
+   // Release any unused nodes
+   int previous = count;
+   count = nextFree;
+   CountNodes(count - previous);
+   Reallocate(previous);
+
+   shared = true;
+   }
+
+int BasicTree::ShareNode(BasicTree & unique, IntArray & table, int node)
+   {
+   int type = Type(node);
+
+   // Summarize node contents in two integers
+   unsigned int key[2] = {0, 0};
+
+   switch (type)
+      {
+      case TREE_NODE_LEAF :
+         memcpy(key, &nodes[node].value, sizeof(double));
+         break;
+      case TREE_NODE_INT_VALUE :
+         key[0] = nodes[node].integer;
+         break;
+      case TREE_NODE_TWO :
+         key[1] = ShareNode(unique, table, nodes[node].child[1]);
+      case TREE_NODE_ONE :
+         key[0] = ShareNode(unique, table, nodes[node].child[0]);
+         break;
+      }
+
+   // Look for an identical node in the table
+   int mask = table.Length() - 1;
+   int slot = (type * 2654435761u ^ key[0] * 2246822519u ^ key[1] * 3266489917u) & mask;
+
+   while (table[slot] != -1)
+      {
+      int candidate = table[slot];
+
+      if (unique.Type(candidate) == type)
+         switch (type)
+            {
+            case TREE_NODE_ZERO :
+               return candidate;
+            case TREE_NODE_LEAF :
+               if (memcmp(key, &unique.nodes[candidate].value, sizeof(double)) == 0)
+                  return candidate;
+               break;
+            case TREE_NODE_INT_VALUE :
+               if (unique.nodes[candidate].integer == (int) key[0])
+                  return candidate;
+               break;
+            case TREE_NODE_TWO :
+               if (unique.nodes[candidate].child[1] != (int) key[1])
+                  break;
+            case TREE_NODE_ONE :
+               if (unique.nodes[candidate].child[0] == (int) key[0])
+                  return candidate;
+               break;
+            }
+
+      slot = (slot + 1) & mask;
+      }
+
+   // Otherwise, add a new node
+   int new_node = unique.NewNode();
+
+   unique.Type(new_node) = type;
+   memcpy(&unique.nodes[new_node].value, key, sizeof(key));
+
+   return table[slot] = new_node;
+   }
+
+void BasicTree::Expand()
+   {
+   if (!shared) return;
+
+   BasicTree expanded;
+   expanded.Copy(*this);
+
+   Exchange(expanded);
+   }
+
+void BasicTree::RoundToFloat()
+   {
+   for (int i = 0; i < nextFree; i++)
+      if (Type(i) == TREE_NODE_LEAF)
+         {
+         int    exponent;
+         double mantissa = frexp(nodes[i].value, &exponent);
+
+         nodes[i].value = ldexp((double) (float) mantissa, exponent);
+         }
    }
 
 // This section handles tree swapping
@@ -262,33 +540,27 @@ void BasicTree::CarbonCopy(const BasicTree & rhs)
 //
 int  BasicTree::SWAP_MIN = 16 * 1024;
 
-void BasicTree::UpdateSwapThreshold(int nTrees)
+void BasicTree::UpdateSwapThreshold(int nTrees, double availableBytes)
    {
    // Update swap tresholds so that at least nTrees can be stored
-   // in memory (it is assumed that about 256 Mb are available)
+   // in the available memory (swap files may be opened at any time
+   // when memory runs short, so larger trees are always swappable)
 
-   int availableMemory = maxNodes ? maxNodes : 512 * 1024 * 1024 / sizeof(TreeNode);
+   double threshold = availableBytes / TREE_NODE_SIZE / nTrees;
 
-   int threshold = availableMemory / nTrees;
-
-   if (threshold > 16 * 1024 && tmpfileInfo.skeleton != NULL)
+   if (threshold > 16 * 1024)
       SWAP_MIN = 16 * 1024;
    else if (threshold >= 8)
-      SWAP_MIN = threshold;
+      SWAP_MIN = (int) threshold;
    else
       SWAP_MIN = 8;
    }
 
-#define SWAP_PACKET    (128 * 1024)
-#define SWAP_MASK      (SWAP_PACKET - 1)
-
-char *      BasicTree::skeleton = NULL;
-double *    BasicTree::leaves = NULL;
-MiniDeflate BasicTree::zip;
+TreeBuffers BasicTree::sharedBuffers;
 
-TreeManager BasicTree::tmpfileInfo;
+__thread TreeBuffers * BasicTree::buffers = &BasicTree::sharedBuffers;
 
-void BasicTree::AllocateBuffers()
+void TreeBuffers::Allocate()
    {
    if (skeleton == NULL)
       {
@@ -297,7 +569,7 @@ void BasicTree::AllocateBuffers()
       }
    }
 
-void BasicTree::FreeBuffers()
+void TreeBuffers::Free()
    {
    if (skeleton != NULL)
       {
@@ -309,15 +581,27 @@ void BasicTree::FreeBuffers()
       }
    }
 
+void BasicTree::AllocateBuffers()
+   {
+   buffers->Allocate();
+   }
+
+void BasicTree::FreeBuffers()
+   {
+   buffers->Free();
+   }
+
 void BasicTree::SetupSwap()
    {
-   if (tmpfileInfo.OpenFiles())
+   if (buffers->tmpfileInfo.OpenFiles())
       AllocateBuffers();
    }
 
 void BasicTree::CloseSwap(bool quiet)
    {
-   if (tmpfileInfo.skeleton != NULL)
+   TreeManager & tmpfileInfo = buffers->tmpfileInfo;
+
+   if (tmpfileInfo.IsOpen())
       {
       if (!quiet)
          {
@@ -325,8 +609,6 @@ void BasicTree::CloseSwap(bool quiet)
 
          if (fileSize > 0.0)
             printf("Swap file usage peaked at < %.0fM \n", fileSize * 1e-6 + 1);
-         else if (fileSize < 0.0)
-            printf("Swap file usage peaked at > 2048 MB.\n");
          }
 
       tmpfileInfo.CloseFiles();
@@ -337,15 +619,15 @@ void BasicTree::CloseSwap(bool quiet)
 
 void BasicTree::FreeSwap()
    {
-   tmpfileInfo.Free();
+   buffers->tmpfileInfo.Free();
    }
 
 void BasicTree::RePack()
    {
-   if (tmpfileInfo.skeleton == NULL || count < SWAP_MIN) return;
+   if (!buffers->tmpfileInfo.IsOpen() || count < SWAP_MIN || shared) return;
 
-   totalNodes -= count;
-   free(nodes);
+   CountNodes(-count);
+   FreeNodes();
    nodes = NULL;
    }
 
@@ -355,27 +637,55 @@ void BasicTree::Discard()
 
    if (nodes != NULL)
       {
-      totalNodes -= count;
-      free(nodes);
+      CountNodes(-count);
+      FreeNodes();
       nodes = NULL;
       }
 
    count = 0;
+   shared = false;
+   }
+
+void BasicTree::Exchange(BasicTree & other)
+   {
+   TreeNode * swap_nodes = nodes;
+   nodes = other.nodes;
+   other.nodes = swap_nodes;
+
+   int swap = nextFree;
+   nextFree = other.nextFree;
+   other.nextFree = swap;
+
+   swap = count;
+   count = other.count;
+   other.count = swap;
+
+   swap = bit_count;
+   bit_count = other.bit_count;
+   other.bit_count = swap;
+
+   double swap_offset = logOffset;
+   logOffset = other.logOffset;
+   other.logOffset = swap_offset;
+
+   bool swap_shared = shared;
+   shared = other.shared;
+   other.shared = swap_shared;
    }
 
 void BasicTree::Pack()
    {
-   Pack(tmpfileInfo);
+   Pack(buffers->tmpfileInfo);
    }
 
 void BasicTree::PackOnly()
    {
-   PackOnly(tmpfileInfo);
+   PackOnly(buffers->tmpfileInfo);
    }
 
 void BasicTree::PackOrDiscard(TreeManager & output)
    {
-   if (output.skeleton == NULL)
+   if (!output.IsOpen())
       Discard();
    else
       Pack(output);
@@ -383,16 +693,47 @@ void BasicTree::PackOrDiscard(TreeManager & output)
 
 void BasicTree::PackOnly(TreeManager & output)
    {
-   if (output.skeleton == NULL || count < SWAP_MIN) return;
+   if (!output.IsOpen() || count < SWAP_MIN || shared) return;
+
+   char        * skeleton = buffers->skeleton;
+   double      * leaves = buffers->leaves;
 
    int nextSkel = 0;
    int nextLeaf = 0;
 
-   tmpfileOffset = output.position;
-   output.SetPosition(output.position);
+   output.BeginPack(tmpfileOffset);
 
    leafCount = 0;
 
+   // Single precision leaves are scaled relative to the largest leaf
+   float * floats = (float *) leaves;
+   packedAsFloat = floatLeaves;
+   leafExponent = 0;
+
+   if (packedAsFloat)
+      {
+      double largest = 0.0, smallest = 0.0;
+
+      for (int i = 0; i < nextFree; i++)
+         if (Type(i) == TREE_NODE_LEAF && nodes[i].value != 0.0)
+            {
+            double value = fabs(nodes[i].value);
+
+            if (value > largest) largest = value;
+            if (value < smallest || smallest == 0.0) smallest = value;
+            }
+
+      int smallestExponent;
+
+      frexp(largest, &leafExponent);
+      frexp(smallest, &smallestExponent);
+
+      // Trees whose leaves span more than the range of normal floats
+      // would lose their smallest leaves, so these are kept as doubles
+      if (leafExponent - smallestExponent > -FLT_MIN_EXP)
+         packedAsFloat = false, leafExponent = 0;
+      }
+
    stack.Clear();
    stack.Push(0);
    nextFree = 0;
@@ -401,19 +742,22 @@ void BasicTree::PackOnly(TreeManager & output)
      {
      int i = stack.Pop();
 
-     skeleton[nextSkel++] = (char) nodes[i].type;
+     skeleton[nextSkel++] = (char) Type(i);
 
      if ((nextSkel & SWAP_MASK) == 0)
-       zip.Deflate(output.skeleton, skeleton, SWAP_PACKET),
+       output.WriteSkeleton(skeleton, SWAP_PACKET),
        nextSkel = 0;
 
-     switch(nodes[i].type)
+     switch(Type(i))
        {
        case TREE_NODE_LEAF :
          leafCount++;
-         leaves[nextLeaf++] = nodes[i].value;
+         if (packedAsFloat)
+            floats[nextLeaf++] = (float) ldexp(nodes[i].value, -leafExponent);
+         else
+            leaves[nextLeaf++] = nodes[i].value;
          if ((nextLeaf & SWAP_MASK) == 0)
-            zip.Deflate(output.leaves, leaves, SWAP_PACKET * sizeof(double)),
+            output.WriteLeaves(leaves, SWAP_PACKET, LeafSize()),
             nextLeaf = 0;
          break;
        case TREE_NODE_TWO :
@@ -426,41 +770,41 @@ void BasicTree::PackOnly(TreeManager & output)
      nextFree++;
      }
 
-   if (nextSkel) zip.Deflate(output.skeleton, skeleton, nextSkel);
-   if (nextLeaf) zip.Deflate(output.leaves, leaves, nextLeaf * sizeof(double));
+   if (nextSkel) output.WriteSkeleton(skeleton, nextSkel);
+   if (nextLeaf) output.WriteLeaves(leaves, nextLeaf, LeafSize());
 
-   output.UpdateFileSize();
-   output.UpdatePosition();
+   output.EndPack();
    }
 
 void BasicTree::Pack(TreeManager & output)
    {
-   if (output.skeleton == NULL || count < SWAP_MIN) return;
+   if (!output.IsOpen() || count < SWAP_MIN || shared) return;
 
    PackOnly(output);
 
-   totalNodes -= count;
-   free(nodes);
+   CountNodes(-count);
+   FreeNodes();
    nodes = NULL;
    }
 
 void BasicTree::UnPack()
    {
-   UnPack(tmpfileInfo);
+   UnPack(buffers->tmpfileInfo);
    }
 
 void BasicTree::UnPack(TreeManager & input)
    {
-   if (input.skeleton == NULL || count < SWAP_MIN) return;
+   if (!input.IsOpen() || count < SWAP_MIN || shared) return;
 
-   totalNodes += count;
+   if (CountNodes(count) > maxNodes && maxNodes) MemoryCeiling();
+   Reallocate(count);
 
-   if (maxNodes && totalNodes > maxNodes) MemoryCeiling();
-   TreeNode * _nodes = (TreeNode *) realloc(nodes, count * sizeof(TreeNode));
-   if (_nodes == NULL) OutOfMemory();
-   nodes = _nodes;
+   input.BeginUnPack(tmpfileOffset);
 
-   input.SetPosition(tmpfileOffset);
+   // Packets are read in place, without copying into the tree buffers
+   const char   * skeleton = NULL;
+   const double * leaves = NULL;
+   const float  * floats = NULL;
 
    int nextSkel = 0;
    int nextLeaf = 0;
@@ -471,21 +815,25 @@ void BasicTree::UnPack(TreeManager & input)
    for (int i = 0; i < nextFree; i++)
       {
       if ((nextSkel & SWAP_MASK) == 0)
-         zip.Inflate(input.skeleton, skeleton, min(nextFree - i, SWAP_PACKET)),
+         skeleton = input.ReadSkeleton(min(nextFree - i, SWAP_PACKET)),
          nextSkel = 0;
 
-      nodes[i].type = skeleton[nextSkel++];
+      Type(i) = skeleton[nextSkel++];
 
-      if (nodes[i].type == TREE_NODE_LEAF)
+      if (Type(i) == TREE_NODE_LEAF)
          {
          if ((nextLeaf & SWAP_MASK) == 0)
-            zip.Inflate(input.leaves, leaves, min(leavesToGo, SWAP_PACKET) * sizeof(double)),
+            leaves = (const double *) input.ReadLeaves(min(leavesToGo, SWAP_PACKET), LeafSize()),
+            floats = (const float *) leaves,
             nextLeaf = 0, leavesToGo -= SWAP_PACKET;
 
-         nodes[i].value = leaves[nextLeaf++];
+         if (packedAsFloat)
+            nodes[i].value = ldexp((double) floats[nextLeaf++], leafExponent);
+         else
+            nodes[i].value = leaves[nextLeaf++];
          }
 
-      switch (nodes[i].type)
+      switch (Type(i))
          {
          case TREE_NODE_ZERO :
          case TREE_NODE_LEAF :
@@ -499,16 +847,18 @@ void BasicTree::UnPack(TreeManager & input)
             break;
          }
       }
+
+   input.EndUnPack();
    }
 
 void BasicTree::MemoryCeiling()
    {
    // Calculated requested memory
-   int request = totalNodes / 1024 * sizeof(TreeNode) / 1024 + 1;
+   int request = totalNodes / 1024 * TREE_NODE_SIZE / 1024 + 1;
 
    // Free Memory
    free(nodes);
-   totalNodes -= count;
+   CountNodes(-count);
    nodes = NULL;
 
    // Throw Exception
@@ -518,10 +868,10 @@ void BasicTree::MemoryCeiling()
 void BasicTree::OutOfMemory()
    {
    // Calculated requested memory
-   int request = totalNodes / 1024 * sizeof(TreeNode) / 1024 + 1;
+   int request = totalNodes / 1024 * TREE_NODE_SIZE / 1024 + 1;
 
    // Update memory usage
-   totalNodes -= count;
+   CountNodes(-count);
 
    // Reset count to zero to avoid double counting
    count = 0;
@@ -533,16 +883,17 @@ void BasicTree::OutOfMemory()
 void BasicTree::ReadFromFile(FILE * input)
    {
    AllocateBuffers();
+
+   char        * skeleton = buffers->skeleton;
+   double      * leaves = buffers->leaves;
+   MiniDeflate & zip = buffers->zip;
    Free();
 
    fread(&bit_count, sizeof(bit_count), 1, input);
    fread(&count, sizeof(count), 1, input);
 
-   totalNodes += count;
-
-   if (maxNodes && totalNodes > maxNodes) MemoryCeiling();
-   nodes = (TreeNode *) malloc(count * sizeof(TreeNode));
-   if (nodes == NULL) OutOfMemory();
+   if (CountNodes(count) > maxNodes && maxNodes) MemoryCeiling();
+   Reallocate(count);
 
    nextFree = count;
 
@@ -565,12 +916,12 @@ void BasicTree::ReadFromFile(FILE * input)
          nextLeaf = 0;
          }
 
-      nodes[i].type = skeleton[nextSkel++];
+      Type(i) = skeleton[nextSkel++];
 
-      if (nodes[i].type == TREE_NODE_LEAF)
+      if (Type(i) == TREE_NODE_LEAF)
          nodes[i].value = leaves[nextLeaf++];
 
-      switch (nodes[i].type)
+      switch (Type(i))
          {
          case TREE_NODE_ZERO :
          case TREE_NODE_LEAF :
@@ -590,9 +941,14 @@ void BasicTree::WriteToFile(FILE * output)
    {
    AllocateBuffers();
 
+   char        * skeleton = buffers->skeleton;
+   double      * leaves = buffers->leaves;
+   MiniDeflate & zip = buffers->zip;
+
    fwrite(&bit_count, sizeof(bit_count), 1, output);
 
-   int placeholder = ftell(output), nodeCount = 0;
+   long placeholder = ftell(output);
+   int  nodeCount = 0;
 
    fwrite(&nodeCount, sizeof(nodeCount), 1, output);
 
@@ -606,9 +962,9 @@ void BasicTree::WriteToFile(FILE * output)
       {
       int i = stack.Pop();
 
-      skeleton[nextSkel++] = (char) nodes[i].type;
+      skeleton[nextSkel++] = (char) Type(i);
 
-      switch(nodes[i].type)
+      switch(Type(i))
          {
          case TREE_NODE_LEAF :
             leaves[nextLeaf++] = nodes[i].value;
@@ -646,7 +1002,7 @@ void BasicTree::WriteToFile(FILE * output)
 
 bool BasicTree::FindNonZero(int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
          return false;
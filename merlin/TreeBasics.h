@@ -27,12 +27,69 @@
 
 class TreeManager;
 
+// Compression buffers and default swap file used for moving trees in and
+// out of memory. Threads that swap trees must each select their own set.
+class TreeBuffers
+   {
+   public:
+     TreeBuffers()
+       { skeleton = NULL; leaves = NULL; }
+     ~TreeBuffers()
+       { tmpfileInfo.CloseFiles(); Free(); }
+
+     void Allocate();
+     void Free();
+
+     char        * skeleton;
+     double      * leaves;
+     MiniDeflate   zip;
+     TreeManager   tmpfileInfo;
+   };
+
+// Recycles node storage between trees. Blocks holding a power of two
+// number of nodes, as allocated by BasicTree::Grow(), are kept in one
+// list per size and handed to the next tree that needs a block of the
+// same size, avoiding realloc() copies and fresh page faults.
+#define NODE_POOL_CLASSES     20
+#define NODE_POOL_MIN_NODES   256
+#define NODE_POOL_MAX_NODES   (4 * 1024 * 1024)
+
+class NodePool
+   {
+   public:
+     NodePool();
+     ~NodePool()
+       { Release(); }
+
+     // Returns a recycled block with room for count nodes, or NULL
+     TreeNode * Allocate(int count);
+
+     // Stores a block for reuse, returns false if the block should be freed
+     bool Recycle(TreeNode * block, int count);
+
+     // Returns all stored blocks to the system
+     void Release();
+
+     // Usage counters
+     int  requests, recycled;
+     int  storedNodes, peakStoredNodes;
+
+   private:
+     TreeNode * blocks[NODE_POOL_CLASSES];
+
+     static int SizeClass(int count);
+   };
+
 class BasicTree
    {
    public:
-     // Maximum number of nodes to store in memory
+     // Maximum number of nodes to store in memory (for each thread)
      static int maxNodes;
-     static int totalNodes;
+
+     // Store leaf values with single precision in swap files
+     static bool floatLeaves;
+     static __thread int totalNodes;
+     static __thread int peakNodes;
 
      // Log of constant that has been used to scale all the values
      // stored in the tree -- we usually assume this is zero
@@ -48,6 +105,23 @@ class BasicTree
      // Total number of nodes allocated
      int        count;
 
+     // Set when identical subtrees are stored only once, so that nodes
+     // may have more than one parent and the tree must not be modified
+     bool       shared;
+
+     // Type for each node
+#ifdef __WIDE_TREE_NODES__
+     int & Type(int node)
+       { return nodes[node].type; }
+     const int & Type(int node) const
+       { return nodes[node].type; }
+#else
+     char & Type(int node)
+       { return ((char *) (nodes + count))[node]; }
+     const char & Type(int node) const
+       { return ((const char *) (nodes + count))[node]; }
+#endif
+
      BasicTree()
        { Initialize(); }
 
@@ -58,16 +132,20 @@ class BasicTree
        {
        if (nodes != NULL)
          {
-         totalNodes -= count;
-         free(nodes);
+         CountNodes(-count);
+         FreeNodes();
          }
        }
 
      void Clear()
-       { nextFree = 0; if (nodes == NULL) count = 0; logOffset = 0; }
+       { nextFree = 0; if (nodes == NULL) count = 0; logOffset = 0; shared = false; }
 
      void Free()
-       { nextFree = count = 0; if (nodes != NULL) free(nodes); nodes = NULL; }
+       {
+       if (nodes != NULL) FreeNodes();
+       nextFree = count = 0; shared = false;
+       nodes = NULL;
+       }
 
      int NewNode()
        {
@@ -94,19 +172,74 @@ class BasicTree
      void MakeMinimalTree(double value, int bits);
      void MakeEmptyTree(int bits);
      bool IsEmpty()
-       { return nextFree == 0 || nodes[0].type == TREE_NODE_ZERO; }
+       { return nextFree == 0 || Type(0) == TREE_NODE_ZERO; }
 
      // Routines for managing swap files
      static void SetupSwap();
      static void FreeSwap();
      static void CloseSwap(bool quiet = false);
-     static double SwapFileSize() { return tmpfileInfo.GetFileSize(); }
+     static double SwapFileSize() { return buffers->tmpfileInfo.GetFileSize(); }
+     static bool   SwapEnabled() { return buffers->tmpfileInfo.IsOpen(); }
+
+     // Selects buffers and swap file for the current thread
+     // (NULL selects the buffers shared with the main thread)
+     static void SelectBuffers(TreeBuffers * local)
+       { buffers = local == NULL ? &sharedBuffers : local; }
+
+     // Selects storage pool for trees freed by the current thread
+     // (NULL returns node storage directly to the system)
+     static void SelectPool(NodePool * local)
+       { pool = local; }
+     static NodePool * SelectedPool()
+       { return pool; }
+
+     // Tracks the largest number of nodes used by the current thread
+     static void ResetPeakNodes()
+       { peakNodes = totalNodes; }
+
+     // Stores identical subtrees only once, turning the tree into a
+     // read-only graph that can still be used as a source for Copy(),
+     // Multiply() and other operations that traverse it from the root
+     void Share();
+
+     // Restores a private copy of each subtree so the tree can be modified
+     void Expand();
+
+     // Rounds leaf values to single precision, keeping their exponents
+     void RoundToFloat();
 
      // Discards the contents of the current tree, to save memory
      void Discard();
 
+     // Exchanges contents with another tree owned by the current thread
+     void Exchange(BasicTree & other);
+
+     // Copies a tree to be handed to another thread, without counting it
+     // against the memory limit for the current thread. The receiving
+     // thread must call AcquireNodes() before the tree is freed.
+     void CopyForThread(const BasicTree & source);
+     void AcquireNodes() { CountNodes(count); }
+
+     // Stops counting a tree that is handed over to another thread
+     void ReleaseNodes() { CountNodes(-count); }
+
+     // Counts working storage held outside trees against the memory limit
+     // for the current thread, returning false if the limit is exceeded
+     static bool ReserveScratch(int nodes)
+       {
+       if (maxNodes && totalNodes + nodes > maxNodes) return false;
+       CountNodes(nodes);
+       return true;
+       }
+     static void ReleaseScratch(int nodes)
+       { CountNodes(-nodes); }
+
+     // Memory needed by the current thread to hold additional nodes
+     static int MegabytesNeeded(int nodes)
+       { return (totalNodes + nodes) / 1024 * TREE_NODE_SIZE / 1024 + 1; }
+
      // Routines for updating thresholds for swapping
-     static void UpdateSwapThreshold(int nTrees);
+     static void UpdateSwapThreshold(int nTrees, double availableBytes);
 
      // Routines for swapping trees in and out of memory
      void Pack();             // Compresses tree and frees memory
@@ -133,7 +266,7 @@ class BasicTree
 
      // Routine to check whether tree is candidate for swapping
      bool IsSwappable()
-         { return count > SWAP_MIN; }
+         { return count > SWAP_MIN && !shared; }
 
      bool IsInMemory()
          { return nodes != NULL; }
@@ -153,24 +286,49 @@ class BasicTree
        {
        bit_count = nextFree = count = 0;
        nodes = NULL;
+       shared = false;
+       packedAsFloat = false;
        logOffset = 0.0;
        }
 
+     // Adds the subtree rooted at node to a table of unique subtrees
+     int ShareNode(BasicTree & unique, IntArray & table, int node);
+
+     // Resizes node storage, which previously held room for previous nodes
+     void Reallocate(int previous);
+
+     // Releases node storage, either to the selected pool or to the system
+     void FreeNodes()
+       { if (pool == NULL || !pool->Recycle(nodes, count)) free(nodes); }
+
      // Routines for managing memory allocation failures
      void MemoryCeiling();
      void OutOfMemory();
 
+     // Updates node count for the current thread and returns new total
+     static int CountNodes(int delta)
+       {
+       if ((totalNodes += delta) > peakNodes) peakNodes = totalNodes;
+       return totalNodes;
+       }
+
      // Information used to swap tree in and out of memory
      int           leafCount;
+     int           leafExponent;
+     bool          packedAsFloat;
+
+     int LeafSize()
+       { return packedAsFloat ? sizeof(float) : sizeof(double); }
      TreePosition  tmpfileOffset;
 
-     // Global file output buffers
+     // File output buffers, selected for each thread
      //
-     static char        * skeleton;
-     static double      * leaves;
-     static MiniDeflate   zip;
+     static TreeBuffers   sharedBuffers;
+     static __thread TreeBuffers * buffers;
 
-     static TreeManager  tmpfileInfo;
+     // Node storage pool, selected for each thread
+     //
+     static __thread NodePool * pool;
 
      // Minimum size of inheritance trees that are swapped out of memory
      //
@@ -22,7 +22,7 @@ int TreeFlips::FlipCopyAndScale(const int * flips, int node, double scale)
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -47,7 +47,7 @@ int TreeFlips::FlipCopyAndScale(const int * flips, Tree & tree, int node, double
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
          break;
@@ -73,12 +73,12 @@ int TreeFlips::FlipCopyAndScaleAndAdd(const int * flips, int node,
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = sum_target;
-         nodes[node].type = TREE_NODE_LEAF;
+         Type(node) = TREE_NODE_LEAF;
          nodes[node].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -105,10 +105,10 @@ int TreeFlips::FlipCopyAndScaleAndAdd(const int * flips, Tree & tree, int node,
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = sum;
          break;
       case TREE_NODE_LEAF :
@@ -132,7 +132,7 @@ int TreeFlips::FlipCopyAndScaleAndAdd(const int * flips, Tree & tree, int node,
 void TreeFlips::FlipGraftAndScale(const int * flips, int target, int source,
      double scale)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
          break;
@@ -155,7 +155,7 @@ void TreeFlips::FlipGraftAndScale(const int * flips, int target, int source,
 void TreeFlips::FlipGraftAndScale(const int * flips, int target,
      Tree & tree, int source, double scale)
    {
-   switch (nodes[target].type = tree.nodes[source].type)
+   switch (Type(target) = tree.Type(source))
       {
       case TREE_NODE_ZERO :
          break;
@@ -178,12 +178,12 @@ void TreeFlips::FlipGraftAndScale(const int * flips, int target,
 void TreeFlips::FlipGraftAndScaleAndAdd(const int * flips, int target, int source,
      double scale, double sum_target, double sum_source)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = sum_target;
-         nodes[source].type = TREE_NODE_LEAF;
+         Type(source) = TREE_NODE_LEAF;
          nodes[source].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -206,10 +206,10 @@ void TreeFlips::FlipGraftAndScaleAndAdd(const int * flips, int target, int sourc
 void TreeFlips::FlipGraftAndScaleAndAdd(const int * flips, int target,
    Tree & tree, int source, double scale, double sum)
    {
-   switch (nodes[target].type = tree.nodes[source].type)
+   switch (Type(target) = tree.Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = sum;
          break;
       case TREE_NODE_LEAF :
@@ -239,12 +239,12 @@ void TreeFlips::FlipGraftAndScaleAndAdd(const int * flips, int target,
 void TreeFlips::FlipGraftAndScaleAndChoose(const int * flips, int target,
                 int source, double scale, double sum_target, double sum_source)
    {
-   switch (nodes[target].type = nodes[source].type)
+   switch (Type(target) = Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = sum_target;
-         nodes[source].type = TREE_NODE_LEAF;
+         Type(source) = TREE_NODE_LEAF;
          nodes[source].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -269,12 +269,12 @@ int TreeFlips::FlipCopyAndScaleAndChoose(const int * flips, int node,
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = nodes[node].type)
+   switch (Type(new_node) = Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = sum_target;
-         nodes[node].type = TREE_NODE_LEAF;
+         Type(node) = TREE_NODE_LEAF;
          nodes[node].value = sum_source;
          break;
       case TREE_NODE_LEAF :
@@ -301,10 +301,10 @@ int TreeFlips::FlipCopyAndScaleAndChoose(const int * flips, Tree & tree, int nod
    {
    int new_node = NewNode();
 
-   switch (nodes[new_node].type = tree.nodes[node].type)
+   switch (Type(new_node) = tree.Type(node))
       {
       case TREE_NODE_ZERO :
-         nodes[new_node].type = TREE_NODE_LEAF;
+         Type(new_node) = TREE_NODE_LEAF;
          nodes[new_node].value = floor;
          break;
       case TREE_NODE_LEAF :
@@ -328,10 +328,10 @@ int TreeFlips::FlipCopyAndScaleAndChoose(const int * flips, Tree & tree, int nod
 void TreeFlips::FlipGraftAndScaleAndChoose(const int * flips, int target,
    Tree & tree, int source, double scale, double floor)
    {
-   switch (nodes[target].type = tree.nodes[source].type)
+   switch (Type(target) = tree.Type(source))
       {
       case TREE_NODE_ZERO :
-         nodes[target].type = TREE_NODE_LEAF;
+         Type(target) = TREE_NODE_LEAF;
          nodes[target].value = floor;
          break;
       case TREE_NODE_LEAF :
@@ -352,7 +352,7 @@ void TreeFlips::FlipGraftAndScaleAndChoose(const int * flips, int target,
 
 void TreeFlips::DoubleFlipBranch(const int * flips, int node)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
       case TREE_NODE_LEAF :
@@ -364,7 +364,7 @@ void TreeFlips::DoubleFlipBranch(const int * flips, int node)
          if ( *flips < 2 )
             DoubleFlipBranch(flips + 1, child);
          else
-            switch (nodes[child].type)
+            switch (Type(child))
                {
                case TREE_NODE_ZERO :
                case TREE_NODE_LEAF :
@@ -375,10 +375,10 @@ void TreeFlips::DoubleFlipBranch(const int * flips, int node)
                case TREE_NODE_TWO :
                   {
                   int new_node = NewNode();
-                  nodes[node].type = TREE_NODE_TWO;
+                  Type(node) = TREE_NODE_TWO;
                   nodes[node].child[1] = new_node;
-                  nodes[child].type = TREE_NODE_ONE;
-                  nodes[new_node].type = TREE_NODE_ONE;
+                  Type(child) = TREE_NODE_ONE;
+                  Type(new_node) = TREE_NODE_ONE;
                   nodes[new_node].child[0] = nodes[child].child[1];
                   DoubleFlipBranch(flips + 2, nodes[child].child[0]);
                   DoubleFlipBranch(flips + 2, nodes[child].child[1]);
@@ -403,22 +403,22 @@ void TreeFlips::DoubleFlipBranch(const int * flips, int node)
             case 2 :
                {
                int child = nodes[node].child[0];
-               UpgradeNode(child, nodes[nodes[node].child[1]].type);
-               UpgradeNode(nodes[node].child[1], nodes[child].type);
+               UpgradeNode(child, Type(nodes[node].child[1]));
+               UpgradeNode(nodes[node].child[1], Type(child));
 
-               if (nodes[child].type <= TREE_NODE_LEAF)
+               if (Type(child) <= TREE_NODE_LEAF)
                   {
                   int new_node = NewNode();
-                  nodes[new_node].type = TREE_NODE_TWO;
+                  Type(new_node) = TREE_NODE_TWO;
                   nodes[new_node].child[0] = nodes[node].child[0];
                   nodes[new_node].child[1] = nodes[node].child[1];
-                  nodes[node].type = TREE_NODE_ONE;
+                  Type(node) = TREE_NODE_ONE;
                   nodes[node].child[0] = new_node;
                   }
-               else if (nodes[child].type == TREE_NODE_ONE)
+               else if (Type(child) == TREE_NODE_ONE)
                   {
-                  nodes[node].type = TREE_NODE_ONE;
-                  nodes[child].type = TREE_NODE_TWO;
+                  Type(node) = TREE_NODE_ONE;
+                  Type(child) = TREE_NODE_TWO;
                   nodes[child].child[1] = nodes[nodes[node].child[1]].child[0];
                   DoubleFlipBranch(flips + 2, nodes[child].child[0]);
                   DoubleFlipBranch(flips + 2, nodes[child].child[1]);
@@ -443,19 +443,19 @@ void TreeFlips::UpgradeNode(int node, int new_type)
    {
    int new_node;
 
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
       case TREE_NODE_LEAF :
          if (new_type < TREE_NODE_ONE) return;
          new_node = NewNode();
-         if ((nodes[new_node].type = nodes[node].type) == TREE_NODE_LEAF)
+         if ((Type(new_node) = Type(node)) == TREE_NODE_LEAF)
             nodes[new_node].value = nodes[node].value;
-         nodes[node].type = TREE_NODE_ONE;
+         Type(node) = TREE_NODE_ONE;
          nodes[node].child[0] = new_node;
       case TREE_NODE_ONE :
          if (new_type < TREE_NODE_TWO) return;
-         nodes[node].type = TREE_NODE_TWO;
+         Type(node) = TREE_NODE_TWO;
          SAFE_SET(nodes[node].child[1], Copy(nodes[node].child[0]));
       case TREE_NODE_TWO :
          return;
@@ -466,15 +466,15 @@ void TreeFlips::PseudoUpgradeNode(int node, int new_type)
    {
    int new_node;
 
-   switch (nodes[node].type)
+   switch (Type(node))
       {
       case TREE_NODE_ZERO :
       case TREE_NODE_LEAF :
          if (new_type < TREE_NODE_ONE) return;
          new_node = NewNode();
-         if ((nodes[new_node].type = nodes[node].type) == TREE_NODE_LEAF)
+         if ((Type(new_node) = Type(node)) == TREE_NODE_LEAF)
             nodes[new_node].value = nodes[node].value;
-         nodes[node].type = TREE_NODE_ONE;
+         Type(node) = TREE_NODE_ONE;
          nodes[node].child[0] = new_node;
       case TREE_NODE_ONE :
          if (new_type < TREE_NODE_TWO) return;
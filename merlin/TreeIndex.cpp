@@ -26,14 +26,14 @@ void IndexTree::MakeIndex(const Tree & source)
 
    // Count number of leaf nodes
    for (int i = 0; i < nextFree; i++)
-     if (nodes[i].type == TREE_NODE_LEAF || nodes[i].type == TREE_NODE_ZERO)
+     if (Type(i) == TREE_NODE_LEAF || Type(i) == TREE_NODE_ZERO)
        leafCount++;
 
    // List all leaf node values in values array
    uniqValues.Dimension(leafCount);
 
    for (int i = 0, next = 0; i < nextFree; i++)
-     if (nodes[i].type == TREE_NODE_LEAF || nodes[i].type == TREE_NODE_ZERO)
+     if (Type(i) == TREE_NODE_LEAF || Type(i) == TREE_NODE_ZERO)
        uniqValues[next++] = nodes[i].value;
 
    // Sort values and delete duplicates
@@ -42,9 +42,9 @@ void IndexTree::MakeIndex(const Tree & source)
 
    // Recode leaf values to ranks
    for (int i = 0; i < nextFree; i++)
-     if (nodes[i].type == TREE_NODE_LEAF || nodes[i].type == TREE_NODE_ZERO)
+     if (Type(i) == TREE_NODE_LEAF || Type(i) == TREE_NODE_ZERO)
        {
-       nodes[i].type = TREE_NODE_INT_VALUE;
+       Type(i) = TREE_NODE_INT_VALUE;
        nodes[i].integer = uniqValues.BinarySearch(nodes[i].value);
        }
    }
@@ -59,7 +59,7 @@ void IndexTree::UpdateFrequencies(const Tree & source, double scale)
 
 void IndexTree::UpdateFrequencies(int node, double weight)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
     {
     case TREE_NODE_INT_VALUE :
       freqs[nodes[node].integer] += weight;
@@ -76,7 +76,7 @@ void IndexTree::UpdateFrequencies(int node, double weight)
 
 void IndexTree::UpdateFrequencies(const Tree & tree, int node1, int node2, double weight)
    {
-   switch (PAIR_NODES(nodes[node1].type, tree.nodes[node2].type))
+   switch (PAIR_NODES(Type(node1), tree.Type(node2)))
      {
      case PAIR_NODES(TREE_NODE_INT_VALUE, TREE_NODE_ZERO) :
      case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ZERO)  :
@@ -128,7 +128,7 @@ void IndexTree::EvenFrequencies()
 
 void IndexTree::EvenFrequencies(int node, double weight)
    {
-   switch (nodes[node].type)
+   switch (Type(node))
     {
     case TREE_NODE_INT_VALUE :
       freqs[nodes[node].integer] += weight;
@@ -143,6 +143,167 @@ void IndexTree::EvenFrequencies(int node, double weight)
     }
    }
 
+// Routines for combined scoring trees
+//    Combine(...) merges the structure of all source trees, with each
+//                 leaf holding the scores of every source at that node
+//    MeanProducts(...) calculates MeanProduct() with each source tree
+//
 
+void MultiScoreTree::Combine(Tree ** sources, int count)
+   {
+   Clear();
+
+   statistics = count;
+   rows = 0;
+   scores.Dimension(0);
+
+   if (count == 0) return;
+
+   bit_count = sources[0]->bit_count;
+
+   // Current node in each source tree, for each level of the tree
+   IntArray source_nodes(count * (bit_count + 2));
+   source_nodes.Zero();
+
+   Merge(sources, source_nodes, (int *) source_nodes + count);
+   }
+
+int MultiScoreTree::Merge(Tree ** sources, const int * source_nodes, int * next)
+   {
+   int type = TREE_NODE_ZERO;
+
+   for (int i = 0; i < statistics; i++)
+      switch (sources[i]->Type(source_nodes[i]))
+         {
+         case TREE_NODE_LEAF :
+            if (type == TREE_NODE_ZERO) type = TREE_NODE_INT_VALUE;
+            break;
+         case TREE_NODE_ONE :
+            if (type != TREE_NODE_TWO) type = TREE_NODE_ONE;
+            break;
+         case TREE_NODE_TWO :
+            type = TREE_NODE_TWO;
+            break;
+         }
+
+   int node = NewNode();
+   Type(node) = type;
+
+   if (type == TREE_NODE_INT_VALUE)
+      {
+      nodes[node].integer = rows++;
+      scores.Dimension(rows * statistics);
+
+      double * row = scores.data + (rows - 1) * statistics;
+
+      for (int i = 0; i < statistics; i++)
+         row[i] = sources[i]->Type(source_nodes[i]) == TREE_NODE_LEAF ?
+                  sources[i]->nodes[source_nodes[i]].value : 0.0;
+      }
+   else if (type != TREE_NODE_ZERO)
+      for (int b = 0; b < (type == TREE_NODE_TWO ? 2 : 1); b++)
+         {
+         // Leaf and zero nodes in a source cover all vectors below them
+         for (int i = 0; i < statistics; i++)
+            switch (sources[i]->Type(source_nodes[i]))
+               {
+               case TREE_NODE_ONE :
+                  next[i] = sources[i]->nodes[source_nodes[i]].child[0];
+                  break;
+               case TREE_NODE_TWO :
+                  next[i] = sources[i]->nodes[source_nodes[i]].child[b];
+                  break;
+               default :
+                  next[i] = source_nodes[i];
+               }
+
+         SAFE_SET(nodes[node].child[b], Merge(sources, next, next + statistics));
+         }
+
+   return node;
+   }
+
+void MultiScoreTree::MeanProducts(const Tree & tree, Vector & means)
+   {
+   means.Dimension(statistics);
+   means.Zero();
+
+   sums = means.data;
+
+   if (statistics) MeanProducts(tree, 0, 0, 1.0);
+   }
+
+void MultiScoreTree::Free()
+   {
+   Tree::Free();
+
+   statistics = rows = 0;
+   scores.Dimension(0);
+   }
+
+void MultiScoreTree::AddRow(int row, double weight)
+   {
+   const double * values = scores.data + row * statistics;
+
+   for (int i = 0; i < statistics; i++)
+      sums[i] += values[i] * weight;
+   }
+
+void MultiScoreTree::AddScores(int node, double weight)
+   {
+   switch (Type(node))
+    {
+    case TREE_NODE_INT_VALUE :
+      AddRow(nodes[node].integer, weight);
+      break;
+    case TREE_NODE_ONE :
+      AddScores(nodes[node].child[0], weight);
+      break;
+    case TREE_NODE_TWO :
+      AddScores(nodes[node].child[0], weight * 0.5);
+      AddScores(nodes[node].child[1], weight * 0.5);
+      break;
+    }
+   }
+
+void MultiScoreTree::MeanProducts(const Tree & tree, int node1, int node2, double weight)
+   {
+   switch (PAIR_NODES(Type(node1), tree.Type(node2)))
+      {
+      case PAIR_NODES(TREE_NODE_INT_VALUE, TREE_NODE_LEAF) :
+         AddRow(nodes[node1].integer, tree.nodes[node2].value * weight);
+         return;
+      case PAIR_NODES(TREE_NODE_INT_VALUE, TREE_NODE_ONE) :
+      case PAIR_NODES(TREE_NODE_INT_VALUE, TREE_NODE_TWO) :
+         AddRow(nodes[node1].integer, tree.Mean(node2, weight));
+         return;
+      case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_LEAF) :
+      case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_LEAF) :
+         AddScores(node1, tree.nodes[node2].value * weight);
+         return;
+      case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_ONE) :
+         MeanProducts(tree, nodes[node1].child[0],
+                      tree.nodes[node2].child[0], weight);
+         return;
+      case PAIR_NODES(TREE_NODE_ONE, TREE_NODE_TWO) :
+         MeanProducts(tree, nodes[node1].child[0],
+                      tree.nodes[node2].child[0], weight * 0.5);
+         MeanProducts(tree, nodes[node1].child[0],
+                      tree.nodes[node2].child[1], weight * 0.5);
+         return;
+      case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_ONE) :
+         MeanProducts(tree, nodes[node1].child[0],
+                      tree.nodes[node2].child[0], weight * 0.5);
+         MeanProducts(tree, nodes[node1].child[1],
+                      tree.nodes[node2].child[0], weight * 0.5);
+         return;
+      case PAIR_NODES(TREE_NODE_TWO, TREE_NODE_TWO) :
+         MeanProducts(tree, nodes[node1].child[0],
+                      tree.nodes[node2].child[0], weight * 0.5);
+         MeanProducts(tree, nodes[node1].child[1],
+                      tree.nodes[node2].child[1], weight * 0.5);
+         return;
+      }
+   }
 
  
@@ -38,5 +38,29 @@ class IndexTree : public Tree
       Vector freqs;
    };
 
+// Combines several scoring trees for the same family into a single tree
+// whose leaves index a row of scores, one per source tree, so that the
+// mean products of all sources with an inheritance tree take one pass
+class MultiScoreTree : public Tree
+   {
+   private:
+      int  Merge(Tree ** sources, const int * source_nodes, int * next);
+      void MeanProducts(const Tree & tree, int node1, int node2, double weight);
+      void AddScores(int node, double weight);
+      void AddRow(int row, double weight);
+
+      double * sums;
+
+   public:
+      MultiScoreTree() : sums(NULL), statistics(0), rows(0) {}
+
+      void Combine(Tree ** sources, int count);
+      void MeanProducts(const Tree & tree, Vector & means);
+      void Free();
+
+      int    statistics, rows;
+      Vector scores;
+   };
+
 #endif
  
@@ -47,7 +47,7 @@ double TreeInfo::GetMean(BasicTree & tree, int node)
       weight = weights[ptr];
       node   = stack[ptr];
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             break;
@@ -90,7 +90,7 @@ void TreeInfo::GetMeanVar(BasicTree & tree, int node)
       weight = weights[ptr];
       node = stack[ptr];
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             break;
@@ -140,7 +140,7 @@ void TreeInfo::GetBounds(BasicTree & tree, int node)
       weight = weights[ptr];
       node = stack[ptr];
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             have_zero = true;
@@ -199,7 +199,7 @@ void TreeInfo::GetTreeInfo(BasicTree & tree, int node)
       weight = weights[ptr];
       node = stack[ptr];
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             break;
@@ -274,7 +274,7 @@ double TreeInfo::GetMinInfo(BasicTree & tree, int node)
       weight = weights[ptr];
       node = stack[ptr];
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             break;
@@ -324,7 +324,7 @@ void TreeInfo::GetDetailedInfo(BasicTree & tree, int node)
       weight = weights[ptr];
       node = stack[ptr];
 
-      switch (tree.nodes[node].type)
+      switch (tree.Type(node))
          {
          case TREE_NODE_ZERO :
             zeroCount++;
@@ -17,107 +17,445 @@
  
 #include "TreeManager.h"
 #include "TreeBasics.h"
+#include "Error.h"
 
-void TreeManager::GetPosition(TreePosition & pos)
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static double WallTime()
    {
-   fgetpos(skeleton, &pos.skeleton);
-   fgetpos(leaves, &pos.leaves);
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+
+   return now.tv_sec + now.tv_usec * 1e-6;
    }
 
-void TreeManager::UpdateFileSize()
+// Packets are preceded by an eight byte header and aligned on eight
+// byte boundaries, so that leaf values can be read in place
+#define PACKET_HEADER        8
+#define PACKET_ALIGN(bytes)  (((bytes) + 7) & ~7)
+
+// The end of the data in a segment is marked by a negative packet size
+#define PACKET_END_SEGMENT   -1
+
+SwapStream::SwapStream()
    {
-   if (skeletonSize == -1)
-      return;
+   data = NULL;
+   files = NULL;
+   sizes = NULL;
+   segments = 0;
+   position = 0;
+   }
+
+SwapStream::~SwapStream()
+   {
+   Close();
+   }
 
-   int newSkeletonUsage = ftell(skeleton);
-   int newLeafUsage = ftell(leaves);
+void SwapStream::Close()
+   {
+   for (int i = 0; i < segments; i++)
+      {
+      munmap(data[i], sizes[i]);
+      fclose(files[i]);
+      }
 
-   if (newSkeletonUsage < skeletonUsage || newLeafUsage < leafUsage)
+   if (segments)
       {
-      skeletonSize = leafSize = skeletonUsage = leafUsage = -1;
-      return;
+      delete [] data;
+      delete [] files;
+      delete [] sizes;
+      }
+
+   data = NULL;
+   files = NULL;
+   sizes = NULL;
+   segments = 0;
+   position = 0;
+   }
+
+void SwapStream::AddSegment(int minimum)
+   {
+   int size = segments == 0 ? SWAP_SEGMENT_MIN : sizes[segments - 1] * 2;
+
+   if (size > SWAP_SEGMENT_MAX) size = SWAP_SEGMENT_MAX;
+   while (size < minimum) size *= 2;
+
+   // Each segment is an anonymous temporary file, with space reserved
+   // up front so that running out of disk is reported here rather than
+   // as a fault when the mapped pages are first written
+   FILE * file = tmpfile();
+
+   if (file == NULL || posix_fallocate(fileno(file), 0, size) != 0)
+      error("Unable to reserve %d MB for swap file segment\n", size >> 20);
+
+   void * mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+
+   if (mapping == MAP_FAILED)
+      error("Unable to map %d MB swap file segment into memory\n", size >> 20);
+
+   char ** newData = new char * [segments + 1];
+   FILE ** newFiles = new FILE * [segments + 1];
+   int   * newSizes = new int [segments + 1];
+
+   for (int i = 0; i < segments; i++)
+      {
+      newData[i] = data[i];
+      newFiles[i] = files[i];
+      newSizes[i] = sizes[i];
       }
 
-   skeletonUsage = newSkeletonUsage;
-   leafUsage = newLeafUsage;
+   if (segments)
+      {
+      delete [] data;
+      delete [] files;
+      delete [] sizes;
+      }
 
-   if (skeletonUsage > skeletonSize)
-      skeletonSize = skeletonUsage;
+   data = newData;
+   files = newFiles;
+   sizes = newSizes;
 
-   if (leafUsage > leafSize)
-      leafSize = leafUsage;
+   data[segments] = (char *) mapping;
+   files[segments] = file;
+   sizes[segments++] = size;
    }
 
+char * SwapStream::Reserve(int bytes)
+   {
+   int segment = (int) (position >> 32);
+   int offset = (int) (position & 0xFFFFFFFF);
+   int needed = PACKET_HEADER + PACKET_ALIGN(bytes);
+
+   // Move to the next segment that can hold the packet
+   if (segments == 0)
+      AddSegment(needed);
+
+   while (offset + needed > sizes[segment])
+      {
+      if (offset + PACKET_HEADER <= sizes[segment])
+         *(int *) (data[segment] + offset) = PACKET_END_SEGMENT;
+
+      segment++;
+      offset = 0;
+
+      if (segment == segments)
+         AddSegment(needed);
+      }
+
+   position = ((long long) segment << 32) | offset;
+
+   return data[segment] + offset + PACKET_HEADER;
+   }
 
-void TreeManager::SetPosition(const TreePosition & pos)
+void SwapStream::Commit(int bytes)
    {
-   fsetpos(skeleton, &pos.skeleton);
-   fsetpos(leaves, &pos.leaves);
+   int segment = (int) (position >> 32);
+   int offset = (int) (position & 0xFFFFFFFF);
 
-//   printf("/** Moved pointer to [%d, %d] **/\n", ftell(skeleton), ftell(leaves));
+   *(int *) (data[segment] + offset) = bytes;
+
+   position += PACKET_HEADER + PACKET_ALIGN(bytes);
    }
 
-bool TreeManager::OpenFiles()
+const char * SwapStream::Read(long long & where, int & bytes)
    {
-   if (skeleton == NULL)
+   while (true)
       {
-      skeleton = tmpfile();
-      leaves = tmpfile();
+      int segment = (int) (where >> 32);
+      int offset = (int) (where & 0xFFFFFFFF);
 
-      return true;
+      if (offset + PACKET_HEADER > sizes[segment] ||
+          *(int *) (data[segment] + offset) == PACKET_END_SEGMENT)
+         {
+         where = (long long) (segment + 1) << 32;
+         continue;
+         }
+
+      bytes = *(int *) (data[segment] + offset);
+      where += PACKET_HEADER + PACKET_ALIGN(bytes);
+
+      return data[segment] + offset + PACKET_HEADER;
       }
+   }
+
+double SwapStream::Usage()
+   {
+   int segment = (int) (position >> 32);
+   double usage = (double) (position & 0xFFFFFFFF);
+
+   for (int i = 0; i < segment && i < segments; i++)
+      usage += sizes[i];
+
+   return usage;
+   }
+
+// Codec selection
+//
+
+int    TreeManager::codec = SWAP_CODEC_LZ;
+String TreeManager::codecName = "lz";
+
+void TreeManager::SelectCodec()
+   {
+   if (codecName.SlowCompare("raw") == 0)
+      codec = SWAP_CODEC_RAW;
+   else if (codecName.SlowCompare("lz") == 0)
+      codec = SWAP_CODEC_LZ;
+   else if (codecName.SlowCompare("deflate") == 0)
+      codec = SWAP_CODEC_DEFLATE;
+   else
+      error("Swap codec '%s' is not recognized\n\n"
+            "Valid choices are 'raw', 'lz' and 'deflate'\n",
+            (const char *) codecName);
+   }
 
-   return false;
+// Swap file management
+//
+
+TreeManager::TreeManager()
+   {
+   isOpen = false;
+   skeletonBuffer = leafBuffer = shuffled = NULL;
+
+   peakUsage = 0.0;
+   startTime = 0.0;
+
+   packs = unpacks = 0;
+   bytesPacked = bytesStored = bytesUnPacked = 0.0;
+   packSeconds = unpackSeconds = 0.0;
+   }
+
+TreeManager::~TreeManager()
+   {
+   CloseFiles();
+   }
+
+bool TreeManager::OpenFiles()
+   {
+   if (isOpen)
+      return false;
+
+   skeletonBuffer = new char [SWAP_PACKET];
+   leafBuffer = new char [SWAP_PACKET * sizeof(double)];
+   shuffled = new char [SWAP_PACKET * sizeof(double)];
+
+   return isOpen = true;
    }
 
 void TreeManager::CloseFiles()
    {
-   if (skeleton != NULL)
-      {
-      fclose(skeleton);
-      fclose(leaves);
-      }
+   if (!isOpen) return;
+
+   skeleton.Close();
+   leaves.Close();
+
+   delete [] skeletonBuffer;
+   delete [] leafBuffer;
+   delete [] shuffled;
 
-   skeleton = leaves = NULL;
+   skeletonBuffer = leafBuffer = shuffled = NULL;
+   isOpen = false;
    }
 
 void TreeManager::Free()
    {
-   if (skeleton == NULL) return;
+   if (!isOpen) return;
 
-   fseek(skeleton, 0, SEEK_SET);
-   fseek(leaves, 0, SEEK_SET);
+   skeleton.Rewind();
+   leaves.Rewind();
+   }
 
-   fgetpos(skeleton, &position.skeleton);
-   fgetpos(leaves, &position.leaves);
+double TreeManager::GetFileUsage()
+   {
+   return skeleton.Usage() + leaves.Usage();
+   }
 
-   skeletonUsage = leafUsage = 0;
+double TreeManager::GetFileSize()
+   {
+   return peakUsage;
+   }
+
+void TreeManager::MergeFileSize(const TreeManager & other)
+   {
+   if (other.peakUsage > peakUsage)
+      peakUsage = other.peakUsage;
 
-//   printf("/** Freed Swap File **/\n");
+   packs += other.packs;
+   unpacks += other.unpacks;
+   bytesPacked += other.bytesPacked;
+   bytesStored += other.bytesStored;
+   bytesUnPacked += other.bytesUnPacked;
+   packSeconds += other.packSeconds;
+   unpackSeconds += other.unpackSeconds;
    }
 
-double TreeManager::GetFileUsage()
+// Routines for writing trees
+//
+
+void TreeManager::BeginPack(TreePosition & position)
    {
-   if (skeletonUsage == -1 || leafUsage == -1)
-      return -1.0;
+   startTime = WallTime();
 
-   return (double) skeletonUsage + (double) leafUsage;
+   position.skeleton = skeleton.Tell();
+   position.leaves = leaves.Tell();
+   position.codec = codec;
    }
 
-double TreeManager::GetFileSize()
+void TreeManager::WriteSkeleton(const char * types, int count)
    {
-   if (skeletonSize == -1 || leafSize == -1)
-      return -1.0;
+   WritePacket(skeleton, types, count, 1);
+   }
 
-   return (double) skeletonSize + (double) leafSize;
+void TreeManager::WriteLeaves(const void * values, int count, int size)
+   {
+   WritePacket(leaves, values, count * size, size);
    }
 
-TreeManager::TreeManager()
+void TreeManager::EndPack()
+   {
+   double usage = GetFileUsage();
+
+   if (usage > peakUsage)
+      peakUsage = usage;
+
+   packs++;
+   packSeconds += WallTime() - startTime;
+   }
+
+void TreeManager::WritePacket(SwapStream & stream, const void * data, int bytes, int size)
+   {
+   bytesPacked += bytes;
+
+   if (codec == SWAP_CODEC_RAW)
+      {
+      memcpy(stream.Reserve(bytes), data, bytes);
+      stream.Commit(bytes);
+      bytesStored += bytes;
+      return;
+      }
+
+   if (codec == SWAP_CODEC_LZ)
+      {
+      // Grouping the n-th byte of each value together gives long runs
+      // of matching sign and exponent bytes
+      const char * input = (const char *) data;
+
+      if (size > 1)
+         {
+         int count = bytes / size;
+
+         for (int i = 0; i < count; i++)
+            for (int j = 0; j < size; j++)
+               shuffled[j * count + i] = input[i * size + j];
+
+         input = shuffled;
+         }
+
+      int stored = lz.Compress(input, bytes, stream.Reserve(MiniLZ::Bound(bytes)));
+
+      stream.Commit(stored);
+      bytesStored += stored;
+      return;
+      }
+
+   // MiniDeflate writes to a stream, which is mapped onto the segment
+   int    bound = bytes + bytes / 8 + 64;
+   FILE * output = fmemopen(stream.Reserve(bound), bound, "wb");
+
+   zip.Deflate(output, (void *) data, bytes);
+   fflush(output);
+
+   int stored = ftell(output);
+
+   fclose(output);
+   stream.Commit(stored);
+   bytesStored += stored;
+   }
+
+// Routines for reading trees
+//
+
+void TreeManager::BeginUnPack(const TreePosition & position)
+   {
+   startTime = WallTime();
+
+   reading = position;
+   }
+
+const char * TreeManager::ReadSkeleton(int count)
+   {
+   return ReadPacket(skeleton, reading.skeleton, reading.codec, count, 1, skeletonBuffer);
+   }
+
+const char * TreeManager::ReadLeaves(int count, int size)
+   {
+   return ReadPacket(leaves, reading.leaves, reading.codec, count * size, size, leafBuffer);
+   }
+
+void TreeManager::EndUnPack()
+   {
+   unpacks++;
+   unpackSeconds += WallTime() - startTime;
+   }
+
+const char * TreeManager::ReadPacket(SwapStream & stream, long long & position,
+                                     int packetCodec, int bytes, int size, char * buffer)
    {
-   skeleton = NULL;
-   leaves = NULL;
+   int stored;
+   const char * packet = stream.Read(position, stored);
 
-   skeletonSize = leafSize = 0;
-   skeletonUsage = leafUsage = 0;
+   bytesUnPacked += bytes;
+
+   if (packetCodec == SWAP_CODEC_RAW)
+      return packet;
+
+   if (packetCodec == SWAP_CODEC_LZ)
+      {
+      if (size == 1)
+         {
+         lz.Decompress(packet, stored, buffer, bytes);
+         return buffer;
+         }
+
+      lz.Decompress(packet, stored, shuffled, bytes);
+
+      int count = bytes / size;
+
+      for (int i = 0; i < count; i++)
+         for (int j = 0; j < size; j++)
+            buffer[i * size + j] = shuffled[j * count + i];
+
+      return buffer;
+      }
+
+   FILE * input = fmemopen((void *) packet, stored, "rb");
+
+   zip.Inflate(input, buffer, bytes);
+   fclose(input);
+
+   return buffer;
    }
+
+// Summary of swap activity
+//
+
+void TreeManager::ReportThroughput(const char * label)
+   {
+   if (packs == 0) return;
+
+   printf("  %-12s %7d trees packed, %9.1f MB -> %9.1f MB, %7.1f MB/s\n",
+          label, packs, bytesPacked * 1e-6, bytesStored * 1e-6,
+          packSeconds > 0.0 ? bytesPacked * 1e-6 / packSeconds : 0.0);
+
+   if (unpacks)
+      printf("  %-12s %7d trees unpacked, %9.1f MB, %7.1f MB/s\n",
+             "", unpacks, bytesUnPacked * 1e-6,
+             unpackSeconds > 0.0 ? bytesUnPacked * 1e-6 / unpackSeconds : 0.0);
+   }
+
  
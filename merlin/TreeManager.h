@@ -19,18 +19,66 @@
 #define __TREEMANAGER_H__
 
 #include "MiniDeflate.h"
+#include "MiniLZ.h"
+#include "StringBasics.h"
 
-#define   FILEINDEX_t fpos_t
+// Trees are swapped in packets of up to SWAP_PACKET nodes
+#define SWAP_PACKET    (128 * 1024)
+#define SWAP_MASK      (SWAP_PACKET - 1)
+
+// Codecs for swapped trees
+#define SWAP_CODEC_RAW       0
+#define SWAP_CODEC_LZ        1
+#define SWAP_CODEC_DEFLATE   2
+
+// Segment files start at SWAP_SEGMENT_MIN bytes, doubling up to a maximum
+#define SWAP_SEGMENT_MIN     (4 * 1024 * 1024)
+#define SWAP_SEGMENT_MAX     (256 * 1024 * 1024)
 
 class BasicTree;
 
 class TreePosition
    {
    public:
-      FILEINDEX_t leaves;
-      FILEINDEX_t skeleton;
+      long long leaves;
+      long long skeleton;
+      int       codec;
    };
 
+// Append-only packet storage in a series of memory mapped segment files.
+// Positions hold the segment index in the upper 32 bits and the offset
+// within that segment in the lower 32 bits.
+class SwapStream
+   {
+   public:
+      SwapStream();
+      ~SwapStream();
+
+      void Close();
+
+      // Returns room for a packet of up to bytes, to be confirmed by Commit()
+      char * Reserve(int bytes);
+      void   Commit(int bytes);
+
+      // Returns the packet stored at position and moves to the next packet
+      const char * Read(long long & position, int & bytes);
+
+      long long Tell()   { return position; }
+      void      Rewind() { position = 0; }
+
+      // Bytes stored up to the current position
+      double    Usage();
+
+   private:
+      char ** data;
+      FILE ** files;
+      int   * sizes;
+      int     segments;
+
+      long long position;
+
+      void AddSegment(int minimum);
+   };
 
 class TreeManager
    {
@@ -38,52 +86,81 @@ class TreeManager
       // Constructor
       //
       TreeManager();
+      ~TreeManager();
 
       // Swap file management functions
       //
-      bool OpenFiles();       // Open file pointers
+      bool OpenFiles();          // Prepare swap streams
       void CloseFiles();         // Close files
       void Free();               // Discard contents and reuse swap file
 
-      // These function returns the estimated file size / current usage
-      // or a negative number when files get too big
+      bool IsOpen() const
+         { return isOpen; }
+
+      // These functions return the peak / current usage in bytes
       //
       double GetFileSize();
       double GetFileUsage();
 
-      // This function should be called after the files are written to,
-      // and is used to keep track of file sizes in a reasonably portable
-      // manner ...
-      void UpdateFileSize();
+      // Updates peak file sizes and throughput counters to include
+      // usage recorded by another manager
+      void MergeFileSize(const TreeManager & other);
 
-      // Routines for swapping tree in and out of memory
-      FILEINDEX_t Pack(BasicTree & tree);
-      FILEINDEX_t UnPack(BasicTree & tree);
+      // Routines for swapping tree in and out of memory, one packet of
+      // skeleton or leaf data at a time
+      void BeginPack(TreePosition & position);
+      void WriteSkeleton(const char * types, int count);
+      void WriteLeaves(const void * values, int count, int size);
+      void EndPack();
 
-      // Swap file pointers
-      //
-      FILE * skeleton;
-      FILE * leaves;
+      // Packets returned by these routines remain valid until the next read
+      // of the same kind and, for uncompressed trees, point directly into
+      // the swap file
+      void BeginUnPack(const TreePosition & position);
+      const char * ReadSkeleton(int count);
+      const char * ReadLeaves(int count, int size);
+      void EndUnPack();
+
+      // Throughput counters
+      int    packs, unpacks;
+      double bytesPacked, bytesStored, bytesUnPacked;
+      double packSeconds, unpackSeconds;
 
-      TreePosition  position;
+      void ReportThroughput(const char * label);
 
-      void GetPosition(TreePosition & position);
-      void SetPosition(const TreePosition & position);
+      // Codec used for newly swapped trees
+      static int    codec;
+      static String codecName;
 
-      void UpdatePosition()
-         {
-         GetPosition(position);
-         }
+      static void SelectCodec();
 
    private:
-      // These variables are used to track file size
-      int leafSize;
-      int skeletonSize;
-      int leafUsage;
-      int skeletonUsage;
+      bool isOpen;
+
+      SwapStream skeleton;
+      SwapStream leaves;
+
+      // Current read positions
+      TreePosition reading;
+
+      // Largest number of bytes in use
+      double peakUsage;
+
+      // Timer for current operation
+      double startTime;
+
+      // Compression engines and buffers
+      MiniLZ      lz;
+      MiniDeflate zip;
+      char      * skeletonBuffer;
+      char      * leafBuffer;
+      char      * shuffled;
+
+      void WritePacket(SwapStream & stream, const void * data, int bytes, int size);
+      const char * ReadPacket(SwapStream & stream, long long & position,
+                              int codec, int bytes, int size, char * buffer);
    };
 
 #endif
 
-
  
@@ -26,6 +26,9 @@
 
 #define PAIR_NODES(a, b)   (((a) << 2) + (b))
 
+#ifdef __WIDE_TREE_NODES__
+
+// Original layout, with the node type stored alongside each node
 struct TreeNode
    {
    int type;
@@ -38,6 +41,32 @@ struct TreeNode
       };
    };
 
+#define TREE_NODE_SIZE     (sizeof(TreeNode))
+
+#else
+
+// Compact layout, node types are stored in a separate byte array
+// that follows the nodes in the same allocation (see BasicTree::Type)
+//
+// A whole byte is used for each type, rather than a packed bitmap:
+// index trees need a fifth type (TREE_NODE_INT_VALUE), which doesn't
+// fit in two bits, and Type() is assigned directly in the innermost
+// loops, where packed types would need a read-modify-write each time.
+struct TreeNode
+   {
+   union
+      {
+      double value;
+      int    child[2];
+      int    integer;
+      void * info;
+      };
+   };
+
+#define TREE_NODE_SIZE     (sizeof(TreeNode) + 1)
+
+#endif
+
 #endif
 
 
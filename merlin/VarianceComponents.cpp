@@ -32,6 +32,8 @@
 bool VarianceComponents::useCovariates = false;
 bool VarianceComponents::useProbands = false;
 double VarianceComponents::unlinkedFraction = 0.0;
+double VarianceComponents::screenLod = 0.0;
+bool VarianceComponents::coldStart = false;
 
 QtlModel VarianceComponents::customModels;
 
@@ -81,7 +83,8 @@ void VarianceComponents::Analyse(FamilyAnalysis & engine)
       }
 
    if (tablefile != NULL)
-      fprintf(tablefile, "CHR\tPOS\tLABEL\tTRAIT\tH2\tLOD\tPVALUE\n");
+      fprintf(tablefile, "CHR\tPOS\tLABEL\tTRAIT\tH2\tLOD\tPVALUE%s\n",
+              screenLod > 0.0 ? "\tFIT" : "");
 
    int probandStatus = useProbands ? ped.affectionNames.SlowFind("proband") : -1;
 
@@ -202,7 +205,7 @@ void VarianceComponents::Analyse(FamilyAnalysis & engine)
       int vc_count2 = heterogeneity ? vc_count * 2 : vc_count;
 
       // The normal set class is our workhorse
-      NormalSet mvn;
+      NormalSet mvn(MerlinCore::threads);
       mvn.Dimension(useful, vc_count2);
 
       // Per family likelihoods under the null and alternative hypothesis
@@ -412,6 +415,10 @@ void VarianceComponents::Analyse(FamilyAnalysis & engine)
       // Fit polygenic model
       mvn.Solve();
 
+      // Track the cost of model fitting
+      int fits = 1, scoredFits = mvn.iterations > 0;
+      int iterations = mvn.iterations, evaluations = mvn.evaluations;
+
       // Track Key Values
       double lkNull = mvn.Evaluate();
       double sampleVar = TotalVariance(mvn.variances, vc_count);
@@ -442,12 +449,29 @@ void VarianceComponents::Analyse(FamilyAnalysis & engine)
             sampleH2 * 100. / sampleVar,
             (const char *) errorString);
 #endif
-      printf("%20s %8s %7s %7s %7s\n",
-             "Position", "H2 ", "ChiSq", "LOD", "pvalue");
+
+      // Score tests use the polygenic model as the null, and can quickly
+      // identify positions where the LOD score will be small
+      Vector nullVariances = mvn.variances;
+      bool   screening = screenLod > 0.0 && perFamily == NULL && mvn.PrepareTest();
+      int    screened = 0;
+
+      // When screening, each row records whether it is a maximum
+      // likelihood fit or a score test approximation
+      if (screening)
+         printf("%20s %8s %7s %7s %7s %5s\n",
+                "Position", "H2 ", "ChiSq", "LOD", "pvalue", "Fit");
+      else
+         printf("%20s %8s %7s %7s %7s\n",
+                "Position", "H2 ", "ChiSq", "LOD", "pvalue");
 
       // Add an additional variance component for linked major gene
       mvn.Dimension(useful, vc_count2 + 1);
 
+      // Adjacent positions have similar estimates, so each fit can start
+      // where the previous one ended
+      mvn.warmStart = !coldStart;
+
       // Loop through analysis at individual marker locations
       for (int pos = 0; pos < positions; pos++)
          {
@@ -489,31 +513,63 @@ void VarianceComponents::Analyse(FamilyAnalysis & engine)
                index++;
                }
 
-         // Fit the alternative model
-         mvn.Solve();
+         double chisq, h2, var;
+         bool   approximate = false;
 
-         // Evaluate the likelihood
-         double lk = mvn.Evaluate();
+         // Positions where the score test LOD is below the screening threshold
+         // are summarized with the score test and a one step estimate. The
+         // score statistic follows the same 50:50 mixture of chi-squared
+         // distributions as the likelihood ratio, so the threshold has the
+         // same meaning for both, but the two can differ in any one sample.
+         double estimate, statistic = screening ? mvn.ScoreTest(vc_count2, estimate) : 0.0;
+
+         if (screening && statistic < screenLod * 2.0 * log(10.0))
+            {
+            Vector screenVariances = nullVariances;
+            screenVariances.Push(estimate);
+
+            chisq = statistic;
+            h2 = estimate;
+            var = TotalVariance(screenVariances, vc_count + 1);
+            approximate = true;
+            screened++;
+            }
+         else
+            {
+            // Fit the alternative model
+            mvn.Solve();
+
+            fits++;
+            scoredFits += mvn.iterations > 0;
+            iterations += mvn.iterations;
+            evaluations += mvn.evaluations;
+
+            // Evaluate the likelihood
+            double lk = mvn.Evaluate();
+
+            // Get key values
+            chisq = lkNull > lk ? (lkNull - lk) * 2.0 : 0.0;
+            h2 = mvn.variances[vc_count2];
+            var = TotalVariance(mvn.variances, vc_count + 1);
+            }
 
-         // Get key values
-         double chisq = lkNull > lk ? (lkNull - lk) * 2.0 : 0.0;
          double pvalue = chidist(chisq, 1) * 0.5;
-         double h2 = mvn.variances[vc_count2];
-         double var = TotalVariance(mvn.variances, vc_count + 1);
 
          int digits = pvalue < 1.5e-4 ? 5 : int(log(pvalue*0.06666666)*-0.4343);
 
          double lod = chisq / (2*log(10.0));
 
          // Print out a one-line summary of results
-         printf("%20.20s %7.2f%% %7.2f %7.2f %7.*f\n",
+         printf("%20.20s %7.2f%% %7.2f %7.2f %7.*f%s\n",
                 (const char *) labels[pos],
-                h2 * 100 / var, chisq, lod, digits, pvalue);
+                h2 * 100 / var, chisq, lod, digits, pvalue,
+                screening ? (approximate ? " score" : "    ML") : "");
 
          if (tablefile != NULL)
-            fprintf(tablefile, "%d\t%.3f\t%s\t%s\t%.3f\t%.3f\t%.4g\n",
+            fprintf(tablefile, "%d\t%.3f\t%s\t%s\t%.3f\t%.3f\t%.4g%s\n",
                      chr, engine.analysisPositions[pos] * 100., (const char *) labels[pos],
-                     (const char *) traitLabel, h2 * 100. / var, lod, pvalue);
+                     (const char *) traitLabel, h2 * 100. / var, lod, pvalue,
+                     screenLod > 0.0 ? (approximate ? "\tSCORE" : "\tML") : "");
 
          if (perFamily != NULL)
             WritePerFamilyLOD(ped, pheno, (const char *) labels[pos],
@@ -526,6 +582,18 @@ void VarianceComponents::Analyse(FamilyAnalysis & engine)
      if (engine.writePDF)
         engine.pdf.DrawChart();
 
+      if (screened)
+         printf("\n%d position%s with score test LOD below %.2f %s not refitted. Results at\n"
+                "these positions, marked 'score', are score test approximations, which can\n"
+                "understate the likelihood ratio LOD and miss linkage close to the threshold.\n",
+                screened, screened == 1 ? "" : "s", screenLod, screened == 1 ? "was" : "were");
+
+      if (MerlinCore::reportCosts)
+         printf("\n%d models fitted, %d by Fisher scoring (%.1f iterations each), "
+                "%d likelihood evaluations\n",
+                fits, scoredFits, scoredFits ? iterations / (double) scoredFits : 0.0,
+                evaluations);
+
       printf("\n");
       }
 
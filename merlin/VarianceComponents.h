@@ -37,6 +37,15 @@ class VarianceComponents
       static bool   useProbands;
       static double unlinkedFraction;
 
+      // Positions where the score test LOD is below this value are not
+      // refitted by maximum likelihood. The score test can understate the
+      // likelihood ratio LOD, so real signals near the threshold can be missed.
+      static double screenLod;
+
+      // Fit each position from the polygenic model estimates, rather than
+      // from the estimates at the previous position
+      static bool   coldStart;
+
       static QtlModel customModels;
 
       void OpenPerFamilyFile();
@@ -19,6 +19,7 @@
 #include "MerlinFamily.h"
 #include "FastAssociation.h"
 #include "TraitTransformations.h"
+#include "ThreadPool.h"
 
 int main(int argc, char ** argv)
    {
@@ -42,6 +43,8 @@ int main(int argc, char ** argv)
          LONG_PARAMETER("useCovariates", &VarianceComponents::useCovariates)
          LONG_DOUBLEPARAMETER("filter", &FastAssociationAnalysis::fastFilter)
          LONG_STRINGPARAMETER("custom", &covfile)
+      LONG_PARAMETER_GROUP("Performance")
+         LONG_INTPARAMETER("threads", &MerlinCore::threads)
       LONG_PARAMETER_GROUP("Output Files")
          LONG_STRINGPARAMETER("prefix", &MerlinCore::filePrefix)
          LONG_PARAMETER("pdf", &FamilyAnalysis::writePDF)
@@ -60,6 +63,13 @@ int main(int argc, char ** argv)
    pl.Add(new StringParameter('f', "Frequency File", freqfile));
    pl.Add(new LongParameters("Additional Options", additional));
    pl.Read(argc, argv);
+
+   // At least one thread is needed for fitting models
+   if (MerlinCore::threads < 1)
+      MerlinCore::threads = 1;
+
+   ThreadPool::defaultThreads = MerlinCore::threads;
+
    pl.Status();
 
    // Load pedigree files, one with inferred genotypes, the other with
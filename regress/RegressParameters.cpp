@@ -22,6 +22,7 @@
 #include "Houdini.h"
 #include "AutoFit.h"
 #include "Random.h"
+#include "ThreadPool.h"
 #include "Error.h"
 
 // Memory limit for gene flow trees
@@ -88,6 +89,7 @@ BEGIN_LONG_PARAMETERS(longParameters)
       LONG_PARAMETER("noCoupleBits", &Mantra::ignoreCoupleSymmetries)
       LONG_PARAMETER("swap", &MerlinCore::useSwap)
       LONG_STRINGPARAMETER("cache", &MerlinCache::directory)
+      LONG_INTPARAMETER("threads", &MerlinCore::threads)
    LONG_PARAMETER_GROUP("Output")
       LONG_STRINGPARAMETER("prefix", &MerlinCore::filePrefix)
       LONG_PARAMETER("pdf", &RegressionAnalysis::writePDF)
@@ -142,6 +144,12 @@ void RegressionParameters::Read(int argc, char ** argv, int start)
    if (MerlinCore::maxBits < 0)
       MerlinCore::maxBits = 0;
 
+   // At least one thread is needed for analysis
+   if (MerlinCore::threads < 1)
+      MerlinCore::threads = 1;
+
+   ThreadPool::defaultThreads = MerlinCore::threads;
+
    // Limited range of options in two-point mode
    if (MerlinCore::twopoint)
       {
@@ -167,7 +175,8 @@ void RegressionParameters::Read(int argc, char ** argv, int start)
    if (reruns > 1)
       Enforce(simulateNull, true, "The --reruns option automatically enables the --simulate option\n");
       
-   BasicTree::maxNodes = (1024 * 1024) / sizeof(TreeNode) * maxMegabytes;
+   BasicTree::maxNodes = (1024 * 1024) / TREE_NODE_SIZE * maxMegabytes;
+   MemoryGovernor::SetupGlobals(maxMegabytes, 1);
    }
 
 void RegressionParameters::Check()
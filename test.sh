@@ -136,6 +136,466 @@ test_command "Memory limit (256MB)" \
 test_command "Complexity limit (16 bits)" \
     "./executables/merlin -d examples/basic2.dat -p examples/basic2.ped -m examples/basic2.map --bits:16"
 
+# Test 10: Single precision leaves
+echo -e "\n${YELLOW}=== Testing Single Precision Leaves (--float) ===${NC}"
+
+# Function to compare tabulated LOD and NPL scores with and without --float
+test_float_precision() {
+    local description="$1"
+    local command="$2"
+    local tolerance="0.01"
+    local scratch=$(mktemp -d)
+
+    echo -e "\n${YELLOW}Testing: $description${NC}"
+    echo "Command: $command --float"
+
+    if eval "$command --tabulate --prefix $scratch/double" > /dev/null 2>&1 &&
+       eval "$command --tabulate --prefix $scratch/float --float" > /dev/null 2>&1; then
+        local deviation=0
+        for table in $scratch/double-*.tbl; do
+            deviation=$(paste "$table" "${table/double-/float-}" | awk -v max=$deviation '
+                NR > 1 {
+                    half = NF / 2
+                    for (i = 1; i <= half; i++)
+                        if ($i ~ /^-?[0-9.]+(e[-+]?[0-9]+)?$/) {
+                            d = $i - $(i + half); if (d < 0) d = -d
+                            if (d > max) max = d
+                        }
+                }
+                END { print max }')
+        done
+        echo "Maximum LOD/NPL deviation: $deviation"
+        rm -rf $scratch
+
+        if awk -v d=$deviation -v t=$tolerance 'BEGIN { exit !(d <= t) }'; then
+            echo -e "${GREEN}✓ PASSED${NC}"
+            ((passed++))
+            return 0
+        fi
+    fi
+
+    rm -rf $scratch
+    echo -e "${RED}✗ FAILED${NC}"
+    ((failed++))
+    return 1
+}
+
+test_float_precision "Non-parametric linkage" \
+    "./executables/merlin -d examples/basic2.dat -p examples/basic2.ped -m examples/basic2.map --npl --pairs"
+
+test_float_precision "Non-parametric linkage with swapping" \
+    "./executables/merlin -d examples/basic2.dat -p examples/basic2.ped -m examples/basic2.map --npl --swap"
+
+test_float_precision "Affected sibling pairs" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs"
+
+test_float_precision "QTL analysis" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --qtl --deviates"
+
+test_float_precision "Parametric linkage analysis" \
+    "./executables/merlin -d examples/parametric.dat -p examples/parametric.ped -m examples/parametric.map --model examples/parametric.model --freq examples/parametric.freq"
+
+# A large sibship with untyped parents, sparse genotypes and markers only
+# 0.000001 cM apart, so that swapped trees hold leaves spanning far more
+# than the exponent range of single precision floats
+wide=$(mktemp -d)
+awk -v dir=$wide -v markers=30 -v kids=8 'BEGIN {
+    srand(1234)
+    print "A disease" > (dir "/wide.dat")
+    print "CHR MARKER POS" > (dir "/wide.map")
+    for (m = 1; m <= markers; m++) {
+        print "M SNP" m > (dir "/wide.dat")
+        printf "1 SNP%d %.6f\n", m, m * 0.000001 > (dir "/wide.map")
+        for (p = 1; p <= 2; p++)
+            for (h = 1; h <= 2; h++)
+                allele[p, m, h] = 1 + (rand() < 0.5)
+    }
+    for (p = 1; p <= 2; p++) {
+        line = "1 " p " 0 0 " p " 0"
+        for (m = 1; m <= markers; m++)
+            line = line " 0/0"
+        print line > (dir "/wide.ped")
+    }
+    for (k = 3; k < kids + 3; k++) {
+        line = "1 " k " 1 2 " (1 + k % 2) " 2"
+        for (m = 1; m <= markers; m++)
+            if (rand() < 0.5)
+                line = line " 0/0"
+            else
+                line = line " " allele[1, m, 1 + int(rand() * 2)] "/" allele[2, m, 1 + int(rand() * 2)]
+        print line > (dir "/wide.ped")
+    }
+}'
+
+test_float_precision "Non-parametric linkage with swapping and wide dynamic range" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --swap --megabytes 16"
+
+# Test 11: Performance options
+echo -e "\n${YELLOW}=== Testing Performance Options ===${NC}"
+
+# Function to check that performance options leave analysis results unchanged;
+# the options may add reports of their own, but results printed after the
+# parameter listing and all output files must match the default run
+test_same_results() {
+    local description="$1"
+    local command="$2"
+    local options="$3"
+    local tolerance="${4:-0}"
+    local scratch=$(mktemp -d)
+
+    echo -e "\n${YELLOW}Testing: $description${NC}"
+    echo "Command: $command $options"
+
+    if eval "$command --prefix $scratch/default" > $scratch/log-default 2>&1 &&
+       eval "$command --prefix $scratch/changed $options" > $scratch/log-changed 2>&1; then
+        local deviation=0
+        local missing=0
+
+        # Printed results are only compared exactly, so approximations
+        # are checked against the output files alone
+        if [ "$tolerance" = "0" ]; then
+            for run in default changed; do
+                tr '\r' '\n' < $scratch/log-$run |
+                    awk '/^ *Simulation :/ { found = 1; next } found && !/%/' |
+                    sed "s|$scratch/$run|PREFIX|g" > $scratch/results-$run
+            done
+            missing=$(diff $scratch/results-default $scratch/results-changed | grep -c '^<' || true)
+        fi
+
+        for output in $scratch/default*; do
+            [ -f "$output" ] || continue
+            if [ ! -f "${output/default/changed}" ]; then
+                missing=$((missing + 1))
+                continue
+            fi
+            deviation=$(paste "$output" "${output/default/changed}" | awk -v max=$deviation '
+                {
+                    half = NF / 2
+                    for (i = 1; i <= half; i++)
+                        if ($i ~ /^-?[0-9.]+(e[-+]?[0-9]+)?$/) {
+                            d = $i - $(i + half); if (d < 0) d = -d
+                            if (d > max) max = d
+                        } else if ($i != $(i + half))
+                            max = "mismatch"
+                }
+                END { print max }')
+        done
+        echo "Maximum deviation: $deviation, missing results: $missing"
+        rm -rf $scratch
+
+        if [ $missing -eq 0 ] && [ "$deviation" != "mismatch" ] &&
+           awk -v d=$deviation -v t=$tolerance 'BEGIN { exit !(d <= t) }'; then
+            echo -e "${GREEN}✓ PASSED${NC}"
+            ((passed++))
+            return 0
+        fi
+    fi
+
+    rm -rf $scratch
+    echo -e "${RED}✗ FAILED${NC}"
+    ((failed++))
+    return 1
+}
+
+perf=$(mktemp -d)
+
+test_same_results "Parallel family analysis" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs --tabulate" \
+    "--threads 3"
+
+test_same_results "Parallel family analysis with cost report" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs --tabulate" \
+    "--threads 2 --costs"
+
+test_same_results "Parallel parametric linkage analysis" \
+    "./executables/merlin -d examples/parametric.dat -p examples/parametric.ped -m examples/parametric.map --model examples/parametric.model --freq examples/parametric.freq --tabulate" \
+    "--threads 3"
+
+test_same_results "Parallel analysis of a single large family" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --tabulate" \
+    "--threads 3"
+
+test_same_results "Parallel likelihood of a single large family" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --likelihood" \
+    "--threads 3"
+
+test_same_results "Shared subtrees" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --tabulate" \
+    "--shareTrees"
+
+test_same_results "Spectral transforms for grid positions" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs --grid 1 --tabulate" \
+    "--spectral"
+
+# Sibships of four or seven with untyped parents, where founders with more
+# than two children are handled by parity masks in the spectral domain and
+# some flanking trees are too sparse to be transformed
+sibs=$(mktemp -d)
+awk -v dir=$sibs -v markers=20 -v families=20 'BEGIN {
+    srand(1357)
+    print "A disease" > (dir "/sibs.dat")
+    print "CHR MARKER POS" > (dir "/sibs.map")
+    for (m = 1; m <= markers; m++) {
+        print "M SNP" m > (dir "/sibs.dat")
+        printf "1 SNP%d %.1f\n", m, m * 5.0 > (dir "/sibs.map")
+    }
+    for (f = 1; f <= families; f++)
+        for (i = 1; i <= (f % 5 ? 4 : 7) + 2; i++) {
+            line = f " " i " " (i > 2 ? "1 2 " (1 + i % 2) " " (1 + (i < 5)) : "0 0 " i " 0")
+            for (m = 1; m <= markers; m++) {
+                for (h = 1; h <= 2; h++)
+                    allele[i, h] = i > 2 ? allele[h, 1 + int(rand() * 2)] : 1 + int(rand() * 3)
+                line = line (i <= 2 || rand() < 0.3 ? " 0/0" : " " allele[i, 1] "/" allele[i, 2])
+            }
+            print line > (dir "/sibs.ped")
+        }
+}'
+
+test_same_results "Spectral transforms with larger sibships" \
+    "./executables/merlin -d $sibs/sibs.dat -p $sibs/sibs.ped -m $sibs/sibs.map --npl --pairs --grid 1 --tabulate" \
+    "--spectral"
+
+# Both fully and partly expanded trees are moved as flat arrays here
+test_same_results "Dense trees moved with the recursive algorithm" \
+    "./executables/merlin -d $sibs/sibs.dat -p $sibs/sibs.ped -m $sibs/sibs.map --npl --pairs --grid 1 --tabulate" \
+    "--recursiveMoves"
+
+test_same_results "Likelihood with dense trees moved recursively" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --likelihood" \
+    "--recursiveMoves"
+
+# Singlepoint trees for the larger sibships are measured before scheduling
+test_same_results "Parallel analysis with measured family costs" \
+    "./executables/merlin -d $sibs/sibs.dat -p $sibs/sibs.ped -m $sibs/sibs.map --npl --pairs --grid 1 --tabulate" \
+    "--threads 2 --costs"
+
+# Stored trees for the larger sibships don't fit in one megabyte, so those
+# families are analysed again by the main thread
+test_same_results "Parallel analysis with results too large to store" \
+    "./executables/merlin -d $sibs/sibs.dat -p $sibs/sibs.ped -m $sibs/sibs.map --npl --pairs --grid 1 --tabulate --megabytes 1" \
+    "--threads 2"
+
+test_same_results "Singlepoint tree cache (first run)" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs --tabulate" \
+    "--cache $perf/cache"
+
+test_same_results "Singlepoint tree cache (second run)" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs --tabulate" \
+    "--cache $perf/cache"
+
+test_same_results "Uncompressed swap files" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --tabulate" \
+    "--swap --codec raw"
+
+test_same_results "Deflated swap files" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --tabulate" \
+    "--swap --codec deflate"
+
+test_same_results "Swap file prefetching" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --tabulate" \
+    "--swap --prefetch 4"
+
+test_same_results "Memory governor with a small memory limit" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --pairs --tabulate" \
+    "--megabytes 16"
+
+# Results for the first positions are only recorded, so a family that runs
+# out of memory while scanning the chromosome can still be retried
+test_command "Retry after results for some positions are recorded" \
+    "./executables/merlin -d $wide/wide.dat -p $wide/wide.ped -m $wide/wide.map --npl --steps 5 --swap --megabytes 1 | grep -q retrying"
+
+test_same_results "Per-family profiling" \
+    "./executables/merlin -d examples/asp.dat -p examples/asp.ped -m examples/asp.map --npl --pairs --tabulate" \
+    "--profile $perf/profile.json"
+
+# Function to check that a profile has one entry per family, each with
+# phase timings and tree statistics, followed by a summary for the chromosome
+test_profile_entries() {
+    local description="$1"
+    local file="$2"
+    local families="$3"
+
+    echo -e "\n${YELLOW}Testing: $description${NC}"
+
+    if [ -f "$file" ]; then
+        local summary=$(awk '
+            /"family": "/ {
+                entries++
+                match($0, /"family": "[^"]*"/)
+                if (seen[substr($0, RSTART, RLENGTH)]++) errors++
+                if ($0 !~ /"total": \{"wall": [0-9.]+, "cpu": [0-9.]+\}/) errors++
+                split("singlepoint conditionals scan haplotyping", phases, " ")
+                for (i in phases)
+                    if ($0 !~ "\"" phases[i] "\": \\{\"wall\": [0-9.]+, \"cpu\": [0-9.]+\\}") errors++
+                split("peak singlepoint singlepoint_mean location_mean", stats, " ")
+                for (i in stats)
+                    if ($0 !~ "\"nodes\": \\{.*\"" stats[i] "\": [0-9.]+") errors++
+                next
+            }
+            /"families": / {
+                match($0, /"families": [0-9]+/)
+                total = substr($0, RSTART + 12, RLENGTH - 12)
+            }
+            END { print entries + 0, total + 0, errors + 0 }' "$file")
+        set -- $summary
+        echo "Family entries: $1, families in summary: $2, errors: $3"
+
+        if [ $1 -eq $families ] && [ $2 -eq $families ] && [ $3 -eq 0 ]; then
+            echo -e "${GREEN}✓ PASSED${NC}"
+            ((passed++))
+            return 0
+        fi
+    fi
+
+    echo -e "${RED}✗ FAILED${NC}"
+    ((failed++))
+    return 1
+}
+
+test_profile_entries "Per-family profile" "$perf/profile.json" 200
+
+test_same_results "Parallel variance components analysis" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --vc --tabulate" \
+    "--threads 3"
+
+# Fisher scoring and derivative free fits agree to within 0.05% heritability
+# and 0.05 LOD units
+test_same_results "Variance components fitted without derivatives" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --vc --tabulate" \
+    "--derivativeFree" 0.05
+
+test_same_results "Association analysis fitted without derivatives" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --assoc --tabulate" \
+    "--derivativeFree" 0.05
+
+test_same_results "Fast association analysis fitted without derivatives" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --fastAssoc --tabulate" \
+    "--derivativeFree" 0.05
+
+# Fits started from the polygenic model or from the previous position agree
+# to within 0.01% heritability
+test_same_results "Variance components fitted from the polygenic model" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --vc --tabulate" \
+    "--coldStart" 0.01
+
+# Function to check that positions screened by the score test report LOD
+# scores below the threshold, and that all other positions match a full fit
+test_vc_screening() {
+    local description="$1"
+    local command="$2"
+    local threshold="$3"
+    local scratch=$(mktemp -d)
+
+    echo -e "\n${YELLOW}Testing: $description${NC}"
+    echo "Command: $command --screen $threshold"
+
+    if eval "$command --tabulate --prefix $scratch/full" > /dev/null 2>&1 &&
+       eval "$command --tabulate --prefix $scratch/screened --screen $threshold" > /dev/null 2>&1; then
+        local summary=$(paste $scratch/full-vc-*.tbl $scratch/screened-vc-*.tbl | awk -v t=$threshold '
+            NR > 1 {
+                if ($15 == "SCORE") {
+                    screened++
+                    if ($13 > t) errors++
+                } else {
+                    fitted++
+                    if ($15 != "ML" || $5 != $12 || $6 != $13 || $7 != $14) errors++
+                }
+            }
+            END { print screened + 0, fitted + 0, errors + 0 }')
+        set -- $summary
+        echo "Screened positions: $1, refitted positions: $2, errors: $3"
+        rm -rf $scratch
+
+        if [ $1 -gt 0 ] && [ $2 -gt 0 ] && [ $3 -eq 0 ]; then
+            echo -e "${GREEN}✓ PASSED${NC}"
+            ((passed++))
+            return 0
+        fi
+    fi
+
+    rm -rf $scratch
+    echo -e "${RED}✗ FAILED${NC}"
+    ((failed++))
+    return 1
+}
+
+# Nuclear families with a quantitative trait linked to the middle of the map
+linked=$(mktemp -d)
+awk -v dir=$linked -v markers=60 -v families=60 'BEGIN {
+    srand(2468)
+    print "T trait" > (dir "/linked.dat")
+    print "CHR MARKER POS" > (dir "/linked.map")
+    for (m = 1; m <= markers; m++) {
+        print "M SNP" m > (dir "/linked.dat")
+        printf "1 SNP%d %.1f\n", m, m * 2.0 > (dir "/linked.map")
+    }
+    for (f = 1; f <= families; f++)
+        for (i = 1; i <= 5; i++) {
+            genotypes = ""
+            for (m = 1; m <= markers; m++) {
+                for (h = 1; h <= 2; h++)
+                    if (i > 2) {
+                        pick[h] = m == 1 || rand() < 0.02 ? 1 + int(rand() * 2) : pick[h]
+                        allele[i, h] = allele[h, pick[h]]
+                    } else
+                        allele[i, h] = 1 + (rand() < 0.5)
+                if (m == markers / 2) qtl = i > 2 ? 2 * (pick[1] + pick[2] - 3) : 0
+                genotypes = genotypes " " allele[i, 1] "/" allele[i, 2]
+            }
+            trait = qtl + sqrt(-2 * log(1 - rand())) * cos(6.2831853 * rand())
+            print f, i, (i > 2 ? "1 2 " (1 + i % 2) : "0 0 " i), sprintf("%.3f", trait) genotypes > (dir "/linked.ped")
+        }
+}'
+
+test_vc_screening "Variance components with score test screening" \
+    "./executables/merlin -d $linked/linked.dat -p $linked/linked.ped -m $linked/linked.map --vc" 0.3
+
+test_same_results "Parallel association analysis" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --assoc --tabulate" \
+    "--threads 3"
+
+# Nuclear families typed at enough markers for several blocks of score tests
+blocks=$(mktemp -d)
+awk -v dir=$blocks -v markers=150 -v families=40 'BEGIN {
+    srand(4321)
+    print "T trait" > (dir "/blocks.dat")
+    print "CHR MARKER POS" > (dir "/blocks.map")
+    for (m = 1; m <= markers; m++) {
+        print "M SNP" m > (dir "/blocks.dat")
+        printf "1 SNP%d %.1f\n", m, m * 0.5 > (dir "/blocks.map")
+        freq[m] = 0.2 + rand() * 0.6
+    }
+    for (f = 1; f <= families; f++)
+        for (i = 1; i <= 5; i++) {
+            line = f " " i " " (i > 2 ? "1 2 " (1 + i % 2) : "0 0 " i)
+            line = line " " sprintf("%.3f", sqrt(-2 * log(1 - rand())) * cos(6.2831853 * rand()))
+            for (m = 1; m <= markers; m++) {
+                for (h = 1; h <= 2; h++)
+                    allele[i, h] = i > 2 ? allele[h, 1 + int(rand() * 2)] : 1 + (rand() < freq[m])
+                line = line " " allele[i, 1] "/" allele[i, 2]
+            }
+            print line > (dir "/blocks.ped")
+        }
+}'
+
+test_same_results "Parallel blocks of fast association tests" \
+    "./executables/merlin -d $blocks/blocks.dat -p $blocks/blocks.ped -m $blocks/blocks.map --fastAssoc --tabulate" \
+    "--threads 3"
+
+test_same_results "Fast association with 16 bit dosages" \
+    "./executables/merlin -d $blocks/blocks.dat -p $blocks/blocks.ped -m $blocks/blocks.map --fastAssoc --tabulate" \
+    "--dosageBits 16"
+
+test_same_results "Fast association with 8 bit dosages" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --fastAssoc --tabulate" \
+    "--dosageBits 8" 0.05
+
+test_same_results "Genotype inference with 16 bit dosages" \
+    "./executables/merlin -d examples/assoc.dat -p examples/assoc.ped -m examples/assoc.map --infer" \
+    "--dosageBits 16"
+
+rm -rf $wide $sibs $blocks $linked $perf
+
 # Summary
 echo -e "\n${YELLOW}=========================================="
 echo "TEST SUMMARY"